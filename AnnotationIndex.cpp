@@ -0,0 +1,364 @@
+#include "AnnotationIndex.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+    constexpr char INDEX_MAGIC[4] = {'F', 'L', 'I', 'X'};
+    constexpr uint32_t INDEX_VERSION = 1;
+
+    template <typename T>
+    void write_column(std::ofstream& fout, const std::vector<T>& column)
+    {
+        fout.write(reinterpret_cast<const char*>(column.data()), column.size() * sizeof(T));
+    }
+
+    template <typename T>
+    bool read_column(std::ifstream& fin, std::vector<T>& column, const uint64_t num_elements)
+    {
+        column.resize(num_elements);
+        fin.read(reinterpret_cast<char*>(column.data()), num_elements * sizeof(T));
+        return static_cast<bool>(fin);
+    }
+
+    //stat the file, leaving the mtime and size at 0 if it doesn't exist
+    void stat_label_file(const boost::filesystem::path& fpath, int64_t& mtime, int64_t& fsize)
+    {
+        boost::system::error_code ec;
+        auto file_mtime = boost::filesystem::last_write_time(fpath, ec);
+        if (ec) {
+            mtime = 0;
+            fsize = 0;
+            return;
+        }
+        auto file_sz = boost::filesystem::file_size(fpath, ec);
+        mtime = static_cast<int64_t>(file_mtime);
+        fsize = ec ? 0 : static_cast<int64_t>(file_sz);
+    }
+}
+
+void AnnotationIndex::build()
+{
+    auto start_time = std::chrono::steady_clock::now();
+    if (frame_names.empty()) {
+        load_cache();
+    }
+
+    //one listing per label directory, merged into the (sorted) set of labelled frames
+    auto bbox_frame_names = vlogger.list_boundingbox_frames();
+    auto mask_frame_names = vlogger.list_annotated_frames();
+    auto text_frame_names = vlogger.list_textmetadata_frames();
+    std::vector<std::string> labelled_names;
+    labelled_names.reserve(bbox_frame_names.size() + mask_frame_names.size() + text_frame_names.size());
+    std::set_union(bbox_frame_names.begin(), bbox_frame_names.end(), mask_frame_names.begin(), mask_frame_names.end(),
+            std::back_inserter(labelled_names));
+    std::vector<std::string> merged_names;
+    merged_names.reserve(labelled_names.size() + text_frame_names.size());
+    std::set_union(labelled_names.begin(), labelled_names.end(), text_frame_names.begin(), text_frame_names.end(),
+            std::back_inserter(merged_names));
+
+    const int num_frames = merged_names.size();
+    std::vector<int64_t> new_bbox_mtimes (num_frames), new_bbox_sizes (num_frames);
+    std::vector<int64_t> new_mask_mtimes (num_frames), new_text_mtimes (num_frames), new_text_sizes (num_frames);
+    //the row of the frame in the cached index, or -1 if it needs to be (re-)parsed
+    std::vector<int> cached_rows (num_frames, -1);
+    //whether any of the frame's label files changed since the cache was saved (or it isn't in there). NOTE: not a
+    //vector<bool>, the jobs write to it concurrently
+    std::vector<char> refreshed_rows (num_frames, 1);
+    const size_t num_cached = frame_names.size();
+    std::vector<std::vector<BoundingBoxMD>> parsed_bboxes (num_frames);
+
+    workers.parallel_for(0, num_frames, [&](const int fidx) {
+        const auto& frame_name = merged_names[fidx];
+        int64_t mask_sz;
+        stat_label_file(vlogger.get_boundingbox_filepath(frame_name), new_bbox_mtimes[fidx], new_bbox_sizes[fidx]);
+        stat_label_file(vlogger.get_annotation_filepath(frame_name), new_mask_mtimes[fidx], mask_sz);
+        stat_label_file(vlogger.get_textmetadata_filepath(frame_name), new_text_mtimes[fidx], new_text_sizes[fidx]);
+
+        auto cached_it = std::lower_bound(frame_names.begin(), frame_names.end(), frame_name);
+        int cached_row = -1;
+        if (cached_it != frame_names.end() && *cached_it == frame_name) {
+            cached_row = std::distance(frame_names.begin(), cached_it);
+            const bool same_bboxes = bbox_mtimes[cached_row] == new_bbox_mtimes[fidx] && bbox_sizes[cached_row] == new_bbox_sizes[fidx];
+            refreshed_rows[fidx] = !same_bboxes || mask_mtimes[cached_row] != new_mask_mtimes[fidx] ||
+                text_mtimes[cached_row] != new_text_mtimes[fidx] || text_sizes[cached_row] != new_text_sizes[fidx];
+            if (same_bboxes && stale_frames.count(frame_name) == 0) {
+                cached_rows[fidx] = cached_row;
+                return;
+            }
+        }
+
+        if (new_bbox_mtimes[fidx] != 0) {
+            try {
+                parsed_bboxes[fidx] = vlogger.get_boundingboxes(frame_name);
+            } catch (const std::exception& err) {
+                std::cout << "skipping bounding boxes for frame " << frame_name << ": " << err.what() << std::endl;
+            }
+        }
+
+        //the mtimes only go to the second, so a frame that got saved again right away (and came out the same size,
+        //e.g. relabelling instance 3 as 5) looks unchanged -- the boxes themselves tell
+        if (cached_row >= 0 && !refreshed_rows[fidx]) {
+            const auto& frame_bboxes = parsed_bboxes[fidx];
+            bool same_bboxes = frame_bboxes.size() == bbox_offsets[cached_row+1] - bbox_offsets[cached_row];
+            int tl_x, tl_y, br_x, br_y;
+            for (size_t bidx = 0; same_bboxes && bidx < frame_bboxes.size(); bidx++) {
+                const auto cached_bidx = bbox_offsets[cached_row] + bidx;
+                frame_bboxes[bidx].bbox.getCoords(&tl_x, &tl_y, &br_x, &br_y);
+                same_bboxes = frame_bboxes[bidx].instance_id == bbox_instances[cached_bidx] && tl_x == bbox_tl_x[cached_bidx] &&
+                    tl_y == bbox_tl_y[cached_bidx] && br_x == bbox_br_x[cached_bidx] && br_y == bbox_br_y[cached_bidx];
+            }
+            refreshed_rows[fidx] = !same_bboxes;
+        }
+    });
+
+    //where each frame lives in the video, for anything time-based
+    std::unordered_map<std::string, int> video_frame_indices;
+    video_frame_indices.reserve(vreader.get_num_frames());
+    for (int vidx = 0; vidx < vreader.get_num_frames(); vidx++) {
+        video_frame_indices.emplace(vreader.get_frame_name(vidx), vidx);
+    }
+
+    //stitch the cached and newly parsed boxes together into the new columns
+    std::vector<int32_t> new_frame_indices (num_frames);
+    std::vector<uint32_t> new_bbox_offsets (num_frames+1, 0);
+    std::vector<int32_t> new_bbox_frames, new_bbox_instances, new_tl_x, new_tl_y, new_br_x, new_br_y;
+    int num_parsed = 0;
+    int num_refreshed = 0;
+    for (int fidx = 0; fidx < num_frames; fidx++) {
+        num_refreshed += refreshed_rows[fidx];
+        auto video_it = video_frame_indices.find(merged_names[fidx]);
+        new_frame_indices[fidx] = video_it != video_frame_indices.end() ? video_it->second : -1;
+        new_bbox_offsets[fidx] = new_bbox_instances.size();
+
+        const int cached_row = cached_rows[fidx];
+        if (cached_row >= 0) {
+            for (auto bidx = bbox_offsets[cached_row]; bidx < bbox_offsets[cached_row+1]; bidx++) {
+                new_bbox_frames.push_back(fidx);
+                new_bbox_instances.push_back(bbox_instances[bidx]);
+                new_tl_x.push_back(bbox_tl_x[bidx]);
+                new_tl_y.push_back(bbox_tl_y[bidx]);
+                new_br_x.push_back(bbox_br_x[bidx]);
+                new_br_y.push_back(bbox_br_y[bidx]);
+            }
+        } else {
+            int tl_x, tl_y, br_x, br_y;
+            for (const auto& bbox_md : parsed_bboxes[fidx]) {
+                bbox_md.bbox.getCoords(&tl_x, &tl_y, &br_x, &br_y);
+                new_bbox_frames.push_back(fidx);
+                new_bbox_instances.push_back(bbox_md.instance_id);
+                new_tl_x.push_back(tl_x);
+                new_tl_y.push_back(tl_y);
+                new_br_x.push_back(br_x);
+                new_br_y.push_back(br_y);
+            }
+            if (new_bbox_mtimes[fidx] != 0) {
+                num_parsed++;
+            }
+        }
+    }
+    new_bbox_offsets[num_frames] = new_bbox_instances.size();
+
+    frame_names = std::move(merged_names);
+    frame_indices = std::move(new_frame_indices);
+    bbox_mtimes = std::move(new_bbox_mtimes);
+    bbox_sizes = std::move(new_bbox_sizes);
+    mask_mtimes = std::move(new_mask_mtimes);
+    text_mtimes = std::move(new_text_mtimes);
+    text_sizes = std::move(new_text_sizes);
+    bbox_offsets = std::move(new_bbox_offsets);
+    bbox_frames = std::move(new_bbox_frames);
+    bbox_instances = std::move(new_bbox_instances);
+    bbox_tl_x = std::move(new_tl_x);
+    bbox_tl_y = std::move(new_tl_y);
+    bbox_br_x = std::move(new_br_x);
+    bbox_br_y = std::move(new_br_y);
+    stale_frames.clear();
+    stale = false;
+
+    //NOTE: the same frames as before with none of their stats or boxes changed means the cache is still up to date,
+    //whatever got re-parsed (e.g. frames marked stale that turned out not to have been edited)
+    if (num_refreshed > 0 || static_cast<size_t>(num_frames) != num_cached) {
+        save_cache();
+    }
+
+    auto build_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+    std::cout << "Indexed " << frame_names.size() << " labelled frames (" << num_refreshed << " changed, " << num_parsed << " re-parsed) and "
+              << bbox_instances.size() << " boxes in " << build_time.count() << " ms" << std::endl;
+}
+
+bool AnnotationIndex::load_cache()
+{
+    const auto cache_fpath = get_cache_filepath();
+    if (!boost::filesystem::exists(cache_fpath)) {
+        return false;
+    }
+
+    std::ifstream fin(cache_fpath.string(), std::ios::binary);
+    char magic[4];
+    uint32_t version = 0;
+    uint64_t num_frames = 0, num_bboxes = 0;
+    fin.read(magic, sizeof(magic));
+    fin.read(reinterpret_cast<char*>(&version), sizeof(version));
+    fin.read(reinterpret_cast<char*>(&num_frames), sizeof(num_frames));
+    fin.read(reinterpret_cast<char*>(&num_bboxes), sizeof(num_bboxes));
+    if (!fin || !std::equal(magic, magic+4, INDEX_MAGIC) || version != INDEX_VERSION) {
+        std::cout << "ignoring out-of-date annotation index cache " << cache_fpath.string() << std::endl;
+        return false;
+    }
+
+    std::vector<std::string> cached_names (num_frames);
+    for (auto& frame_name : cached_names) {
+        uint32_t name_len = 0;
+        fin.read(reinterpret_cast<char*>(&name_len), sizeof(name_len));
+        frame_name.resize(name_len);
+        fin.read(&frame_name[0], name_len);
+    }
+
+    bool valid_cache = static_cast<bool>(fin);
+    valid_cache = valid_cache && read_column(fin, bbox_mtimes, num_frames) && read_column(fin, bbox_sizes, num_frames);
+    valid_cache = valid_cache && read_column(fin, mask_mtimes, num_frames) && read_column(fin, text_mtimes, num_frames);
+    valid_cache = valid_cache && read_column(fin, text_sizes, num_frames) && read_column(fin, bbox_offsets, num_frames+1);
+    valid_cache = valid_cache && read_column(fin, bbox_instances, num_bboxes);
+    valid_cache = valid_cache && read_column(fin, bbox_tl_x, num_bboxes) && read_column(fin, bbox_tl_y, num_bboxes);
+    valid_cache = valid_cache && read_column(fin, bbox_br_x, num_bboxes) && read_column(fin, bbox_br_y, num_bboxes);
+    if (!valid_cache || bbox_offsets.back() != num_bboxes) {
+        std::cout << "ignoring truncated annotation index cache " << cache_fpath.string() << std::endl;
+        //start from scratch, otherwise the half-read columns would be used as the cached rows
+        bbox_mtimes.clear();
+        bbox_sizes.clear();
+        bbox_offsets.clear();
+        return false;
+    }
+    frame_names = std::move(cached_names);
+    return true;
+}
+
+void AnnotationIndex::save_cache() const
+{
+    //write to the side and move it into place, s.t. a crash mid-write doesn't leave a truncated cache around
+    const auto cache_fpath = get_cache_filepath();
+    auto tmp_fpath = cache_fpath;
+    tmp_fpath += ".tmp";
+    boost::system::error_code dir_ec;
+    boost::filesystem::create_directories(cache_fpath.parent_path(), dir_ec);
+
+    std::ofstream fout(tmp_fpath.string(), std::ios::binary);
+    const uint64_t num_frames = frame_names.size();
+    const uint64_t num_bboxes = bbox_instances.size();
+    fout.write(INDEX_MAGIC, sizeof(INDEX_MAGIC));
+    fout.write(reinterpret_cast<const char*>(&INDEX_VERSION), sizeof(INDEX_VERSION));
+    fout.write(reinterpret_cast<const char*>(&num_frames), sizeof(num_frames));
+    fout.write(reinterpret_cast<const char*>(&num_bboxes), sizeof(num_bboxes));
+    for (const auto& frame_name : frame_names) {
+        const uint32_t name_len = frame_name.size();
+        fout.write(reinterpret_cast<const char*>(&name_len), sizeof(name_len));
+        fout.write(frame_name.data(), name_len);
+    }
+    write_column(fout, bbox_mtimes);
+    write_column(fout, bbox_sizes);
+    write_column(fout, mask_mtimes);
+    write_column(fout, text_mtimes);
+    write_column(fout, text_sizes);
+    write_column(fout, bbox_offsets);
+    write_column(fout, bbox_instances);
+    write_column(fout, bbox_tl_x);
+    write_column(fout, bbox_tl_y);
+    write_column(fout, bbox_br_x);
+    write_column(fout, bbox_br_y);
+    fout.close();
+
+    boost::system::error_code ec;
+    boost::filesystem::rename(tmp_fpath, cache_fpath, ec);
+    if (ec) {
+        std::cout << "couldn't write annotation index cache " << cache_fpath.string() << ": " << ec.message() << std::endl;
+    }
+}
+
+std::vector<std::string> AnnotationIndex::frames_with_instance(const int instance_id) const
+{
+    std::vector<std::string> matching_frames;
+    const int num_frames = frame_names.size();
+    for (int fidx = 0; fidx < num_frames; fidx++) {
+        auto frame_begin = bbox_instances.begin() + bbox_offsets[fidx];
+        auto frame_end = bbox_instances.begin() + bbox_offsets[fidx+1];
+        if (std::find(frame_begin, frame_end, instance_id) != frame_end) {
+            matching_frames.push_back(frame_names[fidx]);
+        }
+    }
+    return matching_frames;
+}
+
+int AnnotationIndex::count_frames_with_instance(const int instance_id) const
+{
+    //the boxes are grouped by frame, so each frame only needs to be counted on its first match
+    int num_matches = 0;
+    int last_frame = -1;
+    const int num_bboxes = bbox_instances.size();
+    for (int bidx = 0; bidx < num_bboxes; bidx++) {
+        if (bbox_instances[bidx] == instance_id && bbox_frames[bidx] != last_frame) {
+            last_frame = bbox_frames[bidx];
+            num_matches++;
+        }
+    }
+    return num_matches;
+}
+
+std::vector<std::string> AnnotationIndex::frames_with_bboxes_without_text() const
+{
+    std::vector<std::string> matching_frames;
+    const int num_frames = frame_names.size();
+    for (int fidx = 0; fidx < num_frames; fidx++) {
+        if (bbox_offsets[fidx+1] > bbox_offsets[fidx] && text_sizes[fidx] == 0) {
+            matching_frames.push_back(frame_names[fidx]);
+        }
+    }
+    return matching_frames;
+}
+
+std::vector<int> AnnotationIndex::bbox_count_histogram(const double bin_seconds) const
+{
+    if (bin_seconds <= 0 || (!vreader.has_frame_timestamps() && vreader.get_fps() <= 0)) {
+        std::string err_msg {"ERROR: invalid histogram bin size of " + std::to_string(bin_seconds) + " s"};
+        throw std::runtime_error(err_msg);
+    }
+
+    //NOTE: binned by the frames' timestamps, which aren't evenly spaced for variable frame rate videos
+    const double video_duration = vreader.get_frame_timestamp(vreader.get_num_frames()-1);
+    const int num_bins = std::max(static_cast<int>(std::floor(video_duration / bin_seconds)) + 1, 1);
+    std::vector<int> bbox_hist (num_bins, 0);
+    const int num_frames = frame_names.size();
+    for (int fidx = 0; fidx < num_frames; fidx++) {
+        if (frame_indices[fidx] < 0) {
+            continue;
+        }
+        const int bin = std::min(static_cast<int>(vreader.get_frame_timestamp(frame_indices[fidx]) / bin_seconds), num_bins-1);
+        bbox_hist[bin] += bbox_offsets[fidx+1] - bbox_offsets[fidx];
+    }
+    return bbox_hist;
+}
+
+std::map<int, int> AnnotationIndex::instance_bbox_counts() const
+{
+    std::map<int, int> instance_counts;
+    for (auto instance_id : bbox_instances) {
+        instance_counts[instance_id]++;
+    }
+    return instance_counts;
+}
+
+AnnotationSummary AnnotationIndex::get_summary() const
+{
+    AnnotationSummary summary;
+    summary.num_labelled_frames = frame_names.size();
+    summary.num_bbox_frames = std::count_if(bbox_mtimes.begin(), bbox_mtimes.end(), [](const int64_t mtime) { return mtime != 0; });
+    summary.num_mask_frames = std::count_if(mask_mtimes.begin(), mask_mtimes.end(), [](const int64_t mtime) { return mtime != 0; });
+    summary.num_text_frames = std::count_if(text_sizes.begin(), text_sizes.end(), [](const int64_t fsize) { return fsize != 0; });
+    summary.num_bboxes = bbox_instances.size();
+    summary.num_instances = instance_bbox_counts().size();
+    return summary;
+}
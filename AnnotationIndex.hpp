@@ -0,0 +1,113 @@
+#ifndef FISHLABELER_ANNOTATIONINDEX_HPP
+#define FISHLABELER_ANNOTATIONINDEX_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+
+#include "VideoLogger.hpp"
+#include "VideoReader.hpp"
+#include "WorkerPool.hpp"
+
+//overall counts for a labelled video
+struct AnnotationSummary {
+    int num_labelled_frames;
+    int num_bbox_frames;
+    int num_mask_frames;
+    int num_text_frames;
+    int num_bboxes;
+    int num_instances;
+};
+
+/* A columnar in-memory index over everything the VideoLogger has written for a video, for answering aggregate
+ * queries without touching the label files again. There's one row per labelled frame in the frame columns, and
+ * one row per bounding box in the box columns (grouped by frame, with bbox_offsets marking where each frame's
+ * boxes start).
+ *
+ * The index gets cached to <logdir>/Index/annotation_index.bin along with each label file's modification time, so
+ * re-building only has to re-parse the files that changed since it was last cached. Building stats and parses the
+ * label files across the worker pool.
+ */
+class AnnotationIndex
+{
+public:
+    AnnotationIndex(const VideoLogger& logger, const VideoReader& reader, WorkerPool& pool)
+        : vlogger(logger), vreader(reader), workers(pool), stale(true)
+    {}
+
+    //(re-)build the index, starting from the on-disk cache if there is one
+    void build();
+
+    //the user has changed the frame's labels, so the next query re-builds first. NOTE: the frame gets re-parsed
+    //regardless of its modification time, which only has a 1 sec. resolution
+    void mark_stale(const std::string& frame_name) {
+        stale_frames.insert(frame_name);
+        stale = true;
+    }
+
+    bool is_stale() const {
+        return stale;
+    }
+
+    int get_num_frames() const {
+        return frame_names.size();
+    }
+
+    //the frames that contain a bounding box for the given instance
+    std::vector<std::string> frames_with_instance(const int instance_id) const;
+    int count_frames_with_instance(const int instance_id) const;
+
+    //the frames that have bounding boxes but no (or empty) text metadata
+    std::vector<std::string> frames_with_bboxes_without_text() const;
+
+    //number of bounding boxes per bin_seconds of video, indexed by bin
+    std::vector<int> bbox_count_histogram(const double bin_seconds) const;
+
+    //number of boxes for each instance ID
+    std::map<int, int> instance_bbox_counts() const;
+
+    AnnotationSummary get_summary() const;
+
+private:
+    bool load_cache();
+    void save_cache() const;
+    boost::filesystem::path get_cache_filepath() const {
+        //NOTE: not in the log directory itself, that's (usually) the frame directory, whose mtime tells a frame
+        //archive whether the frames have changed since they were packed
+        auto cache_fpath = vlogger.get_logdir();
+        cache_fpath /= "Index";
+        cache_fpath /= "annotation_index.bin";
+        return cache_fpath;
+    }
+
+    const VideoLogger& vlogger;
+    const VideoReader& vreader;
+    WorkerPool& workers;
+    bool stale;
+    std::set<std::string> stale_frames;
+
+    //frame columns, sorted by frame name
+    std::vector<std::string> frame_names;
+    //index of the frame in the video (or -1 if there's no matching frame)
+    std::vector<int32_t> frame_indices;
+    //modification times and sizes of the frame's label files (0 if the file doesn't exist)
+    std::vector<int64_t> bbox_mtimes;
+    std::vector<int64_t> bbox_sizes;
+    std::vector<int64_t> mask_mtimes;
+    std::vector<int64_t> text_mtimes;
+    std::vector<int64_t> text_sizes;
+    //frame i's boxes are [bbox_offsets[i], bbox_offsets[i+1])
+    std::vector<uint32_t> bbox_offsets;
+
+    //box columns
+    std::vector<int32_t> bbox_frames;
+    std::vector<int32_t> bbox_instances;
+    std::vector<int32_t> bbox_tl_x;
+    std::vector<int32_t> bbox_tl_y;
+    std::vector<int32_t> bbox_br_x;
+    std::vector<int32_t> bbox_br_y;
+};
+
+#endif
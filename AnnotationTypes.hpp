@@ -5,11 +5,22 @@
 #include <QRect>
 #include <QPoint>
 
+#include "SharedList.hpp"
+#include "SpanMask.hpp"
+
 enum class ANNOTATION_MODE {
     SEGMENTATION,
     BOUNDINGBOX
 };
 
+//what a click / drag does to the current instance's mask in segmentation mode
+enum class SEGMENTATION_TOOL {
+    BRUSH,
+    POLYGON,
+    FLOOD_FILL,
+    ERASER
+};
+
 struct BoundingBoxMD {
     BoundingBoxMD()
         : instance_id(0)
@@ -24,24 +35,27 @@ struct BoundingBoxMD {
 
 struct PixelLabelMB {
     PixelLabelMB()
-        : instance_id(0)
+        : instance_id(0), class_id(0)
     {}
 
-    PixelLabelMB(std::vector<QPoint>&& spts, int id)
-        : smask(std::move(spts)), instance_id(id)
+    PixelLabelMB(SpanMask&& mask, int id, int cls = 0)
+        : smask(std::move(mask)), instance_id(id), class_id(cls)
     {}
-    std::vector<QPoint> smask;
+    SpanMask smask;
     int instance_id;
+    //0 for no class, see VideoLogger::write_annotations
+    int class_id;
 };
 
 //something to encapulate all of the user-supplied information for a given frame
+//NOTE: the lists are shared with whoever handed them over (e.g. the frame viewer), so passing these around is free
 struct FrameAnnotations {
-    FrameAnnotations(std::vector<BoundingBoxMD>&& fvboxes, std::vector<PixelLabelMB>&& fvpoints)
+    FrameAnnotations(SharedList<BoundingBoxMD> fvboxes, SharedList<PixelLabelMB> fvpoints)
         : bboxes(std::move(fvboxes)), segm_points(std::move(fvpoints))
     {}
 
-    std::vector<BoundingBoxMD> bboxes;
-    std::vector<PixelLabelMB> segm_points;
+    SharedList<BoundingBoxMD> bboxes;
+    SharedList<PixelLabelMB> segm_points;
 };
 
 
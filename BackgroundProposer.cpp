@@ -0,0 +1,267 @@
+#include "BackgroundProposer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+
+#include <QMetaObject>
+#include <QPointer>
+
+#include "FrameBuffer.hpp"
+
+constexpr int BackgroundProposer::MAX_MODEL_DIM;
+constexpr int BackgroundProposer::CHECKPOINT_INTERVAL;
+constexpr int BackgroundProposer::WARMUP_FRAMES;
+constexpr int BackgroundProposer::MAX_CATCHUP;
+constexpr int BackgroundProposer::MAX_PROPOSALS;
+
+namespace {
+    //MOG2's parameters -- the fish don't stay put for long, so a fairly short history
+    constexpr int MODEL_HISTORY = 300;
+    constexpr double MODEL_VAR_THRESHOLD = 16.0;
+    //MOG2 marks shadows as 127, which aren't fish
+    constexpr double FOREGROUND_THRESHOLD = 200.0;
+    //the warm-up of a model that starts from scratch is spread out over this many times as many frames, s.t. a fish
+    //that's sitting still doesn't end up in the background
+    constexpr int COLD_WARMUP_STRIDE = 5;
+    //blobs smaller than this fraction of the frame are noise
+    constexpr double MIN_BLOB_FRACTION = 0.0002;
+    //more of the frame than this in the foreground is a lighting change (or the camera moving), not fish
+    constexpr double MAX_FOREGROUND_FRACTION = 0.4;
+
+    cv::Ptr<cv::BackgroundSubtractorMOG2> make_model()
+    {
+        return cv::createBackgroundSubtractorMOG2(MODEL_HISTORY, MODEL_VAR_THRESHOLD, true);
+    }
+}
+
+BackgroundProposer::BackgroundProposer(const std::string& frame_dir, const FrameSource& frames, const QSize& full_size,
+        WorkerPool& pool, QObject* result_receiver)
+    : workers(pool), receiver(result_receiver), generation(std::make_shared<std::atomic<int>>(0)),
+      model_context(std::make_shared<ModelContext>())
+{
+    model_context->checkpoint_dir = boost::filesystem::path(frame_dir) / "Background";
+    model_context->frames = frames;
+    model_context->full_size = full_size;
+    model_context->state.last_index = -1;
+    model_context->state.num_fed = 0;
+}
+
+void BackgroundProposer::request(const int frame_index, ResultCallback on_result)
+{
+    const int request_generation = ++(*generation);
+    auto request_gen_counter = generation;
+    auto context = model_context;
+    QPointer<QObject> result_receiver (receiver);
+
+    workers.submit([frame_index, context, request_gen_counter, request_generation, result_receiver, on_result]{
+        std::vector<BoundingBoxMD> proposals;
+        {
+            std::lock_guard<std::mutex> model_lock (context->state.model_mutex);
+            if (*request_gen_counter != request_generation || !result_receiver) {
+                return;
+            }
+            try {
+                const cv::Mat fg_mask = update_model(*context, frame_index, *request_gen_counter, request_generation);
+                if (fg_mask.empty()) {
+                    return;
+                }
+                proposals = extract_bboxes(fg_mask, context->full_size);
+            } catch (const cv::Exception& err) {
+                std::cout << "background subtraction failed: " << err.what() << std::endl;
+                //start over next time
+                context->state.model.release();
+                context->state.last_index = -1;
+                return;
+            }
+        }
+        if (proposals.empty() || !result_receiver) {
+            return;
+        }
+
+        auto shared_proposals = std::make_shared<std::vector<BoundingBoxMD>>(std::move(proposals));
+        QMetaObject::invokeMethod(result_receiver.data(), [shared_proposals, request_gen_counter, request_generation, on_result]{
+            //the user could have moved on while this one was queued up
+            if (*request_gen_counter == request_generation) {
+                on_result(std::move(*shared_proposals));
+            }
+        }, Qt::QueuedConnection);
+    }, 1);
+}
+
+cv::Mat BackgroundProposer::update_model(ModelContext& context, const int frame_index, const std::atomic<int>& generation, const int request_generation)
+{
+    ModelState& state = context.state;
+    const int num_frames = context.frames.get_num_frames();
+    if (frame_index < 0 || frame_index >= num_frames) {
+        return cv::Mat();
+    }
+    auto start_time = std::chrono::steady_clock::now();
+
+    //where the model picks up from, and how it gets fed up to the frame
+    int first_index = state.last_index + 1;
+    int stride = 1;
+    const bool can_catch_up = state.model && state.last_index < frame_index && frame_index - state.last_index <= MAX_CATCHUP;
+    //the background won't have changed much since a frame the model's (just about) seen, e.g. stepping back
+    const bool seen_recently = state.model && state.last_index >= frame_index && state.last_index - frame_index <= MAX_CATCHUP;
+    if (!can_catch_up && !seen_recently) {
+        state.model = make_model();
+        state.num_fed = 0;
+        //the nearest checkpoint that isn't past the frame. NOTE: they only get written for the parts of the video the
+        //model's been through, so the one for the frame's own interval needn't exist yet
+        int checkpoint_index = frame_index / CHECKPOINT_INTERVAL * CHECKPOINT_INTERVAL;
+        cv::Mat checkpoint;
+        for (; checkpoint_index >= 0; checkpoint_index -= CHECKPOINT_INTERVAL) {
+            const auto checkpoint_fpath = get_checkpoint_fpath(context, checkpoint_index);
+            if (boost::filesystem::exists(checkpoint_fpath)) {
+                checkpoint = cv::imread(checkpoint_fpath.string(), cv::IMREAD_COLOR);
+                if (!checkpoint.empty()) {
+                    break;
+                }
+            }
+        }
+        if (!checkpoint.empty()) {
+            //a learning rate of 1 starts the model over from just the checkpoint's background
+            cv::Mat ignored_mask;
+            cv::cvtColor(checkpoint, checkpoint, cv::COLOR_BGR2RGB);
+            state.model->apply(checkpoint, ignored_mask, 1.0);
+            first_index = std::min(frame_index, std::max(checkpoint_index + 1, frame_index - WARMUP_FRAMES));
+        } else {
+            stride = COLD_WARMUP_STRIDE;
+            first_index = std::max(0, frame_index - WARMUP_FRAMES * stride);
+        }
+    }
+
+    //NOTE: the frame itself gets learned as well, unless the model's already past it
+    cv::Mat fg_mask;
+    int num_fed = 0;
+    int checked_checkpoint = -1;
+    for (int index = seen_recently ? frame_index : first_index; index <= frame_index; index += stride) {
+        //the frame we've been asked for always gets fed last, whatever the stride
+        if (index + stride > frame_index) {
+            index = frame_index;
+        }
+        if (generation != request_generation) {
+            return cv::Mat();
+        }
+        const cv::Mat model_frame = load_model_frame(context.frames, index, context.full_size);
+        if (model_frame.empty()) {
+            std::cout << "couldn't read " << context.frames.get_frame_path(index) << " for the background model" << std::endl;
+            //NOTE: the mask so far is some earlier frame's, its blobs aren't this frame's fish
+            if (index == frame_index) {
+                return cv::Mat();
+            }
+            continue;
+        }
+        const double learning_rate = seen_recently ? 0.0 : -1.0;
+        state.model->apply(model_frame, fg_mask, learning_rate);
+        if (seen_recently) {
+            break;
+        }
+        state.last_index = index;
+        state.num_fed++;
+        num_fed++;
+
+        //once the model's warmed up, its background becomes the checkpoint of the interval it's in (unless there
+        //already is one). NOTE: the strided frames of a cold start count too, or jumping around the video would never
+        //build any up
+        const int interval_checkpoint = index / CHECKPOINT_INTERVAL * CHECKPOINT_INTERVAL;
+        if (state.num_fed >= WARMUP_FRAMES && interval_checkpoint != checked_checkpoint) {
+            checked_checkpoint = interval_checkpoint;
+            const auto checkpoint_fpath = get_checkpoint_fpath(context, interval_checkpoint);
+            if (!boost::filesystem::exists(checkpoint_fpath)) {
+                cv::Mat background;
+                state.model->getBackgroundImage(background);
+                if (!background.empty()) {
+                    cv::cvtColor(background, background, cv::COLOR_RGB2BGR);
+                    boost::filesystem::create_directories(context.checkpoint_dir);
+                    cv::imwrite(checkpoint_fpath.string(), background);
+                }
+            }
+        }
+    }
+    auto model_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+    std::cout << "background model fed " << num_fed << " frames up to " << frame_index << " in " << model_time.count() << " ms" << std::endl;
+    return fg_mask;
+}
+
+std::vector<BoundingBoxMD> BackgroundProposer::extract_bboxes(const cv::Mat& fg_mask, const QSize& full_size)
+{
+    std::vector<BoundingBoxMD> proposals;
+    cv::Mat blob_mask;
+    cv::threshold(fg_mask, blob_mask, FOREGROUND_THRESHOLD, 255, cv::THRESH_BINARY);
+    const double frame_area = static_cast<double>(blob_mask.rows) * blob_mask.cols;
+    if (cv::countNonZero(blob_mask) > MAX_FOREGROUND_FRACTION * frame_area) {
+        return proposals;
+    }
+    //drop the speckle, then join up the pieces of the same fish (fins, the stripes on its back, ...)
+    cv::morphologyEx(blob_mask, blob_mask, cv::MORPH_OPEN, cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(3, 3)));
+    cv::morphologyEx(blob_mask, blob_mask, cv::MORPH_CLOSE, cv::getStructuringElement(cv::MORPH_ELLIPSE, cv::Size(9, 9)));
+
+    cv::Mat blob_labels, blob_stats, blob_centroids;
+    const int num_blobs = cv::connectedComponentsWithStats(blob_mask, blob_labels, blob_stats, blob_centroids, 8, CV_32S);
+    const double scale_x = static_cast<double>(full_size.width()) / blob_mask.cols;
+    const double scale_y = static_cast<double>(full_size.height()) / blob_mask.rows;
+    std::vector<std::pair<int, QRect>> blobs;
+    //NOTE: label 0 is the background
+    for (int blob = 1; blob < num_blobs; blob++) {
+        const int blob_area = blob_stats.at<int>(blob, cv::CC_STAT_AREA);
+        if (blob_area < MIN_BLOB_FRACTION * frame_area) {
+            continue;
+        }
+        const int x = blob_stats.at<int>(blob, cv::CC_STAT_LEFT);
+        const int y = blob_stats.at<int>(blob, cv::CC_STAT_TOP);
+        const int width = blob_stats.at<int>(blob, cv::CC_STAT_WIDTH);
+        const int height = blob_stats.at<int>(blob, cv::CC_STAT_HEIGHT);
+        const QRect blob_rect (QPoint(static_cast<int>(x * scale_x), static_cast<int>(y * scale_y)),
+                               QPoint(static_cast<int>((x + width) * scale_x) - 1, static_cast<int>((y + height) * scale_y) - 1));
+        blobs.emplace_back(blob_area, blob_rect);
+    }
+    //the biggest blobs are the likeliest to be fish
+    std::sort(blobs.begin(), blobs.end(), [](const std::pair<int, QRect>& lhs, const std::pair<int, QRect>& rhs) {
+        return lhs.first > rhs.first;
+    });
+    for (size_t bidx = 0; bidx < blobs.size() && static_cast<int>(bidx) < MAX_PROPOSALS; bidx++) {
+        proposals.emplace_back(blobs[bidx].second, 0);
+    }
+    return proposals;
+}
+
+cv::Mat BackgroundProposer::load_model_frame(const FrameSource& frames, const int frame_index, const QSize& full_size)
+{
+    //the coarsest decode that's still at least as big as what the model runs on
+    const int full_dim = std::max(full_size.width(), full_size.height());
+    int decode_scale = 1;
+    while (decode_scale < 8 && full_dim / (decode_scale * 2) >= MAX_MODEL_DIM) {
+        decode_scale *= 2;
+    }
+    FrameBuffer frame;
+    try {
+        frame = frames.read(frame_index, decode_scale);
+    } catch (const std::runtime_error& err) {
+        std::cout << err.what() << std::endl;
+    }
+    if (frame.empty()) {
+        return cv::Mat();
+    }
+
+    //NOTE: always the same size (whatever the decode scale), the model can't take frames of different sizes
+    const cv::Mat frame_mat = frame.as_mat();
+    const double scale = std::min(1.0, static_cast<double>(MAX_MODEL_DIM) / full_dim);
+    const cv::Size model_size (std::max(1, static_cast<int>(full_size.width() * scale)), std::max(1, static_cast<int>(full_size.height() * scale)));
+    cv::Mat model_frame;
+    if (frame_mat.channels() == 3) {
+        cv::resize(frame_mat, model_frame, model_size, 0, 0, cv::INTER_AREA);
+    } else {
+        cv::Mat rgb_frame;
+        cv::cvtColor(frame_mat, rgb_frame, (frame_mat.channels() == 1) ? cv::COLOR_GRAY2RGB : cv::COLOR_BGRA2RGB);
+        cv::resize(rgb_frame, model_frame, model_size, 0, 0, cv::INTER_AREA);
+    }
+    return model_frame;
+}
+
+boost::filesystem::path BackgroundProposer::get_checkpoint_fpath(const ModelContext& context, const int frame_index)
+{
+    const auto frame_name = boost::filesystem::path(context.frames.get_frame_path(frame_index)).stem().string();
+    return context.checkpoint_dir / (frame_name + ".png");
+}
@@ -0,0 +1,90 @@
+#ifndef FISHLABELER_BACKGROUNDPROPOSER_HPP
+#define FISHLABELER_BACKGROUNDPROPOSER_HPP
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <QObject>
+#include <QSize>
+#include <boost/filesystem.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "AnnotationTypes.hpp"
+#include "VideoReader.hpp"
+#include "WorkerPool.hpp"
+
+/* Proposes bounding boxes for the fish in static camera footage: a running background model (OpenCV's MOG2) gets
+ * fed the frames as the user steps through the video, and the connected blobs of foreground in the frame being
+ * shown become box proposals.
+ *
+ * The model runs on the worker pool, on downscaled versions of the frames, and picks up from wherever it last was:
+ * stepping forward only feeds it the frames in between. For every CHECKPOINT_INTERVAL frames the model gets through
+ * (once it's warmed up), its background image gets saved under <frame directory>/Background, s.t. jumping into the
+ * middle of the video starts a fresh model off the nearest checkpoint before the frame (plus the few frames before
+ * the one being shown) instead of replaying the video up to there. NOTE: MOG2 doesn't expose the rest of its state, so a model restored from a checkpoint has to
+ * re-learn the variances -- which is what the warm-up frames are for.
+ *
+ * Same as the MaskPropagator, only the latest request counts.
+ */
+class BackgroundProposer
+{
+public:
+    using ResultCallback = std::function<void(std::vector<BoundingBoxMD>&&)>;
+
+    //frames are the video's frames in order. NOTE: the checkpoints go in frame_dir
+    BackgroundProposer(const std::string& frame_dir, const FrameSource& frames, const QSize& full_size,
+            WorkerPool& pool, QObject* result_receiver);
+
+    //NOTE: on_result gets run on the receiver's thread, and only if the request is still the latest one by then.
+    //The boxes are in full_size coordinates, and their instance IDs are all 0
+    void request(const int frame_index, ResultCallback on_result);
+
+    void cancel() {
+        (*generation)++;
+    }
+
+    //the longest side of the frames the model runs on
+    static constexpr int MAX_MODEL_DIM = 640;
+    static constexpr int CHECKPOINT_INTERVAL = 300;
+    //how many frames a fresh (or restored) model gets to learn the background before it's asked for the foreground
+    static constexpr int WARMUP_FRAMES = 30;
+    //stepping forward by up to this many frames feeds the model every frame in between, anything further restarts it
+    static constexpr int MAX_CATCHUP = 120;
+    static constexpr int MAX_PROPOSALS = 32;
+
+private:
+    //NOTE: the model has to see the frames in order, so only one job at a time gets to work on it
+    struct ModelState {
+        std::mutex model_mutex;
+        cv::Ptr<cv::BackgroundSubtractorMOG2> model;
+        //the last frame the model saw (-1 if there's no model), and how many frames it's seen since it was started
+        int last_index;
+        int num_fed;
+    };
+
+    //everything the jobs need, shared with them s.t. they can outlive the proposer
+    struct ModelContext {
+        boost::filesystem::path checkpoint_dir;
+        FrameSource frames;
+        QSize full_size;
+        ModelState state;
+    };
+
+    //bring the model up to frame_index, and return its foreground mask for that frame (empty if the request got
+    //superseded on the way)
+    static cv::Mat update_model(ModelContext& context, const int frame_index, const std::atomic<int>& generation, const int request_generation);
+    static std::vector<BoundingBoxMD> extract_bboxes(const cv::Mat& fg_mask, const QSize& full_size);
+    static cv::Mat load_model_frame(const FrameSource& frames, const int frame_index, const QSize& full_size);
+    static boost::filesystem::path get_checkpoint_fpath(const ModelContext& context, const int frame_index);
+
+    WorkerPool& workers;
+    QObject* receiver;
+    std::shared_ptr<std::atomic<int>> generation;
+    std::shared_ptr<ModelContext> model_context;
+};
+
+#endif
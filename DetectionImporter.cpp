@@ -0,0 +1,481 @@
+#include "DetectionImporter.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <stdexcept>
+
+#include <boost/algorithm/string.hpp>
+
+namespace {
+    //only print the first few malformed lines, a bad export could have millions of them
+    constexpr int MAX_REPORTED_ERRORS = 10;
+
+    const char* skip_whitespace(const char* pos, const char* end)
+    {
+        while (pos < end && (*pos == ' ' || *pos == '\t' || *pos == '\r')) {
+            pos++;
+        }
+        return pos;
+    }
+
+    //strip whitespace and quotes from around a field
+    void trim_field(const char*& begin, const char*& end)
+    {
+        begin = skip_whitespace(begin, end);
+        while (end > begin && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+            end--;
+        }
+        if (end - begin >= 2 && *begin == '"' && end[-1] == '"') {
+            begin++;
+            end--;
+        }
+    }
+
+    //NOTE: the read buffer is always null-terminated, so strtod can't run off of the end of it. Without num_end the
+    //number has to be all of [begin, end) (e.g. a trimmed CSV field), with it the number just has to start at begin
+    bool parse_number(const char* begin, const char* end, double& value, const char** num_end = nullptr)
+    {
+        char* parse_end = nullptr;
+        value = std::strtod(begin, &parse_end);
+        if (parse_end == begin || parse_end > end || (!num_end && parse_end != end)) {
+            return false;
+        }
+        //strtod takes "nan" and "inf" as well, neither of which is a coordinate (or a frame index)
+        if (!std::isfinite(value)) {
+            return false;
+        }
+        if (num_end) {
+            *num_end = parse_end;
+        }
+        return true;
+    }
+
+    //skip over a JSON value we don't care about (nested objects/arrays included)
+    const char* skip_json_value(const char* pos, const char* end)
+    {
+        int depth = 0;
+        bool in_string = false;
+        for (; pos < end; pos++) {
+            if (in_string) {
+                if (*pos == '\\') {
+                    pos++;
+                } else if (*pos == '"') {
+                    in_string = false;
+                }
+            } else if (*pos == '"') {
+                in_string = true;
+            } else if (*pos == '{' || *pos == '[') {
+                depth++;
+            } else if (*pos == '}' || *pos == ']') {
+                if (depth == 0) {
+                    return pos;
+                }
+                depth--;
+            } else if (*pos == ',' && depth == 0) {
+                return pos;
+            }
+        }
+        return pos;
+    }
+}
+
+int DetectionImporter::field_from_name(const char* name_begin, const char* name_end)
+{
+    static const std::array<std::pair<const char*, int>, 16> field_names = {{
+        {"frame", FRAME}, {"frame_name", FRAME}, {"frame_index", FRAME_INDEX},
+        {"id", ID}, {"instance_id", ID},
+        {"x0", X0}, {"y0", Y0}, {"x1", X1}, {"y1", Y1},
+        {"x", X}, {"y", Y}, {"w", W}, {"h", H},
+        {"score", SCORE}, {"confidence", SCORE}, {"conf", SCORE}
+    }};
+
+    const size_t name_len = name_end - name_begin;
+    for (const auto& field_name : field_names) {
+        if (std::strlen(field_name.first) == name_len && std::strncmp(field_name.first, name_begin, name_len) == 0) {
+            return field_name.second;
+        }
+    }
+    return -1;
+}
+
+ImportStats DetectionImporter::import_file(const std::string& detections_fpath)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    std::ifstream fin(detections_fpath, std::ios::binary);
+    if (!fin) {
+        std::string err_msg {"ERROR: couldn't open detections file " + detections_fpath};
+        throw std::runtime_error(err_msg);
+    }
+
+    auto fext = boost::algorithm::to_lower_copy(boost::filesystem::path(detections_fpath).extension().string());
+    const bool is_jsonl = (fext == ".jsonl" || fext == ".json");
+    if (!is_jsonl && fext != ".csv") {
+        std::string err_msg {"ERROR: unknown detections format " + fext + " (expected .csv or .jsonl)"};
+        throw std::runtime_error(err_msg);
+    }
+
+    stats = ImportStats();
+    csv_columns.clear();
+    known_frames.clear();
+    if (vreader) {
+        known_frames.reserve(vreader->get_num_frames());
+        for (int frame_index = 0; frame_index < vreader->get_num_frames(); frame_index++) {
+            known_frames.insert(vreader->get_frame_name(frame_index));
+        }
+    }
+    bool need_header = !is_jsonl;
+
+    //NOTE: +1 s.t. there's always room for a null-terminator after the data
+    std::vector<char> read_buffer (options.read_chunk_sz + 1);
+    size_t carry_sz = 0;
+    int64_t line_num = 0;
+    DetectionRow row;
+    while (true) {
+        fin.read(read_buffer.data() + carry_sz, options.read_chunk_sz - carry_sz);
+        const size_t data_sz = carry_sz + fin.gcount();
+        const bool at_eof = !fin;
+        if (data_sz == 0) {
+            break;
+        }
+        read_buffer[data_sz] = '\0';
+
+        const char* data_end = read_buffer.data() + data_sz;
+        const char* line_begin = read_buffer.data();
+        while (line_begin < data_end) {
+            auto line_end = static_cast<const char*>(std::memchr(line_begin, '\n', data_end - line_begin));
+            if (!line_end) {
+                //an incomplete line, unless it's the last line of the file
+                if (!at_eof) {
+                    break;
+                }
+                line_end = data_end;
+            }
+            line_num++;
+
+            const char* content_begin = skip_whitespace(line_begin, line_end);
+            if (content_begin < line_end) {
+                if (need_header) {
+                    parse_csv_header(content_begin, line_end);
+                    need_header = false;
+                } else {
+                    stats.num_rows++;
+                    bool valid_row = is_jsonl ? parse_jsonl_row(content_begin, line_end, row) : parse_csv_row(content_begin, line_end, row);
+                    valid_row = valid_row && add_detection(row);
+                    if (!valid_row) {
+                        if (stats.num_malformed < MAX_REPORTED_ERRORS) {
+                            std::cout << "skipping malformed detection at " << detections_fpath << ":" << line_num << std::endl;
+                        }
+                        stats.num_malformed++;
+                    }
+                }
+            }
+            line_begin = line_end + 1;
+        }
+
+        if (at_eof) {
+            break;
+        }
+        carry_sz = line_begin < data_end ? data_end - line_begin : 0;
+        if (carry_sz == static_cast<size_t>(options.read_chunk_sz)) {
+            std::string err_msg {"ERROR: line " + std::to_string(line_num+1) + " of " + detections_fpath + " is longer than the read buffer"};
+            throw std::runtime_error(err_msg);
+        }
+        std::memmove(read_buffer.data(), line_begin, carry_sz);
+    }
+    flush_pending();
+
+    auto import_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+    std::cout << "Imported " << stats.num_imported << " / " << stats.num_rows << " detections into " << stats.num_frames << " frames in "
+              << import_time.count() << " ms (" << stats.num_below_threshold << " below threshold, " << stats.num_skipped
+              << " in already labelled frames, " << stats.num_malformed << " malformed, " << stats.num_unknown_frame << " for unknown frames)" << std::endl;
+    return stats;
+}
+
+void DetectionImporter::parse_csv_header(const char* line_begin, const char* line_end)
+{
+    std::array<bool, NUM_FIELDS> has_field;
+    has_field.fill(false);
+    const char* field_begin = line_begin;
+    while (field_begin <= line_end) {
+        auto field_end = std::find(field_begin, line_end, ',');
+        const char* name_begin = field_begin;
+        const char* name_end = field_end;
+        trim_field(name_begin, name_end);
+        auto lower_name = boost::algorithm::to_lower_copy(std::string(name_begin, name_end));
+        const int field = field_from_name(lower_name.data(), lower_name.data() + lower_name.size());
+        csv_columns.push_back(field);
+        if (field >= 0) {
+            has_field[field] = true;
+        }
+        field_begin = field_end + 1;
+    }
+
+    const bool has_frame = has_field[FRAME] || has_field[FRAME_INDEX];
+    const bool has_corners = has_field[X0] && has_field[Y0] && has_field[X1] && has_field[Y1];
+    const bool has_xywh = has_field[X] && has_field[Y] && has_field[W] && has_field[H];
+    if (!has_frame || !(has_corners || has_xywh)) {
+        std::string err_msg {"ERROR: detections CSV header '" + std::string(line_begin, line_end) +
+            "' needs a frame/frame_index column and x0,y0,x1,y1 or x,y,w,h columns"};
+        throw std::runtime_error(err_msg);
+    }
+    if (has_field[FRAME_INDEX] && !has_field[FRAME] && !vreader) {
+        throw std::runtime_error("ERROR: importing by frame_index needs the video's frames");
+    }
+}
+
+bool DetectionImporter::parse_csv_row(const char* line_begin, const char* line_end, DetectionRow& row) const
+{
+    row.has_value.fill(false);
+    const char* field_begin = line_begin;
+    const int num_columns = csv_columns.size();
+    for (int column = 0; column < num_columns; column++) {
+        if (field_begin > line_end) {
+            return false;
+        }
+        auto field_end = std::find(field_begin, line_end, ',');
+        const int field = csv_columns[column];
+        if (field == FRAME) {
+            const char* name_begin = field_begin;
+            const char* name_end = field_end;
+            trim_field(name_begin, name_end);
+            row.frame_begin = name_begin;
+            row.frame_end = name_end;
+            row.has_value[FRAME] = name_end > name_begin;
+        } else if (field >= 0) {
+            const char* value_begin = field_begin;
+            const char* value_end = field_end;
+            trim_field(value_begin, value_end);
+            if (!parse_number(value_begin, value_end, row.values[field])) {
+                return false;
+            }
+            row.has_value[field] = true;
+        }
+        field_begin = field_end + 1;
+    }
+    return true;
+}
+
+bool DetectionImporter::parse_jsonl_row(const char* line_begin, const char* line_end, DetectionRow& row) const
+{
+    row.has_value.fill(false);
+    const char* pos = skip_whitespace(line_begin, line_end);
+    if (pos == line_end || *pos != '{') {
+        return false;
+    }
+    pos++;
+
+    while (true) {
+        pos = skip_whitespace(pos, line_end);
+        if (pos < line_end && *pos == '}') {
+            return true;
+        }
+        //the key
+        if (pos == line_end || *pos != '"') {
+            return false;
+        }
+        const char* key_begin = ++pos;
+        pos = std::find(pos, line_end, '"');
+        if (pos == line_end) {
+            return false;
+        }
+        const char* key_end = pos++;
+        pos = skip_whitespace(pos, line_end);
+        if (pos == line_end || *pos != ':') {
+            return false;
+        }
+        pos = skip_whitespace(pos+1, line_end);
+        if (pos == line_end) {
+            return false;
+        }
+
+        //... and the value
+        const int field = field_from_name(key_begin, key_end);
+        const size_t key_len = key_end - key_begin;
+        const bool is_bbox = (key_len == 4 && std::strncmp(key_begin, "bbox", 4) == 0);
+        const bool is_xywh = (key_len == 4 && std::strncmp(key_begin, "xywh", 4) == 0);
+        if (*pos == '"') {
+            const char* str_begin = ++pos;
+            pos = std::find(pos, line_end, '"');
+            if (pos == line_end) {
+                return false;
+            }
+            if (field == FRAME) {
+                row.frame_begin = str_begin;
+                row.frame_end = pos;
+                row.has_value[FRAME] = pos > str_begin;
+            } else if (field >= 0) {
+                //numbers written as strings
+                if (!parse_number(str_begin, pos, row.values[field])) {
+                    return false;
+                }
+                row.has_value[field] = true;
+            }
+            pos++;
+        } else if (*pos == '[' && (is_bbox || is_xywh)) {
+            const std::array<int, 4> coord_fields = is_bbox ? std::array<int, 4>{{X0, Y0, X1, Y1}} : std::array<int, 4>{{X, Y, W, H}};
+            pos++;
+            for (int cidx = 0; cidx < 4; cidx++) {
+                pos = skip_whitespace(pos, line_end);
+                if (!parse_number(pos, line_end, row.values[coord_fields[cidx]], &pos)) {
+                    return false;
+                }
+                row.has_value[coord_fields[cidx]] = true;
+                pos = skip_whitespace(pos, line_end);
+                if (pos < line_end && *pos == ',') {
+                    pos++;
+                }
+            }
+            if (pos == line_end || *pos != ']') {
+                return false;
+            }
+            pos++;
+        } else if (field >= 0 && field != FRAME) {
+            if (!parse_number(pos, line_end, row.values[field], &pos)) {
+                return false;
+            }
+            row.has_value[field] = true;
+        } else {
+            pos = skip_json_value(pos, line_end);
+        }
+
+        pos = skip_whitespace(pos, line_end);
+        if (pos < line_end && *pos == ',') {
+            pos++;
+        } else if (pos < line_end && *pos == '}') {
+            return true;
+        } else {
+            return false;
+        }
+    }
+}
+
+bool DetectionImporter::add_detection(const DetectionRow& row)
+{
+    const auto& values = row.values;
+    const auto& has_value = row.has_value;
+
+    //NOTE: QRect's bottom right corner is inclusive, i.e. the corners are both inside the box while a width and
+    //height count the pixels
+    QRect bbox_rect;
+    if (has_value[X0] && has_value[Y0] && has_value[X1] && has_value[Y1]) {
+        //some detectors put the corners the other way around
+        bbox_rect = QRect(QPoint(std::lround(values[X0]), std::lround(values[Y0])), QPoint(std::lround(values[X1]), std::lround(values[Y1]))).normalized();
+    } else if (has_value[X] && has_value[Y] && has_value[W] && has_value[H]) {
+        bbox_rect = QRect(std::lround(values[X]), std::lround(values[Y]), std::lround(values[W]), std::lround(values[H]));
+        if (bbox_rect.width() <= 0 || bbox_rect.height() <= 0) {
+            return false;
+        }
+    } else {
+        return false;
+    }
+
+    if (has_value[SCORE] && values[SCORE] < options.min_score) {
+        stats.num_below_threshold++;
+        return true;
+    }
+
+    //find (or start) the frame's batch of boxes
+    const bool same_frame = last_pending && has_value[FRAME] &&
+        last_frame_name.size() == static_cast<size_t>(row.frame_end - row.frame_begin) &&
+        std::equal(row.frame_begin, row.frame_end, last_frame_name.begin());
+    if (!same_frame) {
+        last_pending = nullptr;
+        if (has_value[FRAME]) {
+            if (!resolve_frame_name(row.frame_begin, row.frame_end, last_frame_name)) {
+                stats.num_unknown_frame++;
+                return true;
+            }
+        } else if (has_value[FRAME_INDEX] && vreader) {
+            //NOTE: range-checked as a double, casting one that's out of range to int is undefined
+            const double frame_index = values[FRAME_INDEX];
+            if (frame_index < 0 || frame_index >= vreader->get_num_frames()) {
+                stats.num_unknown_frame++;
+                return true;
+            }
+            last_frame_name = vreader->get_frame_name(static_cast<int>(frame_index));
+        } else {
+            return false;
+        }
+        last_pending = &pending_bboxes[last_frame_name];
+    }
+
+    if (has_value[ID] && (values[ID] < 0 || values[ID] > std::numeric_limits<int>::max())) {
+        return false;
+    }
+    const int instance_id = has_value[ID] ? static_cast<int>(values[ID]) : 0;
+    last_pending->emplace_back(bbox_rect, instance_id);
+    num_pending++;
+    if (num_pending >= options.max_pending_bboxes) {
+        flush_pending();
+    }
+    return true;
+}
+
+bool DetectionImporter::resolve_frame_name(const char* name_begin, const char* name_end, std::string& frame_name) const
+{
+    frame_name.assign(name_begin, name_end);
+    //the name ends up as a file name under Detections/, so it can't be allowed to point anywhere else
+    if (frame_name.find('/') != std::string::npos || frame_name.find('\\') != std::string::npos || frame_name.find("..") != std::string::npos) {
+        return false;
+    }
+    if (!vreader) {
+        return true;
+    }
+    if (known_frames.count(frame_name)) {
+        return true;
+    }
+    //detectors tend to write out the frame's file name, extension and all
+    const auto frame_stem = boost::filesystem::path(frame_name).stem().string();
+    if (known_frames.count(frame_stem)) {
+        frame_name = frame_stem;
+        return true;
+    }
+    return false;
+}
+
+void DetectionImporter::flush_pending()
+{
+    //figure out what to do with each frame up front, s.t. the writes themselves are independent of each other
+    std::vector<std::pair<const std::string*, std::vector<BoundingBoxMD>*>> frame_writes;
+    std::vector<bool> replace_frame;
+    for (auto& pending : pending_bboxes) {
+        const auto& frame_name = pending.first;
+        auto imported_it = imported_frames.find(frame_name);
+        bool first_write = false;
+        if (imported_it == imported_frames.end()) {
+            const bool is_labelled = vlogger.has_boundingbox(frame_name);
+            const bool do_import = !(is_labelled && options.policy == IMPORT_POLICY::SKIP_LABELLED);
+            imported_it = imported_frames.emplace(frame_name, do_import).first;
+            first_write = true;
+            stats.num_frames += do_import;
+        }
+
+        if (!imported_it->second) {
+            stats.num_skipped += pending.second.size();
+            continue;
+        }
+        stats.num_imported += pending.second.size();
+        frame_writes.emplace_back(&frame_name, &pending.second);
+        replace_frame.push_back(first_write && options.policy != IMPORT_POLICY::APPEND);
+    }
+
+    workers.parallel_for(0, static_cast<int>(frame_writes.size()), [this, &frame_writes, &replace_frame](const int widx) {
+        const auto& frame_name = *frame_writes[widx].first;
+        auto& frame_bboxes = *frame_writes[widx].second;
+        if (replace_frame[widx]) {
+            vlogger.write_bboxes(frame_name, frame_bboxes, 0, 0, 0);
+        } else {
+            vlogger.append_bboxes(frame_name, std::move(frame_bboxes));
+        }
+    });
+
+    pending_bboxes.clear();
+    num_pending = 0;
+    last_pending = nullptr;
+}
@@ -0,0 +1,128 @@
+#ifndef FISHLABELER_DETECTIONIMPORTER_HPP
+#define FISHLABELER_DETECTIONIMPORTER_HPP
+
+#include <cstdint>
+#include <array>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "AnnotationTypes.hpp"
+#include "VideoLogger.hpp"
+#include "VideoReader.hpp"
+#include "WorkerPool.hpp"
+
+//what to do with frames that already have bounding boxes before the import
+enum class IMPORT_POLICY {
+    SKIP_LABELLED,
+    APPEND,
+    REPLACE
+};
+
+struct ImportOptions {
+    ImportOptions()
+        : min_score(0), policy(IMPORT_POLICY::SKIP_LABELLED), max_pending_bboxes(1 << 18), read_chunk_sz(1 << 22)
+    {}
+
+    //detections with a score below this get dropped (detections without a score are always kept)
+    double min_score;
+    IMPORT_POLICY policy;
+    //how many boxes to hold onto before writing them out, this (and the chunk size) bounds the memory use
+    int max_pending_bboxes;
+    int read_chunk_sz;
+};
+
+struct ImportStats {
+    ImportStats()
+        : num_rows(0), num_imported(0), num_below_threshold(0), num_malformed(0), num_unknown_frame(0), num_skipped(0), num_frames(0)
+    {}
+
+    int64_t num_rows;
+    int64_t num_imported;
+    int64_t num_below_threshold;
+    int64_t num_malformed;
+    //dropped since their frame isn't one of the video's (or its name isn't a plain file name)
+    int64_t num_unknown_frame;
+    //dropped since their frame was already labelled
+    int64_t num_skipped;
+    int64_t num_frames;
+};
+
+/* Streams detector output into the VideoLogger's Detections/ storage as pre-annotations. Supported inputs are
+ *  - CSV (.csv) with a header row naming the columns
+ *  - JSON lines (.jsonl, .json) with one flat object per detection
+ * using the fields
+ *   frame (frame name) or frame_index (index into the video's frames, needs a reader)
+ *   id / instance_id (optional, defaults to 0)
+ *   x0, y0, x1, y1 or x, y, w, h (JSON lines can also use "bbox": [x0, y0, x1, y1] or "xywh": [x, y, w, h]). The
+ *   corners are inclusive (same as QRect's), and boxes with their corners swapped around get put right
+ *   score / confidence (optional)
+ *
+ * Frame names have to be one of the reader's frames (with or without the extension), or without a reader at
+ * least a plain file name, s.t. a detections file can't have labels written anywhere but Detections/.
+ *
+ * The file gets read in fixed-size chunks and parsed in place, and the boxes are grouped by frame and written out
+ * across the worker pool in batches of ImportOptions::max_pending_bboxes.
+ */
+class DetectionImporter
+{
+public:
+    DetectionImporter(VideoLogger& logger, const VideoReader* reader, WorkerPool& pool, const ImportOptions& opts = ImportOptions())
+        : vlogger(logger), vreader(reader), workers(pool), options(opts), num_pending(0), last_pending(nullptr)
+    {}
+
+    ImportStats import_file(const std::string& detections_fpath);
+
+private:
+    enum DETECTION_FIELD {
+        FRAME = 0,
+        FRAME_INDEX,
+        ID,
+        X0, Y0, X1, Y1,
+        X, Y, W, H,
+        SCORE,
+        NUM_FIELDS
+    };
+
+    //a single parsed detection -- the frame name points back into the read buffer
+    struct DetectionRow {
+        const char* frame_begin;
+        const char* frame_end;
+        std::array<double, NUM_FIELDS> values;
+        std::array<bool, NUM_FIELDS> has_value;
+    };
+
+    static int field_from_name(const char* name_begin, const char* name_end);
+
+    void parse_csv_header(const char* line_begin, const char* line_end);
+    bool parse_csv_row(const char* line_begin, const char* line_end, DetectionRow& row) const;
+    bool parse_jsonl_row(const char* line_begin, const char* line_end, DetectionRow& row) const;
+    bool add_detection(const DetectionRow& row);
+    //the name the frame's labels go under, or false if it isn't a frame we'll write labels for
+    bool resolve_frame_name(const char* name_begin, const char* name_end, std::string& frame_name) const;
+    void flush_pending();
+
+    VideoLogger& vlogger;
+    const VideoReader* vreader;
+    WorkerPool& workers;
+    const ImportOptions options;
+    ImportStats stats;
+
+    //the reader's frame names, for checking the detections' frame names against
+    std::unordered_set<std::string> known_frames;
+
+    //which field each CSV column holds (-1 for columns we don't care about)
+    std::vector<int> csv_columns;
+
+    //boxes waiting to be written out, by frame name
+    std::unordered_map<std::string, std::vector<BoundingBoxMD>> pending_bboxes;
+    int num_pending;
+    //detections are usually grouped by frame, so keep the last frame around to skip the lookup
+    std::string last_frame_name;
+    std::vector<BoundingBoxMD>* last_pending;
+    //every frame written so far, and whether it's being imported into (or was skipped by the policy)
+    std::unordered_map<std::string, bool> imported_frames;
+};
+
+#endif
@@ -0,0 +1,441 @@
+#include <iostream>
+#include <string>
+#include <memory>
+#include <algorithm>
+#include <fstream>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+
+#include "VideoReader.hpp"
+#include "VideoLogger.hpp"
+#include "WorkerPool.hpp"
+#include "DetectionImporter.hpp"
+#include "ShardExporter.hpp"
+#include "LabelValidator.hpp"
+#include "LabelMerger.hpp"
+#include "LeaseManager.hpp"
+#include "RangeEditor.hpp"
+#include "FrameArchive.hpp"
+
+/* command-line batch tool for the labelled frame directories, i.e.
+ *   FishTool import <frame directory> <detections file> [--min-score S] [--policy skip|append|replace] [--bbox-format F]
+ *   FishTool convert-bboxes <frame directory> --bbox-format text|binary|both
+ *   FishTool export <frame directory> <output directory> [--records-per-shard N] [--max-dim D] [--quality Q] [--all-frames]
+ *   FishTool validate <frame directory> [--report <report.json>] [--repair]
+ *   FishTool merge <frame directory> [<label directory>...] [--prefer-source-masks] [--bbox-format F]
+ *   FishTool leases <frame directory>
+ *   FishTool edit-range <frame directory> <first frame> <last frame> --relabel ID|--delete|--shift DX,DY [--instance ID] [--bboxes-only|--masks-only]
+ *   FishTool edit-range <frame directory> --undo
+ *   FishTool pack <frame directory> [--codec raw|lz4]
+ */
+
+namespace {
+    BBOX_FORMAT parse_bbox_format(const QString& format_name)
+    {
+        if (format_name == "text") {
+            return BBOX_FORMAT::TEXT;
+        } else if (format_name == "binary") {
+            return BBOX_FORMAT::BINARY;
+        } else if (format_name == "both") {
+            return BBOX_FORMAT::TEXT_AND_BINARY;
+        }
+        std::string err_msg {"ERROR: unknown bounding box format " + format_name.toStdString()};
+        throw std::runtime_error(err_msg);
+    }
+
+    //the format(s) the directory's boxes are already in, s.t. writing into it doesn't convert it by accident
+    BBOX_FORMAT detect_bbox_format(const VideoLogger& vlogger)
+    {
+        bool has_text = false;
+        bool has_binary = false;
+        for (const auto& frame_name : vlogger.list_boundingbox_frames()) {
+            has_text = has_text || boost::filesystem::exists(vlogger.get_text_boundingbox_filepath(frame_name));
+            has_binary = has_binary || boost::filesystem::exists(vlogger.get_binary_boundingbox_filepath(frame_name));
+            if (has_text && has_binary) {
+                return BBOX_FORMAT::TEXT_AND_BINARY;
+            }
+        }
+        return has_binary ? BBOX_FORMAT::BINARY : BBOX_FORMAT::TEXT;
+    }
+
+    //the --bbox-format if it's given, or else whatever the directory has already
+    void set_bbox_format(VideoLogger& vlogger, QCommandLineParser& cmd_parser, const QCommandLineOption& format_option)
+    {
+        vlogger.set_bbox_format(cmd_parser.isSet(format_option) ? parse_bbox_format(cmd_parser.value(format_option)) : detect_bbox_format(vlogger));
+    }
+
+    int run_import(QCoreApplication& app, QCommandLineParser& cmd_parser)
+    {
+        cmd_parser.clearPositionalArguments();
+        cmd_parser.addPositionalArgument("import", "Import detector output as pre-annotations.");
+        cmd_parser.addPositionalArgument("framedir", "The video's frame directory.");
+        cmd_parser.addPositionalArgument("detections", "The detections file (.csv or .jsonl).");
+        QCommandLineOption score_option("min-score", "Drop detections scoring below <score>.", "score", "0");
+        QCommandLineOption policy_option("policy", "What to do with frames that already have boxes: skip, append or replace.", "policy", "skip");
+        QCommandLineOption format_option("bbox-format", "Write the boxes as text, binary or both (default: the format the directory's boxes are in).", "format");
+        cmd_parser.addOption(score_option);
+        cmd_parser.addOption(policy_option);
+        cmd_parser.addOption(format_option);
+        cmd_parser.process(app);
+
+        const auto args = cmd_parser.positionalArguments();
+        if (args.size() != 3) {
+            cmd_parser.showHelp(1);
+        }
+
+        ImportOptions import_opts;
+        import_opts.min_score = cmd_parser.value(score_option).toDouble();
+        const auto policy = cmd_parser.value(policy_option);
+        if (policy == "append") {
+            import_opts.policy = IMPORT_POLICY::APPEND;
+        } else if (policy == "replace") {
+            import_opts.policy = IMPORT_POLICY::REPLACE;
+        } else if (policy != "skip") {
+            std::cout << "ERROR: unknown import policy " << policy.toStdString() << std::endl;
+            return 1;
+        }
+
+        const std::string frame_dir = args[1].toStdString();
+        WorkerPool workers;
+        VideoReader vreader (frame_dir);
+        VideoLogger vlogger (frame_dir);
+        set_bbox_format(vlogger, cmd_parser, format_option);
+        DetectionImporter importer (vlogger, &vreader, workers, import_opts);
+        importer.import_file(args[2].toStdString());
+        return 0;
+    }
+
+    int run_convert_bboxes(QCoreApplication& app, QCommandLineParser& cmd_parser)
+    {
+        cmd_parser.clearPositionalArguments();
+        cmd_parser.addPositionalArgument("convert-bboxes", "Re-write every frame's bounding boxes in the given format.");
+        cmd_parser.addPositionalArgument("framedir", "The video's frame directory.");
+        QCommandLineOption format_option("bbox-format", "The format to convert to: text, binary or both.", "format");
+        cmd_parser.addOption(format_option);
+        cmd_parser.process(app);
+
+        const auto args = cmd_parser.positionalArguments();
+        if (args.size() != 2 || !cmd_parser.isSet(format_option)) {
+            cmd_parser.showHelp(1);
+        }
+
+        WorkerPool workers;
+        VideoLogger vlogger (args[1].toStdString(), parse_bbox_format(cmd_parser.value(format_option)));
+        const auto frame_names = vlogger.list_boundingbox_frames();
+        workers.parallel_for(0, static_cast<int>(frame_names.size()), [&vlogger, &frame_names](const int fidx) {
+            auto frame_bboxes = vlogger.get_boundingboxes(frame_names[fidx]);
+            vlogger.write_bboxes(frame_names[fidx], frame_bboxes, 0, 0, 0);
+        });
+        std::cout << "Converted the bounding boxes of " << frame_names.size() << " frames" << std::endl;
+        return 0;
+    }
+
+    int run_export(QCoreApplication& app, QCommandLineParser& cmd_parser)
+    {
+        cmd_parser.clearPositionalArguments();
+        cmd_parser.addPositionalArgument("export", "Pack the labelled frames into shard files for training.");
+        cmd_parser.addPositionalArgument("framedir", "The video's frame directory.");
+        cmd_parser.addPositionalArgument("outdir", "Where to write the shards.");
+        QCommandLineOption records_option("records-per-shard", "How many frames go in each shard.", "count", "2048");
+        QCommandLineOption dim_option("max-dim", "Downscale frames to at most <pixels> on their longest side (0 keeps them as-is).", "pixels", "0");
+        QCommandLineOption quality_option("quality", "JPEG quality for frames that need re-encoding.", "quality", "95");
+        QCommandLineOption all_option("all-frames", "Export every frame, not just the labelled ones.");
+        cmd_parser.addOption(records_option);
+        cmd_parser.addOption(dim_option);
+        cmd_parser.addOption(quality_option);
+        cmd_parser.addOption(all_option);
+        cmd_parser.process(app);
+
+        const auto args = cmd_parser.positionalArguments();
+        if (args.size() != 3) {
+            cmd_parser.showHelp(1);
+        }
+
+        ExportOptions export_opts;
+        export_opts.records_per_shard = std::max(1, cmd_parser.value(records_option).toInt());
+        export_opts.max_dim = cmd_parser.value(dim_option).toInt();
+        export_opts.jpeg_quality = cmd_parser.value(quality_option).toInt();
+        export_opts.labelled_only = !cmd_parser.isSet(all_option);
+
+        const std::string frame_dir = args[1].toStdString();
+        WorkerPool workers;
+        VideoReader vreader (frame_dir);
+        VideoLogger vlogger (frame_dir);
+        ShardExporter exporter (vreader, vlogger, workers, export_opts);
+        const auto export_stats = exporter.export_shards(args[2].toStdString());
+        return export_stats.num_failed > 0 ? 1 : 0;
+    }
+
+    int run_validate(QCoreApplication& app, QCommandLineParser& cmd_parser)
+    {
+        cmd_parser.clearPositionalArguments();
+        cmd_parser.addPositionalArgument("validate", "Check the frame directory's labels for problems.");
+        cmd_parser.addPositionalArgument("framedir", "The video's frame directory.");
+        QCommandLineOption report_option("report", "Write the JSON report to <file> (instead of stdout).", "file");
+        QCommandLineOption repair_option("repair", "Fix what can be fixed automatically.");
+        cmd_parser.addOption(report_option);
+        cmd_parser.addOption(repair_option);
+        cmd_parser.process(app);
+
+        const auto args = cmd_parser.positionalArguments();
+        if (args.size() != 2) {
+            cmd_parser.showHelp(1);
+        }
+
+        const std::string frame_dir = args[1].toStdString();
+        WorkerPool workers;
+        VideoReader vreader (frame_dir);
+        VideoLogger vlogger (frame_dir);
+        LabelValidator validator (vreader, vlogger, workers);
+        const auto report = validator.validate(cmd_parser.isSet(repair_option));
+
+        const auto report_json = report.to_json(frame_dir);
+        if (cmd_parser.isSet(report_option)) {
+            const std::string report_fpath = cmd_parser.value(report_option).toStdString();
+            std::ofstream report_out(report_fpath);
+            report_out << report_json;
+            if (!report_out) {
+                std::cout << "ERROR: couldn't write the report to " << report_fpath << std::endl;
+                return 1;
+            }
+        } else {
+            std::cout << report_json;
+        }
+        return report.num_unrepaired() > 0 ? 1 : 0;
+    }
+
+    int run_merge(QCoreApplication& app, QCommandLineParser& cmd_parser)
+    {
+        cmd_parser.clearPositionalArguments();
+        cmd_parser.addPositionalArgument("merge", "Merge other annotators' labels into the frame directory's.");
+        cmd_parser.addPositionalArgument("framedir", "The video's frame directory.");
+        cmd_parser.addPositionalArgument("sources", "The label directories to merge in (default: everything under <framedir>/Conflicts/).", "[sources...]");
+        QCommandLineOption masks_option("prefer-source-masks", "Where both sides have different masks, take the source's.");
+        QCommandLineOption format_option("bbox-format", "Write the merged boxes as text, binary or both (default: the format the directory's boxes are in).", "format");
+        cmd_parser.addOption(masks_option);
+        cmd_parser.addOption(format_option);
+        cmd_parser.process(app);
+
+        const auto args = cmd_parser.positionalArguments();
+        if (args.size() < 2) {
+            cmd_parser.showHelp(1);
+        }
+
+        const std::string frame_dir = args[1].toStdString();
+        std::vector<std::string> source_dirs;
+        for (int aidx = 2; aidx < args.size(); aidx++) {
+            source_dirs.push_back(args[aidx].toStdString());
+        }
+        //by default, fold in every annotator's conflicting labels
+        const auto conflicts_dir = boost::filesystem::path(frame_dir) / "Conflicts";
+        if (source_dirs.empty() && boost::filesystem::is_directory(conflicts_dir)) {
+            for (boost::filesystem::directory_iterator dit(conflicts_dir); dit != boost::filesystem::directory_iterator(); dit++) {
+                if (boost::filesystem::is_directory(dit->path())) {
+                    source_dirs.push_back(dit->path().string());
+                }
+            }
+            std::sort(source_dirs.begin(), source_dirs.end());
+        }
+        if (source_dirs.empty()) {
+            std::cout << "nothing to merge" << std::endl;
+            return 0;
+        }
+
+        WorkerPool workers;
+        VideoLogger vlogger (frame_dir);
+        set_bbox_format(vlogger, cmd_parser, format_option);
+        LabelMerger merger (vlogger, workers);
+        MergeStats stats;
+        for (const auto& source_dir : source_dirs) {
+            stats += merger.merge(source_dir, cmd_parser.isSet(masks_option));
+        }
+        //the masks that are still different need someone to look at them
+        return stats.num_mask_conflicts > 0 && !cmd_parser.isSet(masks_option) ? 1 : 0;
+    }
+
+    int run_leases(QCoreApplication& app, QCommandLineParser& cmd_parser)
+    {
+        cmd_parser.clearPositionalArguments();
+        cmd_parser.addPositionalArgument("leases", "List who's labelling which frames of the video.");
+        cmd_parser.addPositionalArgument("framedir", "The video's frame directory.");
+        cmd_parser.process(app);
+
+        const auto args = cmd_parser.positionalArguments();
+        if (args.size() != 2) {
+            cmd_parser.showHelp(1);
+        }
+
+        const auto leases = LeaseManager::read_leases(boost::filesystem::path(args[1].toStdString()) / "Leases");
+        for (const auto& lease : leases) {
+            std::cout << lease.annotator << ": frames " << lease.first_frame << " - " << lease.last_frame << " on " << lease.host
+                      << " (pid " << lease.pid << ", " << (LeaseManager::is_live(lease) ? "live" : "expired") << ")" << std::endl;
+        }
+        if (leases.empty()) {
+            std::cout << "no leases" << std::endl;
+        }
+        return 0;
+    }
+    int run_edit_range(QCoreApplication& app, QCommandLineParser& cmd_parser)
+    {
+        cmd_parser.clearPositionalArguments();
+        cmd_parser.addPositionalArgument("edit-range", "Relabel, delete or shift an instance's labels over a range of frames, as one undoable edit.");
+        cmd_parser.addPositionalArgument("framedir", "The video's frame directory.");
+        cmd_parser.addPositionalArgument("first", "The index of the first frame to edit.", "[first]");
+        cmd_parser.addPositionalArgument("last", "The index of the last frame to edit.", "[last]");
+        QCommandLineOption instance_option("instance", "The instance to edit (shifting edits every instance by default).", "id");
+        QCommandLineOption relabel_option("relabel", "Give the instance the ID <id>.", "id");
+        QCommandLineOption delete_option("delete", "Delete the instance's labels.");
+        QCommandLineOption shift_option("shift", "Move the labels by <dx,dy> pixels.", "dx,dy");
+        QCommandLineOption bboxes_option("bboxes-only", "Only edit the bounding boxes.");
+        QCommandLineOption masks_option("masks-only", "Only edit the masks.");
+        QCommandLineOption undo_option("undo", "Undo the last range edit.");
+        cmd_parser.addOption(instance_option);
+        cmd_parser.addOption(relabel_option);
+        cmd_parser.addOption(delete_option);
+        cmd_parser.addOption(shift_option);
+        cmd_parser.addOption(bboxes_option);
+        cmd_parser.addOption(masks_option);
+        cmd_parser.addOption(undo_option);
+        cmd_parser.process(app);
+
+        const auto args = cmd_parser.positionalArguments();
+        const std::string frame_dir = args.size() > 1 ? args[1].toStdString() : std::string();
+        WorkerPool workers;
+        if (cmd_parser.isSet(undo_option)) {
+            if (args.size() != 2) {
+                cmd_parser.showHelp(1);
+            }
+            VideoLogger vlogger (frame_dir);
+            RangeEditor editor (vlogger, workers);
+            return editor.undo() ? 0 : 1;
+        }
+
+        const int num_ops = cmd_parser.isSet(relabel_option) + cmd_parser.isSet(delete_option) + cmd_parser.isSet(shift_option);
+        if (args.size() != 4 || num_ops != 1 || (cmd_parser.isSet(bboxes_option) && cmd_parser.isSet(masks_option))) {
+            cmd_parser.showHelp(1);
+        }
+
+        RangeEdit edit;
+        edit.instance_id = RangeEdit::ALL_INSTANCES;
+        if (cmd_parser.isSet(instance_option)) {
+            edit.instance_id = cmd_parser.value(instance_option).toInt();
+        }
+        if (cmd_parser.isSet(relabel_option)) {
+            edit.op = RANGE_OP::RELABEL;
+            edit.new_instance_id = cmd_parser.value(relabel_option).toInt();
+        } else if (cmd_parser.isSet(delete_option)) {
+            edit.op = RANGE_OP::DELETE_INSTANCE;
+        } else {
+            edit.op = RANGE_OP::SHIFT;
+            const auto offset_vals = cmd_parser.value(shift_option).split(',');
+            bool dx_ok = false, dy_ok = false;
+            if (offset_vals.size() == 2) {
+                edit.offset = QPoint(offset_vals[0].toInt(&dx_ok), offset_vals[1].toInt(&dy_ok));
+            }
+            if (!dx_ok || !dy_ok) {
+                std::cout << "ERROR: the shift has to be <dx,dy>, not " << cmd_parser.value(shift_option).toStdString() << std::endl;
+                return 1;
+            }
+        }
+        edit.edit_bboxes = !cmd_parser.isSet(masks_option);
+        edit.edit_masks = !cmd_parser.isSet(bboxes_option);
+
+        VideoReader vreader (frame_dir);
+        const int first_frame = std::max(0, args[2].toInt());
+        const int last_frame = std::min(vreader.get_num_frames() - 1, args[3].toInt());
+        std::vector<std::string> frame_names;
+        for (int fidx = first_frame; fidx <= last_frame; fidx++) {
+            frame_names.push_back(vreader.get_frame_name(fidx));
+        }
+        if (frame_names.empty()) {
+            std::cout << "ERROR: no frames in the range " << args[2].toStdString() << " - " << args[3].toStdString() << std::endl;
+            return 1;
+        }
+
+        VideoLogger vlogger (frame_dir);
+        RangeEditor editor (vlogger, workers);
+        editor.apply(edit, frame_names, vreader.get_frame_size());
+        return 0;
+    }
+    int run_pack(QCoreApplication& app, QCommandLineParser& cmd_parser)
+    {
+        cmd_parser.clearPositionalArguments();
+        cmd_parser.addPositionalArgument("pack", "Pack the decoded frames into the one memory-mapped archive, for instant seeking.");
+        cmd_parser.addPositionalArgument("framedir", "The video's frame directory.");
+        const char* default_codec = FrameArchive::has_codec(FRAME_CODEC::LZ4) ? "lz4" : "raw";
+        QCommandLineOption codec_option("codec", "Store the frames as raw pixels or LZ4 compressed.", "codec", default_codec);
+        cmd_parser.addOption(codec_option);
+        cmd_parser.process(app);
+
+        const auto args = cmd_parser.positionalArguments();
+        if (args.size() != 2) {
+            cmd_parser.showHelp(1);
+        }
+
+        FRAME_CODEC codec = FRAME_CODEC::RAW;
+        const auto codec_name = cmd_parser.value(codec_option);
+        if (codec_name == "lz4") {
+            codec = FRAME_CODEC::LZ4;
+        } else if (codec_name != "raw") {
+            std::cout << "ERROR: unknown codec " << codec_name.toStdString() << std::endl;
+            return 1;
+        }
+
+        const std::string frame_dir = args[1].toStdString();
+        WorkerPool workers;
+        //NOTE: the frames as they are in the directory now, not as they were the last time it was packed
+        VideoReader vreader (frame_dir, false);
+        std::vector<std::string> frame_fpaths;
+        for (int fidx = 0; fidx < vreader.get_num_frames(); fidx++) {
+            frame_fpaths.push_back(vreader.get_frame_path(fidx));
+        }
+        const auto archive_fpath = boost::filesystem::path(frame_dir) / FrameArchive::ARCHIVE_FNAME;
+        FrameArchive::pack(frame_fpaths, archive_fpath.string(), codec, workers);
+        return 0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication app(argc, argv);
+    QCoreApplication::setOrganizationName("Alrik Firl");
+    QCoreApplication::setApplicationName("Fish Labeler Tool");
+    QCoreApplication::setApplicationVersion(QT_VERSION_STR);
+
+    QCommandLineParser cmd_parser;
+    cmd_parser.setApplicationDescription("Batch processing for labelled fish video frame directories");
+    cmd_parser.addHelpOption();
+    cmd_parser.addPositionalArgument("command", "The command to run: import, convert-bboxes, export, validate, merge, leases, edit-range, pack");
+
+    //only look at the command for now, each command sets up and checks its own options
+    cmd_parser.parse(app.arguments());
+    const auto args = cmd_parser.positionalArguments();
+    const QString command = args.isEmpty() ? QString() : args.first();
+
+    try {
+        if (command == "import") {
+            return run_import(app, cmd_parser);
+        } else if (command == "convert-bboxes") {
+            return run_convert_bboxes(app, cmd_parser);
+        } else if (command == "export") {
+            return run_export(app, cmd_parser);
+        } else if (command == "validate") {
+            return run_validate(app, cmd_parser);
+        } else if (command == "merge") {
+            return run_merge(app, cmd_parser);
+        } else if (command == "leases") {
+            return run_leases(app, cmd_parser);
+        } else if (command == "edit-range") {
+            return run_edit_range(app, cmd_parser);
+        } else if (command == "pack") {
+            return run_pack(app, cmd_parser);
+        }
+    } catch (const std::runtime_error& err) {
+        std::cout << err.what() << std::endl;
+        return 1;
+    }
+
+    cmd_parser.process(app);
+    cmd_parser.showHelp(1);
+}
@@ -0,0 +1,363 @@
+#include "FrameArchive.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+#include <sys/stat.h>
+
+#ifdef FISHLABELER_HAVE_LZ4
+#include <lz4.h>
+#endif
+
+const std::string FrameArchive::ARCHIVE_FNAME {"frames.flpk"};
+
+namespace {
+    constexpr char ARCHIVE_MAGIC[4] = {'F', 'L', 'P', 'K'};
+    constexpr uint32_t ARCHIVE_VERSION = 2;
+    //each frame starts on a page boundary, s.t. reading one only touches its own pages
+    constexpr uint32_t FRAME_ALIGNMENT = 4096;
+    constexpr size_t HEADER_SZ = 40;
+    constexpr size_t DIR_MTIME_POS = 32;
+    constexpr size_t INDEX_RECORD_SZ = 32;
+
+    struct PackedFrame {
+        std::vector<char> bytes;
+        int width;
+        int height;
+        int channels;
+        int64_t raw_size;
+    };
+
+    template <typename T>
+    T read_value(const char* data, const size_t offset)
+    {
+        T value;
+        std::memcpy(&value, data + offset, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    void append_value(std::vector<char>& buffer, const T value)
+    {
+        const char* value_bytes = reinterpret_cast<const char*>(&value);
+        buffer.insert(buffer.end(), value_bytes, value_bytes + sizeof(T));
+    }
+
+    //NOTE: to the nanosecond, boost only goes to the second and a frame could be added in the same second as the packing
+    int64_t get_mtime_ns(const boost::filesystem::path& fpath)
+    {
+        struct stat file_stat;
+        if (::stat(fpath.string().c_str(), &file_stat) != 0) {
+            return -1;
+        }
+#ifdef __APPLE__
+        return static_cast<int64_t>(file_stat.st_mtimespec.tv_sec) * 1000000000 + file_stat.st_mtimespec.tv_nsec;
+#else
+        return static_cast<int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec;
+#endif
+    }
+
+    boost::filesystem::path get_frame_dir(const std::string& archive_fpath)
+    {
+        const boost::filesystem::path frame_dir = boost::filesystem::path(archive_fpath).parent_path();
+        return frame_dir.empty() ? boost::filesystem::path(".") : frame_dir;
+    }
+
+    uint64_t align_offset(const uint64_t offset, const uint64_t alignment)
+    {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
+    PackedFrame pack_frame(const std::string& frame_fpath, const FRAME_CODEC codec)
+    {
+        const FrameBuffer frame = FrameBuffer::decode(frame_fpath);
+        if (frame.empty()) {
+            std::string err_msg {"ERROR: couldn't decode the frame " + frame_fpath};
+            throw std::runtime_error(err_msg);
+        }
+        PackedFrame packed_frame;
+        packed_frame.width = frame.width();
+        packed_frame.height = frame.height();
+        packed_frame.channels = frame.channels();
+
+        //NOTE: the decoded rows can be padded, the archive's aren't
+        const cv::Mat frame_mat = frame.as_mat();
+        const size_t row_sz = static_cast<size_t>(frame.width()) * frame.channels();
+        std::vector<char> pixels (row_sz * frame.height());
+        for (int row = 0; row < frame.height(); row++) {
+            std::memcpy(pixels.data() + row * row_sz, frame_mat.ptr<uchar>(row), row_sz);
+        }
+        packed_frame.raw_size = pixels.size();
+
+        if (codec == FRAME_CODEC::RAW) {
+            packed_frame.bytes = std::move(pixels);
+            return packed_frame;
+        }
+#ifdef FISHLABELER_HAVE_LZ4
+        packed_frame.bytes.resize(LZ4_compressBound(static_cast<int>(pixels.size())));
+        const int packed_sz = LZ4_compress_default(pixels.data(), packed_frame.bytes.data(), static_cast<int>(pixels.size()),
+                                                   static_cast<int>(packed_frame.bytes.size()));
+        if (packed_sz <= 0) {
+            std::string err_msg {"ERROR: couldn't compress the frame " + frame_fpath};
+            throw std::runtime_error(err_msg);
+        }
+        packed_frame.bytes.resize(packed_sz);
+        return packed_frame;
+#else
+        std::string err_msg {"ERROR: this was built without LZ4"};
+        throw std::runtime_error(err_msg);
+#endif
+    }
+}
+
+FrameArchive::FrameArchive(const std::string& archive_fpath)
+    : fpath(archive_fpath), dir_mtime(0)
+{
+    try {
+        mapping = std::make_shared<boost::iostreams::mapped_file_source>(archive_fpath);
+    } catch (const std::exception& err) {
+        std::string err_msg {"ERROR: couldn't map the frame archive " + archive_fpath + ": " + err.what()};
+        throw std::runtime_error(err_msg);
+    }
+    read_index();
+}
+
+void FrameArchive::read_index()
+{
+    const char* data = mapping->data();
+    const uint64_t file_sz = mapping->size();
+    auto malformed = [this](const std::string& problem) {
+        std::string err_msg {"ERROR: frame archive " + fpath + " is malformed (" + problem + "), it needs re-packing"};
+        return std::runtime_error(err_msg);
+    };
+
+    if (file_sz < HEADER_SZ || std::memcmp(data, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0) {
+        throw malformed("bad header");
+    }
+    const auto version = read_value<uint32_t>(data, 4);
+    if (version != ARCHIVE_VERSION) {
+        throw malformed("unknown version " + std::to_string(version));
+    }
+    const auto num_frames = read_value<uint32_t>(data, 8);
+    const auto index_offset = read_value<uint64_t>(data, 16);
+    const auto names_offset = read_value<uint64_t>(data, 24);
+    dir_mtime = read_value<int64_t>(data, DIR_MTIME_POS);
+    if (index_offset > file_sz || num_frames > (file_sz - index_offset) / INDEX_RECORD_SZ || names_offset > file_sz) {
+        throw malformed("the index runs past the end of the file");
+    }
+
+    frame_entries.resize(num_frames);
+    uint64_t name_pos = names_offset;
+    for (uint32_t fidx = 0; fidx < num_frames; fidx++) {
+        const uint64_t record_pos = index_offset + fidx * INDEX_RECORD_SZ;
+        FrameEntry& entry = frame_entries[fidx];
+        entry.offset = read_value<uint64_t>(data, record_pos);
+        entry.size = read_value<uint64_t>(data, record_pos + 8);
+        entry.width = read_value<uint32_t>(data, record_pos + 16);
+        entry.height = read_value<uint32_t>(data, record_pos + 20);
+        entry.channels = read_value<uint32_t>(data, record_pos + 24);
+        entry.codec = static_cast<FRAME_CODEC>(read_value<uint32_t>(data, record_pos + 28));
+
+        if (entry.offset > file_sz || entry.size > file_sz - entry.offset) {
+            throw malformed("frame " + std::to_string(fidx) + " runs past the end of the file");
+        }
+        if (entry.width <= 0 || entry.height <= 0) {
+            throw malformed("frame " + std::to_string(fidx) + " is " + std::to_string(entry.width) + "x" + std::to_string(entry.height));
+        }
+        if (entry.channels != 1 && entry.channels != 3 && entry.channels != 4) {
+            throw malformed("frame " + std::to_string(fidx) + " has " + std::to_string(entry.channels) + " channels");
+        }
+        const uint64_t raw_sz = static_cast<uint64_t>(entry.width) * entry.height * entry.channels;
+        if ((entry.codec == FRAME_CODEC::RAW && entry.size != raw_sz) || (entry.codec != FRAME_CODEC::RAW && entry.codec != FRAME_CODEC::LZ4)) {
+            throw malformed("frame " + std::to_string(fidx) + " has a bad size or codec");
+        }
+
+        if (name_pos > file_sz - sizeof(uint32_t)) {
+            throw malformed("the names run past the end of the file");
+        }
+        const auto name_len = read_value<uint32_t>(data, name_pos);
+        name_pos += sizeof(uint32_t);
+        if (name_len > file_sz - name_pos) {
+            throw malformed("the names run past the end of the file");
+        }
+        entry.fname.assign(data + name_pos, name_len);
+        name_pos += name_len;
+    }
+
+    const bool has_lz4 = std::any_of(frame_entries.begin(), frame_entries.end(), [](const FrameEntry& entry) {
+        return entry.codec == FRAME_CODEC::LZ4;
+    });
+    if (has_lz4 && !has_codec(FRAME_CODEC::LZ4)) {
+        std::string err_msg {"ERROR: frame archive " + fpath + " has LZ4 frames, but this was built without LZ4"};
+        throw std::runtime_error(err_msg);
+    }
+    std::cout << "Mapped " << num_frames << " frames from " << fpath << " (" << file_sz / (1024*1024) << " MiB)" << std::endl;
+}
+
+FrameBuffer FrameArchive::get_frame(const int index) const
+{
+    check_frame_index(index);
+    const FrameEntry& entry = frame_entries[index];
+    const auto frame_data = reinterpret_cast<const uchar*>(mapping->data() + entry.offset);
+    const size_t row_sz = static_cast<size_t>(entry.width) * entry.channels;
+
+    if (entry.codec == FRAME_CODEC::RAW) {
+        return FrameBuffer::from_memory(frame_data, entry.width, entry.height, entry.channels, row_sz, mapping);
+    }
+#ifdef FISHLABELER_HAVE_LZ4
+    cv::Mat frame (entry.height, entry.width, CV_8UC(entry.channels));
+    const int raw_sz = static_cast<int>(row_sz * entry.height);
+    const int unpacked_sz = LZ4_decompress_safe(reinterpret_cast<const char*>(frame_data), reinterpret_cast<char*>(frame.data),
+                                                static_cast<int>(entry.size), raw_sz);
+    if (unpacked_sz != raw_sz) {
+        std::string err_msg {"ERROR: frame " + std::to_string(index) + " of " + fpath + " is corrupt"};
+        throw std::runtime_error(err_msg);
+    }
+    return FrameBuffer::from_mat(frame);
+#else
+    //NOTE: the constructor already refused archives like this
+    return FrameBuffer();
+#endif
+}
+
+bool FrameArchive::has_codec(const FRAME_CODEC codec)
+{
+#ifdef FISHLABELER_HAVE_LZ4
+    return codec == FRAME_CODEC::RAW || codec == FRAME_CODEC::LZ4;
+#else
+    return codec == FRAME_CODEC::RAW;
+#endif
+}
+
+bool FrameArchive::is_dir_unchanged() const
+{
+    const int64_t mtime = get_mtime_ns(get_frame_dir(fpath));
+    return mtime >= 0 && mtime == dir_mtime;
+}
+
+void FrameArchive::stamp_dir_mtime(const std::string& archive_fpath)
+{
+    const int64_t mtime = get_mtime_ns(get_frame_dir(archive_fpath));
+    //NOTE: overwritten in place, which (unlike creating a file) leaves the directory's mtime alone
+    std::fstream archive_io(archive_fpath, std::ios::binary | std::ios::in | std::ios::out);
+    archive_io.seekp(DIR_MTIME_POS);
+    archive_io.write(reinterpret_cast<const char*>(&mtime), sizeof(mtime));
+    archive_io.close();
+    if (!archive_io) {
+        std::string err_msg {"ERROR: couldn't update the header of " + archive_fpath};
+        throw std::runtime_error(err_msg);
+    }
+}
+
+PackStats FrameArchive::pack(const std::vector<std::string>& frame_fpaths, const std::string& archive_fpath, const FRAME_CODEC codec, WorkerPool& workers)
+{
+    if (!has_codec(codec)) {
+        std::string err_msg {"ERROR: this was built without LZ4"};
+        throw std::runtime_error(err_msg);
+    }
+    auto start_time = std::chrono::steady_clock::now();
+
+    //NOTE: written to the side and renamed into place, a reader never sees half an archive
+    const std::string tmp_fpath = archive_fpath + ".tmp";
+    std::ofstream archive_out(tmp_fpath, std::ios::binary | std::ios::trunc);
+    if (!archive_out) {
+        std::string err_msg {"ERROR: couldn't create " + tmp_fpath};
+        throw std::runtime_error(err_msg);
+    }
+    //filled in once everything else has been written
+    archive_out.write(std::vector<char>(HEADER_SZ, 0).data(), HEADER_SZ);
+    uint64_t write_pos = HEADER_SZ;
+
+    PackStats stats;
+    std::vector<char> index_buffer;
+    index_buffer.reserve(frame_fpaths.size() * INDEX_RECORD_SZ);
+    //decode + compress a bounded number of frames ahead on the pool, and write them out in order as they finish
+    const size_t max_in_flight = 4 * workers.num_threads();
+    std::deque<std::future<PackedFrame>> in_flight;
+    size_t next_frame = 0;
+    size_t num_written = 0;
+    try {
+        while (next_frame < frame_fpaths.size() || !in_flight.empty()) {
+            while (next_frame < frame_fpaths.size() && in_flight.size() < max_in_flight) {
+                const std::string frame_fpath = frame_fpaths[next_frame++];
+                in_flight.push_back(workers.submit([frame_fpath, codec]{
+                    return pack_frame(frame_fpath, codec);
+                }));
+            }
+            PackedFrame packed_frame = in_flight.front().get();
+            in_flight.pop_front();
+
+            const uint64_t frame_offset = align_offset(write_pos, FRAME_ALIGNMENT);
+            archive_out.write(std::vector<char>(frame_offset - write_pos, 0).data(), frame_offset - write_pos);
+            archive_out.write(packed_frame.bytes.data(), packed_frame.bytes.size());
+            write_pos = frame_offset + packed_frame.bytes.size();
+
+            append_value<uint64_t>(index_buffer, frame_offset);
+            append_value<uint64_t>(index_buffer, packed_frame.bytes.size());
+            append_value<uint32_t>(index_buffer, packed_frame.width);
+            append_value<uint32_t>(index_buffer, packed_frame.height);
+            append_value<uint32_t>(index_buffer, packed_frame.channels);
+            append_value<uint32_t>(index_buffer, static_cast<uint32_t>(codec));
+            stats.num_frames++;
+            stats.raw_bytes += packed_frame.raw_size;
+            stats.packed_bytes += packed_frame.bytes.size();
+
+            num_written++;
+            if (num_written % 1000 == 0) {
+                std::cout << "packed " << num_written << " / " << frame_fpaths.size() << " frames" << std::endl;
+            }
+        }
+    } catch (...) {
+        //the rest of the jobs reference nothing of ours, but don't leave them decoding for nothing
+        for (auto& frame_job : in_flight) {
+            frame_job.wait();
+        }
+        archive_out.close();
+        boost::system::error_code ec;
+        boost::filesystem::remove(tmp_fpath, ec);
+        throw;
+    }
+
+    const uint64_t index_offset = align_offset(write_pos, sizeof(uint64_t));
+    archive_out.write(std::vector<char>(index_offset - write_pos, 0).data(), index_offset - write_pos);
+    archive_out.write(index_buffer.data(), index_buffer.size());
+    const uint64_t names_offset = index_offset + index_buffer.size();
+    std::vector<char> names_buffer;
+    for (const auto& frame_fpath : frame_fpaths) {
+        const std::string fname = boost::filesystem::path(frame_fpath).filename().string();
+        append_value<uint32_t>(names_buffer, fname.size());
+        names_buffer.insert(names_buffer.end(), fname.begin(), fname.end());
+    }
+    archive_out.write(names_buffer.data(), names_buffer.size());
+
+    std::vector<char> header_buffer (ARCHIVE_MAGIC, ARCHIVE_MAGIC + sizeof(ARCHIVE_MAGIC));
+    append_value<uint32_t>(header_buffer, ARCHIVE_VERSION);
+    append_value<uint32_t>(header_buffer, frame_fpaths.size());
+    append_value<uint32_t>(header_buffer, FRAME_ALIGNMENT);
+    append_value<uint64_t>(header_buffer, index_offset);
+    append_value<uint64_t>(header_buffer, names_offset);
+    //stamped once it's been renamed into place, which itself changes the directory's mtime
+    append_value<int64_t>(header_buffer, 0);
+    archive_out.seekp(0);
+    archive_out.write(header_buffer.data(), header_buffer.size());
+    archive_out.close();
+    if (!archive_out) {
+        boost::system::error_code ec;
+        boost::filesystem::remove(tmp_fpath, ec);
+        std::string err_msg {"ERROR: couldn't write " + tmp_fpath};
+        throw std::runtime_error(err_msg);
+    }
+    boost::filesystem::rename(tmp_fpath, archive_fpath);
+    stamp_dir_mtime(archive_fpath);
+
+    auto pack_time = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - start_time);
+    std::cout << "Packed " << stats.num_frames << " frames into " << archive_fpath << " in " << pack_time.count() << " s: "
+              << stats.packed_bytes / (1024*1024) << " MiB (" << stats.raw_bytes / (1024*1024) << " MiB raw)" << std::endl;
+    return stats;
+}
@@ -0,0 +1,120 @@
+#ifndef FISHLABELER_FRAMEARCHIVE_HPP
+#define FISHLABELER_FRAMEARCHIVE_HPP
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <QSize>
+#include <boost/iostreams/device/mapped_file.hpp>
+
+#include "FrameBuffer.hpp"
+#include "WorkerPool.hpp"
+
+//how the frames in an archive are stored
+enum class FRAME_CODEC : uint32_t {
+    //the decoded pixels as-is, i.e. served straight out of the page cache without a copy
+    RAW = 0,
+    //the decoded pixels LZ4 compressed (only if this was built with LZ4)
+    LZ4 = 1
+};
+
+struct PackStats {
+    PackStats()
+        : num_frames(0), raw_bytes(0), packed_bytes(0)
+    {}
+
+    int64_t num_frames;
+    int64_t raw_bytes;
+    int64_t packed_bytes;
+};
+
+/* A whole frame directory's frames, decoded and packed into the one file (<frame directory>/frames.flpk) s.t. any
+ * frame can be read without opening a file or decoding a JPEG. The archive gets memory-mapped, so fetching a frame
+ * is a page cache read plus (at most) an LZ4 decompress, and seeking an hour into the video costs the same as
+ * stepping to the next frame.
+ *
+ * The file is
+ *   header: "FLPK" | uint32 version | uint32 #frames | uint32 alignment | uint64 index offset | uint64 names offset |
+ *           int64 frame directory mtime (ns)
+ *   frames: each one's pixels (tightly packed rows, RGB / gray / BGRA as in FrameBuffer), starting on an alignment
+ *           boundary
+ *   index:  #frames records of uint64 offset | uint64 size | uint32 width | uint32 height | uint32 channels | uint32 codec
+ *   names:  #frames records of uint32 length | the frame's original file name
+ * all in native byte order, same as the binary bounding boxes.
+ *
+ * NOTE: it's a snapshot of the frame directory, frames added since need the archive re-packed. The directory's mtime
+ * as of packing is kept in the header s.t. VideoReader can tell when the directory's changed since, and check the
+ * frames still match before it trusts the archive. Only adding, removing or renaming the directory's own entries
+ * changes it, and everything the labeller writes goes into subdirectories, so that's the frames (or the archive)
+ * changing in practice. Nothing reads the original frames once it's packed (everything goes through VideoReader), so
+ * they can be removed.
+ */
+class FrameArchive
+{
+public:
+    //maps the archive, and checks its index is consistent with the file
+    explicit FrameArchive(const std::string& archive_fpath);
+
+    int get_num_frames() const {
+        return frame_entries.size();
+    }
+
+    //the name of the file the frame was packed from (i.e. with its extension)
+    const std::string& get_frame_fname(const int index) const {
+        check_frame_index(index);
+        return frame_entries[index].fname;
+    }
+
+    QSize get_frame_size(const int index) const {
+        check_frame_index(index);
+        return QSize(frame_entries[index].width, frame_entries[index].height);
+    }
+
+    //whether the frame directory's mtime is still the one it had the last time it was known to match the archive
+    bool is_dir_unchanged() const;
+
+    //thread-safe. NOTE: raw frames are views of the mapping, which stays open for as long as any of them are around
+    FrameBuffer get_frame(const int index) const;
+
+    //decode the frames (in order) and write them into a new archive, replacing whatever was at archive_fpath once
+    //it's complete. Throws if any of the frames can't be read
+    static PackStats pack(const std::vector<std::string>& frame_fpaths, const std::string& archive_fpath, const FRAME_CODEC codec, WorkerPool& workers);
+
+    static bool has_codec(const FRAME_CODEC codec);
+
+    //record the frame directory's current mtime in the archive's header, i.e. that the directory still matches it
+    static void stamp_dir_mtime(const std::string& archive_fpath);
+
+    //where VideoReader looks for the archive, in the frame directory
+    static const std::string ARCHIVE_FNAME;
+
+private:
+    struct FrameEntry {
+        uint64_t offset;
+        uint64_t size;
+        int width;
+        int height;
+        int channels;
+        FRAME_CODEC codec;
+        std::string fname;
+    };
+
+    void check_frame_index(const int index) const {
+        if (index < 0 || index >= static_cast<int>(frame_entries.size())) {
+            std::string err_msg {"ERROR: index " + std::to_string(index) + " is out of bounds"};
+            throw std::runtime_error(err_msg);
+        }
+    }
+
+    void read_index();
+
+    const std::string fpath;
+    //NOTE: shared with the raw frames handed out
+    std::shared_ptr<boost::iostreams::mapped_file_source> mapping;
+    std::vector<FrameEntry> frame_entries;
+    int64_t dir_mtime;
+};
+
+#endif
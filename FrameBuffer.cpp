@@ -0,0 +1,155 @@
+#include "FrameBuffer.hpp"
+
+#include <stdexcept>
+
+#include <boost/filesystem.hpp>
+#include <boost/algorithm/string.hpp>
+
+//the IMREAD_REDUCED_* modes showed up in OpenCV 3.2
+#if defined(CV_VERSION_MAJOR) && (CV_VERSION_MAJOR > 3 || (CV_VERSION_MAJOR == 3 && CV_VERSION_MINOR >= 2))
+#define FISHLABELER_HAVE_REDUCED_DECODE
+#endif
+
+namespace {
+    QImage::Format qimage_format(const int channels)
+    {
+        switch (channels) {
+            case 1:
+                return QImage::Format_Grayscale8;
+            case 3:
+                return QImage::Format_RGB888;
+            case 4:
+                return QImage::Format_ARGB32;
+        }
+        std::string err_msg {"ERROR: can't wrap a frame with " + std::to_string(channels) + " channels"};
+        throw std::runtime_error(err_msg);
+    }
+
+    //holds a reference to the pixels for as long as the QImage view needs them
+    void release_frame_storage(void* storage_ref)
+    {
+        delete static_cast<std::shared_ptr<const void>*>(storage_ref);
+    }
+}
+
+FrameBuffer FrameBuffer::from_mat(const cv::Mat& frame)
+{
+    if (frame.empty()) {
+        return FrameBuffer();
+    }
+    if (frame.depth() != CV_8U) {
+        std::string err_msg {"ERROR: can only wrap 8-bit frames"};
+        throw std::runtime_error(err_msg);
+    }
+    //just to make sure it's a format we know how to hand to Qt
+    qimage_format(frame.channels());
+
+    auto frame_storage = std::make_shared<Storage>();
+    frame_storage->mat_owner = frame;
+    frame_storage->data = frame.data;
+    frame_storage->width = frame.cols;
+    frame_storage->height = frame.rows;
+    frame_storage->channels = frame.channels();
+    frame_storage->stride = frame.step;
+    return FrameBuffer(std::move(frame_storage));
+}
+
+FrameBuffer FrameBuffer::from_memory(const uchar* data, const int width, const int height, const int channels, const size_t stride,
+                                     std::shared_ptr<const void> owner)
+{
+    if (!data || width <= 0 || height <= 0) {
+        return FrameBuffer();
+    }
+    qimage_format(channels);
+
+    auto frame_storage = std::make_shared<Storage>();
+    frame_storage->memory_owner = std::move(owner);
+    frame_storage->data = data;
+    frame_storage->width = width;
+    frame_storage->height = height;
+    frame_storage->channels = channels;
+    frame_storage->stride = stride;
+    return FrameBuffer(std::move(frame_storage));
+}
+
+FrameBuffer FrameBuffer::from_qimage(const QImage& frame)
+{
+    if (frame.isNull()) {
+        return FrameBuffer();
+    }
+
+    auto frame_storage = std::make_shared<Storage>();
+    switch (frame.format()) {
+        case QImage::Format_Grayscale8:
+            frame_storage->channels = 1;
+            frame_storage->qimage_owner = frame;
+            break;
+        case QImage::Format_RGB888:
+            frame_storage->channels = 3;
+            frame_storage->qimage_owner = frame;
+            break;
+        case QImage::Format_ARGB32:
+            frame_storage->channels = 4;
+            frame_storage->qimage_owner = frame;
+            break;
+        default:
+            //NOTE: the one copy, but the frame would have needed converting for OpenCV anyway
+            frame_storage->channels = 3;
+            frame_storage->qimage_owner = frame.convertToFormat(QImage::Format_RGB888);
+            break;
+    }
+    //NOTE: constBits doesn't detach, so this is the (shared) image's own buffer
+    const QImage& owner = frame_storage->qimage_owner;
+    frame_storage->data = owner.constBits();
+    frame_storage->width = owner.width();
+    frame_storage->height = owner.height();
+    frame_storage->stride = owner.bytesPerLine();
+    return FrameBuffer(std::move(frame_storage));
+}
+
+FrameBuffer FrameBuffer::decode(const std::string& frame_fpath, const int scale)
+{
+    int read_mode = cv::IMREAD_COLOR;
+#ifdef FISHLABELER_HAVE_REDUCED_DECODE
+    //JPEGs can be decoded straight to 1/2, 1/4 or 1/8 resolution, which is much cheaper than a full decode
+    auto fext = boost::algorithm::to_lower_copy(boost::filesystem::path(frame_fpath).extension().string());
+    if (scale > 1 && (fext == ".jpg" || fext == ".jpeg")) {
+        read_mode = (scale == 2) ? cv::IMREAD_REDUCED_COLOR_2 : (scale == 4) ? cv::IMREAD_REDUCED_COLOR_4 : cv::IMREAD_REDUCED_COLOR_8;
+    }
+#endif
+    cv::Mat frame = cv::imread(frame_fpath, read_mode);
+    if (frame.empty()) {
+        //OpenCV doesn't read everything Qt does (and vice versa)
+        return from_qimage(QImage(frame_fpath.c_str()));
+    }
+    //NOTE: in place, so no extra buffer
+    cv::cvtColor(frame, frame, cv::COLOR_BGR2RGB);
+    return from_mat(frame);
+}
+
+QImage FrameBuffer::as_qimage() const
+{
+    if (!storage) {
+        return QImage();
+    }
+    if (!storage->qimage_owner.isNull()) {
+        //implicitly shared, so this doesn't copy
+        return storage->qimage_owner;
+    }
+    //the QImage gets its own reference to the pixels, which it drops when the last copy of it goes away
+    auto storage_ref = new std::shared_ptr<const void>(storage);
+    return QImage(storage->data, storage->width, storage->height, static_cast<int>(storage->stride),
+                  qimage_format(storage->channels), release_frame_storage, storage_ref);
+}
+
+cv::Mat FrameBuffer::as_mat() const
+{
+    if (!storage) {
+        return cv::Mat();
+    }
+    if (!storage->mat_owner.empty()) {
+        //reference counted, so this one is safe to hold onto
+        return storage->mat_owner;
+    }
+    return cv::Mat(storage->height, storage->width, CV_8UC(storage->channels), const_cast<uchar*>(storage->data), storage->stride);
+}
@@ -0,0 +1,92 @@
+#ifndef FISHLABELER_FRAMEBUFFER_HPP
+#define FISHLABELER_FRAMEBUFFER_HPP
+
+#include <memory>
+#include <string>
+
+#include <QImage>
+#include <QSize>
+#include <opencv2/opencv.hpp>
+
+/* A decoded frame that both Qt and OpenCV can look at without copying the pixels.
+ *
+ * The pixels live in exactly one owner -- either a cv::Mat or a QImage, whichever decoded the frame, or whatever
+ * holds the memory they were read into (see from_memory) -- which is shared (and never modified) between every copy
+ * of the FrameBuffer, so copying a FrameBuffer or handing it to another thread is just a reference count bump. The views:
+ *  - as_qimage() shares ownership, the QImage keeps the pixels alive for as long as it (or any copy of it) lives
+ *  - as_mat() is a header over the pixels, and is only valid while a FrameBuffer holding them is alive
+ * Neither view should be written to -- a QImage view detaches (copies) on write, a Mat view doesn't.
+ *
+ * 3 channel frames are stored as RGB (OpenCV's BGR gets swapped in place when decoding), 1 channel frames as
+ * grayscale and 4 channel frames as BGRA (i.e. QImage's ARGB32 on little-endian machines).
+ */
+class FrameBuffer
+{
+public:
+    //an empty frame
+    FrameBuffer() {}
+
+    //takes (a reference to) the Mat's pixels -- the Mat needs to be 8-bit with 1, 3 (RGB) or 4 channels
+    static FrameBuffer from_mat(const cv::Mat& frame);
+
+    //takes (a reference to) the image's pixels, converting it first if it's in a format OpenCV can't wrap
+    static FrameBuffer from_qimage(const QImage& frame);
+
+    //wraps pixels that someone else owns (e.g. a memory-mapped file), holding on to owner for as long as any
+    //FrameBuffer or view needs them. Same layouts as from_mat
+    static FrameBuffer from_memory(const uchar* data, const int width, const int height, const int channels, const size_t stride,
+                                   std::shared_ptr<const void> owner);
+
+    //decodes the file (at 1/scale resolution for JPEGs if scale is 2, 4 or 8). Returns an empty frame if it can't be read
+    static FrameBuffer decode(const std::string& frame_fpath, const int scale = 1);
+
+    QImage as_qimage() const;
+    cv::Mat as_mat() const;
+
+    bool empty() const {
+        return !storage;
+    }
+
+    int width() const {
+        return storage ? storage->width : 0;
+    }
+
+    int height() const {
+        return storage ? storage->height : 0;
+    }
+
+    int channels() const {
+        return storage ? storage->channels : 0;
+    }
+
+    QSize size() const {
+        return QSize(width(), height());
+    }
+
+    //how many FrameBuffers share the pixels (mostly for debugging lifetime issues)
+    long use_count() const {
+        return storage.use_count();
+    }
+
+private:
+    struct Storage {
+        //NOTE: only one of these holds the pixels
+        cv::Mat mat_owner;
+        QImage qimage_owner;
+        std::shared_ptr<const void> memory_owner;
+
+        const uchar* data;
+        int width;
+        int height;
+        int channels;
+        size_t stride;
+    };
+
+    explicit FrameBuffer(std::shared_ptr<const Storage> frame_storage)
+        : storage(std::move(frame_storage))
+    {}
+
+    std::shared_ptr<const Storage> storage;
+};
+
+#endif
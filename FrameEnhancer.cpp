@@ -0,0 +1,168 @@
+#include "FrameEnhancer.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+
+#include <opencv2/opencv.hpp>
+
+constexpr int FrameEnhancer::CACHE_SIZE;
+
+namespace {
+    //don't let a frame that's nearly all one color blow the other channels up
+    constexpr double MAX_WHITE_BALANCE_GAIN = 4.0;
+
+    //one lookup table entry per channel value, which is how OpenCV's LUT wants it
+    cv::Mat make_lut(const int channels)
+    {
+        return cv::Mat(1, 256, CV_8UC(channels));
+    }
+
+    uchar gamma_value(const int value, const double gamma)
+    {
+        return cv::saturate_cast<uchar>(255.0 * std::pow(value / 255.0, 1.0 / gamma));
+    }
+}
+
+FrameBuffer FrameEnhancer::get(const std::string& frame_fpath, const FrameBuffer& frame, const EnhanceSettings& enhance_settings)
+{
+    if (frame.empty()) {
+        return frame;
+    }
+    EnhanceKey enhance_key {frame_fpath, frame.width(), enhance_settings};
+    std::promise<FrameBuffer> enhance_promise;
+    std::shared_future<FrameBuffer> enhance_future;
+    {
+        std::lock_guard<std::mutex> cache_lock (cache_mutex);
+        auto entry_it = std::find_if(cache_entries.begin(), cache_entries.end(), [&enhance_key](const std::pair<EnhanceKey, std::shared_future<FrameBuffer>>& entry) {
+            return entry.first == enhance_key;
+        });
+        if (entry_it != cache_entries.end()) {
+            cache_entries.splice(cache_entries.begin(), cache_entries, entry_it);
+            enhance_future = entry_it->second;
+        } else {
+            cache_entries.emplace_front(enhance_key, enhance_promise.get_future().share());
+            if (static_cast<int>(cache_entries.size()) > CACHE_SIZE) {
+                cache_entries.pop_back();
+            }
+        }
+    }
+    if (enhance_future.valid()) {
+        return enhance_future.get();
+    }
+
+    try {
+        FrameBuffer enhanced_frame = enhance(frame, enhance_settings);
+        enhance_promise.set_value(enhanced_frame);
+        return enhanced_frame;
+    } catch (const cv::Exception& err) {
+        std::cout << "couldn't enhance " << frame_fpath << ": " << err.what() << std::endl;
+        //don't leave anyone waiting on it, and let the next fetch try again
+        enhance_promise.set_value(frame);
+        std::lock_guard<std::mutex> cache_lock (cache_mutex);
+        cache_entries.remove_if([&enhance_key](const std::pair<EnhanceKey, std::shared_future<FrameBuffer>>& entry) {
+            return entry.first == enhance_key;
+        });
+        return frame;
+    }
+}
+
+FrameBuffer FrameEnhancer::get_if_ready(const std::string& frame_fpath, const FrameBuffer& frame, const EnhanceSettings& enhance_settings)
+{
+    if (frame.empty()) {
+        return FrameBuffer();
+    }
+    const EnhanceKey enhance_key {frame_fpath, frame.width(), enhance_settings};
+    std::lock_guard<std::mutex> cache_lock (cache_mutex);
+    auto entry_it = std::find_if(cache_entries.begin(), cache_entries.end(), [&enhance_key](const std::pair<EnhanceKey, std::shared_future<FrameBuffer>>& entry) {
+        return entry.first == enhance_key;
+    });
+    if (entry_it == cache_entries.end() || entry_it->second.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+        return FrameBuffer();
+    }
+    cache_entries.splice(cache_entries.begin(), cache_entries, entry_it);
+    return entry_it->second.get();
+}
+
+FrameBuffer FrameEnhancer::enhance(const FrameBuffer& frame, const EnhanceSettings& enhance_settings)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    //NOTE: the Mat is just a view of the frame's pixels, every step below writes into a new Mat
+    const cv::Mat frame_mat = frame.as_mat();
+    cv::Mat enhanced;
+    if (frame_mat.channels() == 4) {
+        cv::cvtColor(frame_mat, enhanced, cv::COLOR_BGRA2RGB);
+    } else {
+        enhanced = frame_mat;
+    }
+    const bool is_color = enhanced.channels() == 3;
+
+    //the white balance gains and the gamma curve are both just per-channel lookups, so they can go into the one
+    //table -- unless CLAHE has to go in between them
+    const bool gamma_after_clahe = enhance_settings.clahe;
+    const bool has_white_balance = enhance_settings.white_balance && is_color;
+    const bool has_gamma = enhance_settings.gamma > 0 && enhance_settings.gamma != 1.0;
+
+    if (has_white_balance || (has_gamma && !gamma_after_clahe)) {
+        double gains[3] = {1.0, 1.0, 1.0};
+        if (has_white_balance) {
+            const cv::Scalar channel_means = cv::mean(enhanced);
+            const double gray_mean = (channel_means[0] + channel_means[1] + channel_means[2]) / 3;
+            for (int channel = 0; channel < 3; channel++) {
+                gains[channel] = std::min(gray_mean / std::max(channel_means[channel], 1.0), MAX_WHITE_BALANCE_GAIN);
+            }
+        }
+        cv::Mat lut = make_lut(enhanced.channels());
+        uchar* lut_values = lut.ptr<uchar>(0);
+        for (int value = 0; value < 256; value++) {
+            for (int channel = 0; channel < enhanced.channels(); channel++) {
+                int balanced = cv::saturate_cast<uchar>(value * gains[channel]);
+                if (has_gamma && !gamma_after_clahe) {
+                    balanced = gamma_value(balanced, enhance_settings.gamma);
+                }
+                lut_values[value * enhanced.channels() + channel] = static_cast<uchar>(balanced);
+            }
+        }
+        cv::Mat balanced_frame;
+        cv::LUT(enhanced, lut, balanced_frame);
+        enhanced = balanced_frame;
+    }
+
+    if (enhance_settings.clahe) {
+        auto clahe = cv::createCLAHE(enhance_settings.clahe_clip, cv::Size(enhance_settings.clahe_tiles, enhance_settings.clahe_tiles));
+        cv::Mat equalized_frame;
+        if (is_color) {
+            //just the lightness, equalizing the channels separately would shift the colors again
+            cv::Mat lab_frame;
+            cv::cvtColor(enhanced, lab_frame, cv::COLOR_RGB2Lab);
+            cv::Mat lab_channels[3];
+            cv::split(lab_frame, lab_channels);
+            clahe->apply(lab_channels[0], lab_channels[0]);
+            cv::merge(lab_channels, 3, lab_frame);
+            cv::cvtColor(lab_frame, equalized_frame, cv::COLOR_Lab2RGB);
+        } else {
+            clahe->apply(enhanced, equalized_frame);
+        }
+        enhanced = equalized_frame;
+
+        if (has_gamma) {
+            cv::Mat lut = make_lut(1);
+            uchar* lut_values = lut.ptr<uchar>(0);
+            for (int value = 0; value < 256; value++) {
+                lut_values[value] = gamma_value(value, enhance_settings.gamma);
+            }
+            cv::Mat gamma_frame;
+            cv::LUT(enhanced, lut, gamma_frame);
+            enhanced = gamma_frame;
+        }
+    }
+
+    //nothing to do, but it's still its own frame (the original's pixels are shared, not copied)
+    if (enhanced.data == frame_mat.data) {
+        return frame;
+    }
+    auto enhance_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+    std::cout << "enhancing the frame (" << enhanced.cols << "x" << enhanced.rows << ") took " << enhance_time.count() << " ms" << std::endl;
+    return FrameBuffer::from_mat(enhanced);
+}
@@ -0,0 +1,100 @@
+#ifndef FISHLABELER_FRAMEENHANCER_HPP
+#define FISHLABELER_FRAMEENHANCER_HPP
+
+#include <atomic>
+#include <future>
+#include <list>
+#include <mutex>
+#include <string>
+#include <utility>
+
+#include "FrameBuffer.hpp"
+
+//what the enhancement does to a frame, in the order it gets done
+struct EnhanceSettings {
+    EnhanceSettings()
+        : white_balance(true), clahe(true), clahe_clip(2.0), clahe_tiles(8), gamma(1.2)
+    {}
+
+    bool operator==(const EnhanceSettings& rhs) const {
+        return white_balance == rhs.white_balance && clahe == rhs.clahe && clahe_clip == rhs.clahe_clip &&
+            clahe_tiles == rhs.clahe_tiles && gamma == rhs.gamma;
+    }
+
+    //gray-world: scale the channels s.t. they average out to gray (undoes the water's blue / green cast)
+    bool white_balance;
+    //contrast limited adaptive histogram equalization on the lightness, over a clahe_tiles x clahe_tiles grid
+    bool clahe;
+    double clahe_clip;
+    int clahe_tiles;
+    //> 1 brightens the shadows, 1 turns it off
+    double gamma;
+};
+
+/* An optional enhancement stage for murky footage (gray-world white balance, CLAHE and a gamma curve), between
+ * decoding a frame and showing it. It's all per-pixel, so the enhanced frame is the same size as the original and
+ * the labels drawn on it line up with the original frame.
+ *
+ * The enhanced frames are cached per (frame, resolution, settings), s.t. the readers can enhance the frames they
+ * prefetch on the worker pool and toggling the enhancement (or stepping back to a frame) doesn't redo it. The
+ * readers of a window share the one enhancer.
+ *
+ * NOTE: enabled / the settings belong to the GUI thread, the jobs get handed a copy of the settings along with the
+ * frame. get() is thread-safe.
+ */
+class FrameEnhancer
+{
+public:
+    FrameEnhancer()
+        : enabled(false)
+    {}
+
+    bool is_enabled() const {
+        return enabled;
+    }
+
+    void set_enabled(const bool enable) {
+        enabled = enable;
+    }
+
+    const EnhanceSettings& get_settings() const {
+        return settings;
+    }
+
+    //NOTE: the frames enhanced with the old settings just age out of the cache
+    void set_settings(const EnhanceSettings& enhance_settings) {
+        settings = enhance_settings;
+    }
+
+    //the frame (decoded from frame_fpath) enhanced with the settings, out of the cache if it's been done before.
+    //Falls back to the original frame if OpenCV chokes on it
+    FrameBuffer get(const std::string& frame_fpath, const FrameBuffer& frame, const EnhanceSettings& enhance_settings);
+    //same, but never waits or enhances: an empty frame unless it's already been done
+    FrameBuffer get_if_ready(const std::string& frame_fpath, const FrameBuffer& frame, const EnhanceSettings& enhance_settings);
+
+    static FrameBuffer enhance(const FrameBuffer& frame, const EnhanceSettings& enhance_settings);
+
+    //how many enhanced frames to keep around -- a bit more than the readers prefetch
+    static constexpr int CACHE_SIZE = 16;
+
+private:
+    //NOTE: the width tells the decode scales apart
+    struct EnhanceKey {
+        bool operator==(const EnhanceKey& rhs) const {
+            return frame_width == rhs.frame_width && frame_fpath == rhs.frame_fpath && settings == rhs.settings;
+        }
+
+        std::string frame_fpath;
+        int frame_width;
+        EnhanceSettings settings;
+    };
+
+    std::atomic<bool> enabled;
+    EnhanceSettings settings;
+
+    std::mutex cache_mutex;
+    //most recently used first. Same as the optical flow cache, the frame can still be in the works
+    std::list<std::pair<EnhanceKey, std::shared_future<FrameBuffer>>> cache_entries;
+};
+
+#endif
@@ -1,8 +1,8 @@
 #include "FrameScene.hpp"
 
+#include <algorithm>
 #include <cmath>
 #include <iostream>
-#include <QImage>
 #include <QKeyEvent>
 #include <QPainter>
 
@@ -47,36 +47,203 @@ namespace utils {
     }
 }
 
-FrameViewer::FrameViewer(const QImage& initial_frame, QObject* parent)
+constexpr int FrameViewer::MAX_UNDO_STEPS;
+constexpr int FrameViewer::POLYGON_SNAP_DIST;
+
+FrameViewer::FrameViewer(const FrameBuffer& initial_frame, QObject* parent)
     : QGraphicsScene(parent) 
 {
+    //NOTE: the default, but the boxes rely on it -- a frame can have hundreds of them
+    setItemIndexMethod(QGraphicsScene::BspTreeIndex);
     drawing_annotations = false;
+    annotations_modified = false;
+    drawing_segmentation_box = false;
+    fullres_requested = false;
     annotation_brushsz = 8;
-    display_frame(initial_frame);
+    current_id = 0;
+    current_class_id = 0;
     mode = ANNOTATION_MODE::BOUNDINGBOX;
+    segm_tool = SEGMENTATION_TOOL::BRUSH;
+    drag_item = addRect(QRectF());
+    drag_item->setAcceptedMouseButtons(Qt::NoButton);
+    drag_item->setVisible(false);
+    display_frame(initial_frame);
 }
 
-void FrameViewer::display_frame(const QImage& frame) 
+void FrameViewer::display_frame(const FrameBuffer& frame, const QSize& full_size) 
 {
-
-    //if we are doing segmentation, write out whatever the current mask is as well
-    if (mode == ANNOTATION_MODE::SEGMENTATION) {
-        set_instance_id(current_id);
+    //any in-flight grabcut is for the old frame
+    if (segmenter) {
+        segmenter->cancel();
     }
 
     current_frame = frame; 
+    //NOTE: the QImage is just a view of the frame, the pixmap is the only copy (and it has to be)
+    frame_pixmap = QPixmap::fromImage(current_frame.as_qimage());
+    full_frame_size = full_size.isValid() ? full_size : frame.size();
+    fullres_requested = false;
+    //NOTE: the background is painted by hand, so the scene needs to be told how big the frame is
+    setSceneRect(0, 0, full_frame_size.width(), full_frame_size.height());
 
-    //moving to the next frame, so clear out the current frame's annotations
+    //moving to the next frame, so clear out the current frame's annotations (after holding on to them for
+    //carry_over_labels)
+    if (!boundingbox_locations.empty() || !annotation_locations.empty()) {
+        carried_bboxes = boundingbox_locations;
+        carried_masks = annotation_locations;
+    }
+    annotations_modified = false;
     annotation_locations.clear();
-    limbo_points.clear();
+    undo_masks.clear();
+    redo_masks.clear();
+    polygon_vertices.clear();
+    proposed_masks.clear();
+    proposed_bboxes.clear();
     boundingbox_locations.clear();
     limbo_bboxes.clear();
+    drag_item->setVisible(false);
+    sync_bbox_items();
+    this->update();
+}
+
+void FrameViewer::set_metadata(FrameAnnotations&& metadata)
+{
+    //NOTE: a frame's saved labels normally arrive while it doesn't have any yet, so they can just be shared
+    if (boundingbox_locations.empty()) {
+        boundingbox_locations = std::move(metadata.bboxes);
+    } else {
+        auto& frame_bboxes = boundingbox_locations.edit();
+        frame_bboxes.insert(frame_bboxes.end(), metadata.bboxes.begin(), metadata.bboxes.end());
+    }
+    if (annotation_locations.empty()) {
+        annotation_locations = std::move(metadata.segm_points);
+    } else {
+        auto& frame_masks = annotation_locations.edit();
+        frame_masks.insert(frame_masks.end(), metadata.segm_points.begin(), metadata.segm_points.end());
+    }
+    sync_bbox_items();
+}
+
+void FrameViewer::carry_over_labels()
+{
+    if (carried_bboxes.empty() && carried_masks.empty()) {
+        std::cout << "no labels to carry over" << std::endl;
+        return;
+    }
+
+    push_mask_undo();
+    if (boundingbox_locations.empty()) {
+        boundingbox_locations = carried_bboxes;
+    } else {
+        auto& frame_bboxes = boundingbox_locations.edit();
+        frame_bboxes.insert(frame_bboxes.end(), carried_bboxes.begin(), carried_bboxes.end());
+    }
+    if (annotation_locations.empty()) {
+        annotation_locations = carried_masks;
+    } else {
+        //an instance the frame already has a mask for gets the carried mask added to it
+        for (const auto& carried_label : carried_masks) {
+            get_instance_mask(carried_label.instance_id, carried_label.class_id).add_mask(carried_label.smask);
+        }
+    }
+    sync_bbox_items();
+    std::cout << "carried over " << carried_bboxes.size() << " boxes and " << carried_masks.size() << " masks" << std::endl;
+    annotations_modified = true;
     this->update();
 }
 
+void FrameViewer::set_proposals(std::vector<PixelLabelMB>&& proposals)
+{
+    proposed_masks = std::move(proposals);
+    std::cout << proposed_masks.size() << " proposed masks, control + A to accept them" << std::endl;
+    this->update();
+}
+
+void FrameViewer::set_bbox_proposals(std::vector<BoundingBoxMD>&& proposals)
+{
+    proposed_bboxes = std::move(proposals);
+    std::cout << proposed_bboxes.size() << " proposed boxes, control + A to accept them" << std::endl;
+    this->update();
+}
+
+void FrameViewer::accept_proposals()
+{
+    if (proposed_masks.empty() && proposed_bboxes.empty()) {
+        return;
+    }
+    if (!proposed_masks.empty()) {
+        push_mask_undo();
+        for (const auto& proposal : proposed_masks) {
+            get_instance_mask(proposal.instance_id, proposal.class_id).add_mask(proposal.smask);
+        }
+        proposed_masks.clear();
+    }
+    if (!proposed_bboxes.empty()) {
+        //each box is a fish of its own, numbered on from the frame's boxes
+        int next_id = 0;
+        for (const auto& bbox_md : boundingbox_locations) {
+            next_id = std::max(next_id, bbox_md.instance_id + 1);
+        }
+        auto& frame_bboxes = boundingbox_locations.edit();
+        for (auto& proposal : proposed_bboxes) {
+            proposal.instance_id = next_id++;
+            frame_bboxes.push_back(proposal);
+        }
+        proposed_bboxes.clear();
+        //NOTE: undo takes the accepted boxes back off one at a time, same as the drawn ones
+        sync_bbox_items();
+    }
+    annotations_modified = true;
+    this->update();
+}
+
+void FrameViewer::upgrade_frame(const FrameBuffer& full_frame)
+{
+    if (full_frame.size() != full_frame_size) {
+        std::cout << "full resolution frame doesn't match the preview's frame size, ignoring it" << std::endl;
+        return;
+    }
+    current_frame = full_frame;
+    frame_pixmap = QPixmap::fromImage(current_frame.as_qimage());
+    this->update();
+}
+
+void FrameViewer::replace_frame(const FrameBuffer& frame)
+{
+    //NOTE: the frame comes from the reader, so it's a preview again if the full resolution frame was showing
+    const bool wanted_fullres = fullres_requested;
+    current_frame = frame;
+    frame_pixmap = QPixmap::fromImage(current_frame.as_qimage());
+    if (is_preview()) {
+        fullres_requested = false;
+        if (wanted_fullres) {
+            ensure_full_resolution();
+        }
+    }
+    this->update();
+}
+
+void FrameViewer::ensure_full_resolution()
+{
+    if (is_preview() && !fullres_requested && fullres_loader) {
+        fullres_requested = true;
+        fullres_loader();
+    }
+}
+
 void FrameViewer::drawBackground(QPainter* painter, const QRectF&  rect)
 {
-    this->addPixmap(QPixmap::fromImage(current_frame));
+    //a preview gets stretched over the full resolution frame, so the annotations line up either way
+    const QRectF frame_rect (0, 0, full_frame_size.width(), full_frame_size.height());
+    //only the part that needs repainting, e.g. around a box that's being dragged
+    const QRectF exposed_rect = rect.intersected(frame_rect);
+    if (exposed_rect.isEmpty()) {
+        return;
+    }
+    const double scale_x = frame_pixmap.width() / frame_rect.width();
+    const double scale_y = frame_pixmap.height() / frame_rect.height();
+    const QRectF source_rect (exposed_rect.x() * scale_x, exposed_rect.y() * scale_y, exposed_rect.width() * scale_x, exposed_rect.height() * scale_y);
+    painter->setRenderHint(QPainter::SmoothPixmapTransform, is_preview());
+    painter->drawPixmap(exposed_rect, frame_pixmap, source_rect);
 }
 
 void FrameViewer::drawForeground(QPainter* painter, const QRectF& rect)
@@ -85,62 +252,265 @@ void FrameViewer::drawForeground(QPainter* painter, const QRectF& rect)
     pen.setWidth(annotation_brushsz);
 
     if (mode == ANNOTATION_MODE::SEGMENTATION) {
-        for (int i = 0; i < annotation_locations.size(); i++) {
-            auto smask_inst = annotation_locations[i].smask;
-            //adjust pen color per instance ID
-            pen.setBrush(utils::get_qt_color(annotation_locations[i].instance_id));
-            painter->setPen(pen);   
-            for (auto npt_loc : smask_inst) {
-                painter->drawPoint(npt_loc.x(),npt_loc.y());
-                std::cout << "drawing pt " << npt_loc.x() << ", " << npt_loc.y() << std::endl;
+        //only the rows that need repainting, a span at a time
+        const int first_row = static_cast<int>(std::floor(rect.top()));
+        const int last_row = static_cast<int>(std::ceil(rect.bottom()));
+        for (const auto& segm_label : annotation_locations) {
+            const QColor instance_color = utils::get_qt_color(segm_label.instance_id);
+            const auto& mask_rows = segm_label.smask.get_rows();
+            for (auto row_it = mask_rows.lower_bound(first_row); row_it != mask_rows.end() && row_it->first <= last_row; row_it++) {
+                for (const auto& span : row_it->second) {
+                    painter->fillRect(span.x_begin, row_it->first, span.x_end - span.x_begin, 1, instance_color);
+                }
             }
         }
 
-        pen.setBrush(Qt::lightGray);
-        painter->setPen(pen);   
-        //draw the current mask annotation as well
-        for (auto npt_loc : current_mask) {
-            painter->drawPoint(npt_loc.x(),npt_loc.y());
-            std::cout << "drawing pt " << npt_loc.x() << ", " << npt_loc.y() << std::endl;
+        //proposals are see-through, s.t. they're easy to tell apart from the actual labels
+        for (const auto& proposal : proposed_masks) {
+            QColor proposal_color (utils::get_qt_color(proposal.instance_id));
+            proposal_color.setAlpha(96);
+            const auto& mask_rows = proposal.smask.get_rows();
+            for (auto row_it = mask_rows.lower_bound(first_row); row_it != mask_rows.end() && row_it->first <= last_row; row_it++) {
+                for (const auto& span : row_it->second) {
+                    painter->fillRect(span.x_begin, row_it->first, span.x_end - span.x_begin, 1, proposal_color);
+                }
+            }
         }
-    } else {
-        for (auto bbox_md : boundingbox_locations) {
-            //adjust pen color based on instance ID
-            pen.setBrush(utils::get_qt_color(bbox_md.instance_id));
-            painter->setPen(pen);   
-            painter->drawRect(bbox_md.bbox);
+
+        //the polygon that's being clicked together, with the edge that follows the mouse
+        if (!polygon_vertices.empty()) {
+            pen.setWidth(1);
+            pen.setBrush(Qt::lightGray);
+            painter->setPen(pen);
+            for (size_t vidx = 1; vidx < polygon_vertices.size(); vidx++) {
+                painter->drawLine(polygon_vertices[vidx-1], polygon_vertices[vidx]);
+            }
+            painter->drawLine(polygon_vertices.back(), polygon_cursor);
+        }
+    }
+    //NOTE: the boxes (and the one being dragged out) are scene items, see sync_bbox_items. The proposals aren't,
+    //there's only ever a handful of them and they're gone as soon as the user moves on
+    if (mode == ANNOTATION_MODE::BOUNDINGBOX && !proposed_bboxes.empty()) {
+        pen.setColor(Qt::yellow);
+        pen.setStyle(Qt::DashLine);
+        painter->setPen(pen);
+        painter->setBrush(Qt::NoBrush);
+        for (const auto& proposal : proposed_bboxes) {
+            const QRectF proposal_rect = QRectF(proposal.bbox).normalized();
+            if (proposal_rect.intersects(rect)) {
+                painter->drawRect(proposal_rect);
+            }
+        }
+    }
+}
+
+void FrameViewer::sync_bbox_items()
+{
+    //NOTE: only the items that actually change get touched, each change repaints the item's old and new area
+    while (bbox_items.size() > boundingbox_locations.size()) {
+        //deleting it takes it out of the scene
+        delete bbox_items.back();
+        bbox_items.pop_back();
+    }
+    const bool show_bboxes = mode == ANNOTATION_MODE::BOUNDINGBOX;
+    for (size_t bidx = 0; bidx < boundingbox_locations.size(); bidx++) {
+        const auto& bbox_md = boundingbox_locations[bidx];
+        //pen color based on instance ID
+        QPen bbox_pen (utils::get_qt_color(bbox_md.instance_id));
+        bbox_pen.setWidth(annotation_brushsz);
+        const QRectF bbox_rect = QRectF(bbox_md.bbox).normalized();
+        if (bidx == bbox_items.size()) {
+            bbox_items.push_back(addRect(bbox_rect, bbox_pen));
+            bbox_items.back()->setAcceptedMouseButtons(Qt::NoButton);
+        } else {
+            if (bbox_items[bidx]->rect() != bbox_rect) {
+                bbox_items[bidx]->setRect(bbox_rect);
+            }
+            if (bbox_items[bidx]->pen() != bbox_pen) {
+                bbox_items[bidx]->setPen(bbox_pen);
+            }
+        }
+        bbox_items[bidx]->setVisible(show_bboxes);
+    }
+}
+
+void FrameViewer::set_instance_id(const int id)
+{
+    if (id < 0 || id > LabelDepth<LabelT>::MAX_LABEL) {
+        std::cout << "instance ID " << id << " doesn't fit into the label masks (at most " << LabelDepth<LabelT>::MAX_LABEL << ")" << std::endl;
+        return;
+    }
+    current_id = id;
+    //touching up an instance shouldn't relabel it with whatever class was last typed in
+    for (const auto& segm_label : annotation_locations) {
+        if (segm_label.instance_id == id) {
+            current_class_id = segm_label.class_id;
+            break;
         }
+    }
+    this->update();
+}
+
+void FrameViewer::set_class_id(const int id)
+{
+    if (id < 0 || id > LabelDepth<LabelT>::MAX_LABEL) {
+        std::cout << "class ID " << id << " doesn't fit into the label masks (at most " << LabelDepth<LabelT>::MAX_LABEL << ")" << std::endl;
+        return;
+    }
+    current_class_id = id;
+    for (size_t midx = 0; midx < annotation_locations.size(); midx++) {
+        if (annotation_locations[midx].instance_id == current_id) {
+            if (annotation_locations[midx].class_id != id) {
+                push_mask_undo();
+                annotation_locations.edit()[midx].class_id = id;
+                annotations_modified = true;
+                std::cout << "instance " << current_id << " is now class " << id << std::endl;
+            }
+            break;
+        }
+    }
+}
+
+SpanMask& FrameViewer::get_instance_mask(const int id, const int class_id)
+{
+    //NOTE: the other instances' masks stay shared, only the one that gets edited is copied
+    auto& frame_masks = annotation_locations.edit();
+    for (auto& segm_label : frame_masks) {
+        if (segm_label.instance_id == id) {
+            return segm_label.smask;
+        }
+    }
+    frame_masks.emplace_back(SpanMask(), id, class_id);
+    return frame_masks.back().smask;
+}
+
+void FrameViewer::push_mask_undo()
+{
+    undo_masks.push_back(annotation_locations);
+    if (undo_masks.size() > MAX_UNDO_STEPS) {
+        undo_masks.erase(undo_masks.begin());
+    }
+    redo_masks.clear();
+}
 
-        pen.setBrush(Qt::lightGray);
-        painter->setPen(pen);   
-        //draw the current_bbox only if it is currently being drawn (and thus not in the boundingbox_locations vector)
-        if (drawing_annotations) {
-            painter->drawRect(current_bbox);
+void FrameViewer::close_polygon(const bool fill)
+{
+    if (polygon_vertices.size() < 3) {
+        std::cout << "a polygon needs at least 3 vertices" << std::endl;
+        polygon_vertices.clear();
+        this->update();
+        return;
+    }
+
+    push_mask_undo();
+    SpanMask& instance_mask = get_instance_mask(current_id, current_class_id);
+    if (fill) {
+        instance_mask.add_polygon(polygon_vertices);
+    } else {
+        //just the outline, as a brush stroke around it
+        const int brush_radius = annotation_brushsz / 2;
+        for (size_t vidx = 0; vidx < polygon_vertices.size(); vidx++) {
+            instance_mask.add_line(polygon_vertices[vidx], polygon_vertices[(vidx+1) % polygon_vertices.size()], brush_radius);
         }
     }
+    instance_mask.clip(get_frame_rect());
+    std::cout << (fill ? "filled" : "traced") << " a polygon with " << polygon_vertices.size() << " vertices for instance " << current_id << std::endl;
+
+    polygon_vertices.clear();
+    annotations_modified = true;
+    this->update();
 }
 
 void FrameViewer::mouseMoveEvent(QGraphicsSceneMouseEvent* mevt)
 {
-    if (drawing_annotations) {
+    if (drawing_segmentation_box) {
+        current_bbox.setBottomRight(QPoint(mevt->scenePos().x(), mevt->scenePos().y()));
+        drag_item->setRect(QRectF(current_bbox).normalized());
+    } else if (mode == ANNOTATION_MODE::SEGMENTATION && !polygon_vertices.empty()) {
+        polygon_cursor = to_pixel(mevt->scenePos());
+        this->update();
+    } else if (drawing_annotations) {
         if (mode == ANNOTATION_MODE::SEGMENTATION) {
-            //NOTE: could also use e.g. mevt->scenePos().x(), mevt->scenePos().y()
-            QPoint spt {static_cast<int>(std::round(mevt->scenePos().x())), static_cast<int>(std::round(mevt->scenePos().y()))};
-            current_mask.emplace_back(spt);
-            std::cout << "mpos: " << mevt->scenePos().x() << ", " << mevt->scenePos().y() << std::endl;
+            const QPoint spt = to_pixel(mevt->scenePos());
+            const int brush_radius = annotation_brushsz / 2;
+            if (segm_tool == SEGMENTATION_TOOL::ERASER) {
+                for (auto& segm_label : annotation_locations.edit()) {
+                    segm_label.smask.erase_line(stroke_point, spt, brush_radius);
+                }
+            } else {
+                get_instance_mask(current_id, current_class_id).add_line(stroke_point, spt, brush_radius);
+            }
+            stroke_point = spt;
+            this->update();
         } else {
+            //just the box item, the scene repaints where it was and where it is now
             current_bbox.setBottomRight(QPoint(mevt->scenePos().x(), mevt->scenePos().y()));
+            drag_item->setRect(QRectF(current_bbox).normalized());
         }
-        this->update();
     }
 }
 
 void FrameViewer::mousePressEvent(QGraphicsSceneMouseEvent* mevt)
 {
+    //the user's starting to annotate, so they'll want to see the details
+    ensure_full_resolution();
+
+    //shift + drag in segmentation mode --> box for grabcut to segment
+    if (mode == ANNOTATION_MODE::SEGMENTATION && segmenter && (mevt->modifiers() & Qt::ShiftModifier)) {
+        static const QSize default_bbox_sz {0, 0};
+        current_bbox = QRect(QPoint(mevt->scenePos().x(), mevt->scenePos().y()), default_bbox_sz);
+        drawing_segmentation_box = true;
+        QPen drag_pen (Qt::lightGray);
+        drag_pen.setWidth(1);
+        drag_item->setPen(drag_pen);
+        drag_item->setRect(QRectF(current_bbox));
+        drag_item->setVisible(true);
+        return;
+    }
+
     if (mode == ANNOTATION_MODE::SEGMENTATION) {
-        QPoint spt {static_cast<int>(std::round(mevt->scenePos().x())), static_cast<int>(std::round(mevt->scenePos().y()))};
-        current_mask.emplace_back(spt);
+        const QPoint spt = to_pixel(mevt->scenePos());
         std::cout << "mpos click: " << mevt->scenePos().x() << ", " << mevt->scenePos().y() << std::endl;
+        if (segm_tool == SEGMENTATION_TOOL::POLYGON) {
+            //clicking (back) on the first vertex closes the polygon
+            if (polygon_vertices.size() >= 3 && (spt - polygon_vertices.front()).manhattanLength() <= POLYGON_SNAP_DIST) {
+                close_polygon(true);
+            } else {
+                polygon_vertices.push_back(spt);
+                polygon_cursor = spt;
+                this->update();
+            }
+            return;
+        }
+
+        if (segm_tool == SEGMENTATION_TOOL::FLOOD_FILL) {
+            //everything that's labelled already (any instance) is a wall for the fill
+            SpanMask labelled_pixels;
+            for (const auto& segm_label : annotation_locations) {
+                labelled_pixels.add_mask(segm_label.smask);
+            }
+            SpanMask filled_pixels = SpanMask::flood_fill(labelled_pixels, spt, get_frame_rect());
+            if (!filled_pixels.empty()) {
+                push_mask_undo();
+                get_instance_mask(current_id, current_class_id).add_mask(filled_pixels);
+                annotations_modified = true;
+                std::cout << "flood filled " << filled_pixels.area() << " pixels for instance " << current_id << std::endl;
+            }
+            this->update();
+            return;
+        }
+
+        //brush / eraser --> the rest of the stroke follows the mouse
+        push_mask_undo();
+        const int brush_radius = annotation_brushsz / 2;
+        if (segm_tool == SEGMENTATION_TOOL::ERASER) {
+            for (auto& segm_label : annotation_locations.edit()) {
+                segm_label.smask.erase_disc(spt, brush_radius);
+            }
+        } else {
+            get_instance_mask(current_id, current_class_id).add_disc(spt, brush_radius);
+        }
+        stroke_point = spt;
     } else {
 
         auto mdata_item = itemAt(mevt->pos(), QTransform());
@@ -151,6 +521,13 @@ void FrameViewer::mousePressEvent(QGraphicsSceneMouseEvent* mevt)
         }
         static const QSize default_bbox_sz {0, 0};
         current_bbox = QRect(QPoint(mevt->scenePos().x(), mevt->scenePos().y()), default_bbox_sz);
+        QPen drag_pen (Qt::lightGray);
+        drag_pen.setWidth(annotation_brushsz);
+        drag_item->setPen(drag_pen);
+        drag_item->setRect(QRectF(current_bbox));
+        drag_item->setVisible(true);
+        drawing_annotations = true;
+        return;
     }
 
     drawing_annotations = true;
@@ -159,38 +536,72 @@ void FrameViewer::mousePressEvent(QGraphicsSceneMouseEvent* mevt)
 
 void FrameViewer::mouseReleaseEvent(QGraphicsSceneMouseEvent* mevt)
 {
+    if (drawing_segmentation_box) {
+        current_bbox.setBottomRight(QPoint(mevt->scenePos().x(), mevt->scenePos().y()));
+        drawing_segmentation_box = false;
+        drag_item->setVisible(false);
+        //the mask gets added to the instance once grabcut is done with it
+        //grabcut needs to work in full resolution coordinates, even if the full frame isn't in yet
+        const int segm_class_id = current_class_id;
+        segmenter->request(current_frame, full_frame_size, current_bbox, current_id, [this, segm_class_id](PixelLabelMB&& segm_mask) {
+            push_mask_undo();
+            get_instance_mask(segm_mask.instance_id, segm_class_id).add_mask(segm_mask.smask);
+            annotations_modified = true;
+            this->update();
+        });
+        return;
+    }
+    if (!drawing_annotations) {
+        return;
+    }
+
     if (mode == ANNOTATION_MODE::SEGMENTATION) {
-        QPoint spt {static_cast<int>(std::round(mevt->scenePos().x())), static_cast<int>(std::round(mevt->scenePos().y()))};
-        current_mask.emplace_back(spt);
         std::cout << "mpos rel: " << mevt->scenePos().x() << ", " << mevt->scenePos().y() << std::endl;
+        //the brush can reach past the frame's edges
+        for (auto& segm_label : annotation_locations.edit()) {
+            segm_label.smask.clip(get_frame_rect());
+        }
+        this->update();
     } else {
         current_bbox.setBottomRight(QPoint(mevt->scenePos().x(), mevt->scenePos().y()));
-        boundingbox_locations.emplace_back(current_bbox, current_id);
+        boundingbox_locations.edit().emplace_back(current_bbox, current_id);
+        drag_item->setVisible(false);
+        sync_bbox_items();
     }
+    annotations_modified = true;
     drawing_annotations = false;
-    this->update();
 }
 
 void FrameViewer::undo_label()
 {
     if (mode == ANNOTATION_MODE::SEGMENTATION) {
-        utils::point_un_redo(current_mask, limbo_points);
-        //TODO: do we need to propogate this to the annotation_locations as well?
+        if (!undo_masks.empty()) {
+            redo_masks.push_back(std::move(annotation_locations));
+            annotation_locations = std::move(undo_masks.back());
+            undo_masks.pop_back();
+        }
+        this->update();
     } else {
-        utils::point_un_redo(boundingbox_locations, limbo_bboxes);
+        utils::point_un_redo(boundingbox_locations.edit(), limbo_bboxes);
+        sync_bbox_items();
     }
-    this->update();
+    annotations_modified = true;
 }
 
 void FrameViewer::redo_label()
 {
     if (mode == ANNOTATION_MODE::SEGMENTATION) {
-        utils::point_un_redo(limbo_points, current_mask);
-        //TODO: do we need to propogate this to the annotation_locations as well?
+        if (!redo_masks.empty()) {
+            undo_masks.push_back(std::move(annotation_locations));
+            annotation_locations = std::move(redo_masks.back());
+            redo_masks.pop_back();
+        }
+        this->update();
     } else {
-        utils::point_un_redo(limbo_bboxes, boundingbox_locations);
+        utils::point_un_redo(limbo_bboxes, boundingbox_locations.edit());
+        sync_bbox_items();
     }
-    this->update();
+    annotations_modified = true;
 }
 
 void FrameViewer::keyPressEvent(QKeyEvent *evt)
@@ -212,10 +623,51 @@ void FrameViewer::keyPressEvent(QKeyEvent *evt)
             case Qt::Key_S:
                 std::cout << "SEGMENTATION key" << std::endl;
                 mode = ANNOTATION_MODE::SEGMENTATION;
+                segm_tool = SEGMENTATION_TOOL::BRUSH;
+                break;
+            case Qt::Key_G:
+                std::cout << "POLYGON key" << std::endl;
+                mode = ANNOTATION_MODE::SEGMENTATION;
+                segm_tool = SEGMENTATION_TOOL::POLYGON;
+                break;
+            case Qt::Key_F:
+                std::cout << "FLOOD_FILL key" << std::endl;
+                mode = ANNOTATION_MODE::SEGMENTATION;
+                segm_tool = SEGMENTATION_TOOL::FLOOD_FILL;
+                break;
+            case Qt::Key_E:
+                std::cout << "ERASER key" << std::endl;
+                mode = ANNOTATION_MODE::SEGMENTATION;
+                segm_tool = SEGMENTATION_TOOL::ERASER;
+                break;
+            case Qt::Key_V:
+                std::cout << "CARRY_OVER key" << std::endl;
+                carry_over_labels();
+                break;
+            case Qt::Key_A:
+                std::cout << "ACCEPT_PROPOSALS key" << std::endl;
+                accept_proposals();
                 break;
             default:
                 std::cout << "key: " << evt->key() << std::endl;
         }
+        //any other tool drops the half-finished polygon
+        if (segm_tool != SEGMENTATION_TOOL::POLYGON || mode != ANNOTATION_MODE::SEGMENTATION) {
+            polygon_vertices.clear();
+        }
+        //the boxes only show in bounding box mode
+        sync_bbox_items();
+        this->update();
+    } else if (!polygon_vertices.empty() && (evt->key() == Qt::Key_Return || evt->key() == Qt::Key_Enter)) {
+        //enter fills the polygon, shift + enter just traces its outline
+        close_polygon(!(evt->modifiers() & Qt::ShiftModifier));
+    } else if (!polygon_vertices.empty() && evt->key() == Qt::Key_Escape) {
+        polygon_vertices.clear();
+        this->update();
+    } else if ((!proposed_masks.empty() || !proposed_bboxes.empty()) && evt->key() == Qt::Key_Escape) {
+        proposed_masks.clear();
+        proposed_bboxes.clear();
+        this->update();
     } else {
         QGraphicsScene::keyPressEvent(evt);
     }
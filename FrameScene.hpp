@@ -5,34 +5,72 @@
 #include <QObject>
 #include <QGraphicsScene>
 #include <QGraphicsTextItem>
+#include <QGraphicsRectItem>
 #include <QGraphicsSceneMouseEvent>
 #include <QRect>
 #include <QPoint>
+#include <QPixmap>
+
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <functional>
+#include <vector>
 
 #include "AnnotationTypes.hpp"
+#include "FrameBuffer.hpp"
+#include "GrabCutSegmenter.hpp"
+#include "LabelBuffer.hpp"
 
 class FrameViewer : public QGraphicsScene
 {
 public:
-    using PixelT = uint8_t;
-    FrameViewer(const QImage& initial_frame, QObject *parent = 0);
+    //what the masks get saved as, which bounds the instance and class IDs
+    using LabelT = LabelPixel;
+    FrameViewer(const FrameBuffer& initial_frame, QObject *parent = 0);
+
+    //NOTE: the frame can be a reduced resolution preview of a full_size frame (an invalid size means it's
+    //already at full resolution). The scene is always in full resolution coordinates either way
+    void display_frame(const FrameBuffer& frame, const QSize& full_size = QSize());
+
+    //swap the preview for the full resolution frame, keeping the frame's annotations
+    void upgrade_frame(const FrameBuffer& full_frame);
+
+    //show different pixels for the same frame (i.e. with / without the enhancement), keeping the frame's annotations
+    void replace_frame(const FrameBuffer& frame);
+
+    //ask for the full resolution frame (once per frame) if we're only showing a preview
+    void ensure_full_resolution();
+
+    //how to get the full resolution frame when it's needed -- this should be asynchronous, and hand the frame
+    //back through upgrade_frame
+    void set_fullres_loader(std::function<void()> loader) {
+        fullres_loader = std::move(loader);
+    }
 
-    void display_frame(const QImage& frame);
+    bool is_preview() const {
+        return current_frame.size() != full_frame_size;
+    }
 
     QSize get_size_hint() const {
-        QSize sz{current_frame.width(), current_frame.height()};
-        return sz; 
+        return full_frame_size; 
     }
 
-    void set_instance_id(const int id) { 
-        //move the existinig 'current' mask annotation over into the full set for the frame
-        annotation_locations.emplace_back(std::move(current_mask), current_id);
-        current_id = id;
-        this->update();
+    //NOTE: masks are edited in place, so there's nothing to hand over to the new instance. An instance the frame
+    //already has a mask for brings its class along, see get_class_id
+    void set_instance_id(const int id);
+
+    //assigns the class to the current instance (if the frame has a mask for it), and it's the class new instances
+    //get (0 for none). NOTE: editing an instance's mask doesn't change its class, only this does
+    void set_class_id(const int id);
+
+    int get_class_id() const {
+        return current_class_id;
     }
 
     void set_brushsz(int brushsz) {
         annotation_brushsz = brushsz;
+        sync_bbox_items();
         this->update();
     }
 
@@ -40,27 +78,45 @@ public:
         return annotation_brushsz;
     }
 
+    //enables the grabcut-assisted segmentation (shift + drag a box in segmentation mode)
+    void set_worker_pool(WorkerPool* pool) {
+        segmenter = std::make_unique<GrabCutSegmenter>(*pool, this);
+    }
+
     int get_frame_width() const {
-        return current_frame.width(); 
+        return full_frame_size.width(); 
     }
 
     int get_frame_height() const {
-        return current_frame.height(); 
+        return full_frame_size.height(); 
     }
 
-    std::vector<BoundingBoxMD> get_bounding_boxes() const {
+    //NOTE: these share the labels with the viewer, s.t. nothing gets copied unless one side modifies them later
+    SharedList<BoundingBoxMD> get_bounding_boxes() const {
         return boundingbox_locations;
     }
 
-    std::vector<PixelLabelMB> get_frame_annotations() const {
+    SharedList<PixelLabelMB> get_frame_annotations() const {
         return annotation_locations;
     }
     
-    void set_metadata(FrameAnnotations&& metadata) {
-        boundingbox_locations.insert(boundingbox_locations.end(), metadata.bboxes.begin(), metadata.bboxes.end());
-        annotation_locations.insert(annotation_locations.end(), metadata.segm_points.begin(), metadata.segm_points.end());
+    //true if the user's changed the frame's annotations since it was displayed (loading the saved ones doesn't count)
+    bool is_modified() const {
+        return annotations_modified;
     }
 
+    void set_metadata(FrameAnnotations&& metadata);
+
+    //copy the labels of the last frame that had any onto this one (on top of whatever it has already)
+    void carry_over_labels();
+
+    //masks the user can take on as the frame's labels (e.g. propagated from a neighbouring frame), shown until
+    //they're accepted or the frame changes
+    void set_proposals(std::vector<PixelLabelMB>&& proposals);
+    //same, for boxes. NOTE: the boxes get their instance IDs when they're accepted, after the frame's existing ones
+    void set_bbox_proposals(std::vector<BoundingBoxMD>&& proposals);
+    void accept_proposals();
+
 protected slots:
     void drawBackground(QPainter* painter, const QRectF &rect) override;
     void drawForeground(QPainter* painter, const QRectF &rect) override;
@@ -73,24 +129,72 @@ private:
     void undo_label();
     void redo_label();
 
-    //hold the current frame to be / being displayed
-    QImage current_frame;
+    //the instance's mask, added to the frame (with the class) if the instance doesn't have one yet. NOTE: an
+    //existing instance keeps its class, an instance is all one class
+    SpanMask& get_instance_mask(const int id, const int class_id);
+    //bring the box items in line with boundingbox_locations (and the mode / brush size)
+    void sync_bbox_items();
+    //snapshot the masks before an edit, s.t. it can be undone
+    void push_mask_undo();
+    //fill (or just trace) the polygon the user's clicked together
+    void close_polygon(const bool fill);
+    QPoint to_pixel(const QPointF& scene_pos) const {
+        return QPoint(static_cast<int>(std::round(scene_pos.x())), static_cast<int>(std::round(scene_pos.y())));
+    }
+    QRect get_frame_rect() const {
+        return QRect(QPoint(0, 0), full_frame_size);
+    }
+
+    //the frame's masks are copy-on-write, so undo / redo just keep whole snapshots of them
+    static constexpr int MAX_UNDO_STEPS = 50;
+    //clicking within this many pixels of the polygon's first vertex closes it
+    static constexpr int POLYGON_SNAP_DIST = 8;
 
-    //the (float) coords of the mouse position as the user draws things
-    //in segmentation mode
-    std::vector<PixelLabelMB> annotation_locations;
-    std::vector<QPoint> limbo_points;
-    std::vector<QPoint> current_mask;
+    //hold the current frame to be / being displayed
+    FrameBuffer current_frame;
+    //converted once per frame, rather than on every repaint
+    QPixmap frame_pixmap;
+    QSize full_frame_size;
+    std::function<void()> fullres_loader;
+    bool fullres_requested;
+
+    //one mask per instance in segmentation mode
+    SharedList<PixelLabelMB> annotation_locations;
+    std::vector<SharedList<PixelLabelMB>> undo_masks;
+    std::vector<SharedList<PixelLabelMB>> redo_masks;
+    SEGMENTATION_TOOL segm_tool;
+    //the last point of the brush / eraser stroke being drawn
+    QPoint stroke_point;
+    //the polygon being clicked together, and where the mouse is for its next edge
+    std::vector<QPoint> polygon_vertices;
+    QPoint polygon_cursor;
 
     //the bounding box coordinates when the user is drawing in bounding box mode
-    std::vector<BoundingBoxMD> boundingbox_locations;
+    SharedList<BoundingBoxMD> boundingbox_locations;
     std::vector<BoundingBoxMD> limbo_bboxes;
     QRect current_bbox;
+    //the boxes as scene items, one per box in boundingbox_locations. The scene owns them and indexes them, s.t.
+    //changing one only repaints where it was and where it is now (instead of the whole frame and every box)
+    std::vector<QGraphicsRectItem*> bbox_items;
+    //the box being dragged out, either for a label or for grabcut
+    QGraphicsRectItem* drag_item;
+
+    SharedList<PixelLabelMB> proposed_masks;
+    std::vector<BoundingBoxMD> proposed_bboxes;
+
+    //the labels of the last frame that had any, for carry_over_labels (shared, so keeping them around is free)
+    SharedList<BoundingBoxMD> carried_bboxes;
+    SharedList<PixelLabelMB> carried_masks;
 
     QGraphicsTextItem cursor;
     int annotation_brushsz;
     bool drawing_annotations;
+    bool annotations_modified;
+    //drawing a box to be segmented by grabcut while in segmentation mode
+    bool drawing_segmentation_box;
+    std::unique_ptr<GrabCutSegmenter> segmenter;
     int current_id;
+    int current_class_id;
 
     ANNOTATION_MODE mode;
 };
@@ -1,6 +1,7 @@
 #include "FrameViewer.hpp"
 
 #include <iostream>
+#include <algorithm>
 
 void FrameView::wheelEvent(QWheelEvent *evt)
 {
@@ -16,8 +17,28 @@ void FrameView::wheelEvent(QWheelEvent *evt)
         }
         std::cout << "zooming " << (zfactor > 1.f ? "IN ":"OUT ") << "by " << zfactor << std::endl;
         scale(zfactor, zfactor);
+        //zoomed past the preview's resolution --> time to get the full resolution frame
+        if (zfactor > 1.f) {
+            fviewer->ensure_full_resolution();
+        }
         setTransformationAnchor(prev_anchor);
     } else {
         QGraphicsView::wheelEvent(evt);
     }
 }
+
+int FrameView::pick_decode_scale(const QSize& frame_size) const
+{
+    const QSize view_sz = viewport()->size();
+    if (!frame_size.isValid() || view_sz.isEmpty()) {
+        return 1;
+    }
+    //the frame gets fit into the view, so that's how many pixels are actually on screen
+    const double view_ratio = std::min(static_cast<double>(frame_size.width()) / view_sz.width(), 
+                                       static_cast<double>(frame_size.height()) / view_sz.height());
+    int decode_scale = 1;
+    while (decode_scale < 8 && 2*decode_scale <= view_ratio) {
+        decode_scale *= 2;
+    }
+    return decode_scale;
+}
@@ -24,12 +24,22 @@ public:
         return fviewer->get_size_hint(); 
     }
 
-    void update_frame(const QImage& frame) {
+    //NOTE: full_size is the frame's full resolution size when the frame is a reduced resolution preview
+    void update_frame(const FrameBuffer& frame, const QSize& full_size = QSize()) {
         //re-set any viewing transformations
         resetMatrix();
-        fviewer->display_frame(frame);
+        fviewer->display_frame(frame, full_size);
+        //a frame that doesn't fit gets scaled down to fit the view
+        const QSize view_sz = viewport()->size();
+        const QSize frame_sz = fviewer->get_size_hint();
+        if (frame_sz.width() > view_sz.width() || frame_sz.height() > view_sz.height()) {
+            fitInView(fviewer->sceneRect(), Qt::KeepAspectRatio);
+        }
     }
 
+    //the coarsest decode scale (1, 2, 4 or 8) that still has at least as many pixels as the view shows of a frame_size frame
+    int pick_decode_scale(const QSize& frame_size) const;
+
     FrameAnnotations get_frame_annotations() const {
         auto bboxes = fviewer->get_bounding_boxes();   
         auto segmpts = fviewer->get_frame_annotations();   
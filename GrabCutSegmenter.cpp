@@ -0,0 +1,132 @@
+#include "GrabCutSegmenter.hpp"
+
+#include <algorithm>
+#include <iostream>
+
+#include <QMetaObject>
+#include <QPointer>
+#include <opencv2/opencv.hpp>
+
+constexpr int GrabCutSegmenter::MAX_COARSE_DIM;
+constexpr int GrabCutSegmenter::NUM_COARSE_ITERATIONS;
+constexpr int GrabCutSegmenter::NUM_REFINE_ITERATIONS;
+
+void GrabCutSegmenter::request(const FrameBuffer& frame, const QSize& full_size, const QRect& region, const int instance_id, ResultCallback on_result)
+{
+    const int request_generation = ++(*generation);
+    auto request_gen_counter = generation;
+    QPointer<QObject> result_receiver (receiver);
+
+    //NOTE: the frame's pixels are shared, so capturing it by value doesn't copy the frame
+    workers.submit([frame, full_size, region, instance_id, request_gen_counter, request_generation, result_receiver, on_result]{
+        PixelLabelMB segm_mask;
+        bool finished = false;
+        try {
+            finished = segment(frame, full_size, region, instance_id, *request_gen_counter, request_generation, segm_mask);
+        } catch (const cv::Exception& err) {
+            std::cout << "grabcut segmentation failed: " << err.what() << std::endl;
+        }
+        if (!finished || !result_receiver) {
+            return;
+        }
+
+        auto shared_mask = std::make_shared<PixelLabelMB>(std::move(segm_mask));
+        QMetaObject::invokeMethod(result_receiver.data(), [shared_mask, request_gen_counter, request_generation, on_result]{
+            //a newer request could have come in while this one was queued up
+            if (*request_gen_counter == request_generation) {
+                on_result(std::move(*shared_mask));
+            }
+        }, Qt::QueuedConnection);
+    }, 1);
+}
+
+bool GrabCutSegmenter::segment(const FrameBuffer& frame, const QSize& full_size, const QRect& region, const int instance_id,
+        const std::atomic<int>& generation, const int request_generation, PixelLabelMB& segm_mask)
+{
+    auto is_cancelled = [&generation, request_generation]{
+        return generation != request_generation;
+    };
+
+    //grabcut wants 3 channels (but doesn't care about the channel order here)
+    cv::Mat frame_mat = frame.as_mat();
+    if (frame_mat.channels() != 3) {
+        cv::Mat rgb_frame;
+        cv::cvtColor(frame_mat, rgb_frame, (frame_mat.channels() == 1) ? cv::COLOR_GRAY2RGB : cv::COLOR_BGRA2RGB);
+        frame_mat = rgb_frame;
+    }
+    //a preview frame gets blown back up, s.t. the mask comes out in full resolution coordinates
+    if (frame_mat.cols != full_size.width() || frame_mat.rows != full_size.height()) {
+        cv::Mat full_frame;
+        cv::resize(frame_mat, full_frame, cv::Size(full_size.width(), full_size.height()), 0, 0, cv::INTER_LINEAR);
+        frame_mat = full_frame;
+    }
+
+    //the box needs some background around it to build the background model from
+    const cv::Rect frame_rect (0, 0, frame_mat.cols, frame_mat.rows);
+    const QRect fg_region = region.normalized();
+    const cv::Rect fg_rect = cv::Rect(fg_region.x(), fg_region.y(), fg_region.width(), fg_region.height()) & frame_rect;
+    if (fg_rect.width < 2 || fg_rect.height < 2) {
+        return false;
+    }
+    const int margin = std::max(8, std::max(fg_rect.width, fg_rect.height) / 4);
+    const cv::Rect crop_rect = cv::Rect(fg_rect.x - margin, fg_rect.y - margin, fg_rect.width + 2*margin, fg_rect.height + 2*margin) & frame_rect;
+    cv::Mat crop = frame_mat(crop_rect);
+    const cv::Rect crop_fg_rect (fg_rect.x - crop_rect.x, fg_rect.y - crop_rect.y, fg_rect.width, fg_rect.height);
+
+    //coarse pass on the downscaled crop
+    const double scale = std::min(1.0, static_cast<double>(MAX_COARSE_DIM) / std::max(crop.cols, crop.rows));
+    cv::Mat segm_labels, bgd_model, fgd_model;
+    if (scale < 1.0) {
+        cv::Mat small_crop;
+        cv::resize(crop, small_crop, cv::Size(), scale, scale, cv::INTER_AREA);
+        cv::Rect small_fg_rect (cvRound(crop_fg_rect.x * scale), cvRound(crop_fg_rect.y * scale),
+                std::max(1, cvRound(crop_fg_rect.width * scale)), std::max(1, cvRound(crop_fg_rect.height * scale)));
+        small_fg_rect &= cv::Rect(0, 0, small_crop.cols, small_crop.rows);
+
+        cv::Mat small_labels;
+        cv::grabCut(small_crop, small_labels, small_fg_rect, bgd_model, fgd_model, NUM_COARSE_ITERATIONS, cv::GC_INIT_WITH_RECT);
+        if (is_cancelled()) {
+            return false;
+        }
+        //grabCut can't build a foreground model from nothing for the refinement
+        cv::Mat small_fg = (small_labels == cv::GC_FGD) | (small_labels == cv::GC_PR_FGD);
+        if (cv::countNonZero(small_fg) == 0) {
+            std::cout << "grabcut didn't find any foreground in the box" << std::endl;
+            return false;
+        }
+
+        //... then refine at full resolution, starting from the upscaled coarse labels
+        cv::resize(small_labels, segm_labels, crop.size(), 0, 0, cv::INTER_NEAREST);
+        //nothing outside of the user's box can be foreground
+        cv::Mat outside_fg (crop.size(), CV_8UC1, cv::Scalar(1));
+        outside_fg(crop_fg_rect).setTo(0);
+        segm_labels.setTo(cv::GC_BGD, outside_fg);
+        cv::grabCut(crop, segm_labels, cv::Rect(), bgd_model, fgd_model, NUM_REFINE_ITERATIONS, cv::GC_INIT_WITH_MASK);
+    } else {
+        //small enough to just do it all at full resolution
+        cv::grabCut(crop, segm_labels, crop_fg_rect, bgd_model, fgd_model, NUM_COARSE_ITERATIONS, cv::GC_INIT_WITH_RECT);
+    }
+    if (is_cancelled()) {
+        return false;
+    }
+
+    //anything that's (probably) foreground goes into the mask, in frame coordinates
+    segm_mask.instance_id = instance_id;
+    for (int row = 0; row < segm_labels.rows; row++) {
+        const uint8_t* label_row = segm_labels.ptr<uint8_t>(row);
+        int col = 0;
+        while (col < segm_labels.cols) {
+            if (label_row[col] != cv::GC_FGD && label_row[col] != cv::GC_PR_FGD) {
+                col++;
+                continue;
+            }
+            const int run_begin = col;
+            while (col < segm_labels.cols && (label_row[col] == cv::GC_FGD || label_row[col] == cv::GC_PR_FGD)) {
+                col++;
+            }
+            segm_mask.smask.add_span(row + crop_rect.y, run_begin + crop_rect.x, col + crop_rect.x);
+        }
+    }
+    std::cout << "grabcut segmented " << segm_mask.smask.area() << " pixels for instance " << instance_id << std::endl;
+    return true;
+}
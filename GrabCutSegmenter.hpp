@@ -0,0 +1,56 @@
+#ifndef FISHLABELER_GRABCUTSEGMENTER_HPP
+#define FISHLABELER_GRABCUTSEGMENTER_HPP
+
+#include <atomic>
+#include <memory>
+#include <functional>
+
+#include <QObject>
+#include <QSize>
+#include <QRect>
+
+#include "AnnotationTypes.hpp"
+#include "FrameBuffer.hpp"
+#include "WorkerPool.hpp"
+
+/* Turns a box drawn around a fish into a segmentation mask with OpenCV's grabCut. The segmentation runs on the
+ * worker pool -- first on a downscaled crop around the box, then a refinement pass at full resolution -- and the
+ * result gets handed back on the receiver's (i.e. the GUI) thread.
+ *
+ * Only the latest request counts: starting a new one (or cancelling) makes any request still in flight stop at
+ * its next checkpoint, and its result gets dropped.
+ */
+class GrabCutSegmenter
+{
+public:
+    using ResultCallback = std::function<void(PixelLabelMB&&)>;
+
+    GrabCutSegmenter(WorkerPool& pool, QObject* result_receiver)
+        : workers(pool), receiver(result_receiver), generation(std::make_shared<std::atomic<int>>(0))
+    {}
+
+    //NOTE: on_result gets run on the receiver's thread, and only if the request is still the latest one by then.
+    //The region is in full_size coordinates, which can be bigger than the frame if the frame's just a preview
+    void request(const FrameBuffer& frame, const QSize& full_size, const QRect& region, const int instance_id, ResultCallback on_result);
+
+    void cancel() {
+        (*generation)++;
+    }
+
+private:
+    //returns false if the segmentation got cancelled part way through
+    static bool segment(const FrameBuffer& frame, const QSize& full_size, const QRect& region, const int instance_id,
+            const std::atomic<int>& generation, const int request_generation, PixelLabelMB& segm_mask);
+
+    WorkerPool& workers;
+    QObject* receiver;
+    //shared with the jobs, which can outlive the segmenter
+    std::shared_ptr<std::atomic<int>> generation;
+
+    //the longest side of the crop for the initial (downscaled) segmentation
+    static constexpr int MAX_COARSE_DIM = 256;
+    static constexpr int NUM_COARSE_ITERATIONS = 4;
+    static constexpr int NUM_REFINE_ITERATIONS = 1;
+};
+
+#endif
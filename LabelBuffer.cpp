@@ -0,0 +1,109 @@
+#include "LabelBuffer.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+constexpr int LabelDepth<uint8_t>::CV_TYPE;
+constexpr int LabelDepth<uint8_t>::MAX_LABEL;
+constexpr int LabelDepth<uint16_t>::CV_TYPE;
+constexpr int LabelDepth<uint16_t>::MAX_LABEL;
+
+template <typename PixelT>
+LabelBuffer<PixelT>::LabelBuffer(const int height, const int width)
+    : labels(cv::Mat::zeros(height, width, LabelDepth<PixelT>::CV_TYPE))
+{}
+
+template <typename PixelT>
+LabelBuffer<PixelT> LabelBuffer<PixelT>::read(const std::string& label_fpath)
+{
+    //NOTE: unchanged, s.t. 16-bit masks don't get scaled down to 8 bits
+    cv::Mat label_image = cv::imread(label_fpath, cv::IMREAD_UNCHANGED);
+    if (label_image.empty()) {
+        std::string err_msg {"ERROR: couldn't read label mask " + label_fpath};
+        throw std::runtime_error(err_msg);
+    }
+    if (label_image.channels() != 1) {
+        std::string err_msg {"ERROR: label mask " + label_fpath + " has " + std::to_string(label_image.channels()) + " channels"};
+        throw std::runtime_error(err_msg);
+    }
+    try {
+        return from_mat(label_image);
+    } catch (const std::runtime_error& err) {
+        std::string err_msg {err.what() + std::string(" in ") + label_fpath};
+        throw std::runtime_error(err_msg);
+    }
+}
+
+template <typename PixelT>
+LabelBuffer<PixelT> LabelBuffer<PixelT>::from_mat(const cv::Mat& label_image)
+{
+    if (label_image.type() == LabelDepth<PixelT>::CV_TYPE) {
+        return LabelBuffer(label_image);
+    }
+    double max_label = 0;
+    cv::minMaxLoc(label_image, nullptr, &max_label);
+    if (max_label > LabelDepth<PixelT>::MAX_LABEL) {
+        std::string err_msg {"ERROR: label " + std::to_string(static_cast<int64_t>(max_label)) + " doesn't fit into " +
+            std::to_string(8 * sizeof(PixelT)) + "-bit labels (see FISHLABELER_LABEL_BITS)"};
+        throw std::runtime_error(err_msg);
+    }
+    cv::Mat converted_labels;
+    label_image.convertTo(converted_labels, LabelDepth<PixelT>::CV_TYPE);
+    return LabelBuffer(converted_labels);
+}
+
+template <typename PixelT>
+void LabelBuffer<PixelT>::write(const std::string& label_fpath) const
+{
+    if (!cv::imwrite(label_fpath, labels)) {
+        std::string err_msg {"ERROR: couldn't write label mask " + label_fpath};
+        throw std::runtime_error(err_msg);
+    }
+}
+
+template <typename PixelT>
+void LabelBuffer<PixelT>::paint(const SpanMask& mask, const int label)
+{
+    if (label < 0 || label > LabelDepth<PixelT>::MAX_LABEL) {
+        std::string err_msg {"ERROR: label " + std::to_string(label) + " doesn't fit into " + std::to_string(8 * sizeof(PixelT)) +
+            "-bit labels (see FISHLABELER_LABEL_BITS)"};
+        throw std::runtime_error(err_msg);
+    }
+    const auto& mask_rows = mask.get_rows();
+    for (auto row_it = mask_rows.lower_bound(0); row_it != mask_rows.end() && row_it->first < labels.rows; row_it++) {
+        PixelT* label_row = labels.ptr<PixelT>(row_it->first);
+        for (const auto& span : row_it->second) {
+            const int clipped_begin = std::max(span.x_begin, 0);
+            const int clipped_end = std::min(span.x_end, labels.cols);
+            if (clipped_begin < clipped_end) {
+                //NOTE: a memset for 8-bit labels
+                std::fill(label_row + clipped_begin, label_row + clipped_end, static_cast<PixelT>(label));
+            }
+        }
+    }
+}
+
+template <typename PixelT>
+std::map<int, SpanMask> LabelBuffer<PixelT>::split(const QPoint& offset) const
+{
+    std::map<int, SpanMask> label_masks;
+    for (int row = 0; row < labels.rows; row++) {
+        const PixelT* label_row = labels.ptr<PixelT>(row);
+        int col = 0;
+        while (col < labels.cols) {
+            const PixelT label = label_row[col];
+            const int run_begin = col;
+            while (col < labels.cols && label_row[col] == label) {
+                col++;
+            }
+            if (label != 0) {
+                //NOTE: the runs come in order, so this is always an append
+                label_masks[label].add_span(row + offset.y(), run_begin + offset.x(), col + offset.x());
+            }
+        }
+    }
+    return label_masks;
+}
+
+template class LabelBuffer<uint8_t>;
+template class LabelBuffer<uint16_t>;
@@ -0,0 +1,86 @@
+#ifndef FISHLABELER_LABELBUFFER_HPP
+#define FISHLABELER_LABELBUFFER_HPP
+
+#include <cstdint>
+#include <map>
+#include <string>
+
+#include <QPoint>
+#include <opencv2/opencv.hpp>
+
+#include "SpanMask.hpp"
+
+//the OpenCV type and the largest label of each label depth
+template <typename PixelT>
+struct LabelDepth;
+
+template <>
+struct LabelDepth<uint8_t> {
+    static constexpr int CV_TYPE = CV_8UC1;
+    static constexpr int MAX_LABEL = 255;
+};
+
+template <>
+struct LabelDepth<uint16_t> {
+    static constexpr int CV_TYPE = CV_16UC1;
+    static constexpr int MAX_LABEL = 65535;
+};
+
+//the label depth the masks get written with, see FISHLABELER_LABEL_BITS in the CMakeLists
+#if defined(FISHLABELER_LABEL_BITS) && FISHLABELER_LABEL_BITS == 8
+using LabelPixel = uint8_t;
+#else
+using LabelPixel = uint16_t;
+#endif
+
+/* A label image, i.e. one label (instance or class ID) per pixel and 0 for unlabelled, as it gets written to and
+ * read from disk. The depth is fixed at compile time, s.t. painting and splitting are straight loops over the
+ * pixels with no per-pixel type dispatch.
+ *
+ * Reading converts from whichever depth the file was written with -- 8-bit masks read into 16-bit buffers as-is,
+ * and 16-bit masks read into 8-bit buffers as long as they don't have any labels above 255.
+ */
+template <typename PixelT>
+class LabelBuffer
+{
+public:
+    LabelBuffer(const int height, const int width);
+
+    //reads the PNG, throws if it can't be read (or has labels that don't fit)
+    static LabelBuffer read(const std::string& label_fpath);
+    //throws if it can't be written
+    void write(const std::string& label_fpath) const;
+
+    //label the mask's pixels, clipped to the buffer. Throws if the label doesn't fit
+    void paint(const SpanMask& mask, const int label);
+
+    //one mask per (non-zero) label. The offset is where the buffer's top left corner is, for a buffer that's just
+    //a region of the frame
+    std::map<int, SpanMask> split(const QPoint& offset = QPoint(0, 0)) const;
+
+    //0 outside of the buffer
+    int at(const int x, const int y) const {
+        if (x < 0 || y < 0 || x >= labels.cols || y >= labels.rows) {
+            return 0;
+        }
+        return labels.ptr<PixelT>(y)[x];
+    }
+
+    //NOTE: shares the pixels
+    const cv::Mat& get_mat() const {
+        return labels;
+    }
+    static LabelBuffer from_mat(const cv::Mat& label_image);
+
+private:
+    explicit LabelBuffer(cv::Mat label_image)
+        : labels(std::move(label_image))
+    {}
+
+    cv::Mat labels;
+};
+
+//the frames' label masks
+using FrameLabelBuffer = LabelBuffer<LabelPixel>;
+
+#endif
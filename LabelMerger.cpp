@@ -0,0 +1,163 @@
+#include "LabelMerger.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+#include <boost/version.hpp>
+
+constexpr double LabelMerger::DUPLICATE_IOU;
+
+namespace {
+    double bbox_iou(const QRect& lhs, const QRect& rhs)
+    {
+        const QRect lhs_box = lhs.normalized();
+        const QRect rhs_box = rhs.normalized();
+        const QRect intersection = lhs_box.intersected(rhs_box);
+        if (intersection.isEmpty()) {
+            return 0;
+        }
+        const double intersection_area = static_cast<double>(intersection.width()) * intersection.height();
+        const double union_area = static_cast<double>(lhs_box.width()) * lhs_box.height() +
+            static_cast<double>(rhs_box.width()) * rhs_box.height() - intersection_area;
+        return union_area > 0 ? intersection_area / union_area : 0;
+    }
+
+    std::string read_file(const boost::filesystem::path& fpath)
+    {
+        std::ifstream fin(fpath.string(), std::ios::binary);
+        std::ostringstream file_buffer;
+        file_buffer << fin.rdbuf();
+        return file_buffer.str();
+    }
+
+    void overwrite_file(const boost::filesystem::path& from_fpath, const boost::filesystem::path& to_fpath)
+    {
+#if BOOST_VERSION >= 107400
+        boost::filesystem::copy_file(from_fpath, to_fpath, boost::filesystem::copy_options::overwrite_existing);
+#else
+        boost::filesystem::copy_file(from_fpath, to_fpath, boost::filesystem::copy_option::overwrite_if_exists);
+#endif
+    }
+
+    //the class mask only makes sense with the instance mask it was written with, so it goes along with it (or goes
+    //away, if the source doesn't have one)
+    void copy_class_mask(const boost::filesystem::path& source_fpath, const boost::filesystem::path& target_fpath)
+    {
+        if (boost::filesystem::exists(source_fpath)) {
+            boost::filesystem::create_directories(target_fpath.parent_path());
+            overwrite_file(source_fpath, target_fpath);
+        } else {
+            boost::system::error_code ec;
+            boost::filesystem::remove(target_fpath, ec);
+        }
+    }
+}
+
+MergeStats LabelMerger::merge(const std::string& source_dir, const bool prefer_source_masks)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    if (!boost::filesystem::is_directory(source_dir)) {
+        std::string err_msg {"ERROR: label directory " + source_dir + " doesn't exist"};
+        throw std::runtime_error(err_msg);
+    }
+    if (boost::filesystem::equivalent(source_dir, vlogger.get_logdir())) {
+        std::string err_msg {"ERROR: can't merge " + source_dir + " into itself"};
+        throw std::runtime_error(err_msg);
+    }
+    const VideoLogger source_logger (source_dir);
+
+    //every frame the source has any labels for
+    std::vector<std::string> frame_names;
+    for (const auto& label_frames : {source_logger.list_boundingbox_frames(), source_logger.list_annotated_frames(), source_logger.list_textmetadata_frames()}) {
+        std::vector<std::string> merged_names;
+        std::set_union(frame_names.begin(), frame_names.end(), label_frames.begin(), label_frames.end(), std::back_inserter(merged_names));
+        frame_names = std::move(merged_names);
+    }
+
+    const int num_frames = frame_names.size();
+    std::vector<MergeStats> frame_stats (num_frames);
+    workers.parallel_for(0, num_frames, [&](const int fidx) {
+        frame_stats[fidx] = merge_frame(source_logger, frame_names[fidx], prefer_source_masks);
+    });
+
+    MergeStats stats;
+    for (const auto& frame_stat : frame_stats) {
+        stats += frame_stat;
+    }
+    auto merge_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+    std::cout << "Merged " << stats.num_frames << " frames from " << source_dir << " in " << merge_time.count() << " ms: "
+              << stats.num_bboxes_added << " boxes added (" << stats.num_duplicate_bboxes << " duplicates), " << stats.num_masks_copied
+              << " masks copied (" << stats.num_mask_conflicts << " conflicts), " << stats.num_texts_merged << " texts merged" << std::endl;
+    return stats;
+}
+
+MergeStats LabelMerger::merge_frame(const VideoLogger& source_logger, const std::string& frame_name, const bool prefer_source_masks) const
+{
+    MergeStats stats;
+    stats.num_frames = 1;
+
+    std::vector<BoundingBoxMD> source_bboxes, target_bboxes;
+    try {
+        source_bboxes = source_logger.get_boundingboxes(frame_name);
+        target_bboxes = vlogger.get_boundingboxes(frame_name);
+    } catch (const std::runtime_error& err) {
+        //NOTE: leave malformed files alone rather than appending onto them, LabelValidator reports them
+        std::cout << "skipping the boxes of frame " << frame_name << ": " << err.what() << std::endl;
+        source_bboxes.clear();
+    }
+    std::vector<BoundingBoxMD> new_bboxes;
+    for (auto& source_bbox : source_bboxes) {
+        const bool duplicate = std::any_of(target_bboxes.begin(), target_bboxes.end(), [&source_bbox](const BoundingBoxMD& target_bbox) {
+            return target_bbox.instance_id == source_bbox.instance_id && bbox_iou(target_bbox.bbox, source_bbox.bbox) >= DUPLICATE_IOU;
+        });
+        if (duplicate) {
+            stats.num_duplicate_bboxes++;
+        } else {
+            new_bboxes.push_back(std::move(source_bbox));
+        }
+    }
+    if (!new_bboxes.empty()) {
+        stats.num_bboxes_added = new_bboxes.size();
+        vlogger.append_bboxes(frame_name, std::move(new_bboxes));
+    }
+
+    const auto source_mask_fpath = source_logger.get_annotation_filepath(frame_name);
+    if (boost::filesystem::exists(source_mask_fpath)) {
+        const auto target_mask_fpath = vlogger.get_annotation_filepath(frame_name);
+        const auto source_class_fpath = source_logger.get_class_filepath(frame_name);
+        const auto target_class_fpath = vlogger.get_class_filepath(frame_name);
+        if (!boost::filesystem::exists(target_mask_fpath)) {
+            boost::filesystem::copy_file(source_mask_fpath, target_mask_fpath);
+            copy_class_mask(source_class_fpath, target_class_fpath);
+            stats.num_masks_copied++;
+        } else if (read_file(source_mask_fpath) != read_file(target_mask_fpath) ||
+                read_file(source_class_fpath) != read_file(target_class_fpath)) {
+            stats.num_mask_conflicts++;
+            std::cout << "frame " << frame_name << " has different masks on both sides, keeping the " << (prefer_source_masks ? "source's" : "target's") << std::endl;
+            if (prefer_source_masks) {
+                overwrite_file(source_mask_fpath, target_mask_fpath);
+                copy_class_mask(source_class_fpath, target_class_fpath);
+                stats.num_masks_copied++;
+            }
+        }
+    }
+
+    auto source_text = source_logger.get_textmetadata(frame_name);
+    if (!source_text.empty()) {
+        auto target_text = vlogger.get_textmetadata(frame_name);
+        if (target_text.find(source_text) == std::string::npos) {
+            if (!target_text.empty() && target_text.back() != '\n') {
+                target_text += '\n';
+            }
+            target_text += source_text;
+            vlogger.write_textmetadata(frame_name, std::move(target_text));
+            stats.num_texts_merged++;
+        }
+    }
+    return stats;
+}
@@ -0,0 +1,63 @@
+#ifndef FISHLABELER_LABELMERGER_HPP
+#define FISHLABELER_LABELMERGER_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "VideoLogger.hpp"
+#include "WorkerPool.hpp"
+
+struct MergeStats {
+    MergeStats()
+        : num_frames(0), num_bboxes_added(0), num_duplicate_bboxes(0), num_masks_copied(0), num_mask_conflicts(0), num_texts_merged(0)
+    {}
+
+    MergeStats& operator+=(const MergeStats& other) {
+        num_frames += other.num_frames;
+        num_bboxes_added += other.num_bboxes_added;
+        num_duplicate_bboxes += other.num_duplicate_bboxes;
+        num_masks_copied += other.num_masks_copied;
+        num_mask_conflicts += other.num_mask_conflicts;
+        num_texts_merged += other.num_texts_merged;
+        return *this;
+    }
+
+    int64_t num_frames;
+    int64_t num_bboxes_added;
+    //boxes the target already had (same instance, overlapping by at least DUPLICATE_IOU)
+    int64_t num_duplicate_bboxes;
+    int64_t num_masks_copied;
+    //frames where both sides have different masks, which can't be combined automatically
+    int64_t num_mask_conflicts;
+    int64_t num_texts_merged;
+};
+
+/* Folds another annotator's labels (e.g. a LeaseManager conflict directory, or a copy of the label directory
+ * someone worked on separately) into a video's labels:
+ *  - boxes get added, minus the ones that duplicate a box the frame already has
+ *  - a mask gets copied over if the frame doesn't have one. If both have (different) masks, the target's is kept
+ *    unless prefer_source_masks is set, and either way it gets counted as a conflict
+ *  - text gets appended, unless the target's text already contains it
+ * so merging the same source twice doesn't change anything the second time around. The frames get merged across
+ * the worker pool.
+ */
+class LabelMerger
+{
+public:
+    LabelMerger(VideoLogger& logger, WorkerPool& pool)
+        : vlogger(logger), workers(pool)
+    {}
+
+    MergeStats merge(const std::string& source_dir, const bool prefer_source_masks);
+
+    //boxes of the same instance that overlap at least this much are the same box
+    static constexpr double DUPLICATE_IOU = 0.5;
+
+private:
+    MergeStats merge_frame(const VideoLogger& source_logger, const std::string& frame_name, const bool prefer_source_masks) const;
+
+    VideoLogger& vlogger;
+    WorkerPool& workers;
+};
+
+#endif
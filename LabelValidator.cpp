@@ -0,0 +1,362 @@
+#include "LabelValidator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <unordered_set>
+
+#include <QImageReader>
+
+namespace {
+    //the label directories a file can be orphaned out of, and where it goes on repair
+    //NOTE: Classes is Annotations/Classes, but it gets its own orphan directory s.t. the class masks can't clash
+    //with the instance masks
+    const std::array<std::string, 4> LABEL_SUBDIRS {{"Annotations", "Classes", "Detections", "Metadata"}};
+    const std::string ORPHAN_DIRNAME {"Orphaned"};
+
+    std::string json_escape(const std::string& str)
+    {
+        std::string escaped_str;
+        escaped_str.reserve(str.size() + 2);
+        for (const char c : str) {
+            switch (c) {
+                case '"':
+                    escaped_str += "\\\"";
+                    break;
+                case '\\':
+                    escaped_str += "\\\\";
+                    break;
+                case '\n':
+                    escaped_str += "\\n";
+                    break;
+                case '\r':
+                    escaped_str += "\\r";
+                    break;
+                case '\t':
+                    escaped_str += "\\t";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        char code_str[8];
+                        std::snprintf(code_str, sizeof(code_str), "\\u%04x", c);
+                        escaped_str += code_str;
+                    } else {
+                        escaped_str += c;
+                    }
+            }
+        }
+        return escaped_str;
+    }
+
+    std::string describe_bbox(const BoundingBoxMD& bbox_md)
+    {
+        int tl_x, tl_y, br_x, br_y;
+        bbox_md.bbox.getCoords(&tl_x, &tl_y, &br_x, &br_y);
+        return "id " + std::to_string(bbox_md.instance_id) + ": (" + std::to_string(tl_x) + ", " + std::to_string(tl_y) + ") --> (" +
+            std::to_string(br_x) + ", " + std::to_string(br_y) + ")";
+    }
+
+    bool is_blank_file(const boost::filesystem::path& fpath)
+    {
+        std::ifstream fin(fpath.string());
+        char c;
+        while (fin.get(c)) {
+            if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    //removes whichever of the files exist, false (and says why) if any of them couldn't be removed
+    bool remove_label_files(const std::vector<boost::filesystem::path>& fpaths)
+    {
+        bool removed = true;
+        for (const auto& fpath : fpaths) {
+            boost::system::error_code ec;
+            boost::filesystem::remove(fpath, ec);
+            if (ec) {
+                std::cout << "couldn't remove " << fpath.string() << ": " << ec.message() << std::endl;
+                removed = false;
+            }
+        }
+        return removed;
+    }
+}
+
+const char* LabelValidator::issue_name(const LABEL_ISSUE kind)
+{
+    switch (kind) {
+        case LABEL_ISSUE::BBOX_MALFORMED:
+            return "bbox_malformed";
+        case LABEL_ISSUE::BBOX_INVERTED:
+            return "bbox_inverted";
+        case LABEL_ISSUE::BBOX_OUT_OF_BOUNDS:
+            return "bbox_out_of_bounds";
+        case LABEL_ISSUE::BBOX_FILE_EMPTY:
+            return "bbox_file_empty";
+        case LABEL_ISSUE::MASK_UNREADABLE:
+            return "mask_unreadable";
+        case LABEL_ISSUE::MASK_SIZE_MISMATCH:
+            return "mask_size_mismatch";
+        case LABEL_ISSUE::CLASS_MASK_WITHOUT_INSTANCES:
+            return "class_mask_without_instances";
+        case LABEL_ISSUE::TEXT_EMPTY:
+            return "text_empty";
+        case LABEL_ISSUE::ORPHANED_FILE:
+            return "orphaned_file";
+        default:
+            return "unknown";
+    }
+}
+
+int64_t ValidationReport::num_unrepaired() const
+{
+    return std::count_if(issues.begin(), issues.end(), [](const LabelIssue& issue) {
+        return !issue.repaired;
+    });
+}
+
+std::string ValidationReport::to_json(const std::string& label_dir) const
+{
+    std::ostringstream json_out;
+    json_out << "{\n  \"directory\": \"" << json_escape(label_dir) << "\",\n"
+             << "  \"num_frames\": " << num_frames << ",\n"
+             << "  \"num_label_files\": " << num_label_files << ",\n"
+             << "  \"elapsed_ms\": " << elapsed_ms << ",\n"
+             << "  \"num_issues\": " << issues.size() << ",\n"
+             << "  \"num_unrepaired\": " << num_unrepaired() << ",\n"
+             << "  \"counts\": {";
+    for (int kind = 0; kind < static_cast<int>(LABEL_ISSUE::NUM_ISSUES); kind++) {
+        json_out << (kind > 0 ? ", " : "") << "\"" << LabelValidator::issue_name(static_cast<LABEL_ISSUE>(kind)) << "\": " << issue_counts[kind];
+    }
+    json_out << "},\n  \"issues\": [";
+    for (size_t iidx = 0; iidx < issues.size(); iidx++) {
+        const auto& issue = issues[iidx];
+        json_out << (iidx > 0 ? "," : "") << "\n    {\"kind\": \"" << LabelValidator::issue_name(issue.kind) << "\", "
+                 << "\"frame\": \"" << json_escape(issue.frame_name) << "\", "
+                 << "\"file\": \"" << json_escape(issue.fpath) << "\", "
+                 << "\"detail\": \"" << json_escape(issue.detail) << "\", "
+                 << "\"repaired\": " << (issue.repaired ? "true" : "false") << "}";
+    }
+    json_out << (issues.empty() ? "" : "\n  ") << "]\n}\n";
+    return json_out.str();
+}
+
+ValidationReport LabelValidator::validate(const bool repair)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    ValidationReport report;
+
+    const int num_frames = vreader.get_num_frames();
+    std::unordered_set<std::string> video_frames;
+    video_frames.reserve(num_frames);
+    for (int fidx = 0; fidx < num_frames; fidx++) {
+        video_frames.insert(vreader.get_frame_name(fidx));
+    }
+    report.num_frames = num_frames;
+    //NOTE: every frame of a video is the same size
+    const QSize frame_size = (num_frames > 0) ? vreader.get_frame_size() : QSize();
+
+    //every frame with any kind of label
+    auto bbox_frames = vlogger.list_boundingbox_frames();
+    auto mask_frames = vlogger.list_annotated_frames();
+    auto text_frames = vlogger.list_textmetadata_frames();
+    auto class_frames = vlogger.list_class_frames();
+    report.num_label_files = bbox_frames.size() + mask_frames.size() + text_frames.size() + class_frames.size();
+    std::vector<std::string> label_frames;
+    label_frames.reserve(report.num_label_files);
+    label_frames.insert(label_frames.end(), bbox_frames.begin(), bbox_frames.end());
+    label_frames.insert(label_frames.end(), mask_frames.begin(), mask_frames.end());
+    label_frames.insert(label_frames.end(), text_frames.begin(), text_frames.end());
+    label_frames.insert(label_frames.end(), class_frames.begin(), class_frames.end());
+    std::sort(label_frames.begin(), label_frames.end());
+    label_frames.erase(std::unique(label_frames.begin(), label_frames.end()), label_frames.end());
+
+    if (repair) {
+        //NOTE: up front, s.t. the workers don't race to create them
+        for (const auto& label_subdir : LABEL_SUBDIRS) {
+            boost::filesystem::create_directories(vlogger.get_logdir() / ORPHAN_DIRNAME / label_subdir);
+        }
+    }
+
+    //each frame's issues go in their own slot, so the workers don't have to share anything
+    std::vector<std::vector<LabelIssue>> frame_issues (label_frames.size());
+    workers.parallel_for(0, static_cast<int>(label_frames.size()), [&](const int lidx) {
+        const auto& frame_name = label_frames[lidx];
+        auto& issues = frame_issues[lidx];
+        const bool has_bboxes = vlogger.has_boundingbox(frame_name);
+        const bool has_mask = vlogger.has_annotations(frame_name);
+        const bool has_text = vlogger.has_textmetadata(frame_name);
+        const auto class_fpath = vlogger.get_class_filepath(frame_name);
+        const bool has_classes = boost::filesystem::exists(class_fpath);
+
+        if (video_frames.find(frame_name) == video_frames.end()) {
+            std::vector<boost::filesystem::path> orphan_fpaths;
+            if (has_bboxes) {
+                orphan_fpaths.push_back(vlogger.get_text_boundingbox_filepath(frame_name));
+                orphan_fpaths.push_back(vlogger.get_binary_boundingbox_filepath(frame_name));
+            }
+            if (has_mask) {
+                orphan_fpaths.push_back(vlogger.get_annotation_filepath(frame_name));
+            }
+            if (has_classes) {
+                orphan_fpaths.push_back(class_fpath);
+            }
+            if (has_text) {
+                orphan_fpaths.push_back(vlogger.get_textmetadata_filepath(frame_name));
+            }
+            for (const auto& orphan_fpath : orphan_fpaths) {
+                if (boost::filesystem::exists(orphan_fpath)) {
+                    issues.emplace_back(LABEL_ISSUE::ORPHANED_FILE, frame_name, orphan_fpath.string(), "no frame named " + frame_name + " in the video");
+                    if (repair) {
+                        move_orphan(orphan_fpath, issues.back());
+                    }
+                }
+            }
+            return;
+        }
+
+        if (has_bboxes) {
+            check_bboxes(frame_name, frame_size, repair, issues);
+        }
+        //the classes are per instance, so without the instances there's nothing they can be read back onto
+        if (has_classes && !has_mask) {
+            issues.emplace_back(LABEL_ISSUE::CLASS_MASK_WITHOUT_INSTANCES, frame_name, class_fpath.string(), "class mask but no instance mask");
+            if (repair) {
+                move_orphan(class_fpath, issues.back());
+            }
+        }
+        if (has_mask) {
+            check_mask(frame_name, frame_size, issues);
+        }
+        if (has_text) {
+            check_text(frame_name, repair, issues);
+        }
+    });
+
+    for (auto& issues : frame_issues) {
+        for (auto& issue : issues) {
+            report.issue_counts[static_cast<int>(issue.kind)]++;
+            report.issues.emplace_back(std::move(issue));
+        }
+    }
+
+    report.elapsed_ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count();
+    std::cout << "Checked " << label_frames.size() << " labelled frames in " << report.elapsed_ms << " ms: " << report.issues.size()
+              << " issues, " << report.num_unrepaired() << " unrepaired" << std::endl;
+    return report;
+}
+
+void LabelValidator::check_bboxes(const std::string& frame_name, const QSize& frame_size, const bool repair, std::vector<LabelIssue>& issues)
+{
+    const std::string bbox_fpath = vlogger.get_boundingbox_filepath(frame_name).string();
+    std::vector<BoundingBoxMD> frame_bboxes;
+    try {
+        frame_bboxes = vlogger.get_boundingboxes(frame_name);
+    } catch (const std::runtime_error& err) {
+        issues.emplace_back(LABEL_ISSUE::BBOX_MALFORMED, frame_name, bbox_fpath, err.what());
+        return;
+    }
+
+    const auto text_fpath = vlogger.get_text_boundingbox_filepath(frame_name);
+    const auto binary_fpath = vlogger.get_binary_boundingbox_filepath(frame_name);
+    if (frame_bboxes.empty()) {
+        issues.emplace_back(LABEL_ISSUE::BBOX_FILE_EMPTY, frame_name, bbox_fpath, "no bounding boxes in the file");
+        if (repair) {
+            issues.back().repaired = remove_label_files({text_fpath, binary_fpath});
+        }
+        return;
+    }
+
+    const size_t first_issue = issues.size();
+    const QRect frame_rect (QPoint(0, 0), frame_size);
+    std::vector<BoundingBoxMD> repaired_bboxes;
+    repaired_bboxes.reserve(frame_bboxes.size());
+    for (const auto& bbox_md : frame_bboxes) {
+        QRect bbox = bbox_md.bbox;
+        if (bbox.width() < 0 || bbox.height() < 0) {
+            issues.emplace_back(LABEL_ISSUE::BBOX_INVERTED, frame_name, bbox_fpath, describe_bbox(bbox_md));
+            bbox = bbox.normalized();
+        }
+        if (frame_size.isValid() && !frame_rect.contains(bbox)) {
+            issues.emplace_back(LABEL_ISSUE::BBOX_OUT_OF_BOUNDS, frame_name, bbox_fpath, describe_bbox(bbox_md) + " in a " +
+                std::to_string(frame_size.width()) + "x" + std::to_string(frame_size.height()) + " frame");
+            bbox = bbox.intersected(frame_rect);
+        }
+        //a box that was entirely outside of the frame doesn't have anything left to it
+        if (!bbox.isEmpty()) {
+            repaired_bboxes.emplace_back(bbox, bbox_md.instance_id);
+        }
+    }
+
+    if (repair && issues.size() > first_issue) {
+        //re-write whichever format(s) the frame had, s.t. the repair doesn't also change the format
+        bool repaired = true;
+        if (repaired_bboxes.empty()) {
+            repaired = remove_label_files({text_fpath, binary_fpath});
+        } else {
+            if (boost::filesystem::exists(text_fpath)) {
+                VideoLogger::write_text_bboxes(text_fpath, repaired_bboxes);
+            }
+            if (boost::filesystem::exists(binary_fpath)) {
+                VideoLogger::write_binary_bboxes(binary_fpath, repaired_bboxes);
+            }
+        }
+        for (size_t iidx = first_issue; iidx < issues.size(); iidx++) {
+            issues[iidx].repaired = repaired;
+        }
+    }
+}
+
+void LabelValidator::check_mask(const std::string& frame_name, const QSize& frame_size, std::vector<LabelIssue>& issues)
+{
+    check_mask_file(frame_name, vlogger.get_annotation_filepath(frame_name).string(), frame_size, issues);
+    const auto class_fpath = vlogger.get_class_filepath(frame_name);
+    if (boost::filesystem::exists(class_fpath)) {
+        check_mask_file(frame_name, class_fpath.string(), frame_size, issues);
+    }
+}
+
+void LabelValidator::check_mask_file(const std::string& frame_name, const std::string& mask_fpath, const QSize& frame_size, std::vector<LabelIssue>& issues)
+{
+    //NOTE: only reads the header
+    QImageReader mask_reader (QString::fromStdString(mask_fpath));
+    const QSize mask_size = mask_reader.size();
+    if (!mask_size.isValid()) {
+        issues.emplace_back(LABEL_ISSUE::MASK_UNREADABLE, frame_name, mask_fpath, mask_reader.errorString().toStdString());
+    } else if (frame_size.isValid() && mask_size != frame_size) {
+        issues.emplace_back(LABEL_ISSUE::MASK_SIZE_MISMATCH, frame_name, mask_fpath, "mask is " + std::to_string(mask_size.width()) + "x" +
+            std::to_string(mask_size.height()) + ", frame is " + std::to_string(frame_size.width()) + "x" + std::to_string(frame_size.height()));
+    }
+}
+
+void LabelValidator::check_text(const std::string& frame_name, const bool repair, std::vector<LabelIssue>& issues)
+{
+    const auto text_fpath = vlogger.get_textmetadata_filepath(frame_name);
+    if (is_blank_file(text_fpath)) {
+        issues.emplace_back(LABEL_ISSUE::TEXT_EMPTY, frame_name, text_fpath.string(), "no text in the file");
+        if (repair) {
+            boost::system::error_code ec;
+            boost::filesystem::remove(text_fpath, ec);
+            issues.back().repaired = !ec;
+        }
+    }
+}
+
+void LabelValidator::move_orphan(const boost::filesystem::path& fpath, LabelIssue& issue)
+{
+    //Orphaned/<Annotations|Classes|Detections|Metadata>/<file>
+    auto orphan_fpath = vlogger.get_logdir() / ORPHAN_DIRNAME / fpath.parent_path().filename() / fpath.filename();
+    boost::system::error_code ec;
+    boost::filesystem::rename(fpath, orphan_fpath, ec);
+    if (ec) {
+        std::cout << "couldn't move " << fpath.string() << " to " << orphan_fpath.string() << ": " << ec.message() << std::endl;
+        return;
+    }
+    issue.repaired = true;
+    issue.detail += ", moved to " + orphan_fpath.string();
+}
@@ -0,0 +1,96 @@
+#ifndef FISHLABELER_LABELVALIDATOR_HPP
+#define FISHLABELER_LABELVALIDATOR_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <array>
+
+#include <QSize>
+#include <boost/filesystem.hpp>
+
+#include "VideoReader.hpp"
+#include "VideoLogger.hpp"
+#include "WorkerPool.hpp"
+
+enum class LABEL_ISSUE {
+    BBOX_MALFORMED = 0,
+    BBOX_INVERTED,
+    BBOX_OUT_OF_BOUNDS,
+    BBOX_FILE_EMPTY,
+    MASK_UNREADABLE,
+    MASK_SIZE_MISMATCH,
+    CLASS_MASK_WITHOUT_INSTANCES,
+    TEXT_EMPTY,
+    ORPHANED_FILE,
+    NUM_ISSUES
+};
+
+struct LabelIssue {
+    LabelIssue(const LABEL_ISSUE issue_kind, std::string name, std::string issue_fpath, std::string issue_detail)
+        : kind(issue_kind), frame_name(std::move(name)), fpath(std::move(issue_fpath)), detail(std::move(issue_detail)), repaired(false)
+    {}
+
+    LABEL_ISSUE kind;
+    std::string frame_name;
+    std::string fpath;
+    std::string detail;
+    bool repaired;
+};
+
+struct ValidationReport {
+    ValidationReport()
+        : num_frames(0), num_label_files(0), elapsed_ms(0)
+    {
+        issue_counts.fill(0);
+    }
+
+    int64_t num_frames;
+    int64_t num_label_files;
+    int64_t elapsed_ms;
+    std::array<int64_t, static_cast<int>(LABEL_ISSUE::NUM_ISSUES)> issue_counts;
+    std::vector<LabelIssue> issues;
+
+    int64_t num_unrepaired() const;
+    //the whole report as a JSON object
+    std::string to_json(const std::string& label_dir) const;
+};
+
+/* Checks a labelled frame directory for
+ *  - bounding box files that don't parse, have no boxes, or have inverted boxes or boxes outside of the frame
+ *  - masks (instance or class) that can't be read or aren't the size of the frame, and class masks without an
+ *    instance mask
+ *  - empty text metadata
+ *  - label files that don't belong to any of the video's frames
+ * with the frames spread across the worker pool. With repair on, it
+ *  - re-writes boxes normalized and clipped to the frame (dropping the ones that are entirely outside of it)
+ *  - removes empty text and bounding box files
+ *  - moves orphaned label files (and class masks without an instance mask) into <label dir>/Orphaned/ (rather than
+ *    deleting them)
+ * Malformed box files and bad masks need a human, so those only get reported.
+ */
+class LabelValidator
+{
+public:
+    LabelValidator(const VideoReader& reader, VideoLogger& logger, WorkerPool& pool)
+        : vreader(reader), vlogger(logger), workers(pool)
+    {}
+
+    ValidationReport validate(const bool repair);
+
+    static const char* issue_name(const LABEL_ISSUE kind);
+
+private:
+    void check_bboxes(const std::string& frame_name, const QSize& frame_size, const bool repair, std::vector<LabelIssue>& issues);
+    void check_mask(const std::string& frame_name, const QSize& frame_size, std::vector<LabelIssue>& issues);
+    //the header of one of the frame's masks, adding an issue if it's unreadable or the wrong size
+    void check_mask_file(const std::string& frame_name, const std::string& mask_fpath, const QSize& frame_size, std::vector<LabelIssue>& issues);
+    void check_text(const std::string& frame_name, const bool repair, std::vector<LabelIssue>& issues);
+    void move_orphan(const boost::filesystem::path& fpath, LabelIssue& issue);
+
+    const VideoReader& vreader;
+    VideoLogger& vlogger;
+    WorkerPool& workers;
+};
+
+#endif
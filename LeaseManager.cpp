@@ -0,0 +1,306 @@
+#include "LeaseManager.hpp"
+
+#include <cctype>
+#include <chrono>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+constexpr int LeaseManager::HEARTBEAT_INTERVAL_S;
+constexpr int LeaseManager::LEASE_TIMEOUT_S;
+
+namespace {
+    //a claim lock older than this was left behind by a session that died mid-claim
+    constexpr int STALE_CLAIM_LOCK_S = 30;
+    constexpr int CLAIM_LOCK_ATTEMPTS = 50;
+
+    std::string get_hostname()
+    {
+        char hostname[256] = {0};
+        if (gethostname(hostname, sizeof(hostname)-1) != 0) {
+            return "unknown";
+        }
+        return hostname;
+    }
+
+    //modification time and size of the file, 0 for both if it doesn't exist
+    void stat_label_file(const boost::filesystem::path& fpath, int64_t& mtime, int64_t& fsize)
+    {
+        boost::system::error_code ec;
+        auto file_mtime = boost::filesystem::last_write_time(fpath, ec);
+        if (ec) {
+            mtime = 0;
+            fsize = 0;
+            return;
+        }
+        auto file_sz = boost::filesystem::file_size(fpath, ec);
+        mtime = static_cast<int64_t>(file_mtime);
+        fsize = ec ? 0 : static_cast<int64_t>(file_sz);
+    }
+}
+
+LeaseManager::LeaseManager(const VideoLogger& logger, std::string annotator_name)
+    : vlogger(logger), annotator(sanitize_name(annotator_name)), lease_dir(logger.get_logdir() / "Leases"), has_lease(false)
+{
+    if (annotator.empty()) {
+        throw std::runtime_error("ERROR: leases need an annotator name");
+    }
+    boost::filesystem::create_directories(lease_dir);
+    own_lease.annotator = annotator;
+    own_lease.host = get_hostname();
+    own_lease.pid = getpid();
+}
+
+LeaseManager::~LeaseManager()
+{
+    release();
+}
+
+std::string LeaseManager::sanitize_name(const std::string& name)
+{
+    std::string clean_name = boost::algorithm::trim_copy(name);
+    for (auto& c : clean_name) {
+        if (!std::isalnum(static_cast<unsigned char>(c)) && c != '-' && c != '_') {
+            c = '_';
+        }
+    }
+    return clean_name;
+}
+
+bool LeaseManager::is_live(const FrameLease& lease)
+{
+    return std::time(nullptr) - lease.heartbeat <= LEASE_TIMEOUT_S;
+}
+
+std::vector<FrameLease> LeaseManager::read_leases(const boost::filesystem::path& lease_dir)
+{
+    std::vector<FrameLease> leases;
+    if (!boost::filesystem::is_directory(lease_dir)) {
+        return leases;
+    }
+    for (boost::filesystem::directory_iterator fit(lease_dir); fit != boost::filesystem::directory_iterator(); fit++) {
+        const auto& lease_fpath = fit->path();
+        if (lease_fpath.extension() != ".lease") {
+            continue;
+        }
+
+        std::ifstream lease_ifstream(lease_fpath.string());
+        std::string lease_line;
+        std::getline(lease_ifstream, lease_line);
+        std::vector<std::string> line_tokens;
+        boost::split(line_tokens, lease_line, boost::is_any_of(","));
+        for (auto& token : line_tokens) {
+            boost::algorithm::trim(token);
+        }
+
+        FrameLease lease;
+        boost::system::error_code ec;
+        lease.heartbeat = static_cast<int64_t>(boost::filesystem::last_write_time(lease_fpath, ec));
+        try {
+            if (line_tokens.size() != 5 || ec) {
+                throw boost::bad_lexical_cast();
+            }
+            lease.annotator = line_tokens[0];
+            lease.host = line_tokens[1];
+            lease.pid = boost::lexical_cast<int64_t>(line_tokens[2]);
+            lease.first_frame = boost::lexical_cast<int>(line_tokens[3]);
+            lease.last_frame = boost::lexical_cast<int>(line_tokens[4]);
+        } catch (const boost::bad_lexical_cast& err) {
+            //NOTE: could be a lease that's being written right now, it's a rename so that should be rare
+            std::cout << "skipping malformed lease file " << lease_fpath.string() << std::endl;
+            continue;
+        }
+        leases.push_back(std::move(lease));
+    }
+    return leases;
+}
+
+bool LeaseManager::claim(const int first_frame, const int last_frame)
+{
+    if (first_frame < 0 || last_frame < first_frame) {
+        std::string err_msg {"ERROR: invalid lease range " + std::to_string(first_frame) + " - " + std::to_string(last_frame)};
+        throw std::runtime_error(err_msg);
+    }
+    release();
+    if (!lock_claims()) {
+        std::cout << "ERROR: couldn't get the lease claim lock in " << lease_dir.string() << std::endl;
+        return false;
+    }
+    //NOTE: unlocks on every way out, also when writing the lease file throws
+    struct ClaimLockGuard {
+        const LeaseManager& manager;
+        ~ClaimLockGuard() { manager.unlock_claims(); }
+    } claim_lock {*this};
+
+    bool claimed = true;
+    other_leases.clear();
+    for (auto& lease : read_leases(lease_dir)) {
+        const bool live = is_live(lease);
+        if (lease.annotator == annotator) {
+            if (live && (lease.host != own_lease.host || lease.pid != own_lease.pid)) {
+                std::cout << "ERROR: annotator " << annotator << " already has a session running on " << lease.host << " (pid " << lease.pid << ")" << std::endl;
+                claimed = false;
+            }
+        } else if (!live) {
+            //tidy up after sessions that went away without releasing
+            boost::system::error_code ec;
+            boost::filesystem::remove(lease_dir / (lease.annotator + ".lease"), ec);
+            std::cout << "removed the expired lease of " << lease.annotator << " (frames " << lease.first_frame << " - " << lease.last_frame << ")" << std::endl;
+        } else {
+            if (lease.overlaps(first_frame, last_frame)) {
+                std::cout << "ERROR: frames " << lease.first_frame << " - " << lease.last_frame << " are leased by " << lease.annotator
+                          << " on " << lease.host << std::endl;
+                claimed = false;
+            }
+            other_leases.push_back(std::move(lease));
+        }
+    }
+
+    if (claimed) {
+        own_lease.first_frame = first_frame;
+        own_lease.last_frame = last_frame;
+        write_lease_file();
+        has_lease = true;
+        std::cout << "leased frames " << first_frame << " - " << last_frame << " for " << annotator << std::endl;
+    }
+    return claimed;
+}
+
+void LeaseManager::release()
+{
+    if (!has_lease) {
+        return;
+    }
+    boost::system::error_code ec;
+    boost::filesystem::remove(get_lease_filepath(), ec);
+    has_lease = false;
+}
+
+bool LeaseManager::heartbeat()
+{
+    other_leases.clear();
+    bool lease_lost = false;
+    for (auto& lease : read_leases(lease_dir)) {
+        if (lease.annotator == annotator || !is_live(lease)) {
+            continue;
+        }
+        //nobody can claim frames of a live lease, so ours must have lapsed for this to happen
+        if (has_lease && lease.overlaps(own_lease.first_frame, own_lease.last_frame)) {
+            std::cout << "ERROR: lost the lease on frames " << own_lease.first_frame << " - " << own_lease.last_frame << " to "
+                      << lease.annotator << " on " << lease.host << std::endl;
+            lease_lost = true;
+        }
+        other_leases.push_back(std::move(lease));
+    }
+
+    if (lease_lost) {
+        release();
+        return false;
+    }
+    if (has_lease) {
+        write_lease_file();
+    }
+    return true;
+}
+
+const FrameLease* LeaseManager::find_other_lease(const int frame_index) const
+{
+    for (const auto& lease : other_leases) {
+        if (lease.overlaps(frame_index, frame_index) && is_live(lease)) {
+            return &lease;
+        }
+    }
+    return nullptr;
+}
+
+void LeaseManager::snapshot_frame(const std::string& frame_name)
+{
+    frame_snapshots[frame_name] = stat_frame(frame_name);
+}
+
+bool LeaseManager::is_conflicted(const int frame_index, const std::string& frame_name, std::string& reason) const
+{
+    const FrameLease* other_lease = find_other_lease(frame_index);
+    if (other_lease) {
+        reason = "frame " + frame_name + " is leased by " + other_lease->annotator + " on " + other_lease->host;
+        return true;
+    }
+
+    auto snapshot_it = frame_snapshots.find(frame_name);
+    if (snapshot_it != frame_snapshots.end() && !(stat_frame(frame_name) == snapshot_it->second)) {
+        reason = "the labels of frame " + frame_name + " changed on disk since it was loaded";
+        return true;
+    }
+    return false;
+}
+
+boost::filesystem::path LeaseManager::get_conflict_dir() const
+{
+    auto conflict_dir = vlogger.get_logdir() / "Conflicts" / annotator;
+    boost::filesystem::create_directories(conflict_dir);
+    return conflict_dir;
+}
+
+LabelFileState LeaseManager::stat_frame(const std::string& frame_name) const
+{
+    LabelFileState file_state;
+    stat_label_file(vlogger.get_boundingbox_filepath(frame_name), file_state.bbox_mtime, file_state.bbox_size);
+    stat_label_file(vlogger.get_annotation_filepath(frame_name), file_state.mask_mtime, file_state.mask_size);
+    stat_label_file(vlogger.get_textmetadata_filepath(frame_name), file_state.text_mtime, file_state.text_size);
+    return file_state;
+}
+
+void LeaseManager::write_lease_file() const
+{
+    //NOTE: written to the side and renamed over, s.t. nobody reads half of a lease. The tmp file is written
+    //from scratch every time and the rename keeps its modification time, so the lease's mtime is the heartbeat
+    const auto lease_fpath = get_lease_filepath();
+    auto tmp_fpath = lease_fpath;
+    tmp_fpath += ".tmp";
+    {
+        std::ofstream lease_out(tmp_fpath.string());
+        lease_out << own_lease.annotator << ", " << own_lease.host << ", " << own_lease.pid << ", "
+                  << own_lease.first_frame << ", " << own_lease.last_frame << "\n";
+        if (!lease_out) {
+            std::string err_msg {"ERROR: couldn't write lease file " + tmp_fpath.string()};
+            throw std::runtime_error(err_msg);
+        }
+    }
+    boost::filesystem::rename(tmp_fpath, lease_fpath);
+}
+
+bool LeaseManager::lock_claims() const
+{
+    const auto lock_fpath = lease_dir / ".claim";
+    for (int attempt = 0; attempt < CLAIM_LOCK_ATTEMPTS; attempt++) {
+        //O_EXCL creation is atomic, even over NFS (v3 and up)
+        const int lock_fd = open(lock_fpath.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+        if (lock_fd >= 0) {
+            close(lock_fd);
+            return true;
+        }
+
+        boost::system::error_code ec;
+        const auto lock_mtime = boost::filesystem::last_write_time(lock_fpath, ec);
+        if (!ec && std::time(nullptr) - lock_mtime > STALE_CLAIM_LOCK_S) {
+            std::cout << "removing stale lease claim lock " << lock_fpath.string() << std::endl;
+            boost::filesystem::remove(lock_fpath, ec);
+            continue;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    return false;
+}
+
+void LeaseManager::unlock_claims() const
+{
+    boost::system::error_code ec;
+    boost::filesystem::remove(lease_dir / ".claim", ec);
+}
@@ -0,0 +1,143 @@
+#ifndef FISHLABELER_LEASEMANAGER_HPP
+#define FISHLABELER_LEASEMANAGER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#include <boost/filesystem.hpp>
+
+#include "VideoLogger.hpp"
+
+//a session's claim on [first_frame, last_frame] of a video
+struct FrameLease {
+    FrameLease()
+        : pid(0), first_frame(0), last_frame(-1), heartbeat(0)
+    {}
+
+    std::string annotator;
+    std::string host;
+    int64_t pid;
+    int first_frame;
+    int last_frame;
+    //the lease file's modification time (seconds since the epoch), bumped on every heartbeat
+    int64_t heartbeat;
+
+    bool overlaps(const int first, const int last) const {
+        return first_frame <= last && first <= last_frame;
+    }
+};
+
+//the state of a frame's label files (modification time and size of each, 0 if it doesn't exist)
+struct LabelFileState {
+    LabelFileState()
+        : bbox_mtime(0), bbox_size(0), mask_mtime(0), mask_size(0), text_mtime(0), text_size(0)
+    {}
+
+    bool operator==(const LabelFileState& other) const {
+        return bbox_mtime == other.bbox_mtime && bbox_size == other.bbox_size && mask_mtime == other.mask_mtime &&
+            mask_size == other.mask_size && text_mtime == other.text_mtime && text_size == other.text_size;
+    }
+
+    int64_t bbox_mtime;
+    int64_t bbox_size;
+    int64_t mask_mtime;
+    int64_t mask_size;
+    int64_t text_mtime;
+    int64_t text_size;
+};
+
+/* Coordinates several annotators labelling the same video off of a shared filesystem, without any server. Each
+ * session claims a range of frames with a lease file in <label dir>/Leases/<annotator>.lease, holding
+ *   <annotator>, <host>, <pid>, <first frame>, <last frame>
+ * and keeps it alive by re-writing it every HEARTBEAT_INTERVAL_S. A lease whose file hasn't been touched in
+ * LEASE_TIMEOUT_S is dead (the session crashed or lost the share), and its frames are up for grabs again. Claims
+ * are serialized through an exclusively created Leases/.claim lock file. NOTE: heartbeats are judged by the file
+ * server's modification times against the local clock, so the machines' clocks need to be roughly in sync.
+ *
+ * Writes get checked against both the leases and what was on disk when the frame was loaded: a frame in someone
+ * else's live lease, or whose label files changed since we loaded them, is a conflict. Conflicting labels get
+ * written into <label dir>/Conflicts/<annotator>/ (same layout as the label directory) instead of overwriting
+ * the other annotator's, for LabelMerger to fold back in.
+ */
+class LeaseManager
+{
+public:
+    LeaseManager(const VideoLogger& logger, std::string annotator_name);
+    //releases the lease
+    ~LeaseManager();
+
+    LeaseManager(const LeaseManager&) = delete;
+    LeaseManager& operator=(const LeaseManager&) = delete;
+
+    //claim [first_frame, last_frame], replacing whatever this session held before. Returns false (and holds
+    //nothing) if it overlaps someone else's live lease
+    bool claim(const int first_frame, const int last_frame);
+    void release();
+
+    //re-write the lease file and re-read everyone else's. Returns false if the lease got lost, i.e. it lapsed
+    //(e.g. the machine went to sleep) and someone else claimed some of its frames in the meantime
+    bool heartbeat();
+
+    bool holds_lease() const {
+        return has_lease;
+    }
+
+    const FrameLease& get_lease() const {
+        return own_lease;
+    }
+
+    //the other live lease covering the frame, or nullptr if there isn't one (as of the last claim / heartbeat)
+    const FrameLease* find_other_lease(const int frame_index) const;
+
+    //remember what the frame's label files looked like when it got loaded
+    void snapshot_frame(const std::string& frame_name);
+
+    //true if writing the frame's labels would clobber someone else's: either another live lease covers it, or
+    //its label files changed since it was loaded. reason says which
+    bool is_conflicted(const int frame_index, const std::string& frame_name, std::string& reason) const;
+
+    //the frame's labels are written, so they're what's on disk now
+    void update_snapshot(const std::string& frame_name) {
+        snapshot_frame(frame_name);
+    }
+
+    //where this annotator's conflicting labels go
+    boost::filesystem::path get_conflict_dir() const;
+
+    const std::string& get_annotator() const {
+        return annotator;
+    }
+
+    //everyone's leases in the label directory, live or not
+    static std::vector<FrameLease> read_leases(const boost::filesystem::path& lease_dir);
+    static bool is_live(const FrameLease& lease);
+
+    //annotator names become file names, so anything besides letters, digits, '-' and '_' gets replaced
+    static std::string sanitize_name(const std::string& name);
+
+    static constexpr int HEARTBEAT_INTERVAL_S = 30;
+    static constexpr int LEASE_TIMEOUT_S = 120;
+
+private:
+    LabelFileState stat_frame(const std::string& frame_name) const;
+    void write_lease_file() const;
+    //the claim lock serializes claims between sessions, returns false if it couldn't be had in time
+    bool lock_claims() const;
+    void unlock_claims() const;
+    boost::filesystem::path get_lease_filepath() const {
+        return lease_dir / (annotator + ".lease");
+    }
+
+    const VideoLogger& vlogger;
+    const std::string annotator;
+    const boost::filesystem::path lease_dir;
+    FrameLease own_lease;
+    bool has_lease;
+    //everyone else's live leases
+    std::vector<FrameLease> other_leases;
+    std::unordered_map<std::string, LabelFileState> frame_snapshots;
+};
+
+#endif
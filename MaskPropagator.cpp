@@ -0,0 +1,260 @@
+#include "MaskPropagator.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <iostream>
+#include <map>
+
+#include <QMetaObject>
+#include <QPointer>
+#include <opencv2/video/tracking.hpp>
+
+#include "FrameBuffer.hpp"
+#include "LabelBuffer.hpp"
+#include "VideoReader.hpp"
+
+constexpr int MaskPropagator::MAX_FLOW_DIM;
+constexpr int MaskPropagator::FLOW_CACHE_SIZE;
+
+namespace {
+    //Farneback's parameters -- a fairly coarse pyramid, fish can move quite a bit between frames
+    constexpr double FLOW_PYRAMID_SCALE = 0.5;
+    constexpr int FLOW_PYRAMID_LEVELS = 4;
+    constexpr int FLOW_WINDOW_SIZE = 15;
+    constexpr int FLOW_ITERATIONS = 3;
+    constexpr int FLOW_POLY_N = 5;
+    constexpr double FLOW_POLY_SIGMA = 1.2;
+
+    //the frame, in grayscale and no bigger than MAX_FLOW_DIM. An empty Mat if it can't be read
+    cv::Mat load_flow_frame(const FrameSource& frames, const int frame_index, const QSize& full_size)
+    {
+        //the coarsest decode that's still at least as big as what the flow gets computed on
+        const int full_dim = std::max(full_size.width(), full_size.height());
+        int decode_scale = 1;
+        while (decode_scale < 8 && full_dim / (decode_scale * 2) >= MaskPropagator::MAX_FLOW_DIM) {
+            decode_scale *= 2;
+        }
+        FrameBuffer frame;
+        try {
+            frame = frames.read(frame_index, decode_scale);
+        } catch (const std::runtime_error& err) {
+            std::cout << err.what() << std::endl;
+        }
+        if (frame.empty()) {
+            std::cout << "couldn't read frame " << frame_index << " for the optical flow" << std::endl;
+            return cv::Mat();
+        }
+
+        //NOTE: the Mat is just a view of the frame's pixels, so it has to be converted to something that owns its
+        //pixels before the frame goes away
+        const cv::Mat frame_mat = frame.as_mat();
+        cv::Mat gray_frame;
+        if (frame_mat.channels() == 1) {
+            gray_frame = frame_mat.clone();
+        } else {
+            cv::cvtColor(frame_mat, gray_frame, (frame_mat.channels() == 3) ? cv::COLOR_RGB2GRAY : cv::COLOR_BGRA2GRAY);
+        }
+        const int frame_dim = std::max(gray_frame.cols, gray_frame.rows);
+        if (frame_dim > MaskPropagator::MAX_FLOW_DIM) {
+            const double scale = static_cast<double>(MaskPropagator::MAX_FLOW_DIM) / frame_dim;
+            cv::Mat small_frame;
+            cv::resize(gray_frame, small_frame, cv::Size(), scale, scale, cv::INTER_AREA);
+            gray_frame = small_frame;
+        }
+        return gray_frame;
+    }
+}
+
+MaskPropagator::MaskPropagator(WorkerPool& pool, QObject* result_receiver)
+    : workers(pool), receiver(result_receiver), generation(std::make_shared<std::atomic<int>>(0)),
+      flow_cache(std::make_shared<FlowCache>())
+{}
+
+void MaskPropagator::request(const FrameSource& frames, const int from_index, const int to_index, const QSize& full_size,
+        SharedList<PixelLabelMB> masks, ResultCallback on_result)
+{
+    const int request_generation = ++(*generation);
+    auto request_gen_counter = generation;
+    auto cache = flow_cache;
+    QPointer<QObject> result_receiver (receiver);
+
+    //NOTE: the masks are shared, so capturing them by value doesn't copy them (and the user can keep editing theirs)
+    workers.submit([frames, from_index, to_index, full_size, masks, request_gen_counter, request_generation, cache, result_receiver, on_result]{
+        if (*request_gen_counter != request_generation || !result_receiver) {
+            return;
+        }
+        std::vector<PixelLabelMB> proposals;
+        try {
+            const cv::Mat flow = get_flow(*cache, frames, from_index, to_index, full_size);
+            if (flow.empty() || *request_gen_counter != request_generation) {
+                return;
+            }
+            proposals = warp_masks(masks, flow, full_size);
+        } catch (const cv::Exception& err) {
+            std::cout << "mask propagation failed: " << err.what() << std::endl;
+            return;
+        }
+        if (proposals.empty() || !result_receiver) {
+            return;
+        }
+
+        auto shared_proposals = std::make_shared<std::vector<PixelLabelMB>>(std::move(proposals));
+        QMetaObject::invokeMethod(result_receiver.data(), [shared_proposals, request_gen_counter, request_generation, on_result]{
+            //the user could have moved on while this one was queued up
+            if (*request_gen_counter == request_generation) {
+                on_result(std::move(*shared_proposals));
+            }
+        }, Qt::QueuedConnection);
+    }, 1);
+}
+
+void MaskPropagator::prepare(const FrameSource& frames, const int from_index, const int to_index, const QSize& full_size)
+{
+    auto cache = flow_cache;
+    //NOTE: at the same priority as reading frames ahead, it's only needed once the user moves on
+    workers.submit([frames, from_index, to_index, full_size, cache]{
+        try {
+            get_flow(*cache, frames, from_index, to_index, full_size);
+        } catch (const cv::Exception& err) {
+            std::cout << "optical flow failed: " << err.what() << std::endl;
+        }
+    }, 0);
+}
+
+cv::Mat MaskPropagator::get_flow(FlowCache& cache, const FrameSource& frames, const int from_index, const int to_index, const QSize& full_size)
+{
+    const FlowKey flow_key (frames.get_frame_path(to_index), frames.get_frame_path(from_index));
+    std::promise<cv::Mat> flow_promise;
+    std::shared_future<cv::Mat> flow_future;
+    {
+        std::lock_guard<std::mutex> cache_lock (cache.cache_mutex);
+        auto entry_it = std::find_if(cache.entries.begin(), cache.entries.end(), [&flow_key](const std::pair<FlowKey, std::shared_future<cv::Mat>>& entry) {
+            return entry.first == flow_key;
+        });
+        if (entry_it != cache.entries.end()) {
+            cache.entries.splice(cache.entries.begin(), cache.entries, entry_it);
+            flow_future = entry_it->second;
+        } else {
+            //NOTE: the entry only goes in once somebody's actually working on it, so waiting on it can't deadlock
+            //the pool
+            cache.entries.emplace_front(flow_key, flow_promise.get_future().share());
+            if (static_cast<int>(cache.entries.size()) > FLOW_CACHE_SIZE) {
+                cache.entries.pop_back();
+            }
+        }
+    }
+    if (flow_future.valid()) {
+        return flow_future.get();
+    }
+
+    cv::Mat flow;
+    try {
+        flow = compute_flow(frames, from_index, to_index, full_size);
+    } catch (...) {
+        //don't leave anyone waiting on it, and let the next request try again
+        flow_promise.set_value(cv::Mat());
+        std::lock_guard<std::mutex> cache_lock (cache.cache_mutex);
+        cache.entries.remove_if([&flow_key](const std::pair<FlowKey, std::shared_future<cv::Mat>>& entry) {
+            return entry.first == flow_key;
+        });
+        throw;
+    }
+    flow_promise.set_value(flow);
+    return flow;
+}
+
+cv::Mat MaskPropagator::compute_flow(const FrameSource& frames, const int from_index, const int to_index, const QSize& full_size)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    const cv::Mat to_frame = load_flow_frame(frames, to_index, full_size);
+    const cv::Mat from_frame = load_flow_frame(frames, from_index, full_size);
+    if (to_frame.empty() || from_frame.empty() || to_frame.size() != from_frame.size()) {
+        return cv::Mat();
+    }
+
+    //backwards flow: each pixel of the frame the masks go to, to where it came from
+    cv::Mat flow;
+    cv::calcOpticalFlowFarneback(to_frame, from_frame, flow, FLOW_PYRAMID_SCALE, FLOW_PYRAMID_LEVELS, FLOW_WINDOW_SIZE,
+            FLOW_ITERATIONS, FLOW_POLY_N, FLOW_POLY_SIGMA, 0);
+    auto flow_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+    std::cout << "optical flow (" << flow.cols << "x" << flow.rows << ") took " << flow_time.count() << " ms" << std::endl;
+    return flow;
+}
+
+std::vector<PixelLabelMB> MaskPropagator::warp_masks(const SharedList<PixelLabelMB>& masks, const cv::Mat& flow, const QSize& full_size)
+{
+    std::vector<PixelLabelMB> warped_masks;
+    const int full_width = full_size.width(), full_height = full_size.height();
+    //full resolution pixels per flow pixel
+    const double scale_x = static_cast<double>(full_width) / flow.cols;
+    const double scale_y = static_cast<double>(full_height) / flow.rows;
+
+    //the masks get warped all at once, as a label image (the same as they get saved)
+    FrameLabelBuffer label_buffer (full_height, full_width);
+    std::map<int, int> instance_classes;
+    int x_min = full_width, y_min = full_height, x_max = -1, y_max = -1;
+    for (const auto& segm_label : masks) {
+        if (segm_label.smask.empty()) {
+            continue;
+        }
+        label_buffer.paint(segm_label.smask, segm_label.instance_id);
+        instance_classes[segm_label.instance_id] = segm_label.class_id;
+        const QRect mask_rect = segm_label.smask.bounding_rect();
+        x_min = std::min(x_min, mask_rect.left());
+        y_min = std::min(y_min, mask_rect.top());
+        x_max = std::max(x_max, mask_rect.right());
+        y_max = std::max(y_max, mask_rect.bottom());
+    }
+    if (x_max < 0) {
+        return warped_masks;
+    }
+
+    //only the pixels the masks can move to need to be looked at, i.e. around the masks by as far as anything moves
+    cv::Mat flow_channels[2];
+    cv::split(flow, flow_channels);
+    double min_dx, max_dx, min_dy, max_dy;
+    cv::minMaxLoc(flow_channels[0], &min_dx, &max_dx);
+    cv::minMaxLoc(flow_channels[1], &min_dy, &max_dy);
+    const int margin_x = static_cast<int>(std::ceil(std::max(std::abs(min_dx), std::abs(max_dx)) * scale_x)) + 1;
+    const int margin_y = static_cast<int>(std::ceil(std::max(std::abs(min_dy), std::abs(max_dy)) * scale_y)) + 1;
+    const cv::Rect warp_rect = cv::Rect(x_min - margin_x, y_min - margin_y, x_max - x_min + 1 + 2*margin_x, y_max - y_min + 1 + 2*margin_y)
+        & cv::Rect(0, 0, full_width, full_height);
+
+    //where each of those pixels lands in the flow...
+    cv::Mat flow_map_x (warp_rect.height, warp_rect.width, CV_32FC1);
+    cv::Mat flow_map_y (warp_rect.height, warp_rect.width, CV_32FC1);
+    for (int row = 0; row < warp_rect.height; row++) {
+        float* map_x_row = flow_map_x.ptr<float>(row);
+        float* map_y_row = flow_map_y.ptr<float>(row);
+        const float flow_y = static_cast<float>((warp_rect.y + row + 0.5) / scale_y - 0.5);
+        for (int col = 0; col < warp_rect.width; col++) {
+            map_x_row[col] = static_cast<float>((warp_rect.x + col + 0.5) / scale_x - 0.5);
+            map_y_row[col] = flow_y;
+        }
+    }
+    cv::Mat region_flow;
+    cv::remap(flow, region_flow, flow_map_x, flow_map_y, cv::INTER_LINEAR, cv::BORDER_REPLICATE);
+
+    //... and where it came from in the masks' frame
+    cv::Mat label_map_x (warp_rect.height, warp_rect.width, CV_32FC1);
+    cv::Mat label_map_y (warp_rect.height, warp_rect.width, CV_32FC1);
+    for (int row = 0; row < warp_rect.height; row++) {
+        const cv::Vec2f* flow_row = region_flow.ptr<cv::Vec2f>(row);
+        float* map_x_row = label_map_x.ptr<float>(row);
+        float* map_y_row = label_map_y.ptr<float>(row);
+        for (int col = 0; col < warp_rect.width; col++) {
+            map_x_row[col] = static_cast<float>(warp_rect.x + col + flow_row[col][0] * scale_x);
+            map_y_row[col] = static_cast<float>(warp_rect.y + row + flow_row[col][1] * scale_y);
+        }
+    }
+    //NOTE: nearest neighbour, the labels are instance IDs
+    cv::Mat warped_labels;
+    cv::remap(label_buffer.get_mat(), warped_labels, label_map_x, label_map_y, cv::INTER_NEAREST, cv::BORDER_CONSTANT, cv::Scalar(0));
+
+    for (auto& warped_mask : FrameLabelBuffer::from_mat(warped_labels).split(QPoint(warp_rect.x, warp_rect.y))) {
+        warped_masks.emplace_back(std::move(warped_mask.second), warped_mask.first, instance_classes[warped_mask.first]);
+    }
+    return warped_masks;
+}
@@ -0,0 +1,79 @@
+#ifndef FISHLABELER_MASKPROPAGATOR_HPP
+#define FISHLABELER_MASKPROPAGATOR_HPP
+
+#include <atomic>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <QObject>
+#include <QSize>
+#include <opencv2/opencv.hpp>
+
+#include "AnnotationTypes.hpp"
+#include "WorkerPool.hpp"
+
+class FrameSource;
+
+/* Carries a frame's segmentation masks over to a neighbouring frame by warping them along the dense optical flow
+ * (Farneback) between the two frames, as proposals for the user to accept rather than labels.
+ *
+ * The flow gets computed on the worker pool, on downscaled grayscale versions of the frames (read through the video's
+ * FrameSource, decoded at a reduced scale to begin with if they aren't packed), and cached per (ordered) pair of frames -- stepping back and forth between frames only
+ * computes each direction once, and prepare() can compute the flow ahead of time while the user's still labelling
+ * the frame. Warping the masks is cheap in comparison, so that's done for every request.
+ *
+ * Same as the GrabCutSegmenter, only the latest request counts: a newer request (or cancel) drops the results of
+ * the ones still in flight.
+ */
+class MaskPropagator
+{
+public:
+    using ResultCallback = std::function<void(std::vector<PixelLabelMB>&&)>;
+
+    MaskPropagator(WorkerPool& pool, QObject* result_receiver);
+
+    //NOTE: on_result gets run on the receiver's thread, and only if the request is still the latest one by then.
+    //The masks are in full_size coordinates (the frames on disk can be any resolution)
+    void request(const FrameSource& frames, const int from_index, const int to_index, const QSize& full_size,
+            SharedList<PixelLabelMB> masks, ResultCallback on_result);
+
+    //compute the flow for a later request from from_index to to_index, at a low priority
+    void prepare(const FrameSource& frames, const int from_index, const int to_index, const QSize& full_size);
+
+    void cancel() {
+        (*generation)++;
+    }
+
+    //the longest side of the frames the flow gets computed on
+    static constexpr int MAX_FLOW_DIM = 640;
+    //how many frame pairs' flows to keep around
+    static constexpr int FLOW_CACHE_SIZE = 16;
+
+private:
+    //NOTE: the flow is backwards, i.e. from the frame the masks get warped into to the one they come from, which
+    //is what remapping needs. The key is the frames' paths, (to, from)
+    using FlowKey = std::pair<std::string, std::string>;
+    struct FlowCache {
+        std::mutex cache_mutex;
+        //most recently used first. The flow can still be in the works, whoever needs it then waits for it
+        std::list<std::pair<FlowKey, std::shared_future<cv::Mat>>> entries;
+    };
+
+    //the cached flow, or computes it. An empty Mat if either frame can't be read
+    static cv::Mat get_flow(FlowCache& cache, const FrameSource& frames, const int from_index, const int to_index, const QSize& full_size);
+    static cv::Mat compute_flow(const FrameSource& frames, const int from_index, const int to_index, const QSize& full_size);
+    static std::vector<PixelLabelMB> warp_masks(const SharedList<PixelLabelMB>& masks, const cv::Mat& flow, const QSize& full_size);
+
+    WorkerPool& workers;
+    QObject* receiver;
+    //both are shared with the jobs, which can outlive the propagator
+    std::shared_ptr<std::atomic<int>> generation;
+    std::shared_ptr<FlowCache> flow_cache;
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include "ProjectSession.hpp"
+
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <boost/algorithm/string.hpp>
+#include <boost/lexical_cast.hpp>
+
+constexpr int ProjectSession::NUM_PREFETCH_FRAMES;
+
+ProjectSession::ProjectSession(const std::string& project_filepath)
+    : project_fpath(project_filepath), current_video(0), prefetched_video(-1)
+{
+    parse_project_file();
+}
+
+ProjectSession::~ProjectSession()
+{
+    //let the background open finish before the pool goes away (the pool dtor would wait on it anyways)
+    if (prefetched_reader.valid()) {
+        prefetched_reader.wait();
+    }
+}
+
+void ProjectSession::parse_project_file()
+{
+    if (!boost::filesystem::exists(project_fpath)) {
+        std::cout << "Project file " << project_fpath << " doesn't exist yet, starting an empty project" << std::endl;
+        return;
+    }
+
+    std::ifstream project_ifstream(project_fpath);
+    std::string project_line;
+    while (std::getline(project_ifstream, project_line)) {
+        boost::algorithm::trim(project_line);
+        if (project_line.empty() || project_line[0] == '#') {
+            continue;
+        }
+
+        std::vector<std::string> line_tokens;
+        boost::split(line_tokens, project_line, boost::is_any_of(","));
+        for (auto& token : line_tokens) {
+            boost::algorithm::trim(token);
+        }
+
+        try {
+            if (line_tokens[0] == "current" && line_tokens.size() == 2) {
+                current_video = boost::lexical_cast<int>(line_tokens[1]);
+            } else if (line_tokens.size() >= 3) {
+                //NOTE: the directory itself could have commas in it, so the frame indices are taken off of the end
+                const int num_tokens = line_tokens.size();
+                auto visited = boost::lexical_cast<int>(line_tokens[num_tokens-2]);
+                auto labelled = boost::lexical_cast<int>(line_tokens[num_tokens-1]);
+                auto dir_end = project_line.rfind(',', project_line.rfind(',') - 1);
+                auto frame_dir = boost::algorithm::trim_copy(project_line.substr(0, dir_end));
+                videos.emplace_back(std::move(frame_dir), visited, labelled);
+            } else {
+                videos.emplace_back(project_line);
+            }
+        } catch (const boost::bad_lexical_cast& err) {
+            std::string err_msg {"ERROR: malformed project file line '" + project_line + "' in " + project_fpath};
+            throw std::runtime_error(err_msg);
+        }
+    }
+
+    if (current_video < 0 || current_video >= static_cast<int>(videos.size())) {
+        current_video = 0;
+    }
+    std::cout << "Loaded project " << project_fpath << " with " << videos.size() << " videos" << std::endl;
+}
+
+void ProjectSession::save() const
+{
+    std::ofstream fout(project_fpath);
+    fout << "current, " << current_video << "\n";
+    for (const auto& video : videos) {
+        fout << video.frame_dir << ", " << video.last_visited << ", " << video.last_labelled << "\n";
+    }
+    fout.close();
+}
+
+void ProjectSession::add_video(const std::string& frame_dir)
+{
+    videos.emplace_back(frame_dir);
+    //if this is now the next video in line, get it warmed up
+    if (current_video + 1 == static_cast<int>(videos.size()) - 1) {
+        prefetch_video(current_video + 1);
+    }
+}
+
+std::unique_ptr<VideoReader> ProjectSession::open_video(const int video_index)
+{
+    check_video_index(video_index);
+
+    std::unique_ptr<VideoReader> vreader;
+    if (video_index == prefetched_video && prefetched_reader.valid()) {
+        //NOTE: re-throws if the directory turned out to be bad
+        vreader = prefetched_reader.get();
+    } else {
+        vreader = std::make_unique<VideoReader>(videos[video_index].frame_dir);
+        vreader->set_worker_pool(&workers);
+        vreader->prefetch(videos[video_index].last_visited, NUM_PREFETCH_FRAMES);
+    }
+    prefetched_video = -1;
+    current_video = video_index;
+
+    prefetch_video(video_index + 1);
+    return vreader;
+}
+
+void ProjectSession::prefetch_video(const int video_index)
+{
+    if (video_index >= static_cast<int>(videos.size()) || video_index == prefetched_video) {
+        return;
+    }
+
+    //listing a directory with 100k+ frames is slow enough to be noticable, so that goes on the pool as well
+    const VideoResumePoint resume_point = videos[video_index];
+    auto pool = &workers;
+    prefetched_reader = workers.submit([resume_point, pool]{
+        auto vreader = std::make_unique<VideoReader>(resume_point.frame_dir);
+        vreader->set_worker_pool(pool);
+        vreader->prefetch(resume_point.last_visited, NUM_PREFETCH_FRAMES);
+        return vreader;
+    });
+    prefetched_video = video_index;
+}
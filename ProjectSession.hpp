@@ -0,0 +1,105 @@
+#ifndef FISHLABELER_PROJECTSESSION_HPP
+#define FISHLABELER_PROJECTSESSION_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <future>
+#include <stdexcept>
+
+#include "VideoReader.hpp"
+#include "WorkerPool.hpp"
+
+//where the user left off in a given video of the project
+struct VideoResumePoint {
+    VideoResumePoint()
+        : last_visited(0), last_labelled(-1)
+    {}
+
+    explicit VideoResumePoint(std::string dir, const int visited = 0, const int labelled = -1)
+        : frame_dir(std::move(dir)), last_visited(visited), last_labelled(labelled)
+    {}
+
+    std::string frame_dir;
+    int last_visited;
+    //-1 if nothing has been labelled in the video yet
+    int last_labelled;
+};
+
+/* A project is a list of frame directories (one per video) that get worked through in order. The project file is a
+ * text file with one video per line, i.e.
+ *   <frame directory>, <last visited frame>, <last labelled frame>
+ * as well as a 'current, <video index>' line for which video was open last. Lines with just a directory are fine
+ * too, so a new project can be made by just listing the directories.
+ *
+ * All the videos share a single worker pool for decoding, and the next video in the list gets opened and its
+ * first frames prefetched in the background while the current one is being worked on.
+ */
+class ProjectSession
+{
+public:
+    explicit ProjectSession(const std::string& project_filepath);
+    ~ProjectSession();
+
+    int get_num_videos() const {
+        return videos.size();
+    }
+
+    int get_current_video_index() const {
+        return current_video;
+    }
+
+    const VideoResumePoint& get_resume_point(const int video_index) const {
+        check_video_index(video_index);
+        return videos[video_index];
+    }
+
+    WorkerPool& get_worker_pool() {
+        return workers;
+    }
+
+    void add_video(const std::string& frame_dir);
+
+    //makes video_index the current video and returns its reader, positioned nowhere in particular -- the caller
+    //should fetch get_resume_point(video_index).last_visited. NOTE: the reader decodes on this session's pool,
+    //so it can't outlive the session
+    std::unique_ptr<VideoReader> open_video(const int video_index);
+
+    //record the user's position in the current video
+    void set_last_visited(const int frame_index) {
+        check_video_index(current_video);
+        videos[current_video].last_visited = frame_index;
+    }
+
+    void set_last_labelled(const int frame_index) {
+        check_video_index(current_video);
+        videos[current_video].last_labelled = frame_index;
+    }
+
+    void save() const;
+
+private:
+    void parse_project_file();
+    void prefetch_video(const int video_index);
+
+    void check_video_index(const int video_index) const {
+        if (video_index < 0 || video_index >= static_cast<int>(videos.size())) {
+            std::string err_msg {"ERROR: video index " + std::to_string(video_index) + " is out of bounds"};
+            throw std::runtime_error(err_msg);
+        }
+    }
+
+    const std::string project_fpath;
+    std::vector<VideoResumePoint> videos;
+    int current_video;
+
+    WorkerPool workers;
+    //the next video's reader, being opened (and its first frames decoded) in the background
+    int prefetched_video;
+    std::future<std::unique_ptr<VideoReader>> prefetched_reader;
+
+    //how many frames of the next video to have ready to go
+    static constexpr int NUM_PREFETCH_FRAMES = 8;
+};
+
+#endif
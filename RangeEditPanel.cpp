@@ -0,0 +1,158 @@
+#include "RangeEditPanel.hpp"
+
+#include <iostream>
+
+#include <QHBoxLayout>
+#include <QStringList>
+
+RangeEditPanel::RangeEditPanel(QWidget* parent)
+    : QWidget(parent)
+{
+    constexpr int max_arg_width = 60;
+    first_frame_edit = new QLineEdit("0", this);
+    first_frame_edit->setMaximumWidth(max_arg_width);
+    last_frame_edit = new QLineEdit("0", this);
+    last_frame_edit->setMaximumWidth(max_arg_width);
+
+    edit_select = new QComboBox(this);
+    edit_select->addItem("relabel instance as");
+    edit_select->addItem("delete instance");
+    edit_select->addItem("shift by dx,dy");
+    connect(edit_select, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged), [this](int){
+        update_arg_hint();
+    });
+
+    //NOTE: left empty, a shift moves every instance
+    instance_edit = new QLineEdit("1", this);
+    instance_edit->setMaximumWidth(max_arg_width);
+    edit_arg = new QLineEdit(this);
+    edit_arg->setMaximumWidth(max_arg_width);
+
+    target_select = new QComboBox(this);
+    target_select->addItem("boxes + masks");
+    target_select->addItem("boxes");
+    target_select->addItem("masks");
+
+    apply_btn = new QPushButton("apply", this);
+    connect(apply_btn, &QPushButton::clicked, [this]{
+        apply_edit();
+    });
+    undo_btn = new QPushButton("undo edit", this);
+    undo_btn->setEnabled(false);
+    connect(undo_btn, &QPushButton::clicked, [this]{
+        if (undo_handler) {
+            undo_handler();
+        }
+    });
+    edit_status = new QLabel(this);
+
+    auto edit_layout = new QHBoxLayout;
+    edit_layout->setContentsMargins(0, 0, 0, 0);
+    auto edit_txt = new QLabel(this);
+    edit_txt->setText("Edit Frames:");
+    edit_layout->addWidget(edit_txt);
+    edit_layout->addWidget(first_frame_edit);
+    auto range_txt = new QLabel(this);
+    range_txt->setText("-");
+    edit_layout->addWidget(range_txt);
+    edit_layout->addWidget(last_frame_edit);
+    auto instance_txt = new QLabel(this);
+    instance_txt->setText("instance:");
+    edit_layout->addWidget(instance_txt);
+    edit_layout->addWidget(instance_edit);
+    edit_layout->addWidget(edit_select);
+    edit_layout->addWidget(edit_arg);
+    edit_layout->addWidget(target_select);
+    edit_layout->addWidget(apply_btn);
+    edit_layout->addWidget(undo_btn);
+    edit_layout->addWidget(edit_status);
+    setLayout(edit_layout);
+    update_arg_hint();
+}
+
+void RangeEditPanel::set_range(const int first_frame, const int last_frame)
+{
+    first_frame_edit->setText(QString::number(first_frame));
+    last_frame_edit->setText(QString::number(last_frame));
+}
+
+void RangeEditPanel::set_status(const std::string& status, const bool can_undo)
+{
+    edit_status->setText(status.c_str());
+    undo_btn->setEnabled(can_undo);
+}
+
+void RangeEditPanel::update_arg_hint()
+{
+    switch (edit_select->currentIndex()) {
+        case RELABEL:
+            edit_arg->setEnabled(true);
+            edit_arg->setPlaceholderText("new ID");
+            break;
+        case DELETE_INSTANCE:
+            edit_arg->setEnabled(false);
+            edit_arg->setPlaceholderText("");
+            break;
+        case SHIFT:
+            edit_arg->setEnabled(true);
+            edit_arg->setPlaceholderText("dx,dy");
+            break;
+    }
+}
+
+void RangeEditPanel::apply_edit()
+{
+    if (!apply_handler) {
+        return;
+    }
+
+    bool first_ok = false, last_ok = false;
+    const int first_frame = first_frame_edit->text().trimmed().toInt(&first_ok);
+    const int last_frame = last_frame_edit->text().trimmed().toInt(&last_ok);
+    if (!first_ok || !last_ok) {
+        set_status("the frame range isn't a pair of numbers", undo_btn->isEnabled());
+        return;
+    }
+
+    RangeEdit edit;
+    edit.instance_id = RangeEdit::ALL_INSTANCES;
+    if (!instance_edit->text().trimmed().isEmpty()) {
+        bool instance_ok = false;
+        edit.instance_id = instance_edit->text().trimmed().toInt(&instance_ok);
+        if (!instance_ok) {
+            set_status("the instance ID isn't a number", undo_btn->isEnabled());
+            return;
+        }
+    }
+    edit.edit_bboxes = target_select->currentIndex() != 2;
+    edit.edit_masks = target_select->currentIndex() != 1;
+    switch (edit_select->currentIndex()) {
+        case RELABEL: {
+            bool id_ok = false;
+            edit.op = RANGE_OP::RELABEL;
+            edit.new_instance_id = edit_arg->text().toInt(&id_ok);
+            if (!id_ok) {
+                set_status("the new instance ID isn't a number", undo_btn->isEnabled());
+                return;
+            }
+            break;
+        }
+        case DELETE_INSTANCE:
+            edit.op = RANGE_OP::DELETE_INSTANCE;
+            break;
+        case SHIFT: {
+            edit.op = RANGE_OP::SHIFT;
+            const auto offset_vals = edit_arg->text().split(',');
+            bool dx_ok = false, dy_ok = false;
+            if (offset_vals.size() == 2) {
+                edit.offset = QPoint(offset_vals[0].trimmed().toInt(&dx_ok), offset_vals[1].trimmed().toInt(&dy_ok));
+            }
+            if (!dx_ok || !dy_ok) {
+                set_status("the shift has to be dx,dy", undo_btn->isEnabled());
+                return;
+            }
+            break;
+        }
+    }
+    apply_handler(edit, first_frame, last_frame);
+}
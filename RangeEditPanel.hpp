@@ -0,0 +1,60 @@
+#ifndef FISHLABELER_RANGEEDITPANEL_HPP
+#define FISHLABELER_RANGEEDITPANEL_HPP
+
+#include <functional>
+#include <string>
+#include <utility>
+
+#include <QWidget>
+#include <QComboBox>
+#include <QLineEdit>
+#include <QLabel>
+#include <QPushButton>
+
+#include "RangeEditor.hpp"
+
+//the controls for a RangeEditor edit over [first frame, last frame] -- the window does the actual editing
+class RangeEditPanel : public QWidget
+{
+public:
+    using ApplyHandler = std::function<void(const RangeEdit&, const int first_frame, const int last_frame)>;
+
+    explicit RangeEditPanel(QWidget* parent = 0);
+
+    void set_apply_handler(ApplyHandler handler) {
+        apply_handler = std::move(handler);
+    }
+
+    void set_undo_handler(std::function<void()> handler) {
+        undo_handler = std::move(handler);
+    }
+
+    //the range the next edit gets applied to, e.g. the current frame
+    void set_range(const int first_frame, const int last_frame);
+    void set_status(const std::string& status, const bool can_undo);
+
+private:
+    enum EDIT_TYPE {
+        RELABEL = 0,
+        DELETE_INSTANCE,
+        SHIFT
+    };
+
+    void apply_edit();
+    void update_arg_hint();
+
+    ApplyHandler apply_handler;
+    std::function<void()> undo_handler;
+
+    QLineEdit* first_frame_edit;
+    QLineEdit* last_frame_edit;
+    QComboBox* edit_select;
+    QLineEdit* instance_edit;
+    QLineEdit* edit_arg;
+    QComboBox* target_select;
+    QPushButton* apply_btn;
+    QPushButton* undo_btn;
+    QLabel* edit_status;
+};
+
+#endif
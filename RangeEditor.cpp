@@ -0,0 +1,395 @@
+#include "RangeEditor.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#include <QImageReader>
+#include <QRect>
+
+constexpr int RangeEdit::ALL_INSTANCES;
+
+namespace {
+    //the journal's states, see apply() / undo()
+    const std::string JOURNAL_COMMITTING {"COMMITTING"};
+    const std::string JOURNAL_COMMITTED {"COMMITTED"};
+    const std::string JOURNAL_UNDOING {"UNDOING"};
+
+    bool edits_instance(const RangeEdit& edit, const int instance_id)
+    {
+        return edit.instance_id == RangeEdit::ALL_INSTANCES || edit.instance_id == instance_id;
+    }
+
+    //the number of boxes the edit changed (including the ones it removed)
+    int edit_bboxes(const RangeEdit& edit, const QRect& frame_rect, std::vector<BoundingBoxMD>& frame_bboxes)
+    {
+        int num_changed = 0;
+        std::vector<BoundingBoxMD> edited_bboxes;
+        edited_bboxes.reserve(frame_bboxes.size());
+        for (auto& bbox_md : frame_bboxes) {
+            if (!edits_instance(edit, bbox_md.instance_id)) {
+                edited_bboxes.push_back(std::move(bbox_md));
+                continue;
+            }
+            num_changed++;
+            switch (edit.op) {
+                case RANGE_OP::RELABEL:
+                    edited_bboxes.emplace_back(bbox_md.bbox, edit.new_instance_id);
+                    break;
+                case RANGE_OP::DELETE_INSTANCE:
+                    break;
+                case RANGE_OP::SHIFT: {
+                    //a box that gets shifted (entirely) off of the frame is gone
+                    QRect shifted_bbox = bbox_md.bbox.normalized().translated(edit.offset);
+                    if (frame_rect.isValid()) {
+                        shifted_bbox = shifted_bbox.intersected(frame_rect);
+                    }
+                    if (!shifted_bbox.isEmpty()) {
+                        edited_bboxes.emplace_back(shifted_bbox, bbox_md.instance_id);
+                    }
+                    break;
+                }
+            }
+        }
+        frame_bboxes = std::move(edited_bboxes);
+        return num_changed;
+    }
+
+    //the number of masks the edit changed (including the ones it removed)
+    int edit_masks(const RangeEdit& edit, const QRect& frame_rect, std::vector<PixelLabelMB>& frame_masks)
+    {
+        int num_changed = 0;
+        std::vector<PixelLabelMB> edited_masks;
+        std::vector<PixelLabelMB> matched_masks;
+        for (auto& segm_label : frame_masks) {
+            if (edits_instance(edit, segm_label.instance_id)) {
+                matched_masks.push_back(std::move(segm_label));
+            } else {
+                edited_masks.push_back(std::move(segm_label));
+            }
+        }
+        for (auto& segm_label : matched_masks) {
+            num_changed++;
+            switch (edit.op) {
+                case RANGE_OP::RELABEL: {
+                    //an instance only has the one mask, so it gets merged into the new instance's if there is one
+                    auto target_it = std::find_if(edited_masks.begin(), edited_masks.end(), [&edit](const PixelLabelMB& other_label) {
+                        return other_label.instance_id == edit.new_instance_id;
+                    });
+                    if (target_it != edited_masks.end()) {
+                        target_it->smask.add_mask(segm_label.smask);
+                    } else {
+                        edited_masks.emplace_back(std::move(segm_label.smask), edit.new_instance_id, segm_label.class_id);
+                    }
+                    break;
+                }
+                case RANGE_OP::DELETE_INSTANCE:
+                    break;
+                case RANGE_OP::SHIFT:
+                    segm_label.smask.translate(edit.offset);
+                    segm_label.smask.clip(frame_rect);
+                    if (!segm_label.smask.empty()) {
+                        edited_masks.push_back(std::move(segm_label));
+                    }
+                    break;
+            }
+        }
+        frame_masks = std::move(edited_masks);
+        return num_changed;
+    }
+
+    //NOTE: a hard link when the filesystem has them, the original file never gets written to again (the edited
+    //one gets renamed over it)
+    void backup_file(const boost::filesystem::path& fpath, const boost::filesystem::path& backup_fpath)
+    {
+        boost::filesystem::create_directories(backup_fpath.parent_path());
+        boost::system::error_code ec;
+        boost::filesystem::create_hard_link(fpath, backup_fpath, ec);
+        if (ec) {
+            boost::filesystem::copy_file(fpath, backup_fpath);
+        }
+    }
+}
+
+RangeEditor::RangeEditor(VideoLogger& logger, WorkerPool& pool)
+    : vlogger(logger), workers(pool), pending_dir(logger.get_logdir() / "Transactions" / "pending"),
+      last_dir(logger.get_logdir() / "Transactions" / "last")
+{
+    recover();
+}
+
+RangeEditStats RangeEditor::apply(const RangeEdit& edit, const std::vector<std::string>& frame_names, const QSize& frame_size)
+{
+    if (edit.instance_id == RangeEdit::ALL_INSTANCES && edit.op != RANGE_OP::SHIFT) {
+        std::string err_msg {"ERROR: only shifting works on every instance at once"};
+        throw std::runtime_error(err_msg);
+    }
+    if (edit.op == RANGE_OP::RELABEL && edit.new_instance_id == edit.instance_id) {
+        std::string err_msg {"ERROR: instance " + std::to_string(edit.instance_id) + " already has that ID"};
+        throw std::runtime_error(err_msg);
+    }
+    RangeEditStats stats;
+    if (frame_names.empty() || (!edit.edit_bboxes && !edit.edit_masks) || (edit.op == RANGE_OP::SHIFT && edit.offset.isNull())) {
+        return stats;
+    }
+    auto start_time = std::chrono::steady_clock::now();
+
+    //whatever's left over from a failed edit never got applied
+    boost::filesystem::remove_all(pending_dir);
+    boost::filesystem::create_directories(pending_dir);
+    VideoLogger staged_logger ((pending_dir / "staged").string(), vlogger.get_bbox_format());
+
+    const int num_frames = frame_names.size();
+    std::vector<RangeEditStats> frame_stats (num_frames);
+    std::vector<std::vector<JournalEntry>> frame_entries (num_frames);
+    try {
+        workers.parallel_for(0, num_frames, [&](const int fidx) {
+            frame_stats[fidx] = stage_frame(edit, frame_names[fidx], frame_size, staged_logger, frame_entries[fidx]);
+        });
+    } catch (...) {
+        //none of the labels have been touched yet
+        boost::system::error_code ec;
+        boost::filesystem::remove_all(pending_dir, ec);
+        throw;
+    }
+
+    std::vector<JournalEntry> entries;
+    for (int fidx = 0; fidx < num_frames; fidx++) {
+        stats += frame_stats[fidx];
+        entries.insert(entries.end(), frame_entries[fidx].begin(), frame_entries[fidx].end());
+    }
+    if (entries.empty()) {
+        boost::filesystem::remove_all(pending_dir);
+        std::cout << "the edit doesn't change any of the " << num_frames << " frames" << std::endl;
+        return stats;
+    }
+
+    //the point of no return: once the journal's there, the edit gets finished even if we die half way through
+    write_journal(pending_dir, JOURNAL_COMMITTING, entries);
+    //NOTE: there's only the one undo step, the previous edit can't be undone anymore
+    boost::filesystem::remove_all(last_dir);
+    boost::filesystem::rename(pending_dir, last_dir);
+    roll_forward(entries);
+    write_journal(last_dir, JOURNAL_COMMITTED, entries);
+    boost::filesystem::remove_all(last_dir / "staged");
+
+    auto edit_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+    std::cout << "Edited " << stats.num_frames_changed << " of " << stats.num_frames << " frames in " << edit_time.count() << " ms: "
+              << stats.num_bboxes_changed << " boxes and " << stats.num_masks_changed << " masks changed" << std::endl;
+    return stats;
+}
+
+RangeEditStats RangeEditor::stage_frame(const RangeEdit& edit, const std::string& frame_name, const QSize& frame_size,
+        VideoLogger& staged_logger, std::vector<JournalEntry>& entries) const
+{
+    RangeEditStats stats;
+    stats.num_frames = 1;
+    const QRect frame_rect = frame_size.isValid() ? QRect(QPoint(0, 0), frame_size) : QRect();
+
+    if (edit.edit_bboxes && vlogger.has_boundingbox(frame_name)) {
+        auto frame_bboxes = vlogger.get_boundingboxes(frame_name);
+        const int num_changed = edit_bboxes(edit, frame_rect, frame_bboxes);
+        if (num_changed > 0) {
+            //a frame that's out of boxes doesn't get a file
+            if (!frame_bboxes.empty()) {
+                staged_logger.write_bboxes(frame_name, frame_bboxes, 0, frame_size.height(), frame_size.width());
+            }
+            stage_files({vlogger.get_text_boundingbox_filepath(frame_name), vlogger.get_binary_boundingbox_filepath(frame_name)}, entries);
+            stats.num_bboxes_changed += num_changed;
+        }
+    }
+
+    if (edit.edit_masks && vlogger.has_annotations(frame_name)) {
+        const auto mask_fpath = vlogger.get_annotation_filepath(frame_name);
+        //the mask gets re-written at the size it was (or the frame's, which should be the same)
+        QSize mask_size = frame_size;
+        if (!mask_size.isValid()) {
+            mask_size = QImageReader(QString::fromStdString(mask_fpath.string())).size();
+        }
+        auto frame_masks = vlogger.get_annotations(frame_name);
+        const int num_changed = edit_masks(edit, QRect(QPoint(0, 0), mask_size), frame_masks);
+        if (num_changed > 0) {
+            if (!frame_masks.empty()) {
+                staged_logger.write_annotations(frame_name, frame_masks, 0, mask_size.height(), mask_size.width());
+            }
+            stage_files({mask_fpath, vlogger.get_class_filepath(frame_name)}, entries);
+            stats.num_masks_changed += num_changed;
+        }
+    }
+
+    if (!entries.empty()) {
+        stats.num_frames_changed = 1;
+    }
+    return stats;
+}
+
+void RangeEditor::stage_files(const std::vector<boost::filesystem::path>& label_fpaths, std::vector<JournalEntry>& entries) const
+{
+    for (const auto& label_fpath : label_fpaths) {
+        JournalEntry entry;
+        entry.rel_fpath = relative_fpath(label_fpath);
+        entry.replaced = boost::filesystem::exists(pending_dir / "staged" / entry.rel_fpath);
+        entry.had_original = boost::filesystem::exists(label_fpath);
+        if (entry.had_original) {
+            backup_file(label_fpath, pending_dir / "backup" / entry.rel_fpath);
+        }
+        if (entry.replaced || entry.had_original) {
+            entries.push_back(std::move(entry));
+        }
+    }
+}
+
+bool RangeEditor::can_undo() const
+{
+    std::string state;
+    std::vector<JournalEntry> entries;
+    return read_journal(last_dir, state, entries) && state == JOURNAL_COMMITTED;
+}
+
+bool RangeEditor::undo()
+{
+    std::string state;
+    std::vector<JournalEntry> entries;
+    if (!read_journal(last_dir, state, entries) || state != JOURNAL_COMMITTED) {
+        std::cout << "no range edit to undo" << std::endl;
+        return false;
+    }
+    auto start_time = std::chrono::steady_clock::now();
+    write_journal(last_dir, JOURNAL_UNDOING, entries);
+    restore_backup(entries);
+    boost::filesystem::remove_all(last_dir);
+    auto undo_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+    std::cout << "Undid the range edit (" << entries.size() << " files) in " << undo_time.count() << " ms" << std::endl;
+    return true;
+}
+
+void RangeEditor::roll_forward(const std::vector<JournalEntry>& entries)
+{
+    const auto& logdir = vlogger.get_logdir();
+    workers.parallel_for(0, static_cast<int>(entries.size()), [&](const int eidx) {
+        const auto& entry = entries[eidx];
+        const auto label_fpath = logdir / entry.rel_fpath;
+        if (entry.replaced) {
+            //NOTE: already moved if this is a re-run
+            const auto staged_fpath = last_dir / "staged" / entry.rel_fpath;
+            if (boost::filesystem::exists(staged_fpath)) {
+                boost::filesystem::create_directories(label_fpath.parent_path());
+                boost::filesystem::rename(staged_fpath, label_fpath);
+            }
+        } else {
+            boost::system::error_code ec;
+            boost::filesystem::remove(label_fpath, ec);
+        }
+    });
+}
+
+void RangeEditor::restore_backup(const std::vector<JournalEntry>& entries)
+{
+    const auto& logdir = vlogger.get_logdir();
+    workers.parallel_for(0, static_cast<int>(entries.size()), [&](const int eidx) {
+        const auto& entry = entries[eidx];
+        const auto label_fpath = logdir / entry.rel_fpath;
+        if (entry.had_original) {
+            //NOTE: already moved back if this is a re-run
+            const auto backup_fpath = last_dir / "backup" / entry.rel_fpath;
+            if (boost::filesystem::exists(backup_fpath)) {
+                boost::filesystem::create_directories(label_fpath.parent_path());
+                boost::filesystem::rename(backup_fpath, label_fpath);
+            }
+        } else {
+            boost::system::error_code ec;
+            boost::filesystem::remove(label_fpath, ec);
+        }
+    });
+}
+
+void RangeEditor::recover()
+{
+    std::string state;
+    std::vector<JournalEntry> entries;
+    if (boost::filesystem::exists(pending_dir)) {
+        if (read_journal(pending_dir, state, entries) && state == JOURNAL_COMMITTING) {
+            boost::filesystem::remove_all(last_dir);
+            boost::filesystem::rename(pending_dir, last_dir);
+        } else {
+            //it never got as far as the journal, so none of the labels have been touched
+            std::cout << "dropping a range edit that didn't finish staging" << std::endl;
+            boost::filesystem::remove_all(pending_dir);
+        }
+    }
+
+    if (!read_journal(last_dir, state, entries)) {
+        return;
+    }
+    if (state == JOURNAL_COMMITTING) {
+        std::cout << "finishing an interrupted range edit (" << entries.size() << " files)" << std::endl;
+        roll_forward(entries);
+        write_journal(last_dir, JOURNAL_COMMITTED, entries);
+        boost::filesystem::remove_all(last_dir / "staged");
+    } else if (state == JOURNAL_UNDOING) {
+        std::cout << "finishing an interrupted range edit undo (" << entries.size() << " files)" << std::endl;
+        restore_backup(entries);
+        boost::filesystem::remove_all(last_dir);
+    }
+}
+
+void RangeEditor::write_journal(const boost::filesystem::path& txn_path, const std::string& state, const std::vector<JournalEntry>& entries) const
+{
+    /* the journal is the state, then one line per file:
+     *   <R(eplaced) or D(eleted)> <1 if there was a file before, 0 otherwise> <path relative to the label directory>
+     * NOTE: written to the side and renamed over, s.t. it's never half written */
+    const auto journal_fpath = txn_path / "journal.txt";
+    auto tmp_fpath = journal_fpath;
+    tmp_fpath += ".tmp";
+    {
+        std::ofstream journal_out(tmp_fpath.string());
+        journal_out << state << "\n";
+        for (const auto& entry : entries) {
+            journal_out << (entry.replaced ? 'R' : 'D') << " " << (entry.had_original ? 1 : 0) << " " << entry.rel_fpath << "\n";
+        }
+        if (!journal_out) {
+            std::string err_msg {"ERROR: couldn't write journal " + tmp_fpath.string()};
+            throw std::runtime_error(err_msg);
+        }
+    }
+    boost::filesystem::rename(tmp_fpath, journal_fpath);
+}
+
+bool RangeEditor::read_journal(const boost::filesystem::path& txn_path, std::string& state, std::vector<JournalEntry>& entries) const
+{
+    const auto journal_fpath = txn_path / "journal.txt";
+    std::ifstream journal_in(journal_fpath.string());
+    if (!journal_in || !std::getline(journal_in, state)) {
+        return false;
+    }
+    entries.clear();
+    std::string journal_line;
+    while (std::getline(journal_in, journal_line)) {
+        if (journal_line.size() < 5 || (journal_line[0] != 'R' && journal_line[0] != 'D')) {
+            std::string err_msg {"ERROR: malformed line '" + journal_line + "' in " + journal_fpath.string()};
+            throw std::runtime_error(err_msg);
+        }
+        JournalEntry entry;
+        entry.replaced = journal_line[0] == 'R';
+        entry.had_original = journal_line[2] == '1';
+        entry.rel_fpath = journal_line.substr(4);
+        entries.push_back(std::move(entry));
+    }
+    return true;
+}
+
+std::string RangeEditor::relative_fpath(const boost::filesystem::path& fpath) const
+{
+    //NOTE: every label file's path starts with the label directory's, see VideoLogger::make_filepath
+    std::string logdir_str = vlogger.get_logdir().string();
+    while (!logdir_str.empty() && logdir_str.back() == '/') {
+        logdir_str.pop_back();
+    }
+    const std::string fpath_str = fpath.string();
+    if (fpath_str.compare(0, logdir_str.size(), logdir_str) != 0) {
+        std::string err_msg {"ERROR: " + fpath_str + " isn't in the label directory " + logdir_str};
+        throw std::runtime_error(err_msg);
+    }
+    return fpath_str.substr(logdir_str.size() + 1);
+}
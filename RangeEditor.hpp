@@ -0,0 +1,112 @@
+#ifndef FISHLABELER_RANGEEDITOR_HPP
+#define FISHLABELER_RANGEEDITOR_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <QPoint>
+#include <QSize>
+#include <boost/filesystem.hpp>
+
+#include "VideoLogger.hpp"
+#include "WorkerPool.hpp"
+
+enum class RANGE_OP {
+    //give an instance's boxes / mask another instance ID (merging the mask into that instance's if it has one)
+    RELABEL,
+    DELETE_INSTANCE,
+    //move the boxes / masks by an offset, e.g. after the camera got bumped
+    SHIFT
+};
+
+struct RangeEdit {
+    RangeEdit()
+        : op(RANGE_OP::RELABEL), instance_id(0), new_instance_id(0), edit_bboxes(true), edit_masks(true)
+    {}
+
+    RANGE_OP op;
+    //the instance to edit, or ALL_INSTANCES (only for SHIFT)
+    int instance_id;
+    int new_instance_id;
+    QPoint offset;
+    bool edit_bboxes;
+    bool edit_masks;
+
+    static constexpr int ALL_INSTANCES = -1;
+};
+
+struct RangeEditStats {
+    RangeEditStats()
+        : num_frames(0), num_frames_changed(0), num_bboxes_changed(0), num_masks_changed(0)
+    {}
+
+    RangeEditStats& operator+=(const RangeEditStats& other) {
+        num_frames += other.num_frames;
+        num_frames_changed += other.num_frames_changed;
+        num_bboxes_changed += other.num_bboxes_changed;
+        num_masks_changed += other.num_masks_changed;
+        return *this;
+    }
+
+    int64_t num_frames;
+    int64_t num_frames_changed;
+    int64_t num_bboxes_changed;
+    int64_t num_masks_changed;
+};
+
+/* Applies one edit to the labels of a whole range of frames, as a transaction: either every frame gets the edit or
+ * none does, and the whole thing is a single undo step.
+ *
+ * The edited label files get written to the side first (across the worker pool), along with copies of the files
+ * they replace, under <label directory>/Transactions. Only once every frame's been edited does the journal get
+ * written and the new files renamed over the old ones, so an edit that fails part way through doesn't touch
+ * anything, and one that got interrupted while renaming gets finished the next time a RangeEditor is opened on the
+ * directory. The copies of the old files are kept until the next edit, for undo().
+ *
+ * NOTE: this works on what's on disk -- whoever has one of the frames open has to save it before and re-read it after.
+ */
+class RangeEditor
+{
+public:
+    //finishes (or rolls back) an edit that got interrupted
+    RangeEditor(VideoLogger& logger, WorkerPool& pool);
+
+    //frame_size is what shifted labels get clipped to (and the size of the rewritten masks)
+    RangeEditStats apply(const RangeEdit& edit, const std::vector<std::string>& frame_names, const QSize& frame_size);
+
+    bool can_undo() const;
+    //restore the frames the last apply() changed. NOTE: that includes anything written to them since then.
+    //Returns false if there's nothing to undo
+    bool undo();
+
+private:
+    //a label file the edit replaces (or removes), relative to the label directory
+    struct JournalEntry {
+        std::string rel_fpath;
+        bool replaced;
+        bool had_original;
+    };
+
+    RangeEditStats stage_frame(const RangeEdit& edit, const std::string& frame_name, const QSize& frame_size,
+            VideoLogger& staged_logger, std::vector<JournalEntry>& entries) const;
+    //back up the label files (if they exist), and note down what happens to each of them
+    void stage_files(const std::vector<boost::filesystem::path>& label_fpaths, std::vector<JournalEntry>& entries) const;
+
+    void write_journal(const boost::filesystem::path& txn_path, const std::string& state, const std::vector<JournalEntry>& entries) const;
+    bool read_journal(const boost::filesystem::path& txn_path, std::string& state, std::vector<JournalEntry>& entries) const;
+    //move the staged files into place. NOTE: can be re-run if it gets interrupted
+    void roll_forward(const std::vector<JournalEntry>& entries);
+    void restore_backup(const std::vector<JournalEntry>& entries);
+    void recover();
+
+    std::string relative_fpath(const boost::filesystem::path& fpath) const;
+
+    VideoLogger& vlogger;
+    WorkerPool& workers;
+    //the edit being staged, and the last one (kept for undo)
+    boost::filesystem::path pending_dir;
+    boost::filesystem::path last_dir;
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "ReviewQueue.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <unordered_map>
+
+ReviewQueue::~ReviewQueue()
+{
+    for (auto& cached_labels : label_cache) {
+        if (cached_labels.second.valid()) {
+            cached_labels.second.wait();
+        }
+    }
+}
+
+void ReviewQueue::build()
+{
+    auto start_time = std::chrono::steady_clock::now();
+
+    std::unordered_map<std::string, int> video_frame_indices;
+    video_frame_indices.reserve(vreader.get_num_frames());
+    for (int vidx = 0; vidx < vreader.get_num_frames(); vidx++) {
+        video_frame_indices.emplace(vreader.get_frame_name(vidx), vidx);
+    }
+
+    //one listing per label directory, flagging each labelled frame with what it has
+    std::map<int, uint8_t> labelled_frames;
+    auto add_frames = [&](const std::vector<std::string>& frame_names, const uint8_t label_kind) {
+        for (const auto& frame_name : frame_names) {
+            auto video_it = video_frame_indices.find(frame_name);
+            //NOTE: labels that don't match any of the video's frames can't be reviewed (see LabelValidator)
+            if (video_it != video_frame_indices.end()) {
+                labelled_frames[video_it->second] |= label_kind;
+            }
+        }
+    };
+    add_frames(vlogger.list_boundingbox_frames(), LABEL_BBOX);
+    add_frames(vlogger.list_annotated_frames(), LABEL_MASK);
+    add_frames(vlogger.list_textmetadata_frames(), LABEL_TEXT);
+
+    frame_indices.clear();
+    frame_label_kinds.clear();
+    frame_indices.reserve(labelled_frames.size());
+    frame_label_kinds.reserve(labelled_frames.size());
+    for (const auto& labelled_frame : labelled_frames) {
+        frame_indices.push_back(labelled_frame.first);
+        frame_label_kinds.push_back(labelled_frame.second);
+    }
+
+    auto build_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+    std::cout << "Found " << frame_indices.size() << " labelled frames to review in " << build_time.count() << " ms" << std::endl;
+}
+
+int ReviewQueue::next_frame(const int index) const
+{
+    auto next_it = std::upper_bound(frame_indices.begin(), frame_indices.end(), index);
+    return next_it != frame_indices.end() ? *next_it : -1;
+}
+
+int ReviewQueue::prev_frame(const int index) const
+{
+    auto prev_it = std::lower_bound(frame_indices.begin(), frame_indices.end(), index);
+    return prev_it != frame_indices.begin() ? *std::prev(prev_it) : -1;
+}
+
+int ReviewQueue::position(const int index) const
+{
+    auto frame_it = std::lower_bound(frame_indices.begin(), frame_indices.end(), index);
+    if (frame_it == frame_indices.end() || *frame_it != index) {
+        return -1;
+    }
+    return std::distance(frame_indices.begin(), frame_it);
+}
+
+uint8_t ReviewQueue::get_label_kinds(const int index) const
+{
+    const int pos = position(index);
+    return pos >= 0 ? frame_label_kinds[pos] : 0;
+}
+
+void ReviewQueue::mark_labelled(const int index, const uint8_t label_kinds)
+{
+    auto frame_it = std::lower_bound(frame_indices.begin(), frame_indices.end(), index);
+    const int pos = std::distance(frame_indices.begin(), frame_it);
+    if (frame_it != frame_indices.end() && *frame_it == index) {
+        frame_label_kinds[pos] |= label_kinds;
+    } else {
+        frame_indices.insert(frame_it, index);
+        frame_label_kinds.insert(frame_label_kinds.begin() + pos, label_kinds);
+    }
+
+    //whatever got prefetched for it is out of date now
+    auto cached_it = label_cache.find(index);
+    if (cached_it != label_cache.end()) {
+        cached_it->second.wait();
+        label_cache.erase(cached_it);
+    }
+}
+
+void ReviewQueue::prefetch(const int index, const int direction)
+{
+    std::vector<int> upcoming_frames;
+    int upcoming_index = index;
+    for (int i = 0; i < prefetch_depth; i++) {
+        upcoming_index = direction < 0 ? prev_frame(upcoming_index) : next_frame(upcoming_index);
+        if (upcoming_index < 0) {
+            break;
+        }
+        upcoming_frames.push_back(upcoming_index);
+    }
+
+    //drop (finished) label reads that we've moved away from, s.t. the cache stays a handful of frames
+    for (auto cache_it = label_cache.begin(); cache_it != label_cache.end(); ) {
+        const bool upcoming = std::find(upcoming_frames.begin(), upcoming_frames.end(), cache_it->first) != upcoming_frames.end();
+        if (!upcoming && cache_it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+            cache_it = label_cache.erase(cache_it);
+        } else {
+            cache_it++;
+        }
+    }
+
+    vreader.prefetch_frames(upcoming_frames);
+    for (const int upcoming_frame : upcoming_frames) {
+        if (label_cache.find(upcoming_frame) != label_cache.end()) {
+            continue;
+        }
+        //NOTE: the name gets copied, the logger is safe to reference since we wait on the reads before going away
+        const std::string frame_name = vreader.get_frame_name(upcoming_frame);
+        const uint8_t label_kinds = get_label_kinds(upcoming_frame);
+        const VideoLogger* logger = &vlogger;
+        label_cache.emplace(upcoming_frame, workers.submit([logger, frame_name, label_kinds]{
+            return read_labels(*logger, frame_name, label_kinds);
+        }));
+    }
+}
+
+FrameLabels ReviewQueue::get_labels(const int index)
+{
+    auto cached_it = label_cache.find(index);
+    if (cached_it != label_cache.end()) {
+        //blocks if the worker hasn't finished reading them yet
+        FrameLabels frame_labels = cached_it->second.get();
+        label_cache.erase(cached_it);
+        return frame_labels;
+    }
+    return read_labels(vlogger, vreader.get_frame_name(index), get_label_kinds(index));
+}
+
+FrameLabels ReviewQueue::read_labels(const VideoLogger& vlogger, const std::string& frame_name, const uint8_t label_kinds)
+{
+    FrameLabels frame_labels;
+    frame_labels.label_kinds = label_kinds;
+    if (label_kinds & LABEL_BBOX) {
+        try {
+            frame_labels.bboxes = vlogger.get_boundingboxes(frame_name);
+        } catch (const std::runtime_error& err) {
+            std::cout << err.what() << std::endl;
+        }
+    }
+    if (label_kinds & LABEL_MASK) {
+        try {
+            frame_labels.segm_points = vlogger.get_annotations(frame_name);
+        } catch (const std::runtime_error& err) {
+            std::cout << err.what() << std::endl;
+        }
+    }
+    if (label_kinds & LABEL_TEXT) {
+        frame_labels.text = vlogger.get_textmetadata(frame_name);
+    }
+    return frame_labels;
+}
@@ -0,0 +1,97 @@
+#ifndef FISHLABELER_REVIEWQUEUE_HPP
+#define FISHLABELER_REVIEWQUEUE_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <map>
+#include <future>
+
+#include "AnnotationTypes.hpp"
+#include "VideoLogger.hpp"
+#include "VideoReader.hpp"
+#include "WorkerPool.hpp"
+
+//which kinds of labels a frame has on disk (as a bitmask)
+enum LABEL_KIND : uint8_t {
+    LABEL_BBOX = 1 << 0,
+    LABEL_MASK = 1 << 1,
+    LABEL_TEXT = 1 << 2
+};
+
+//everything the UI loads for a labelled frame
+struct FrameLabels {
+    FrameLabels()
+        : label_kinds(0)
+    {}
+
+    uint8_t label_kinds;
+    std::vector<BoundingBoxMD> bboxes;
+    std::vector<PixelLabelMB> segm_points;
+    std::string text;
+};
+
+/* The labelled frames of a video in frame order, for QA passes that only visit frames with labels. The set gets
+ * built from a single listing of each label directory (rather than checking every frame's files), after which
+ * the next / previous labelled frame is a binary search away.
+ *
+ * Moving through the queue prefetches the next few labelled frames in the direction of travel: the frames get
+ * decoded through the reader's cache, and their labels get read on the worker pool, s.t. both are (usually)
+ * ready by the time the reviewer gets there.
+ */
+class ReviewQueue
+{
+public:
+    ReviewQueue(const VideoLogger& logger, VideoReader& reader, WorkerPool& pool, const int depth = 4)
+        : vlogger(logger), vreader(reader), workers(pool), prefetch_depth(depth)
+    {
+        build();
+    }
+
+    //NOTE: waits on any label reads still in flight, they hold onto the logger
+    ~ReviewQueue();
+
+    ReviewQueue(const ReviewQueue&) = delete;
+    ReviewQueue& operator=(const ReviewQueue&) = delete;
+
+    int get_num_frames() const {
+        return frame_indices.size();
+    }
+
+    //the closest labelled frame after / before the given frame, or -1 if there isn't one
+    int next_frame(const int index) const;
+    int prev_frame(const int index) const;
+
+    //the frame's position in the queue (e.g. for 'labelled frame 3 / 120'), or -1 if it isn't labelled
+    int position(const int index) const;
+
+    uint8_t get_label_kinds(const int index) const;
+
+    //the user has written labels for the frame, s.t. it's in the queue from here on and nothing stale gets served
+    void mark_labelled(const int index, const uint8_t label_kinds);
+
+    //prefetch the next prefetch_depth labelled frames after (direction > 0) or before (direction < 0) the frame
+    void prefetch(const int index, const int direction);
+
+    //the frame's labels -- straight out of the prefetch if it's been queued, otherwise read right away. NOTE: only
+    //reads the kinds of labels the frame is known to have, an unlabelled frame doesn't touch the disk at all
+    FrameLabels get_labels(const int index);
+
+private:
+    void build();
+    static FrameLabels read_labels(const VideoLogger& vlogger, const std::string& frame_name, const uint8_t label_kinds);
+
+    const VideoLogger& vlogger;
+    VideoReader& vreader;
+    WorkerPool& workers;
+    const int prefetch_depth;
+
+    //the labelled frames' video indices (sorted) and what each one has
+    std::vector<int> frame_indices;
+    std::vector<uint8_t> frame_label_kinds;
+
+    //NOTE: only touched from the UI thread, the workers just fill in the futures
+    std::map<int, std::future<FrameLabels>> label_cache;
+};
+
+#endif
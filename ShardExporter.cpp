@@ -0,0 +1,329 @@
+#include "ShardExporter.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <deque>
+#include <future>
+#include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+
+#include <boost/algorithm/string.hpp>
+#include <opencv2/opencv.hpp>
+
+namespace {
+    constexpr char SHARD_MAGIC[4] = {'F', 'L', 'S', 'H'};
+    constexpr char SHARD_TRAILER_MAGIC[4] = {'F', 'L', 'S', 'X'};
+
+    template <typename T>
+    void append_value(std::vector<char>& bytes, const T value)
+    {
+        const char* value_bytes = reinterpret_cast<const char*>(&value);
+        bytes.insert(bytes.end(), value_bytes, value_bytes + sizeof(T));
+    }
+
+    template <typename T>
+    void append_buffer(std::vector<char>& bytes, const std::vector<T>& buffer)
+    {
+        append_value(bytes, static_cast<uint32_t>(buffer.size() * sizeof(T)));
+        const char* buffer_bytes = reinterpret_cast<const char*>(buffer.data());
+        bytes.insert(bytes.end(), buffer_bytes, buffer_bytes + buffer.size() * sizeof(T));
+    }
+
+    std::vector<uchar> read_file_bytes(const std::string& fpath)
+    {
+        std::ifstream fin(fpath, std::ios::binary);
+        fin.seekg(0, std::ios::end);
+        const auto fsize = static_cast<size_t>(fin.tellg());
+        fin.seekg(0, std::ios::beg);
+        std::vector<uchar> file_bytes(fsize);
+        fin.read(reinterpret_cast<char*>(file_bytes.data()), fsize);
+        if (!fin) {
+            std::string err_msg {"ERROR: couldn't read " + fpath};
+            throw std::runtime_error(err_msg);
+        }
+        return file_bytes;
+    }
+
+    //a label mask's PNG as-is, or resized to the exported frame's size
+    std::vector<uchar> encode_mask(const std::string& mask_fpath, const double scale, const int width, const int height)
+    {
+        if (scale == 1.0) {
+            return read_file_bytes(mask_fpath);
+        }
+        cv::Mat frame_mask = cv::imread(mask_fpath, cv::IMREAD_UNCHANGED);
+        if (frame_mask.empty()) {
+            std::string err_msg {"ERROR: couldn't read the mask " + mask_fpath};
+            throw std::runtime_error(err_msg);
+        }
+        cv::Mat export_mask;
+        //NOTE: nearest neighbour, the pixels are instance (or class) IDs
+        cv::resize(frame_mask, export_mask, cv::Size(width, height), 0, 0, cv::INTER_NEAREST);
+        std::vector<uchar> mask_bytes;
+        cv::imencode(".png", export_mask, mask_bytes);
+        return mask_bytes;
+    }
+}
+
+constexpr uint32_t ShardExporter::SHARD_VERSION;
+
+ShardExporter::EncodedRecord ShardExporter::encode_record(const FrameSource& frames, const int frame_index, const std::string& frame_name,
+                                                          const VideoLogger& vlogger, const ExportOptions& options)
+{
+    EncodedRecord record;
+    record.frame_index = frame_index;
+
+    const std::string& frame_fpath = frames.get_frame_path(frame_index);
+    //NOTE: only reads the header (if it's not out of the archive)
+    const QSize frame_size = frames.get_frame_size(frame_index);
+    if (!frame_size.isValid()) {
+        std::string err_msg {"ERROR: couldn't read the frame " + frame_fpath};
+        throw std::runtime_error(err_msg);
+    }
+    const int frame_max_dim = std::max(frame_size.width(), frame_size.height());
+    const double scale = (options.max_dim > 0 && frame_max_dim > options.max_dim) ? static_cast<double>(options.max_dim) / frame_max_dim : 1.0;
+
+    //JPEGs that don't need resizing go in as-is, which saves both the decode and a lossy re-encode. NOTE: only if
+    //they're still around, a packed video's frames can have been removed
+    std::vector<uchar> image_bytes;
+    int width = frame_size.width();
+    int height = frame_size.height();
+    const auto fext = boost::algorithm::to_lower_copy(boost::filesystem::path(frame_fpath).extension().string());
+    if (scale == 1.0 && (fext == ".jpg" || fext == ".jpeg") && boost::filesystem::exists(frame_fpath)) {
+        image_bytes = read_file_bytes(frame_fpath);
+    } else {
+        cv::Mat frame = frames.read(frame_index).as_mat();
+        if (frame.empty()) {
+            std::string err_msg {"ERROR: couldn't decode the frame " + frame_fpath};
+            throw std::runtime_error(err_msg);
+        }
+        cv::Mat export_frame;
+        if (scale < 1.0) {
+            cv::resize(frame, export_frame, cv::Size(), scale, scale, cv::INTER_AREA);
+        } else {
+            export_frame = frame;
+        }
+        //NOTE: the frame buffer is RGB (or BGRA), imencode wants BGR (and this also gets us a copy we're allowed to write to)
+        cv::Mat bgr_frame;
+        if (export_frame.channels() == 1) {
+            cv::cvtColor(export_frame, bgr_frame, cv::COLOR_GRAY2BGR);
+        } else if (export_frame.channels() == 4) {
+            cv::cvtColor(export_frame, bgr_frame, cv::COLOR_BGRA2BGR);
+        } else {
+            cv::cvtColor(export_frame, bgr_frame, cv::COLOR_RGB2BGR);
+        }
+        const std::vector<int> encode_params {cv::IMWRITE_JPEG_QUALITY, options.jpeg_quality};
+        cv::imencode(".jpg", bgr_frame, image_bytes, encode_params);
+        width = bgr_frame.cols;
+        height = bgr_frame.rows;
+        record.reencoded = true;
+    }
+
+    std::vector<int32_t> bbox_records;
+    if (vlogger.has_boundingbox(frame_name)) {
+        int tl_x, tl_y, br_x, br_y;
+        for (const auto& bbox_md : vlogger.get_boundingboxes(frame_name)) {
+            bbox_md.bbox.getCoords(&tl_x, &tl_y, &br_x, &br_y);
+            bbox_records.insert(bbox_records.end(), {bbox_md.instance_id,
+                static_cast<int32_t>(std::lround(tl_x * scale)), static_cast<int32_t>(std::lround(tl_y * scale)),
+                static_cast<int32_t>(std::lround(br_x * scale)), static_cast<int32_t>(std::lround(br_y * scale))});
+        }
+    }
+
+    //same as the frame, the mask PNGs go in as-is unless they need resizing. NOTE: the class mask only exists if
+    //some of the frame's instances have a class
+    std::vector<uchar> mask_bytes;
+    std::vector<uchar> class_mask_bytes;
+    if (vlogger.has_annotations(frame_name)) {
+        mask_bytes = encode_mask(vlogger.get_annotation_filepath(frame_name).string(), scale, width, height);
+        const auto class_fpath = vlogger.get_class_filepath(frame_name);
+        if (boost::filesystem::exists(class_fpath)) {
+            class_mask_bytes = encode_mask(class_fpath.string(), scale, width, height);
+        }
+    }
+
+    //the record's size goes in front once we know it
+    auto& bytes = record.bytes;
+    bytes.reserve(64 + frame_name.size() + image_bytes.size() + bbox_records.size() * sizeof(int32_t) + mask_bytes.size() + class_mask_bytes.size());
+    append_value(bytes, uint32_t(0));
+    append_value(bytes, static_cast<uint32_t>(frame_index));
+    append_value(bytes, static_cast<uint16_t>(frame_name.size()));
+    bytes.insert(bytes.end(), frame_name.begin(), frame_name.end());
+    append_value(bytes, static_cast<uint32_t>(width));
+    append_value(bytes, static_cast<uint32_t>(height));
+    append_buffer(bytes, image_bytes);
+    append_value(bytes, static_cast<uint32_t>(bbox_records.size() / 5));
+    const char* bbox_bytes = reinterpret_cast<const char*>(bbox_records.data());
+    bytes.insert(bytes.end(), bbox_bytes, bbox_bytes + bbox_records.size() * sizeof(int32_t));
+    append_buffer(bytes, mask_bytes);
+    append_buffer(bytes, class_mask_bytes);
+    const uint32_t record_sz = bytes.size() - sizeof(uint32_t);
+    std::copy_n(reinterpret_cast<const char*>(&record_sz), sizeof(record_sz), bytes.begin());
+    return record;
+}
+
+ExportStats ShardExporter::export_shards(const std::string& out_dir)
+{
+    auto start_time = std::chrono::steady_clock::now();
+    stats = ExportStats();
+    shard_num = 0;
+
+    //figure out which frames are going in (in frame order)
+    std::vector<int> frame_indices;
+    const int num_frames = vreader.get_num_frames();
+    if (options.labelled_only) {
+        std::unordered_map<std::string, int> frame_lookup;
+        for (int fidx = 0; fidx < num_frames; fidx++) {
+            frame_lookup.emplace(vreader.get_frame_name(fidx), fidx);
+        }
+        auto labelled_frames = vlogger.list_boundingbox_frames();
+        auto annotated_frames = vlogger.list_annotated_frames();
+        labelled_frames.insert(labelled_frames.end(), annotated_frames.begin(), annotated_frames.end());
+        for (const auto& frame_name : labelled_frames) {
+            auto frame_it = frame_lookup.find(frame_name);
+            if (frame_it != frame_lookup.end()) {
+                frame_indices.push_back(frame_it->second);
+            } else {
+                std::cout << "labels for " << frame_name << " don't match any of the video's frames, skipping them" << std::endl;
+            }
+        }
+        std::sort(frame_indices.begin(), frame_indices.end());
+        frame_indices.erase(std::unique(frame_indices.begin(), frame_indices.end()), frame_indices.end());
+    } else {
+        frame_indices.resize(num_frames);
+        for (int fidx = 0; fidx < num_frames; fidx++) {
+            frame_indices[fidx] = fidx;
+        }
+    }
+
+    shard_dir = out_dir;
+    boost::filesystem::create_directories(shard_dir);
+    manifest_out.open((shard_dir / "shards.txt").string(), std::ios::trunc);
+    if (!manifest_out) {
+        std::string err_msg {"ERROR: couldn't write to export directory " + out_dir};
+        throw std::runtime_error(err_msg);
+    }
+
+    //encode a bounded number of records ahead on the pool, and write them out in order as they finish
+    const size_t max_in_flight = 4 * workers.num_threads();
+    std::deque<std::future<EncodedRecord>> in_flight;
+    size_t next_frame = 0;
+    try {
+        while (next_frame < frame_indices.size() || !in_flight.empty()) {
+            while (next_frame < frame_indices.size() && in_flight.size() < max_in_flight) {
+                const int frame_index = frame_indices[next_frame++];
+                const std::string frame_name = vreader.get_frame_name(frame_index);
+                const FrameSource& frames = vreader.get_frame_source();
+                const VideoLogger& logger = vlogger;
+                const ExportOptions& opts = options;
+                in_flight.push_back(workers.submit([&frames, frame_index, frame_name, &logger, &opts]{
+                    try {
+                        return encode_record(frames, frame_index, frame_name, logger, opts);
+                    } catch (const std::exception& err) {
+                        std::cout << "couldn't export frame " << frame_name << ": " << err.what() << std::endl;
+                        return EncodedRecord();
+                    }
+                }));
+            }
+
+            auto record = in_flight.front().get();
+            in_flight.pop_front();
+            if (record.bytes.empty()) {
+                stats.num_failed++;
+                continue;
+            }
+            write_record(record);
+        }
+        if (shard_out.is_open()) {
+            close_shard();
+        }
+    } catch (...) {
+        //the jobs reference the logger and options, so they have to be done before we bail
+        for (auto& record_future : in_flight) {
+            record_future.wait();
+        }
+        throw;
+    }
+    manifest_out.close();
+
+    auto export_time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time);
+    std::cout << "Exported " << stats.num_records << " frames (" << stats.num_reencoded << " re-encoded, " << stats.num_failed << " failed) into "
+              << stats.num_shards << " shards, " << stats.num_bytes / (1024*1024) << " MB in " << export_time.count() << " ms" << std::endl;
+    return stats;
+}
+
+void ShardExporter::write_record(const EncodedRecord& record)
+{
+    //start a new shard if this record would push the current one over either limit
+    const bool shard_full = !shard_index.empty() && (static_cast<int>(shard_index.size()) >= options.records_per_shard ||
+                            static_cast<int64_t>(shard_bytes + record.bytes.size()) > options.max_shard_bytes);
+    if (shard_full) {
+        close_shard();
+    }
+    if (!shard_out.is_open()) {
+        open_shard();
+        shard_first_frame = record.frame_index;
+    }
+
+    shard_out.write(record.bytes.data(), record.bytes.size());
+    shard_index.emplace_back(shard_bytes, static_cast<uint32_t>(record.bytes.size()));
+    shard_bytes += record.bytes.size();
+    shard_last_frame = record.frame_index;
+    stats.num_records++;
+    stats.num_reencoded += record.reencoded ? 1 : 0;
+}
+
+void ShardExporter::open_shard()
+{
+    char shard_fname[32];
+    std::snprintf(shard_fname, sizeof(shard_fname), "shard-%05d.flsh", shard_num);
+    shard_fpath = shard_dir / shard_fname;
+
+    //written to the side and moved into place when it's done, s.t. a loader never sees a partial shard
+    auto tmp_fpath = shard_fpath;
+    tmp_fpath += ".tmp";
+    shard_out.open(tmp_fpath.string(), std::ios::binary | std::ios::trunc);
+    if (!shard_out) {
+        std::string err_msg {"ERROR: couldn't create shard " + tmp_fpath.string()};
+        throw std::runtime_error(err_msg);
+    }
+
+    const uint32_t shard_number = shard_num;
+    const uint32_t reserved = 0;
+    shard_out.write(SHARD_MAGIC, sizeof(SHARD_MAGIC));
+    shard_out.write(reinterpret_cast<const char*>(&SHARD_VERSION), sizeof(SHARD_VERSION));
+    shard_out.write(reinterpret_cast<const char*>(&shard_number), sizeof(shard_number));
+    shard_out.write(reinterpret_cast<const char*>(&reserved), sizeof(reserved));
+    shard_bytes = sizeof(SHARD_MAGIC) + sizeof(SHARD_VERSION) + sizeof(shard_number) + sizeof(reserved);
+    shard_index.clear();
+}
+
+void ShardExporter::close_shard()
+{
+    const uint64_t index_offset = shard_bytes;
+    const uint32_t num_records = shard_index.size();
+    shard_out.write(reinterpret_cast<const char*>(&num_records), sizeof(num_records));
+    for (const auto& index_entry : shard_index) {
+        shard_out.write(reinterpret_cast<const char*>(&index_entry.first), sizeof(index_entry.first));
+        shard_out.write(reinterpret_cast<const char*>(&index_entry.second), sizeof(index_entry.second));
+    }
+    shard_out.write(reinterpret_cast<const char*>(&index_offset), sizeof(index_offset));
+    shard_out.write(SHARD_TRAILER_MAGIC, sizeof(SHARD_TRAILER_MAGIC));
+    shard_out.close();
+    if (!shard_out) {
+        std::string err_msg {"ERROR: failed writing shard " + shard_fpath.string()};
+        throw std::runtime_error(err_msg);
+    }
+
+    auto tmp_fpath = shard_fpath;
+    tmp_fpath += ".tmp";
+    boost::filesystem::rename(tmp_fpath, shard_fpath);
+    manifest_out << shard_fpath.filename().string() << ", " << num_records << ", " << shard_first_frame << ", " << shard_last_frame << std::endl;
+
+    stats.num_shards++;
+    stats.num_bytes += index_offset + sizeof(num_records) + num_records * (sizeof(uint64_t) + sizeof(uint32_t)) + sizeof(index_offset) + sizeof(SHARD_TRAILER_MAGIC);
+    shard_num++;
+    shard_index.clear();
+}
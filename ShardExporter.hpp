@@ -0,0 +1,109 @@
+#ifndef FISHLABELER_SHARDEXPORTER_HPP
+#define FISHLABELER_SHARDEXPORTER_HPP
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <utility>
+
+#include <boost/filesystem.hpp>
+
+#include "VideoReader.hpp"
+#include "VideoLogger.hpp"
+#include "WorkerPool.hpp"
+
+struct ExportOptions {
+    ExportOptions()
+        : records_per_shard(2048), max_shard_bytes(int64_t(1) << 30), jpeg_quality(95), max_dim(0), labelled_only(true)
+    {}
+
+    //a shard gets closed off once it hits either limit
+    int records_per_shard;
+    int64_t max_shard_bytes;
+    //only used for frames that need re-encoding (i.e. non-JPEG sources, or when resizing)
+    int jpeg_quality;
+    //downscale frames s.t. their longest side is at most this (0 keeps the original size). Boxes and masks get scaled along
+    int max_dim;
+    //export only the frames with boxes or a mask, versus every frame of the video
+    bool labelled_only;
+};
+
+struct ExportStats {
+    ExportStats()
+        : num_records(0), num_shards(0), num_bytes(0), num_reencoded(0), num_failed(0)
+    {}
+
+    int64_t num_records;
+    int64_t num_shards;
+    int64_t num_bytes;
+    //frames that had to be decoded and encoded again, as opposed to copied straight from the source JPEG
+    int64_t num_reencoded;
+    int64_t num_failed;
+};
+
+/* Packs a video's (labelled) frames into a few large shard files for training, rather than millions of small ones.
+ * Each shard file is
+ *   header:  "FLSH" | uint32 version | uint32 shard number | uint32 0
+ *   records: uint32 #bytes (of the rest of the record) | uint32 frame index | uint16 name length | name
+ *            | uint32 width | uint32 height | uint32 #image bytes | JPEG
+ *            | uint32 #boxes | #boxes x int32 (id, tl_x, tl_y, br_x, br_y)
+ *            | uint32 #mask bytes | PNG instance mask (0 bytes if the frame has no mask)
+ *            | uint32 #class mask bytes | PNG class mask (0 bytes if none of the frame's instances has a class)
+ *   index:   uint32 #records | #records x (uint64 record offset, uint32 record size)
+ *   trailer: uint64 index offset | "FLSX"
+ * all in native byte order, s.t. a loader can either stream through the records or jump around with the index.
+ * A shards.txt manifest next to the shards lists every shard's name, record count and frame range.
+ *
+ * The records get encoded on the worker pool (a bounded number of frames ahead) and written out in frame order.
+ */
+class ShardExporter
+{
+public:
+    ShardExporter(const VideoReader& reader, const VideoLogger& logger, WorkerPool& pool, const ExportOptions& opts = ExportOptions())
+        : vreader(reader), vlogger(logger), workers(pool), options(opts), shard_num(0), shard_bytes(0), shard_first_frame(-1), shard_last_frame(-1)
+    {}
+
+    ExportStats export_shards(const std::string& out_dir);
+
+    //NOTE: version 2 added the class mask
+    static constexpr uint32_t SHARD_VERSION = 2;
+
+private:
+    //a serialized record, ready to go straight into the shard
+    struct EncodedRecord {
+        EncodedRecord()
+            : frame_index(-1), reencoded(false)
+        {}
+
+        int frame_index;
+        bool reencoded;
+        std::vector<char> bytes;
+    };
+
+    static EncodedRecord encode_record(const FrameSource& frames, const int frame_index, const std::string& frame_name,
+                                       const VideoLogger& vlogger, const ExportOptions& options);
+
+    void open_shard();
+    void close_shard();
+    void write_record(const EncodedRecord& record);
+
+    const VideoReader& vreader;
+    const VideoLogger& vlogger;
+    WorkerPool& workers;
+    const ExportOptions options;
+    ExportStats stats;
+
+    boost::filesystem::path shard_dir;
+    std::ofstream shard_out;
+    std::ofstream manifest_out;
+    boost::filesystem::path shard_fpath;
+    int shard_num;
+    uint64_t shard_bytes;
+    //the current shard's index, i.e. (offset, size) of each record
+    std::vector<std::pair<uint64_t, uint32_t>> shard_index;
+    int shard_first_frame;
+    int shard_last_frame;
+};
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef FISHLABELER_SHAREDLIST_HPP
+#define FISHLABELER_SHAREDLIST_HPP
+
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+/* A copy-on-write vector: copies share the elements until one of them gets modified, at which point that copy
+ * detaches (copies the vector) and the others keep seeing the elements as they were. Copying a SharedList is
+ * just a reference count bump, so handing a frame's labels around (to be saved, to the undo history, carried
+ * over to the next frame, ...) doesn't copy any of them.
+ *
+ * NOTE: detaching copies the elements themselves, so elements that are expensive to copy should be cheap to copy
+ * as well (e.g. SpanMask shares its spans the same way).
+ */
+template <typename T>
+class SharedList
+{
+public:
+    using const_iterator = typename std::vector<T>::const_iterator;
+
+    SharedList() {}
+
+    SharedList(std::vector<T>&& elements)
+        : storage(std::make_shared<std::vector<T>>(std::move(elements)))
+    {}
+
+    const std::vector<T>& get() const {
+        return storage ? *storage : empty_list();
+    }
+
+    size_t size() const {
+        return storage ? storage->size() : 0;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    const T& operator[](const size_t idx) const {
+        return (*storage)[idx];
+    }
+
+    const_iterator begin() const {
+        return get().begin();
+    }
+
+    const_iterator end() const {
+        return get().end();
+    }
+
+    //write access, copying the elements first if anyone else can see them
+    std::vector<T>& edit() {
+        if (!storage) {
+            storage = std::make_shared<std::vector<T>>();
+        } else if (storage.use_count() > 1) {
+            storage = std::make_shared<std::vector<T>>(*storage);
+        }
+        return *storage;
+    }
+
+    void clear() {
+        storage.reset();
+    }
+
+private:
+    static const std::vector<T>& empty_list() {
+        static const std::vector<T> no_elements;
+        return no_elements;
+    }
+
+    std::shared_ptr<std::vector<T>> storage;
+};
+
+#endif
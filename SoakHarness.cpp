@@ -0,0 +1,335 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <array>
+#include <vector>
+#include <memory>
+#include <random>
+#include <algorithm>
+#include <chrono>
+
+#include <unistd.h>
+#include <malloc.h>
+
+#include <QApplication>
+#include <QCommandLineParser>
+#include <QGraphicsView>
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QWheelEvent>
+#include <QTimer>
+#include <boost/filesystem.hpp>
+#include <opencv2/opencv.hpp>
+
+#include "VideoWindow.hpp"
+
+/* Memory soak test for long labelling sessions: runs the real labeler window (on Qt's offscreen platform by
+ * default) and drives it with a long random sequence of the user's actions, i.e.
+ *   next / previous frame, drawing boxes and brush strokes (or polygon clicks, fills and erasing), zooming in and
+ *   out, undo / redo, switching label modes / tools and toggling review mode
+ * through the same key, mouse and wheel events the user would generate. RSS and malloc's heap statistics get
+ * sampled as it goes, and it fails (exit code 1) if either of them grew by more than the limits once the session
+ * has warmed up (i.e. the caches have filled up).
+ *
+ *   FishSoak [--frames <frame directory>] [--actions N] [--sample-every N] [--csv <samples.csv>]
+ *            [--max-rss-growth MB] [--max-heap-growth MB] [--seed S] [--verbose]
+ *
+ * Without --frames it makes (and removes) a synthetic video in the temp directory. NOTE: labels get written into
+ * the frame directory, so don't point it at a video with labels you want to keep.
+ */
+
+namespace {
+    //swallows everything written to it
+    class NullBuffer : public std::streambuf
+    {
+    protected:
+        int overflow(int c) override {
+            return c;
+        }
+    };
+
+    struct MemorySample {
+        int64_t action;
+        double elapsed_s;
+        int64_t rss_kb;
+        //bytes malloc has handed out and not gotten back, versus everything it's holding onto
+        int64_t heap_used_kb;
+        int64_t heap_total_kb;
+    };
+
+    MemorySample sample_memory(const int64_t action, const double elapsed_s)
+    {
+        MemorySample sample {action, elapsed_s, 0, 0, 0};
+        //statm is in pages: total program size, then the resident set
+        std::ifstream statm_in("/proc/self/statm");
+        int64_t num_pages = 0, num_resident_pages = 0;
+        if (statm_in >> num_pages >> num_resident_pages) {
+            sample.rss_kb = num_resident_pages * (sysconf(_SC_PAGESIZE) / 1024);
+        }
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+        const auto heap_info = mallinfo2();
+#else
+        //NOTE: the older mallinfo's fields are ints, which wrap past 2 GB
+        const auto heap_info = mallinfo();
+#endif
+        sample.heap_used_kb = static_cast<int64_t>(heap_info.uordblks + heap_info.hblkhd) / 1024;
+        sample.heap_total_kb = static_cast<int64_t>(heap_info.arena + heap_info.hblkhd) / 1024;
+        return sample;
+    }
+
+    //a video of noisy gradient frames (s.t. they're not trivial to decode), with an info.txt for the fps
+    void make_synthetic_video(const boost::filesystem::path& frame_dir, const int num_frames, const int width, const int height)
+    {
+        boost::filesystem::create_directories(frame_dir);
+        std::ofstream info_out((frame_dir / "info.txt").string());
+        info_out << "Stream #0:0: Video: mjpeg, yuvj420p, " << width << "x" << height << ", 25 fps, 25 tbr" << std::endl;
+
+        cv::Mat frame (height, width, CV_8UC3);
+        cv::RNG rng (42);
+        for (int fidx = 0; fidx < num_frames; fidx++) {
+            for (int row = 0; row < height; row++) {
+                auto row_ptr = frame.ptr<cv::Vec3b>(row);
+                for (int col = 0; col < width; col++) {
+                    row_ptr[col] = cv::Vec3b((col + fidx) & 0xFF, (row + 2*fidx) & 0xFF, (col + row) & 0xFF);
+                }
+            }
+            cv::Mat noise (height, width, CV_8UC3);
+            rng.fill(noise, cv::RNG::UNIFORM, 0, 32);
+            cv::add(frame, noise, frame);
+
+            std::ostringstream fname;
+            fname.width(6);
+            fname.fill('0');
+            fname << fidx+1 << ".jpg";
+            cv::imwrite((frame_dir / fname.str()).string(), frame);
+        }
+    }
+
+    /* Plays the user: picks the next action at random and sends the window the events it'd get for it */
+    class SoakDriver
+    {
+    public:
+        SoakDriver(VideoWindow& window, const int seed)
+            : video_window(window), frame_view(window.findChild<QGraphicsView*>()), rng(seed),
+              //roughly how often each action comes up, with navigation and drawing the most common
+              action_dist({30, 15, 20, 10, 10, 4, 4, 4, 2})
+        {
+            if (!frame_view) {
+                throw std::runtime_error("ERROR: couldn't find the window's frame view");
+            }
+        }
+
+        void run_action() {
+            switch (action_dist(rng)) {
+                case 0: press_key(&video_window, Qt::Key_N); break;
+                case 1: press_key(&video_window, Qt::Key_P); break;
+                case 2: draw(); break;
+                case 3: zoom(120); break;
+                case 4: zoom(-120); break;
+                case 5: press_key(frame_view, Qt::Key_Z, Qt::ControlModifier); break;
+                case 6: press_key(frame_view, Qt::Key_R, Qt::ControlModifier); break;
+                case 7: switch_tool(); break;
+                case 8: press_key(&video_window, Qt::Key_L); break;
+            }
+        }
+
+    private:
+        void press_key(QWidget* receiver, const int key, const Qt::KeyboardModifiers modifiers = Qt::NoModifier) {
+            QKeyEvent press_evt (QEvent::KeyPress, key, modifiers);
+            QApplication::sendEvent(receiver, &press_evt);
+            QKeyEvent release_evt (QEvent::KeyRelease, key, modifiers);
+            QApplication::sendEvent(receiver, &release_evt);
+        }
+
+        QPointF random_point() {
+            const QSize view_sz = frame_view->viewport()->size();
+            std::uniform_real_distribution<double> x_dist (0, std::max(view_sz.width()-1, 1));
+            std::uniform_real_distribution<double> y_dist (0, std::max(view_sz.height()-1, 1));
+            return QPointF(x_dist(rng), y_dist(rng));
+        }
+
+        //boxes, or one of the segmentation tools (brush, polygon, flood fill, eraser)
+        void switch_tool() {
+            static const std::array<int, 5> tool_keys = {{Qt::Key_B, Qt::Key_S, Qt::Key_G, Qt::Key_F, Qt::Key_E}};
+            press_key(frame_view, tool_keys[std::uniform_int_distribution<int>(0, tool_keys.size()-1)(rng)], Qt::ControlModifier);
+        }
+
+        //a drag across the view -- a box or a brush stroke, depending on which mode the scene's in
+        void draw() {
+            QWidget* viewport = frame_view->viewport();
+            QPointF pos = random_point();
+            const QPointF end_pos = random_point();
+            QMouseEvent press_evt (QEvent::MouseButtonPress, pos, Qt::LeftButton, Qt::LeftButton, Qt::NoModifier);
+            QApplication::sendEvent(viewport, &press_evt);
+            const int num_moves = std::uniform_int_distribution<int>(2, 20)(rng);
+            for (int i = 1; i <= num_moves; i++) {
+                pos += (end_pos - pos) / (num_moves - i + 1);
+                QMouseEvent move_evt (QEvent::MouseMove, pos, Qt::NoButton, Qt::LeftButton, Qt::NoModifier);
+                QApplication::sendEvent(viewport, &move_evt);
+            }
+            QMouseEvent release_evt (QEvent::MouseButtonRelease, end_pos, Qt::LeftButton, Qt::NoButton, Qt::NoModifier);
+            QApplication::sendEvent(viewport, &release_evt);
+        }
+
+        //control + scroll, same as the user zooms
+        void zoom(const int delta) {
+            const QPointF pos = random_point();
+#if QT_VERSION >= QT_VERSION_CHECK(5, 12, 0)
+            QWheelEvent wheel_evt (pos, frame_view->viewport()->mapToGlobal(pos.toPoint()), QPoint(), QPoint(0, delta),
+                    Qt::NoButton, Qt::ControlModifier, Qt::NoScrollPhase, false);
+#else
+            QWheelEvent wheel_evt (pos, delta, Qt::NoButton, Qt::ControlModifier);
+#endif
+            QApplication::sendEvent(frame_view->viewport(), &wheel_evt);
+        }
+
+        VideoWindow& video_window;
+        QGraphicsView* frame_view;
+        std::mt19937 rng;
+        std::discrete_distribution<int> action_dist;
+    };
+
+    //how much the given field grew from the baseline to the (worst of the) tail end of the run
+    template <typename FieldFn>
+    int64_t memory_growth_kb(const std::vector<MemorySample>& samples, const size_t baseline_idx, FieldFn field)
+    {
+        const size_t tail_begin = std::max(baseline_idx, samples.size() - std::max<size_t>(samples.size() / 4, 1));
+        int64_t tail_max = 0;
+        for (size_t sidx = tail_begin; sidx < samples.size(); sidx++) {
+            tail_max = std::max(tail_max, field(samples[sidx]));
+        }
+        return tail_max - field(samples[baseline_idx]);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    //no display needed, unless the caller asked for a specific platform
+    if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM")) {
+        qputenv("QT_QPA_PLATFORM", "offscreen");
+    }
+
+    QApplication app(argc, argv);
+    QCoreApplication::setOrganizationName("Alrik Firl");
+    QCoreApplication::setApplicationName("Fish Labeler Soak Test");
+    QCoreApplication::setApplicationVersion(QT_VERSION_STR);
+
+    QCommandLineParser cmd_parser;
+    cmd_parser.setApplicationDescription("Drives the labeler through a long scripted session and checks that memory stays flat");
+    cmd_parser.addHelpOption();
+    QCommandLineOption frames_option("frames", "Run on the video in <directory> rather than a synthetic one (labels get written into it!).", "directory");
+    QCommandLineOption actions_option("actions", "Number of user actions to run.", "N", "20000");
+    QCommandLineOption sample_option("sample-every", "Sample memory every <N> actions.", "N", "250");
+    QCommandLineOption warmup_option("warmup", "Fraction of the run to let the caches fill up before the baseline sample.", "fraction", "0.1");
+    QCommandLineOption csv_option("csv", "Write the memory samples out to <file>.", "file");
+    QCommandLineOption rss_option("max-rss-growth", "Fail if the RSS grows by more than <MB> after the warmup.", "MB", "64");
+    QCommandLineOption heap_option("max-heap-growth", "Fail if the in-use heap grows by more than <MB> after the warmup.", "MB", "32");
+    QCommandLineOption seed_option("seed", "Seed for the action sequence.", "seed", "1");
+    QCommandLineOption verbose_option("verbose", "Keep the labeler's own logging.");
+    cmd_parser.addOptions({frames_option, actions_option, sample_option, warmup_option, csv_option, rss_option, heap_option, seed_option, verbose_option});
+    cmd_parser.process(app);
+
+    const int64_t num_actions = cmd_parser.value(actions_option).toLongLong();
+    const int64_t sample_interval = std::max<int64_t>(cmd_parser.value(sample_option).toLongLong(), 1);
+    const double warmup_fraction = std::min(std::max(cmd_parser.value(warmup_option).toDouble(), 0.0), 0.9);
+    const int64_t max_rss_growth_kb = cmd_parser.value(rss_option).toLongLong() * 1024;
+    const int64_t max_heap_growth_kb = cmd_parser.value(heap_option).toLongLong() * 1024;
+    if (num_actions <= 0) {
+        std::cout << "ERROR: need at least one action to run" << std::endl;
+        return 2;
+    }
+
+    //the labeler logs every action to stdout, which would swamp the report (and slow the run down)
+    std::ostream report (std::cout.rdbuf());
+    NullBuffer null_buffer;
+    if (!cmd_parser.isSet(verbose_option)) {
+        std::cout.rdbuf(&null_buffer);
+    }
+
+    boost::filesystem::path scratch_dir = boost::filesystem::temp_directory_path() / boost::filesystem::unique_path("fishsoak-%%%%%%");
+    boost::filesystem::create_directories(scratch_dir);
+    boost::filesystem::path frame_dir;
+    if (cmd_parser.isSet(frames_option)) {
+        frame_dir = cmd_parser.value(frames_option).toStdString();
+    } else {
+        frame_dir = scratch_dir / "video";
+        report << "making a synthetic video in " << frame_dir.string() << std::endl;
+        make_synthetic_video(frame_dir, 300, 1920, 1080);
+    }
+    //the window's project mode opens a video without asking for it
+    const auto project_fpath = scratch_dir / "soak.project";
+    {
+        std::ofstream project_out(project_fpath.string());
+        project_out << frame_dir.string() << std::endl;
+    }
+
+    std::vector<MemorySample> samples;
+    int exit_code = 0;
+    try {
+        auto video_window = std::make_unique<VideoWindow>(project_fpath.string());
+        video_window->show();
+        SoakDriver driver (*video_window, cmd_parser.value(seed_option).toInt());
+
+        const auto start_time = std::chrono::steady_clock::now();
+        auto elapsed_s = [start_time]{
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        };
+
+        //one action per pass through the event loop, s.t. the queued work (full resolution loads, repaints) keeps up
+        int64_t action = 0;
+        QTimer action_timer;
+        QObject::connect(&action_timer, &QTimer::timeout, [&]{
+            if (action % sample_interval == 0) {
+                samples.push_back(sample_memory(action, elapsed_s()));
+                const auto& sample = samples.back();
+                report << "action " << action << " / " << num_actions << ": RSS " << sample.rss_kb / 1024 << " MB, heap "
+                       << sample.heap_used_kb / 1024 << " MB in use (" << sample.heap_total_kb / 1024 << " MB held)" << std::endl;
+            }
+            if (action == num_actions) {
+                action_timer.stop();
+                app.quit();
+                return;
+            }
+            driver.run_action();
+            action++;
+        });
+        action_timer.start(0);
+        app.exec();
+
+        video_window->close();
+    } catch (const std::exception& err) {
+        std::cout.rdbuf(report.rdbuf());
+        std::cout << err.what() << std::endl;
+        exit_code = 2;
+    }
+    std::cout.rdbuf(report.rdbuf());
+
+    if (cmd_parser.isSet(csv_option)) {
+        std::ofstream csv_out(cmd_parser.value(csv_option).toStdString());
+        csv_out << "action,seconds,rss_kb,heap_used_kb,heap_total_kb" << std::endl;
+        for (const auto& sample : samples) {
+            csv_out << sample.action << "," << sample.elapsed_s << "," << sample.rss_kb << "," << sample.heap_used_kb << "," << sample.heap_total_kb << std::endl;
+        }
+    }
+
+    if (exit_code == 0 && samples.size() >= 2) {
+        const size_t baseline_idx = std::min(static_cast<size_t>(warmup_fraction * samples.size()), samples.size()-1);
+        const int64_t rss_growth_kb = memory_growth_kb(samples, baseline_idx, [](const MemorySample& s){ return s.rss_kb; });
+        const int64_t heap_growth_kb = memory_growth_kb(samples, baseline_idx, [](const MemorySample& s){ return s.heap_used_kb; });
+        const double actions_per_s = samples.back().action / std::max(samples.back().elapsed_s, 1e-3);
+        std::cout << "ran " << samples.back().action << " actions in " << samples.back().elapsed_s << " s (" << actions_per_s << " / s)" << std::endl;
+        std::cout << "after action " << samples[baseline_idx].action << ": RSS grew by " << rss_growth_kb / 1024.0 << " MB (limit "
+                  << max_rss_growth_kb / 1024 << "), in-use heap grew by " << heap_growth_kb / 1024.0 << " MB (limit " << max_heap_growth_kb / 1024 << ")" << std::endl;
+        if (rss_growth_kb > max_rss_growth_kb || heap_growth_kb > max_heap_growth_kb) {
+            std::cout << "FAILED: memory kept growing over the session" << std::endl;
+            exit_code = 1;
+        } else {
+            std::cout << "PASSED" << std::endl;
+        }
+    }
+
+    boost::system::error_code ec;
+    boost::filesystem::remove_all(scratch_dir, ec);
+    return exit_code;
+}
@@ -0,0 +1,332 @@
+#include "SpanMask.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+std::map<int, SpanMask::RowSpans>& SpanMask::edit_rows()
+{
+    if (!rows) {
+        rows = std::make_shared<std::map<int, RowSpans>>();
+    } else if (rows.use_count() > 1) {
+        rows = std::make_shared<std::map<int, RowSpans>>(*rows);
+    }
+    return *rows;
+}
+
+const std::map<int, SpanMask::RowSpans>& SpanMask::no_rows()
+{
+    static const std::map<int, RowSpans> empty_rows;
+    return empty_rows;
+}
+
+void SpanMask::add_span(const int row, const int x_begin, const int x_end)
+{
+    if (x_begin >= x_end) {
+        return;
+    }
+    auto& row_spans = edit_rows()[row];
+    //the first span that ends at or after the new one begins is the first one that could touch it
+    auto first_it = std::lower_bound(row_spans.begin(), row_spans.end(), x_begin, [](const Span& span, const int x) {
+        return span.x_end < x;
+    });
+    int merged_begin = x_begin, merged_end = x_end;
+    auto last_it = first_it;
+    while (last_it != row_spans.end() && last_it->x_begin <= x_end) {
+        merged_begin = std::min(merged_begin, last_it->x_begin);
+        merged_end = std::max(merged_end, last_it->x_end);
+        last_it++;
+    }
+
+    if (first_it == last_it) {
+        row_spans.insert(first_it, Span(merged_begin, merged_end));
+    } else {
+        *first_it = Span(merged_begin, merged_end);
+        row_spans.erase(first_it + 1, last_it);
+    }
+}
+
+void SpanMask::erase_span(const int row, const int x_begin, const int x_end)
+{
+    //NOTE: check before detaching, erasing from the empty space around a shared mask shouldn't copy it
+    if (x_begin >= x_end || get_rows().find(row) == get_rows().end()) {
+        return;
+    }
+    auto& mask_rows = edit_rows();
+    auto row_it = mask_rows.find(row);
+    auto& row_spans = row_it->second;
+    auto first_it = std::lower_bound(row_spans.begin(), row_spans.end(), x_begin, [](const Span& span, const int x) {
+        return span.x_end <= x;
+    });
+    auto last_it = first_it;
+    //whatever's left of the overlapping spans on either side of the erased range
+    RowSpans remainders;
+    while (last_it != row_spans.end() && last_it->x_begin < x_end) {
+        if (last_it->x_begin < x_begin) {
+            remainders.emplace_back(last_it->x_begin, x_begin);
+        }
+        if (last_it->x_end > x_end) {
+            remainders.emplace_back(x_end, last_it->x_end);
+        }
+        last_it++;
+    }
+    if (first_it == last_it) {
+        return;
+    }
+
+    auto insert_it = row_spans.erase(first_it, last_it);
+    row_spans.insert(insert_it, remainders.begin(), remainders.end());
+    if (row_spans.empty()) {
+        mask_rows.erase(row_it);
+    }
+}
+
+void SpanMask::add_disc(const QPoint& center, const int radius)
+{
+    const int r = std::max(radius, 0);
+    for (int dy = -r; dy <= r; dy++) {
+        const int half_width = static_cast<int>(std::sqrt(static_cast<double>(r*r - dy*dy)));
+        add_span(center.y() + dy, center.x() - half_width, center.x() + half_width + 1);
+    }
+}
+
+void SpanMask::erase_disc(const QPoint& center, const int radius)
+{
+    const int r = std::max(radius, 0);
+    for (int dy = -r; dy <= r; dy++) {
+        const int half_width = static_cast<int>(std::sqrt(static_cast<double>(r*r - dy*dy)));
+        erase_span(center.y() + dy, center.x() - half_width, center.x() + half_width + 1);
+    }
+}
+
+namespace {
+    //dabs along the line, close enough together that the stroke doesn't have any gaps
+    template <typename DabFn>
+    void stamp_line(const QPoint& start, const QPoint& end, const int radius, DabFn dab)
+    {
+        const QPoint delta = end - start;
+        const int length = std::max(std::abs(delta.x()), std::abs(delta.y()));
+        const int step = std::max(1, radius / 2);
+        for (int i = 0; i < length; i += step) {
+            dab(QPoint(start.x() + delta.x() * i / length, start.y() + delta.y() * i / length));
+        }
+        dab(end);
+    }
+}
+
+void SpanMask::add_line(const QPoint& start, const QPoint& end, const int radius)
+{
+    stamp_line(start, end, radius, [this, radius](const QPoint& center) {
+        add_disc(center, radius);
+    });
+}
+
+void SpanMask::erase_line(const QPoint& start, const QPoint& end, const int radius)
+{
+    stamp_line(start, end, radius, [this, radius](const QPoint& center) {
+        erase_disc(center, radius);
+    });
+}
+
+void SpanMask::add_polygon(const std::vector<QPoint>& vertices)
+{
+    const int num_vertices = vertices.size();
+    if (num_vertices < 3) {
+        return;
+    }
+    auto minmax_y = std::minmax_element(vertices.begin(), vertices.end(), [](const QPoint& lhs, const QPoint& rhs) {
+        return lhs.y() < rhs.y();
+    });
+
+    //NOTE: a pixel is inside if its center is, with the vertices on the pixel grid. Sampling at the centers also
+    //means a row never runs exactly through a vertex
+    std::vector<double> crossings;
+    for (int row = minmax_y.first->y(); row < minmax_y.second->y(); row++) {
+        const double sample_y = row + 0.5;
+        crossings.clear();
+        for (int vidx = 0; vidx < num_vertices; vidx++) {
+            const QPoint& edge_start = vertices[vidx];
+            const QPoint& edge_end = vertices[(vidx+1) % num_vertices];
+            if ((edge_start.y() < sample_y) != (edge_end.y() < sample_y)) {
+                const double t = (sample_y - edge_start.y()) / (edge_end.y() - edge_start.y());
+                crossings.push_back(edge_start.x() + t * (edge_end.x() - edge_start.x()));
+            }
+        }
+        std::sort(crossings.begin(), crossings.end());
+        //even-odd --> inside between every other pair of crossings
+        for (size_t cidx = 0; cidx + 1 < crossings.size(); cidx += 2) {
+            add_span(row, static_cast<int>(std::ceil(crossings[cidx] - 0.5)), static_cast<int>(std::ceil(crossings[cidx+1] - 0.5)));
+        }
+    }
+}
+
+void SpanMask::add_mask(const SpanMask& other)
+{
+    for (const auto& row : other.get_rows()) {
+        for (const auto& span : row.second) {
+            add_span(row.first, span.x_begin, span.x_end);
+        }
+    }
+}
+
+void SpanMask::erase_mask(const SpanMask& other)
+{
+    for (const auto& row : other.get_rows()) {
+        for (const auto& span : row.second) {
+            erase_span(row.first, span.x_begin, span.x_end);
+        }
+    }
+}
+
+void SpanMask::clip(const QRect& bounds)
+{
+    const int x_begin = bounds.left(), x_end = bounds.right() + 1;
+    if (empty() || bounds.contains(bounding_rect())) {
+        return;
+    }
+    auto& mask_rows = edit_rows();
+    for (auto row_it = mask_rows.begin(); row_it != mask_rows.end(); ) {
+        if (row_it->first < bounds.top() || row_it->first > bounds.bottom()) {
+            row_it = mask_rows.erase(row_it);
+            continue;
+        }
+        auto& row_spans = row_it->second;
+        RowSpans clipped_spans;
+        for (const auto& span : row_spans) {
+            const int clipped_begin = std::max(span.x_begin, x_begin);
+            const int clipped_end = std::min(span.x_end, x_end);
+            if (clipped_begin < clipped_end) {
+                clipped_spans.emplace_back(clipped_begin, clipped_end);
+            }
+        }
+        if (clipped_spans.empty()) {
+            row_it = mask_rows.erase(row_it);
+        } else {
+            row_spans = std::move(clipped_spans);
+            row_it++;
+        }
+    }
+}
+
+void SpanMask::translate(const QPoint& offset)
+{
+    if (empty() || offset.isNull()) {
+        return;
+    }
+    //NOTE: every row moves, so it's a new set of rows either way
+    auto moved_rows = std::make_shared<std::map<int, RowSpans>>();
+    for (const auto& mask_row : get_rows()) {
+        RowSpans moved_spans;
+        moved_spans.reserve(mask_row.second.size());
+        for (const auto& span : mask_row.second) {
+            moved_spans.emplace_back(span.x_begin + offset.x(), span.x_end + offset.x());
+        }
+        moved_rows->emplace_hint(moved_rows->end(), mask_row.first + offset.y(), std::move(moved_spans));
+    }
+    rows = std::move(moved_rows);
+}
+
+SpanMask::RowSpans SpanMask::free_spans(const RowSpans* row_spans, const int x_begin, const int x_end)
+{
+    RowSpans gaps;
+    int gap_begin = x_begin;
+    if (row_spans) {
+        for (const auto& span : *row_spans) {
+            if (span.x_end <= x_begin) {
+                continue;
+            }
+            if (span.x_begin >= x_end) {
+                break;
+            }
+            if (span.x_begin > gap_begin) {
+                gaps.emplace_back(gap_begin, span.x_begin);
+            }
+            gap_begin = std::max(gap_begin, span.x_end);
+        }
+    }
+    if (gap_begin < x_end) {
+        gaps.emplace_back(gap_begin, x_end);
+    }
+    return gaps;
+}
+
+SpanMask SpanMask::flood_fill(const SpanMask& blocked, const QPoint& seed, const QRect& bounds)
+{
+    SpanMask filled;
+    if (!bounds.contains(seed) || blocked.contains(seed.x(), seed.y())) {
+        return filled;
+    }
+
+    const int x_begin = bounds.left(), x_end = bounds.right() + 1;
+    auto row_free_spans = [&blocked, x_begin, x_end](const int row) {
+        auto row_it = blocked.get_rows().find(row);
+        return free_spans(row_it != blocked.get_rows().end() ? &row_it->second : nullptr, x_begin, x_end);
+    };
+
+    //every free span is either filled entirely or not at all, so a span is the unit of work
+    std::vector<std::pair<int, Span>> pending_spans;
+    for (const auto& span : row_free_spans(seed.y())) {
+        if (span.x_begin <= seed.x() && seed.x() < span.x_end) {
+            filled.add_span(seed.y(), span.x_begin, span.x_end);
+            pending_spans.emplace_back(seed.y(), span);
+            break;
+        }
+    }
+
+    while (!pending_spans.empty()) {
+        const auto pending = pending_spans.back();
+        pending_spans.pop_back();
+        for (const int next_row : {pending.first - 1, pending.first + 1}) {
+            if (next_row < bounds.top() || next_row > bounds.bottom()) {
+                continue;
+            }
+            for (const auto& span : row_free_spans(next_row)) {
+                //4-connected, i.e. the spans have to share at least one column
+                const bool connected = span.x_begin < pending.second.x_end && span.x_end > pending.second.x_begin;
+                if (connected && !filled.contains(span.x_begin, next_row)) {
+                    filled.add_span(next_row, span.x_begin, span.x_end);
+                    pending_spans.emplace_back(next_row, span);
+                }
+            }
+        }
+    }
+    return filled;
+}
+
+bool SpanMask::contains(const int x, const int y) const
+{
+    auto row_it = get_rows().find(y);
+    if (row_it == get_rows().end()) {
+        return false;
+    }
+    const auto& row_spans = row_it->second;
+    auto span_it = std::upper_bound(row_spans.begin(), row_spans.end(), x, [](const int x, const Span& span) {
+        return x < span.x_end;
+    });
+    return span_it != row_spans.end() && span_it->x_begin <= x;
+}
+
+int64_t SpanMask::area() const
+{
+    int64_t num_pixels = 0;
+    for (const auto& row : get_rows()) {
+        for (const auto& span : row.second) {
+            num_pixels += span.x_end - span.x_begin;
+        }
+    }
+    return num_pixels;
+}
+
+QRect SpanMask::bounding_rect() const
+{
+    const auto& mask_rows = get_rows();
+    if (mask_rows.empty()) {
+        return QRect();
+    }
+    int x_min = mask_rows.begin()->second.front().x_begin, x_max = mask_rows.begin()->second.back().x_end;
+    for (const auto& row : mask_rows) {
+        x_min = std::min(x_min, row.second.front().x_begin);
+        x_max = std::max(x_max, row.second.back().x_end);
+    }
+    return QRect(QPoint(x_min, mask_rows.begin()->first), QPoint(x_max - 1, mask_rows.rbegin()->first));
+}
@@ -0,0 +1,82 @@
+#ifndef FISHLABELER_SPANMASK_HPP
+#define FISHLABELER_SPANMASK_HPP
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <map>
+
+#include <QPoint>
+#include <QRect>
+
+//a run of pixels [x_begin, x_end) in a row
+struct Span {
+    Span(const int begin, const int end)
+        : x_begin(begin), x_end(end)
+    {}
+
+    int x_begin;
+    int x_end;
+};
+
+/* A binary mask stored as scanline spans: each row that has any pixels holds its runs of set pixels, sorted and
+ * neither overlapping nor touching. Filling or erasing a region only touches the rows it covers, and a filled
+ * shape costs a span or two per row no matter how wide it is.
+ *
+ * The rows are copy-on-write, s.t. copying a mask (e.g. carrying it over to the next frame, or keeping it for
+ * undo) is free until one of the copies gets edited.
+ */
+class SpanMask
+{
+public:
+    using RowSpans = std::vector<Span>;
+
+    //set / clear the pixels [x_begin, x_end) of the row
+    void add_span(const int row, const int x_begin, const int x_end);
+    void erase_span(const int row, const int x_begin, const int x_end);
+
+    //a filled circle, i.e. a brush dab
+    void add_disc(const QPoint& center, const int radius);
+    void erase_disc(const QPoint& center, const int radius);
+    //a brush stroke from start to end, without gaps however far apart they are
+    void add_line(const QPoint& start, const QPoint& end, const int radius);
+    void erase_line(const QPoint& start, const QPoint& end, const int radius);
+
+    //the polygon's interior (even-odd rule): the pixels whose centers are inside of it
+    void add_polygon(const std::vector<QPoint>& vertices);
+
+    void add_mask(const SpanMask& other);
+    void erase_mask(const SpanMask& other);
+
+    //drop everything outside of the rect
+    void clip(const QRect& bounds);
+    //move every pixel by the offset
+    void translate(const QPoint& offset);
+
+    /* the 4-connected region around seed that isn't in blocked, within bounds. Works a span at a time rather
+     * than a pixel at a time, so it's linear in the number of spans it fills */
+    static SpanMask flood_fill(const SpanMask& blocked, const QPoint& seed, const QRect& bounds);
+
+    bool contains(const int x, const int y) const;
+    bool empty() const {
+        return get_rows().empty();
+    }
+    int64_t area() const;
+    QRect bounding_rect() const;
+
+    const std::map<int, RowSpans>& get_rows() const {
+        return rows ? *rows : no_rows();
+    }
+
+private:
+    //the row's free spans within [x_begin, x_end), i.e. the complement of the row's set spans
+    static RowSpans free_spans(const RowSpans* row_spans, const int x_begin, const int x_end);
+
+    //the rows to modify, copied first if another mask shares them
+    std::map<int, RowSpans>& edit_rows();
+    static const std::map<int, RowSpans>& no_rows();
+
+    std::shared_ptr<std::map<int, RowSpans>> rows;
+};
+
+#endif
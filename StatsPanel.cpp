@@ -0,0 +1,136 @@
+#include "StatsPanel.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <string>
+#include <iostream>
+
+#include <QHBoxLayout>
+#include <QVBoxLayout>
+
+constexpr int StatsPanel::MAX_LISTED_FRAMES;
+
+StatsPanel::StatsPanel(QWidget* parent)
+    : QWidget(parent), annotation_index(nullptr)
+{
+    query_select = new QComboBox(this);
+    query_select->addItem("summary");
+    query_select->addItem("frames with instance ID");
+    query_select->addItem("frames with boxes but no text");
+    query_select->addItem("box count histogram (minutes / bin)");
+    query_select->addItem("boxes per instance ID");
+
+    query_arg = new QLineEdit("1", this);
+    constexpr int max_arg_width = 50;
+    query_arg->setMaximumWidth(max_arg_width);
+
+    query_btn = new QPushButton("run query", this);
+    connect(query_btn, &QPushButton::clicked, [this]{
+        run_query();
+    });
+    connect(query_arg, &QLineEdit::returnPressed, [this]{
+        run_query();
+    });
+
+    query_status = new QLabel(this);
+    query_results = new QPlainTextEdit(this);
+    query_results->setReadOnly(true);
+
+    auto query_layout = new QHBoxLayout;
+    auto query_txt = new QLabel(this);
+    query_txt->setText("Label Query:");
+    query_layout->addWidget(query_txt);
+    query_layout->addWidget(query_select);
+    query_layout->addWidget(query_arg);
+    query_layout->addWidget(query_btn);
+    query_layout->addWidget(query_status);
+
+    auto panel_layout = new QVBoxLayout;
+    panel_layout->setContentsMargins(0, 0, 0, 0);
+    panel_layout->addLayout(query_layout);
+    panel_layout->addWidget(query_results);
+    setLayout(panel_layout);
+}
+
+void StatsPanel::run_query()
+{
+    if (!annotation_index) {
+        return;
+    }
+
+    using clock_t = std::chrono::steady_clock;
+    auto start_time = clock_t::now();
+    //only re-indexes the label files that changed since the last query
+    if (annotation_index->is_stale()) {
+        annotation_index->build();
+    }
+    auto query_time = clock_t::now();
+
+    query_results->clear();
+    try {
+        switch(query_select->currentIndex()) {
+            case SUMMARY: {
+                auto summary = annotation_index->get_summary();
+                std::string summary_str {"labelled frames: " + std::to_string(summary.num_labelled_frames) + 
+                    "\nframes with boxes: " + std::to_string(summary.num_bbox_frames) + 
+                    "\nframes with masks: " + std::to_string(summary.num_mask_frames) + 
+                    "\nframes with text: " + std::to_string(summary.num_text_frames) + 
+                    "\nboxes: " + std::to_string(summary.num_bboxes) + 
+                    "\ninstance IDs: " + std::to_string(summary.num_instances)};
+                query_results->appendPlainText(summary_str.c_str());
+                break;
+            }
+            case FRAMES_WITH_INSTANCE: {
+                const int instance_id = query_arg->text().toInt();
+                auto frame_names = annotation_index->frames_with_instance(instance_id);
+                std::string count_str {std::to_string(frame_names.size()) + " frames contain instance " + std::to_string(instance_id)};
+                query_results->appendPlainText(count_str.c_str());
+                append_frame_list(frame_names);
+                break;
+            }
+            case BBOXES_WITHOUT_TEXT: {
+                auto frame_names = annotation_index->frames_with_bboxes_without_text();
+                std::string count_str {std::to_string(frame_names.size()) + " frames have boxes but no text"};
+                query_results->appendPlainText(count_str.c_str());
+                append_frame_list(frame_names);
+                break;
+            }
+            case BBOX_HISTOGRAM: {
+                const double bin_minutes = query_arg->text().toDouble();
+                auto bbox_hist = annotation_index->bbox_count_histogram(60 * bin_minutes);
+                for (size_t bin = 0; bin < bbox_hist.size(); bin++) {
+                    std::string bin_str {"minute " + std::to_string(bin * bin_minutes) + ": " + std::to_string(bbox_hist[bin])};
+                    query_results->appendPlainText(bin_str.c_str());
+                }
+                break;
+            }
+            case INSTANCE_COUNTS: {
+                for (const auto& instance_count : annotation_index->instance_bbox_counts()) {
+                    std::string count_str {"instance " + std::to_string(instance_count.first) + ": " + std::to_string(instance_count.second)};
+                    query_results->appendPlainText(count_str.c_str());
+                }
+                break;
+            }
+        }
+    } catch (const std::runtime_error& err) {
+        query_results->appendPlainText(err.what());
+    }
+
+    auto end_time = clock_t::now();
+    auto index_ms = std::chrono::duration_cast<std::chrono::milliseconds>(query_time - start_time).count();
+    auto query_ms = std::chrono::duration_cast<std::chrono::milliseconds>(end_time - query_time).count();
+    std::string status_str {"index: " + std::to_string(index_ms) + " ms, query: " + std::to_string(query_ms) + " ms"};
+    query_status->setText(status_str.c_str());
+}
+
+void StatsPanel::append_frame_list(const std::vector<std::string>& frame_names)
+{
+    const int num_listed = std::min(static_cast<int>(frame_names.size()), MAX_LISTED_FRAMES);
+    for (int fidx = 0; fidx < num_listed; fidx++) {
+        query_results->appendPlainText(frame_names[fidx].c_str());
+    }
+    if (num_listed < static_cast<int>(frame_names.size())) {
+        std::string more_str {"... and " + std::to_string(frame_names.size() - num_listed) + " more"};
+        query_results->appendPlainText(more_str.c_str());
+    }
+}
@@ -0,0 +1,49 @@
+#ifndef FISHLABELER_STATSPANEL_HPP
+#define FISHLABELER_STATSPANEL_HPP
+
+#include <QWidget>
+#include <QComboBox>
+#include <QLineEdit>
+#include <QLabel>
+#include <QPushButton>
+#include <QPlainTextEdit>
+
+#include "AnnotationIndex.hpp"
+
+//runs the aggregate AnnotationIndex queries for the current video and shows the results
+class StatsPanel : public QWidget
+{
+public:
+    explicit StatsPanel(QWidget* parent = 0);
+
+    //NOTE: the panel doesn't own the index, and it gets swapped out whenever the video changes
+    void set_index(AnnotationIndex* index) {
+        annotation_index = index;
+        query_results->clear();
+    }
+
+private:
+    enum QUERY_TYPE {
+        SUMMARY = 0,
+        FRAMES_WITH_INSTANCE,
+        BBOXES_WITHOUT_TEXT,
+        BBOX_HISTOGRAM,
+        INSTANCE_COUNTS
+    };
+
+    void run_query();
+    void append_frame_list(const std::vector<std::string>& frame_names);
+
+    AnnotationIndex* annotation_index;
+
+    QComboBox* query_select;
+    QLineEdit* query_arg;
+    QPushButton* query_btn;
+    QLabel* query_status;
+    QPlainTextEdit* query_results;
+
+    //don't flood the panel with hundreds of thousands of frame names
+    static constexpr int MAX_LISTED_FRAMES = 500;
+};
+
+#endif
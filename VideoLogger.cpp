@@ -1,12 +1,171 @@
 #include "VideoLogger.hpp"
 
+#include <array>
+#include <cstring>
 #include <fstream>
+#include <sstream>
 #include <iostream>
 #include <algorithm>
+#include <limits>
 
 #include <opencv2/opencv.hpp>
-#include <boost/algorithm/string.hpp>  
-#include <boost/lexical_cast.hpp>
+
+#include "LabelBuffer.hpp"
+
+namespace {
+    /* binary bounding box format: a 12 byte header of
+     *   "FLBB" | uint32 version | uint32 #boxes
+     * followed by #boxes records of 5 int32s (id, tl_x, tl_y, br_x, br_y), all in native byte order
+     */
+    constexpr char BBOX_MAGIC[4] = {'F', 'L', 'B', 'B'};
+    constexpr uint32_t BBOX_VERSION = 1;
+    constexpr int BBOX_RECORD_SZ = 5;
+    constexpr uint64_t BBOX_HEADER_SZ = 12;
+
+    bool is_blank(const char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    //parse a (possibly signed) integer with optional whitespace around it, returns nullptr if there isn't one
+    const char* parse_int(const char* pos, const char* end, int& value)
+    {
+        while (pos < end && is_blank(*pos)) {
+            pos++;
+        }
+        bool negative = false;
+        if (pos < end && (*pos == '-' || *pos == '+')) {
+            negative = (*pos == '-');
+            pos++;
+        }
+        const char* digits_begin = pos;
+        int64_t parsed_value = 0;
+        while (pos < end && *pos >= '0' && *pos <= '9') {
+            parsed_value = 10*parsed_value + (*pos - '0');
+            if (parsed_value > std::numeric_limits<int>::max()) {
+                return nullptr;
+            }
+            pos++;
+        }
+        if (pos == digits_begin) {
+            return nullptr;
+        }
+        while (pos < end && is_blank(*pos)) {
+            pos++;
+        }
+        value = static_cast<int>(negative ? -parsed_value : parsed_value);
+        return pos;
+    }
+}
+
+void VideoLogger::parse_text_bboxes(const char* buffer_begin, const char* buffer_end, const boost::filesystem::path& fpath, std::vector<BoundingBoxMD>& frame_bboxes)
+{
+    int line_num = 0;
+    const char* line_begin = buffer_begin;
+    while (line_begin < buffer_end) {
+        auto line_end = static_cast<const char*>(std::memchr(line_begin, '\n', buffer_end - line_begin));
+        if (!line_end) {
+            line_end = buffer_end;
+        }
+        line_num++;
+
+        //skip blank lines
+        const char* pos = line_begin;
+        while (pos < line_end && is_blank(*pos)) {
+            pos++;
+        }
+        if (pos < line_end) {
+            //id, tl_x, tl_y, br_x, br_y
+            std::array<int, BBOX_RECORD_SZ> bbox_vals;
+            for (int vidx = 0; vidx < BBOX_RECORD_SZ && pos; vidx++) {
+                pos = parse_int(pos, line_end, bbox_vals[vidx]);
+                //the fields are comma separated, and the last one has to end the line
+                if (pos && vidx < BBOX_RECORD_SZ-1) {
+                    pos = (pos < line_end && *pos == ',') ? pos+1 : nullptr;
+                }
+            }
+            if (!pos || pos != line_end) {
+                std::string err_msg {"ERROR: malformed bounding box on line " + std::to_string(line_num) + " of " + fpath.string() + 
+                    ": '" + std::string(line_begin, line_end) + "'"};
+                throw std::runtime_error(err_msg);
+            }
+            QRect bbox_rect (QPoint(bbox_vals[1], bbox_vals[2]), QPoint(bbox_vals[3], bbox_vals[4]));
+            frame_bboxes.emplace_back(bbox_rect, bbox_vals[0]);
+        }
+        line_begin = line_end + 1;
+    }
+}
+
+std::vector<BoundingBoxMD> VideoLogger::read_binary_bboxes(const boost::filesystem::path& fpath)
+{
+    std::ifstream fin(fpath.string(), std::ios::binary);
+    char magic[4];
+    uint32_t version = 0, num_bboxes = 0;
+    fin.read(magic, sizeof(magic));
+    fin.read(reinterpret_cast<char*>(&version), sizeof(version));
+    fin.read(reinterpret_cast<char*>(&num_bboxes), sizeof(num_bboxes));
+    if (!fin || !std::equal(magic, magic+4, BBOX_MAGIC) || version != BBOX_VERSION) {
+        std::string err_msg {"ERROR: " + fpath.string() + " isn't a (version " + std::to_string(BBOX_VERSION) + ") binary bounding box file"};
+        throw std::runtime_error(err_msg);
+    }
+
+    //NOTE: the header's box count can't be trusted until it's been checked against the file's size, a corrupt
+    //one would have us allocate gigabytes
+    const uint64_t records_sz = static_cast<uint64_t>(num_bboxes) * BBOX_RECORD_SZ * sizeof(int32_t);
+    boost::system::error_code ec;
+    const uint64_t file_sz = boost::filesystem::file_size(fpath, ec);
+    if (ec || file_sz != BBOX_HEADER_SZ + records_sz) {
+        std::string err_msg {"ERROR: binary bounding box file " + fpath.string() + " should hold " + std::to_string(num_bboxes) +
+            " boxes (" + std::to_string(BBOX_HEADER_SZ + records_sz) + " bytes), but it's " + std::to_string(file_sz) + " bytes"};
+        throw std::runtime_error(err_msg);
+    }
+    std::vector<int32_t> bbox_records (BBOX_RECORD_SZ * static_cast<size_t>(num_bboxes));
+    fin.read(reinterpret_cast<char*>(bbox_records.data()), bbox_records.size() * sizeof(int32_t));
+    if (!fin) {
+        std::string err_msg {"ERROR: binary bounding box file " + fpath.string() + " is truncated, expected " + std::to_string(num_bboxes) + " boxes"};
+        throw std::runtime_error(err_msg);
+    }
+
+    std::vector<BoundingBoxMD> frame_bboxes;
+    frame_bboxes.reserve(num_bboxes);
+    for (size_t ridx = 0; ridx < bbox_records.size(); ridx += BBOX_RECORD_SZ) {
+        QRect bbox_rect (QPoint(bbox_records[ridx+1], bbox_records[ridx+2]), QPoint(bbox_records[ridx+3], bbox_records[ridx+4]));
+        frame_bboxes.emplace_back(bbox_rect, bbox_records[ridx]);
+    }
+    return frame_bboxes;
+}
+
+void VideoLogger::write_binary_bboxes(const boost::filesystem::path& fpath, const std::vector<BoundingBoxMD>& bbox_rects)
+{
+    std::vector<int32_t> bbox_records;
+    bbox_records.reserve(BBOX_RECORD_SZ * bbox_rects.size());
+    int tl_x, tl_y, br_x, br_y;
+    for (const auto& bbox_md : bbox_rects) {
+        bbox_md.bbox.normalized().getCoords(&tl_x, &tl_y, &br_x, &br_y);
+        bbox_records.insert(bbox_records.end(), {bbox_md.instance_id, tl_x, tl_y, br_x, br_y});
+    }
+
+    const uint32_t num_bboxes = bbox_rects.size();
+    std::ofstream fout(fpath.string(), std::ios::binary | std::ios::trunc);
+    fout.write(BBOX_MAGIC, sizeof(BBOX_MAGIC));
+    fout.write(reinterpret_cast<const char*>(&BBOX_VERSION), sizeof(BBOX_VERSION));
+    fout.write(reinterpret_cast<const char*>(&num_bboxes), sizeof(num_bboxes));
+    fout.write(reinterpret_cast<const char*>(bbox_records.data()), bbox_records.size() * sizeof(int32_t));
+    fout.close();
+}
+
+void VideoLogger::write_text_bboxes(const boost::filesystem::path& fpath, const std::vector<BoundingBoxMD>& bbox_rects, const bool append)
+{
+    std::ofstream fout(fpath.string(), append ? std::ios::app : std::ios::trunc);
+    //top left and bottom right coordinates
+    int tl_x, tl_y, br_x, br_y;
+    for (const auto& bbox_md : bbox_rects) {
+        auto id = bbox_md.instance_id;
+        //NOTE: a box dragged up and/or left comes in inverted, but the files are always tl --> br
+        bbox_md.bbox.normalized().getCoords(&tl_x, &tl_y, &br_x, &br_y);
+        fout << id << ", " << tl_x << ", " << tl_y << ", " << br_x << ", " << br_y << "\n";
+    }
+    fout.close();
+}
 
 void VideoLogger::create_logdirs(boost::filesystem::path& logdir, const std::string& logdir_name) 
 {
@@ -21,47 +180,80 @@ void VideoLogger::create_logdirs(boost::filesystem::path& logdir, const std::str
     }
 }
 
-//segmentation masks --> logged as an image 
-void VideoLogger::write_annotations(const std::string& framenum, std::vector<PixelLabelMB>&& annotations, const int ptsz, const int height, const int width)
+//segmentation masks --> logged as an image (plus one for the classes)
+void VideoLogger::write_annotations(const std::string& framenum, const std::vector<PixelLabelMB>& annotations, const int ptsz, const int height, const int width)
 {
-    auto fpath = make_filepath(annotation_logdir, framenum, ".png");
-    const std::string out_fname = fpath.string(); 
-    cv::Mat log_annotation = cv::Mat::zeros(height, width, CV_8UC1);
-    for (auto mmask : annotations) {
-        //each of these will be a different instance
-        for (auto mpt : mmask.smask) {
-            auto col = mpt.x();
-            auto row = mpt.y();
-            //TODO: the brushsz poses a problem here -- if we want to be able to re-load the points unambiguously, we need to 
-            //store the points as well as the brushsize (as otherwise if there are 2 points which overlap due to brushsize, it 
-            //will be impossible to recover all the original points unambiguously). But if we just store the datapoints independent
-            //of brushsz, then we cannot easily store the brushsize.
-            //The other alternative would be to use textfiles for the annotation points (e.g. brushsz, then  point per line), and have
-            //a script offline that goes through and reads the points and generates masks from them. Or, we could just have it output both,
-            //or we could have it just be afunction that runs on the GUI close event. 
-            //But basically, we could get perfect reconstruction if we use a text file, but not if we use images. 
-            log_annotation.at<uint8_t>(int(row), int(col)) = mmask.instance_id; 
+    //each of these will be a different instance, and the spans are exactly the labelled pixels, so the mask
+    //reads back in unchanged (the brush size only mattered while drawing)
+    FrameLabelBuffer instance_labels (height, width);
+    for (const auto& mmask : annotations) {
+        instance_labels.paint(mmask.smask, mmask.instance_id);
+    }
+    instance_labels.write(make_filepath(annotation_logdir, framenum, ".png").string());
+
+    //the class mask is optional, most videos only ever have the one kind of fish
+    const auto class_fpath = get_class_filepath(framenum);
+    const bool has_classes = std::any_of(annotations.begin(), annotations.end(), [](const PixelLabelMB& mmask) {
+        return mmask.class_id != 0;
+    });
+    if (has_classes) {
+        FrameLabelBuffer class_labels (height, width);
+        for (const auto& mmask : annotations) {
+            class_labels.paint(mmask.smask, mmask.class_id);
         }
+        boost::filesystem::create_directories(class_fpath.parent_path());
+        class_labels.write(class_fpath.string());
+    } else {
+        //don't leave a stale one around to be read back in
+        boost::system::error_code ec;
+        boost::filesystem::remove(class_fpath, ec);
     }
-    cv::imwrite(out_fname, log_annotation);
 }
 
 
-//bounding boxes --> logged in a text file
-void VideoLogger::write_bboxes(const std::string& framenum, std::vector<BoundingBoxMD>&& bbox_rects, const int ptsz, const int height, const int width)
+//bounding boxes --> logged in a text file (and/or the binary format)
+void VideoLogger::write_bboxes(const std::string& framenum, const std::vector<BoundingBoxMD>& bbox_rects, const int ptsz, const int height, const int width)
 {
-    auto fpath = make_filepath(bbox_logdir, framenum, ".txt");
-    const std::string out_fname = fpath.string(); 
+    write_bbox_files(framenum, bbox_rects, false);
+}
 
-    std::ofstream fout(out_fname);
-    //top left and bottom right coordinates
-    int tl_x, tl_y, br_x, br_y;
-    for (auto bbox_md : bbox_rects) {
-        auto id = bbox_md.instance_id;
-        bbox_md.bbox.getCoords(&tl_x, &tl_y, &br_x, &br_y);
-        fout << id << ", " << tl_x << ", " << tl_y << ", " << br_x << ", " << br_y << "\n";
+void VideoLogger::append_bboxes(const std::string& framenum, std::vector<BoundingBoxMD>&& bbox_rects)
+{
+    write_bbox_files(framenum, bbox_rects, true);
+}
+
+void VideoLogger::write_bbox_files(const std::string& framenum, const std::vector<BoundingBoxMD>& bbox_rects, const bool append)
+{
+    auto text_fpath = make_filepath(bbox_logdir, framenum, ".txt");
+    auto binary_fpath = make_filepath(bbox_logdir, framenum, ".bbx");
+    const bool write_text = (bbox_format != BBOX_FORMAT::BINARY);
+    const bool write_binary = (bbox_format != BBOX_FORMAT::TEXT);
+
+    //NOTE: the frame's existing boxes could be in either format (whatever it was written as last), so they're read
+    //back in and both formats get rewritten from the whole lot -- appending to just the one file would lose the boxes
+    //that are only in the other one
+    std::vector<BoundingBoxMD> frame_bboxes;
+    if (append) {
+        frame_bboxes = get_boundingboxes(framenum);
+    }
+    frame_bboxes.insert(frame_bboxes.end(), bbox_rects.begin(), bbox_rects.end());
+
+    if (write_text) {
+        write_text_bboxes(text_fpath, frame_bboxes);
+    }
+    if (write_binary) {
+        write_binary_bboxes(binary_fpath, frame_bboxes);
+    }
+
+    //don't leave a stale file of the other format around to be read back in (only now that the boxes are safely
+    //in the one that's kept)
+    boost::system::error_code ec;
+    if (!write_text) {
+        boost::filesystem::remove(text_fpath, ec);
+    }
+    if (!write_binary) {
+        boost::filesystem::remove(binary_fpath, ec);
     }
-    fout.close();
 }
 
 void VideoLogger::write_textmetadata(const std::string& framenum, std::string&& text_meta)
@@ -76,13 +268,24 @@ void VideoLogger::write_textmetadata(const std::string& framenum, std::string&&
 
 std::vector<PixelLabelMB> VideoLogger::get_annotations (const std::string& framenum) const
 {
-    //TODO: need to implement this (which requires deciding how best to log the pixel-wise annotations)
     std::vector<PixelLabelMB> frame_annotations;
     auto fpath = make_filepath(annotation_logdir, framenum, ".png");
     if (boost::filesystem::exists(fpath)) {
-        const std::string frame_fpath = fpath.string();
-
+        //NOTE: the instance IDs are the pixel values
+        const auto instance_labels = FrameLabelBuffer::read(fpath.string());
+        for (auto& instance_mask : instance_labels.split()) {
+            frame_annotations.emplace_back(std::move(instance_mask.second), instance_mask.first);
+        }
 
+        //an instance is all one class, so any of its pixels will do
+        const auto class_fpath = get_class_filepath(framenum);
+        if (boost::filesystem::exists(class_fpath)) {
+            const auto class_labels = FrameLabelBuffer::read(class_fpath.string());
+            for (auto& instance_mask : frame_annotations) {
+                const auto& first_row = *instance_mask.smask.get_rows().begin();
+                instance_mask.class_id = class_labels.at(first_row.second.front().x_begin, first_row.first);
+            }
+        }
     }
     return frame_annotations;
 }
@@ -90,23 +293,28 @@ std::vector<PixelLabelMB> VideoLogger::get_annotations (const std::string& frame
 std::vector<BoundingBoxMD> VideoLogger::get_boundingboxes (const std::string& framenum) const 
 {
     std::vector<BoundingBoxMD> frame_bboxes;
+    auto binary_fpath = make_filepath(bbox_logdir, framenum, ".bbx");
+    if (boost::filesystem::exists(binary_fpath)) {
+        return read_binary_bboxes(binary_fpath);
+    }
+
     auto fpath = make_filepath(bbox_logdir, framenum, ".txt");
     if (boost::filesystem::exists(fpath)) {
-        std::string bbox_str;
-        std::ifstream bbox_ifstream(fpath.string());
-        while(std::getline(bbox_ifstream, bbox_str)) {
-            bbox_str.erase (std::remove (bbox_str.begin(), bbox_str.end(), ' '), bbox_str.end());
-            std::vector<std::string> bbox_tokens;
-            boost::split(bbox_tokens, bbox_str, boost::is_any_of(","));
-            assert(bbox_tokens.size() % 5 == 0);
-            auto id = boost::lexical_cast<int>(bbox_tokens[0]);
-            auto tl_x = boost::lexical_cast<int>(bbox_tokens[1]);
-            auto tl_y = boost::lexical_cast<int>(bbox_tokens[2]);
-            auto br_x = boost::lexical_cast<int>(bbox_tokens[3]);
-            auto br_y = boost::lexical_cast<int>(bbox_tokens[4]);
-            QRect bbox_rect (QPoint(tl_x, tl_y), QPoint(br_x, br_y));
-            frame_bboxes.emplace_back(bbox_rect, id);
-        }         
+        //NOTE: the buffer gets re-used between calls (per thread), s.t. reading a frame doesn't allocate anything
+        //beyond the output vector
+        thread_local std::string bbox_buffer;
+        std::ifstream bbox_ifstream(fpath.string(), std::ios::binary);
+        bbox_ifstream.seekg(0, std::ios::end);
+        const auto end_pos = bbox_ifstream.tellg();
+        if (!bbox_ifstream || end_pos < 0) {
+            std::string err_msg {"ERROR: couldn't read bounding box file " + fpath.string()};
+            throw std::runtime_error(err_msg);
+        }
+        const auto fsize = static_cast<size_t>(end_pos);
+        bbox_ifstream.seekg(0, std::ios::beg);
+        bbox_buffer.resize(fsize);
+        bbox_ifstream.read(&bbox_buffer[0], fsize);
+        parse_text_bboxes(bbox_buffer.data(), bbox_buffer.data() + bbox_ifstream.gcount(), fpath, frame_bboxes);
     }
     return frame_bboxes;
 }
@@ -123,3 +331,19 @@ std::string VideoLogger::get_textmetadata (const std::string& framenum) const
     }
     return metadata;
 }
+
+std::vector<std::string> VideoLogger::list_frames(const boost::filesystem::path& ldir, const std::string& ext, const std::string& alt_ext) const
+{
+    std::vector<std::string> frame_names;
+    for (boost::filesystem::directory_iterator fit(ldir); fit != boost::filesystem::directory_iterator(); fit++) {
+        const auto& label_fpath = fit->path();
+        const auto label_fext = label_fpath.extension();
+        if (label_fext == ext || (!alt_ext.empty() && label_fext == alt_ext)) {
+            frame_names.emplace_back(label_fpath.stem().string());
+        }
+    }
+    std::sort(frame_names.begin(), frame_names.end());
+    //a frame can have both formats
+    frame_names.erase(std::unique(frame_names.begin(), frame_names.end()), frame_names.end());
+    return frame_names;
+}
@@ -12,11 +12,19 @@
 
 #include "AnnotationTypes.hpp"
 
+//which file format(s) the bounding boxes get written out as -- the text format is Detections/<frame>.txt with one
+//'id, tl_x, tl_y, br_x, br_y' line per box, the binary format is Detections/<frame>.bbx (see VideoLogger.cpp)
+enum class BBOX_FORMAT {
+    TEXT,
+    BINARY,
+    TEXT_AND_BINARY
+};
+
 class VideoLogger
 {
 public:
-    explicit VideoLogger(const std::string& base_outdir)
-        : logdir(base_outdir), annotation_logdir(base_outdir), bbox_logdir(base_outdir), text_logdir(base_outdir)
+    explicit VideoLogger(const std::string& base_outdir, const BBOX_FORMAT bbox_fmt = BBOX_FORMAT::TEXT)
+        : logdir(base_outdir), annotation_logdir(base_outdir), bbox_logdir(base_outdir), text_logdir(base_outdir), bbox_format(bbox_fmt)
     {
         if (!boost::filesystem::exists(logdir)) {
             if(boost::filesystem::create_directory(logdir)) {
@@ -32,9 +40,14 @@ public:
         create_logdirs(text_logdir, "Metadata");
     }
 
-    void write_bboxes(const std::string& framenum, std::vector<BoundingBoxMD>&& annotations, const int ptsz, const int height, const int width);
-    void write_annotations(const std::string& framenum, std::vector<PixelLabelMB>&& annotations, const int ptsz, const int height, const int width);
+    void write_bboxes(const std::string& framenum, const std::vector<BoundingBoxMD>& annotations, const int ptsz, const int height, const int width);
+    //the instance IDs go into the frame's mask, and the class IDs (if any of the instances has one) into a second
+    //mask next to it, both at the compile-time label depth (FrameLabelBuffer)
+    void write_annotations(const std::string& framenum, const std::vector<PixelLabelMB>& annotations, const int ptsz, const int height, const int width);
     void write_textmetadata(const std::string& framenum, std::string&& text_meta);
+    //adds the boxes onto whatever the frame already has (or creates it if it has none). NOTE: the existing boxes are
+    //read from whichever format they're in, and the lot gets written out in the logger's format(s)
+    void append_bboxes(const std::string& framenum, std::vector<BoundingBoxMD>&& annotations);
 
     bool has_annotations(const std::string& framenum) const {
         auto fpath = make_filepath(annotation_logdir, framenum, ".png");
@@ -44,8 +57,9 @@ public:
 
     bool has_boundingbox(const std::string& framenum) const {
         auto fpath = make_filepath(bbox_logdir, framenum, ".txt");
-        return boost::filesystem::exists(fpath);
+        return boost::filesystem::exists(fpath) || boost::filesystem::exists(make_filepath(bbox_logdir, framenum, ".bbx"));
     }
+    //NOTE: reads the binary file if there is one. Throws if the file is malformed
     std::vector<BoundingBoxMD> get_boundingboxes (const std::string& framenum) const;
 
     bool has_textmetadata(const std::string& framenum) const {
@@ -54,7 +68,66 @@ public:
     }
     std::string get_textmetadata (const std::string& framenum) const;
 
+    //the names of every frame with a given kind of label, from a single listing of the label directory
+    std::vector<std::string> list_annotated_frames() const {
+        return list_frames(annotation_logdir, ".png");
+    }
+    //NOTE: every one of these should have an instance mask as well
+    std::vector<std::string> list_class_frames() const {
+        const auto class_logdir = annotation_logdir / "Classes";
+        return boost::filesystem::is_directory(class_logdir) ? list_frames(class_logdir, ".png") : std::vector<std::string>();
+    }
+    std::vector<std::string> list_boundingbox_frames() const {
+        return list_frames(bbox_logdir, ".txt", ".bbx");
+    }
+    std::vector<std::string> list_textmetadata_frames() const {
+        return list_frames(text_logdir, ".txt");
+    }
+
+    boost::filesystem::path get_annotation_filepath(const std::string& framenum) const {
+        return make_filepath(annotation_logdir, framenum, ".png");
+    }
+    //the frame's class mask, which only exists if some of its instances have a class
+    boost::filesystem::path get_class_filepath(const std::string& framenum) const {
+        return make_filepath(annotation_logdir / "Classes", framenum, ".png");
+    }
+    //the file get_boundingboxes would read from
+    boost::filesystem::path get_boundingbox_filepath(const std::string& framenum) const {
+        auto binary_fpath = make_filepath(bbox_logdir, framenum, ".bbx");
+        return boost::filesystem::exists(binary_fpath) ? binary_fpath : make_filepath(bbox_logdir, framenum, ".txt");
+    }
+    //both of the files a frame's boxes could be in (neither has to exist)
+    boost::filesystem::path get_text_boundingbox_filepath(const std::string& framenum) const {
+        return make_filepath(bbox_logdir, framenum, ".txt");
+    }
+    boost::filesystem::path get_binary_boundingbox_filepath(const std::string& framenum) const {
+        return make_filepath(bbox_logdir, framenum, ".bbx");
+    }
+    boost::filesystem::path get_textmetadata_filepath(const std::string& framenum) const {
+        return make_filepath(text_logdir, framenum, ".txt");
+    }
+
+    const boost::filesystem::path& get_logdir() const {
+        return logdir;
+    }
+
+    void set_bbox_format(const BBOX_FORMAT bbox_fmt) {
+        bbox_format = bbox_fmt;
+    }
+
+    BBOX_FORMAT get_bbox_format() const {
+        return bbox_format;
+    }
+
+    //parse the text format straight out of the file's buffer. Throws (naming the line) on malformed lines
+    static void parse_text_bboxes(const char* buffer_begin, const char* buffer_end, const boost::filesystem::path& fpath, std::vector<BoundingBoxMD>& frame_bboxes);
+    static std::vector<BoundingBoxMD> read_binary_bboxes(const boost::filesystem::path& fpath);
+    static void write_binary_bboxes(const boost::filesystem::path& fpath, const std::vector<BoundingBoxMD>& bbox_rects);
+    static void write_text_bboxes(const boost::filesystem::path& fpath, const std::vector<BoundingBoxMD>& bbox_rects, const bool append = false);
+
 private:
+    void write_bbox_files(const std::string& framenum, const std::vector<BoundingBoxMD>& bbox_rects, const bool append);
+    std::vector<std::string> list_frames(const boost::filesystem::path& ldir, const std::string& ext, const std::string& alt_ext = "") const;
     void create_logdirs(boost::filesystem::path& logdir, const std::string& logdir_name);
     boost::filesystem::path make_filepath(const boost::filesystem::path& ldir, const std::string& fname, const std::string& ext) const {
         auto output_fpath = ldir;
@@ -67,6 +140,7 @@ private:
     boost::filesystem::path annotation_logdir;
     boost::filesystem::path bbox_logdir;
     boost::filesystem::path text_logdir;
+    BBOX_FORMAT bbox_format;
 };
 
 #endif
@@ -4,53 +4,217 @@
 #include <iostream>
 #include <sstream>
 #include <fstream>
+#include <algorithm>
+#include <cstdlib>
+#include <unordered_map>
 
 #include <boost/algorithm/string.hpp>  
 #include <boost/lexical_cast.hpp>
 #include <boost/sort/spreadsort/string_sort.hpp>
+#include <QImageReader>
 
-QImage VideoReader::get_prev_frame()
+FrameBuffer VideoReader::get_prev_frame()
 {
     const int target_frame = frame_index - 1;
-    auto qframe = get_frame(target_frame);
+    auto vframe = get_frame(target_frame);
     frame_index = target_frame;
-    return qframe;
+    return vframe;
 }
 
-QImage VideoReader::get_next_frame()
+FrameBuffer VideoReader::get_next_frame()
 {
     const int target_frame = frame_index + 1;
-    auto qframe = get_frame(target_frame);
+    auto vframe = get_frame(target_frame);
     frame_index = target_frame;
-    return qframe;
+    return vframe;
 }
 
-QImage VideoReader::get_frame(const int houroffset, const int minoffset, const int secoffset)
+FrameBuffer VideoReader::get_frame(const int houroffset, const int minoffset, const double secoffset)
 {
     //convert the timestamp to a frame index
-    const float time_offset = 60*60*houroffset + 60*minoffset + secoffset;
-    const int offset_index = static_cast<int>(std::round(time_offset * video_fps));
+    const double time_offset = 60*60*houroffset + 60*minoffset + secoffset;
+    const int offset_index = find_frame_index(time_offset);
     frame_index = offset_index;
     return get_frame(frame_index);
 }
 
-QImage VideoReader::get_frame(const int index)
+int VideoReader::find_frame_index(const double seconds) const
 {
-    //just to squash warnings, we won't be using videos with > 4B frames
-    if (index < 0 || index >= static_cast<int>(files.size())) {
-        std::string err_msg {"ERROR: " + std::to_string(index) + " out of bounds"};
-        throw std::runtime_error(err_msg);
+    if (frame_timestamps.empty()) {
+        return static_cast<int>(std::round(seconds * video_fps));
     }
+    //binary search for the first frame after the time, the one before it is what's showing
+    const int64_t timestamp = std::llround(seconds * 1e6);
+    auto next_it = std::upper_bound(frame_timestamps.begin(), frame_timestamps.end(), timestamp);
+    return std::max(static_cast<int>(next_it - frame_timestamps.begin()) - 1, 0);
+}
+
+FrameBuffer VideoReader::get_frame(const int index)
+{
+    check_frame_index(index);
 
     std::cout << "index " << index << " --> " << files[index] << std::endl;
-    QImage qframe(files[index].c_str());
-    //TODO: will this get deallocated? what does the copy ctor do?
+    FrameBuffer vframe;
+    auto cached_it = frame_cache.find(index);
+    if (cached_it != frame_cache.end()) {
+        //blocks if the worker hasn't finished decoding it yet
+        vframe = cached_it->second.get();
+        frame_cache.erase(cached_it);
+        pinned_frames.erase(index);
+        cache_hits++;
+    } else {
+        vframe = frame_source.read(index, decode_scale);
+        cache_misses++;
+    }
     frame_index = index;
-    return qframe;
+    current_frame = vframe;
+
+    evict_cached_frames(index);
+    prefetch(index+prefetch_stride, prefetch_depth, prefetch_stride);
+    return present_frame(index, vframe);
 }
 
+FrameBuffer VideoReader::get_current_frame()
+{
+    if (current_frame.empty()) {
+        return get_frame(frame_index);
+    }
+    return present_frame(frame_index, current_frame);
+}
 
-void VideoReader::parse_video_frames()
+FrameBuffer VideoReader::present_frame(const int index, const FrameBuffer& frame)
+{
+    if (!enhancer || !enhancer->is_enabled()) {
+        return frame;
+    }
+    //without a pool there's nowhere else to do it
+    if (!workers) {
+        return enhancer->get(files[index], frame, enhancer->get_settings());
+    }
+    //NOTE: ready unless the frame wasn't prefetched (or the settings changed since), see enhance_current_frame
+    FrameBuffer enhanced_frame = enhancer->get_if_ready(files[index], frame, enhancer->get_settings());
+    return enhanced_frame.empty() ? frame : enhanced_frame;
+}
+
+void VideoReader::enhance_current_frame(std::function<void()> on_enhanced)
+{
+    if (!workers || !enhancer || !enhancer->is_enabled() || current_frame.empty()) {
+        return;
+    }
+    const EnhanceSettings settings = enhancer->get_settings();
+    if (!enhancer->get_if_ready(files[frame_index], current_frame, settings).empty()) {
+        return;
+    }
+    //NOTE: at the same priority as the user's other requests, it's the frame they're looking at
+    auto frame_enhancer = enhancer;
+    const std::string frame_fpath = files[frame_index];
+    const FrameBuffer frame = current_frame;
+    workers->submit([frame_enhancer, frame_fpath, frame, settings, on_enhanced]{
+        frame_enhancer->get(frame_fpath, frame, settings);
+        on_enhanced();
+    }, 1);
+}
+
+void VideoReader::prefetch(const int first_index, const int count, const int stride)
+{
+    if (!workers) {
+        return;
+    }
+
+    const int last_index = std::min(first_index + count*stride, static_cast<int>(files.size()));
+    for (int index = std::max(first_index, 0); index < last_index; index += stride) {
+        if (frame_cache.find(index) == frame_cache.end()) {
+            //NOTE: capture the path by value, the job can outlive the reader
+            const std::string frame_fpath = files[index];
+            const int scale = decode_scale;
+            //the enhancement happens here as well, s.t. it doesn't hold up showing the frame
+            std::shared_ptr<FrameEnhancer> frame_enhancer;
+            EnhanceSettings settings;
+            if (enhancer && enhancer->is_enabled()) {
+                frame_enhancer = enhancer;
+                settings = enhancer->get_settings();
+            }
+            //NOTE: the frame source is shared as well, for the same reason
+            const FrameSource frames = frame_source;
+            frame_cache.emplace(index, workers->submit([frame_fpath, scale, frames, index, frame_enhancer, settings]{
+                FrameBuffer frame = frames.read(index, scale);
+                if (frame_enhancer) {
+                    frame_enhancer->get(frame_fpath, frame, settings);
+                }
+                return frame;
+            }));
+        }
+    }
+}
+
+void VideoReader::prefetch_frames(const std::vector<int>& indices)
+{
+    pinned_frames.clear();
+    for (const int index : indices) {
+        if (index >= 0 && index < static_cast<int>(files.size())) {
+            prefetch(index, 1);
+            pinned_frames.insert(index);
+        }
+    }
+}
+
+bool VideoReader::is_frame_ready(const int index) const
+{
+    auto cached_it = frame_cache.find(index);
+    return cached_it != frame_cache.end() && cached_it->second.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+void VideoReader::set_decode_scale(const int scale)
+{
+    if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+        std::string err_msg {"ERROR: invalid decode scale " + std::to_string(scale) + " (needs to be 1, 2, 4 or 8)"};
+        throw std::runtime_error(err_msg);
+    }
+    if (scale != decode_scale) {
+        //everything that's been prefetched is at the wrong resolution now (unless it came out of the archive)
+        if (!archive) {
+            frame_cache.clear();
+        }
+        decode_scale = scale;
+    }
+}
+
+QSize VideoReader::get_frame_size() const
+{
+    //NOTE: all of a video's frames are the same size
+    if (!frame_size.isValid()) {
+        frame_size = frame_source.get_frame_size(0);
+    }
+    return frame_size;
+}
+
+QSize FrameSource::get_frame_size(const int index) const
+{
+    check_frame_index(index);
+    if (archive) {
+        return archive->get_frame_size(index);
+    }
+    QImageReader frame_reader (QString::fromStdString((*fpaths)[index]));
+    return frame_reader.size();
+}
+
+void VideoReader::evict_cached_frames(const int index)
+{
+    //keep a bit of slack behind the current frame for stepping backwards, drop everything else that's out of range
+    const int lower_bound = index - prefetch_depth*prefetch_stride;
+    const int upper_bound = index + 2*prefetch_depth*prefetch_stride;
+    for (auto cache_it = frame_cache.begin(); cache_it != frame_cache.end(); ) {
+        const bool out_of_range = cache_it->first < lower_bound || cache_it->first > upper_bound;
+        if (out_of_range && pinned_frames.count(cache_it->first) == 0) {
+            cache_it = frame_cache.erase(cache_it);
+        } else {
+            cache_it++;
+        }
+    }
+}
+
+
+void VideoReader::parse_video_frames(const bool use_archive)
 {
     if (!boost::filesystem::is_directory(fpath)) {
         std::string err_msg {"ERROR: directory " + fpath + " doesn't exist or isn't a directory"}; 
@@ -83,6 +247,68 @@ void VideoReader::parse_video_frames()
         }
     }
 
+    //a packed directory doesn't need listing (which for hundreds of thousands of frames takes a while by itself)
+    const auto archive_fpath = boost::filesystem::path(fpath) / FrameArchive::ARCHIVE_FNAME;
+    if ((!use_archive || !boost::filesystem::exists(archive_fpath) || !open_archive(archive_fpath)) && files.empty()) {
+        files = list_frame_files();
+    }
+
+    std::cout << "Got " << files.size() << " #frames" << std::endl;
+    if (files.size() == 0) {
+        std::string err_msg {"ERROR: 0 valid frames in directory " + fpath};
+        throw std::runtime_error(err_msg);
+    }
+
+    frame_source = FrameSource(std::make_shared<const std::vector<std::string>>(files), archive);
+
+    //variable frame rate videos come with each frame's timestamp
+    boost::filesystem::path timestamps_fpath {fpath};
+    timestamps_fpath /= "timestamps.txt";
+    if (boost::filesystem::exists(timestamps_fpath)) {
+        parse_frame_timestamps(timestamps_fpath);
+    }
+}
+
+bool VideoReader::open_archive(const boost::filesystem::path& archive_fpath)
+{
+    try {
+        archive = std::make_shared<const FrameArchive>(archive_fpath.string());
+    } catch (const std::runtime_error& err) {
+        std::cout << err.what() << ", reading the frames from the directory instead" << std::endl;
+        return false;
+    }
+    //NOTE: the paths are where the frames were packed from, they're still the frames' names (and the caches' keys)
+    files.reserve(archive->get_num_frames());
+    for (int fidx = 0; fidx < archive->get_num_frames(); fidx++) {
+        files.push_back((boost::filesystem::path(fpath) / archive->get_frame_fname(fidx)).string());
+    }
+
+    //anything added, removed or renamed in the directory since it was packed changes its mtime, in which case the
+    //frames that are there have to be the ones that were packed (or gone altogether, once it's packed they aren't needed)
+    if (archive->is_dir_unchanged()) {
+        return true;
+    }
+    std::vector<std::string> dir_files = list_frame_files();
+    if (!dir_files.empty() && dir_files != files) {
+        std::cout << "WARNING: frame archive " << archive_fpath.string() << " is stale (" << archive->get_num_frames()
+                  << " frames packed, " << dir_files.size() << " in the directory), reading the frames from the directory instead."
+                  << " It needs re-packing" << std::endl;
+        archive.reset();
+        files = std::move(dir_files);
+        return false;
+    }
+    //still matches, so don't list the directory again next time
+    try {
+        FrameArchive::stamp_dir_mtime(archive_fpath.string());
+    } catch (const std::runtime_error& err) {
+        std::cout << err.what() << std::endl;
+    }
+    return true;
+}
+
+std::vector<std::string> VideoReader::list_frame_files() const
+{
+    std::vector<std::string> frame_files;
     for (boost::filesystem::directory_iterator fit(fpath); fit != boost::filesystem::directory_iterator(); fit++) {
         //check if it's a file
         if (boost::filesystem::is_regular_file(fit->status())) {
@@ -91,18 +317,80 @@ void VideoReader::parse_video_frames()
             auto fext = boost::algorithm::to_lower_copy(file_fext);
             bool valid_file = std::find(valid_ext.begin(), valid_ext.end(), fext) != valid_ext.end(); 
             if (valid_file) {
-                auto fpath_str = fit->path().string();
-                files.emplace_back(fpath_str);
+                frame_files.emplace_back(fit->path().string());
             }
         }
     }
-    boost::sort::spreadsort::string_sort(files.begin(), files.end());
+    boost::sort::spreadsort::string_sort(frame_files.begin(), frame_files.end());
+    return frame_files;
+}
 
-    std::cout << "Got " << files.size() << " #frames" << std::endl;
-    if (files.size() == 0) {
-        std::string err_msg {"ERROR: 0 valid frames in directory " + fpath};
-        throw std::runtime_error(err_msg);
+void VideoReader::parse_frame_timestamps(const boost::filesystem::path& timestamps_fpath)
+{
+    //one line per frame, in frame order: either '<seconds>' or '<frame name>, <seconds>' ('#' for comments)
+    std::unordered_map<std::string, int> frame_lookup;
+    std::vector<int64_t> parsed_timestamps (files.size(), 0);
+    //NOTE: not a sentinel timestamp, the timestamps can be anything (negative included) as long as they're in order
+    std::vector<bool> has_timestamp (files.size(), false);
+    std::ifstream timestamps_ifstream(timestamps_fpath.string());
+    std::string ts_line;
+    int line_num = 0;
+    int num_parsed = 0;
+    while (std::getline(timestamps_ifstream, ts_line)) {
+        line_num++;
+        boost::algorithm::trim(ts_line);
+        if (ts_line.empty() || ts_line[0] == '#') {
+            continue;
+        }
+
+        int ts_index = num_parsed;
+        std::string ts_str = ts_line;
+        auto sep_pos = ts_line.find(',');
+        if (sep_pos != std::string::npos) {
+            if (frame_lookup.empty()) {
+                for (int fidx = 0; fidx < static_cast<int>(files.size()); fidx++) {
+                    frame_lookup.emplace(get_frame_name(fidx), fidx);
+                }
+            }
+            auto frame_it = frame_lookup.find(boost::algorithm::trim_copy(ts_line.substr(0, sep_pos)));
+            if (frame_it == frame_lookup.end()) {
+                continue;
+            }
+            ts_index = frame_it->second;
+            ts_str = ts_line.substr(sep_pos + 1);
+        }
+
+        char* ts_end = nullptr;
+        const double ts_seconds = std::strtod(ts_str.c_str(), &ts_end);
+        if (ts_end == ts_str.c_str() || !std::isfinite(ts_seconds) || ts_index >= static_cast<int>(files.size())) {
+            std::cout << "ERROR: bad timestamp on line " << line_num << " of " << timestamps_fpath.string() << ", falling back to " << video_fps << " fps" << std::endl;
+            return;
+        }
+        parsed_timestamps[ts_index] = std::llround(ts_seconds * 1e6);
+        has_timestamp[ts_index] = true;
+        num_parsed++;
+    }
+
+    //the lookups need every frame, in order
+    for (size_t fidx = 0; fidx < parsed_timestamps.size(); fidx++) {
+        if (!has_timestamp[fidx] || (fidx > 0 && parsed_timestamps[fidx] < parsed_timestamps[fidx-1])) {
+            std::cout << "ERROR: " << timestamps_fpath.string() << " is missing frame " << fidx << "'s timestamp, or they're out of order, falling back to "
+                      << video_fps << " fps" << std::endl;
+            return;
+        }
+    }
+
+    //relative to the start of the video
+    const int64_t first_timestamp = parsed_timestamps.front();
+    for (auto& frame_ts : parsed_timestamps) {
+        frame_ts -= first_timestamp;
+    }
+    frame_timestamps = std::move(parsed_timestamps);
+    //the average rate, for anything that still needs one (e.g. if info.txt doesn't have it)
+    if (video_fps <= 0 && frame_timestamps.back() > 0) {
+        video_fps = (frame_timestamps.size() - 1) / (frame_timestamps.back() * 1e-6);
     }
+    std::cout << "Loaded " << frame_timestamps.size() << " frame timestamps (" << frame_timestamps.back() * 1e-6 << " s)" << std::endl;
 }
 
 const std::array<std::string, VideoReader::NUM_FEXTS> VideoReader::valid_ext = {{
@@ -6,10 +6,68 @@
 #include <string>
 #include <vector>
 #include <array>
+#include <map>
+#include <set>
+#include <future>
+#include <functional>
+#include <memory>
 #include <iostream>
+#include <algorithm>
 
 #include <boost/filesystem.hpp>
-#include <QImage> 
+#include <QSize>
+
+#include "FrameArchive.hpp"
+#include "FrameBuffer.hpp"
+#include "FrameEnhancer.hpp"
+#include "WorkerPool.hpp"
+
+//reads a video's frames off of the reader's thread (e.g. on the worker pool): out of the frame archive if the
+//video has one, otherwise decoded from the frame's file. NOTE: cheap to copy, and everything it needs is shared, so
+//the jobs holding on to one can outlive the reader
+class FrameSource
+{
+public:
+    FrameSource() {}
+
+    FrameSource(std::shared_ptr<const std::vector<std::string>> frame_fpaths, std::shared_ptr<const FrameArchive> frame_archive)
+        : fpaths(std::move(frame_fpaths)), archive(std::move(frame_archive))
+    {}
+
+    //thread-safe. NOTE: the scale only applies to decoding, frames out of an archive are always full resolution
+    FrameBuffer read(const int index, const int scale = 1) const {
+        check_frame_index(index);
+        return archive ? archive->get_frame(index) : FrameBuffer::decode((*fpaths)[index], scale);
+    }
+
+    //NOTE: only reads the header when it's not out of an archive
+    QSize get_frame_size(const int index) const;
+
+    //where the frame is (or was, when it was packed) on disk -- also what names it, and keys the caches
+    const std::string& get_frame_path(const int index) const {
+        check_frame_index(index);
+        return (*fpaths)[index];
+    }
+
+    int get_num_frames() const {
+        return fpaths ? fpaths->size() : 0;
+    }
+
+    bool has_archive() const {
+        return static_cast<bool>(archive);
+    }
+
+private:
+    void check_frame_index(const int index) const {
+        if (index < 0 || index >= get_num_frames()) {
+            std::string err_msg {"ERROR: index " + std::to_string(index) + " is out of bounds"};
+            throw std::runtime_error(err_msg);
+        }
+    }
+
+    std::shared_ptr<const std::vector<std::string>> fpaths;
+    std::shared_ptr<const FrameArchive> archive;
+};
 
 class VideoReader
 {
@@ -19,59 +77,192 @@ class VideoReader
 public: 
     using PixelT = uint8_t;
 
-    explicit VideoReader(const std::string& filepath) 
-        : fpath(filepath), frame_index(0), video_fps(0.0)
+    //reads the frames out of the directory's frame archive if it has one (see FrameArchive), unless use_archive is off
+    explicit VideoReader(const std::string& filepath, const bool use_archive = true) 
+        : fpath(filepath), frame_index(0), video_fps(0.0), decode_scale(1), workers(nullptr), prefetch_depth(0), prefetch_stride(1), cache_hits(0), cache_misses(0)
     {
-        parse_video_frames();
+        parse_video_frames(use_archive);
+    }
+
+    //NOTE: the frames are shared (not copied) with the cache and the decoding jobs, see FrameBuffer
+    FrameBuffer get_prev_frame();
+    FrameBuffer get_next_frame();
+    FrameBuffer get_frame(const int houroffset, const int minoffset, const double secoffset);
+    FrameBuffer get_frame(const int index);
+    //the current frame again (enhanced or not, whichever is on now), without decoding it
+    FrameBuffer get_current_frame();
+    //NOTE: the fetches never enhance a frame themselves, a frame whose enhanced version isn't ready yet (it wasn't
+    //prefetched, or the enhancement just got turned on) gets handed out as-is. This has it enhanced on the worker
+    //pool, after which get_current_frame() returns the enhanced version. on_enhanced gets run on the pool, and only
+    //if there was anything to do
+    void enhance_current_frame(std::function<void()> on_enhanced);
+
+    //decode JPEG frames at 1/scale resolution (scale is 1, 2, 4 or 8) for previewing. This applies to every frame
+    //fetch from here on, and the frame size is still the full resolution size. NOTE: frames out of an archive are
+    //always full resolution, they're already decoded
+    void set_decode_scale(const int scale);
+
+    int get_decode_scale() const {
+        return decode_scale;
+    }
+
+    //the full resolution size of the video's frames (from the archive, or the first frame's header)
+    QSize get_frame_size() const;
+
+    bool has_archive() const {
+        return static_cast<bool>(archive);
     }
 
-    QImage get_prev_frame();
-    QImage get_next_frame();
-    QImage get_frame(const int houroffset, const int minoffset, const int secoffset);
-    QImage get_frame(const int index);
+    //for reading the frames on the worker pool, rather than going to their files
+    const FrameSource& get_frame_source() const {
+        return frame_source;
+    }
+
+    const std::string& get_frame_path(const int index) const {
+        check_frame_index(index);
+        return files[index];
+    }
 
     int get_num_frames() const {
         return files.size();
     }
 
-    std::string get_frame_name(const int frame_index) {
-        //just to squash warnings, we won't be using videos with > 4B frames
-        if (frame_index < 0 || frame_index >= static_cast<int>(files.size())) {
-            std::string err_msg {"ERROR: index " + std::to_string(frame_index) + " is out of bounds"};     
-            throw std::runtime_error(err_msg);
-        }
+    std::string get_frame_name(const int frame_index) const {
+        check_frame_index(frame_index);
         auto fname = files[frame_index];
         boost::filesystem::path p (fname);
         return p.stem().string();
     }
 
-    //vestige of old class, might be informative if I add caching to this one
+    //hand the reader a (shared) pool to decode on -- once set, every frame fetch queues up the
+    //next prefetch_depth frames in the background. NOTE: the pool has to outlive the reader
+    void set_worker_pool(WorkerPool* pool, const int depth = 4) {
+        workers = pool;
+        prefetch_depth = depth;
+    }
+
+    //queue up decodes for count frames from first_index, every stride frames, on the worker pool (no-op without a pool)
+    void prefetch(const int first_index, const int count, const int stride = 1);
+    //queue up decodes for an arbitrary set of frames (e.g. the next few labelled ones), which then stay cached
+    //until they're fetched or the next call replaces them, however far they are from the current frame
+    void prefetch_frames(const std::vector<int>& indices);
+
+    //enhance the frames on their way out when the enhancer's enabled (on the worker pool, along with decoding them
+    //when they're prefetched). NOTE: shared, the prefetch jobs can outlive the reader
+    void set_enhancer(std::shared_ptr<FrameEnhancer> frame_enhancer) {
+        enhancer = std::move(frame_enhancer);
+    }
+
+    //how many frames each fetch prefetches after itself (0 turns off the sequential prefetching)
+    void set_prefetch_depth(const int depth) {
+        prefetch_depth = std::max(depth, 0);
+    }
+
+    int get_prefetch_depth() const {
+        return prefetch_depth;
+    }
+
+    //have the frame fetches prefetch every stride-th frame, i.e. when playing back faster than we can show every frame
+    void set_prefetch_stride(const int stride) {
+        prefetch_stride = std::max(stride, 1);
+    }
+
+    //true if fetching the frame won't block on decoding it
+    bool is_frame_ready(const int index) const;
+
+    //fraction of frame fetches that were served out of the prefetch cache
     float get_cache_stats() const {
-        return 0;
+        const int num_fetches = cache_hits + cache_misses;
+        return num_fetches > 0 ? static_cast<float>(cache_hits) / num_fetches : 0;
     } 
 
+    double get_fps() const {
+        return video_fps;
+    }
+
     int get_current_frame_index() const {
         return frame_index;
     }
 
-    std::tuple<int, int, int> get_current_timestamp() const {
-        double foffset = frame_index / video_fps;
+    std::tuple<int, int, double> get_current_timestamp() const {
+        double foffset = get_frame_timestamp(frame_index);
         int hour_offset = static_cast<int>(std::floor(foffset / (60*60)));
         foffset -= hour_offset * 60*60;
         int min_offset = static_cast<int>(std::floor(foffset / 60));
         foffset -= min_offset*60;
-        int sec_offset = static_cast<int>(std::floor(foffset));
+        double sec_offset = foffset;
         std::cout << "Frame Offset: " << frame_index << " --> H: " << hour_offset << " M: " << min_offset << " S: " << sec_offset << std::endl; 
         return std::make_tuple(hour_offset, min_offset, sec_offset);
     }
 
+    //seconds since the start of the video -- from the video's timestamps.txt if it has one, otherwise from the fps
+    double get_frame_timestamp(const int index) const {
+        check_frame_index(index);
+        if (!frame_timestamps.empty()) {
+            return frame_timestamps[index] * 1e-6;
+        }
+        return index / video_fps;
+    }
+
+    //the frame on screen at the given time (i.e. the last frame starting at or before it). NOTE: this is only
+    //bounds-checked with the timestamps, at a constant fps it can land past the end of the video
+    int find_frame_index(const double seconds) const;
+
+    bool has_frame_timestamps() const {
+        return !frame_timestamps.empty();
+    }
+
+    const std::string& get_video_path() const {
+        return fpath;
+    }
+
 private:
-    void parse_video_frames();
+    void check_frame_index(const int index) const {
+        //just to squash warnings, we won't be using videos with > 4B frames
+        if (index < 0 || index >= static_cast<int>(files.size())) {
+            std::string err_msg {"ERROR: index " + std::to_string(index) + " is out of bounds"};     
+            throw std::runtime_error(err_msg);
+        }
+    }
+
+    void parse_video_frames(const bool use_archive);
+    //the frame names come out of the archive instead of a directory listing. Returns false if it can't be read, or if
+    //it's stale (in which case the directory's already been listed into files)
+    bool open_archive(const boost::filesystem::path& archive_fpath);
+    //the directory's frame files, sorted
+    std::vector<std::string> list_frame_files() const;
+    void parse_frame_timestamps(const boost::filesystem::path& timestamps_fpath);
+    void evict_cached_frames(const int index);
+    //the frame as it gets handed out, i.e. enhanced if that's on
+    FrameBuffer present_frame(const int index, const FrameBuffer& frame);
 
     const std::string fpath;
     int frame_index;
     std::vector<std::string> files;
     double video_fps;
+    //per-frame timestamps (in microseconds from the first frame) for variable frame rate videos, empty otherwise
+    std::vector<int64_t> frame_timestamps;
+    int decode_scale;
+    mutable QSize frame_size;
+
+    //NOTE: the cache is only ever touched from the thread that owns the reader, the workers
+    //just decode into the futures
+    WorkerPool* workers;
+    int prefetch_depth;
+    int prefetch_stride;
+    std::map<int, std::future<FrameBuffer>> frame_cache;
+    //frames from prefetch_frames, which don't get evicted with the rest
+    std::set<int> pinned_frames;
+    int cache_hits;
+    int cache_misses;
+
+    //NOTE: shared with the prefetch jobs, and the frames handed out can be views of it
+    std::shared_ptr<const FrameArchive> archive;
+    FrameSource frame_source;
+
+    std::shared_ptr<FrameEnhancer> enhancer;
+    //the current frame as it was decoded, for toggling the enhancement
+    FrameBuffer current_frame;
 };
 
 #endif
@@ -1,8 +1,13 @@
 #include <iostream>
 #include <string>
+#include <algorithm>
+#include <cstdlib>
 
 #include <QTimer>
 #include <QFileDialog>
+#include <QPointer>
+#include <QMetaObject>
+#include <QTextDocument>
 
 #include "VideoWindow.hpp"
 #include "AnnotationTypes.hpp"
@@ -13,6 +18,9 @@
  *   {N, P, --> next / prev frame
  *   cntrl+Z, cntrl+R --> undo / redo annotation
  *   cntrl+B, cntrl+S --> bounding box / pixel-wise label mode
+ *   L --> review mode (N / P only visit labelled frames)
+ *   H --> toggle the image enhancement
+ *   X --> toggle the background subtraction box proposals
  * - top toolbar for save, exit, and maybe a help bar (for hotkeys)
  */
 
@@ -23,23 +31,68 @@
  * - make mouse capture times for annotations faster
  */
 
+constexpr int VideoWindow::MAX_PLAYBACK_FPS;
+
 VideoWindow::VideoWindow(QWidget *parent)
-    : QMainWindow(parent)
+    : QMainWindow(parent), playback_speed(1.0), playback_start_index(0), playback_start_time(0), playback_stride(1), num_played_frames(0), num_dropped_frames(0), propose_bg_bboxes(false), saved_prefetch_depth(0), lease_first_frame(0), lease_last_frame(-1),
+      video_label(nullptr), prev_video_btn(nullptr), next_video_btn(nullptr), add_video_btn(nullptr)
 {
     auto filename = QFileDialog::getExistingDirectory(this, 
     tr("Open Fish Video Frame Directory"), QDir::currentPath(), QFileDialog::ShowDirsOnly);
     const std::string vpath = filename.toStdString(); 
+    workers = std::make_unique<WorkerPool>();
     vreader = std::make_unique<VideoReader> (vpath);
-    auto initial_frame = vreader->get_next_frame();
+    vreader->set_worker_pool(workers.get());
+    auto initial_frame = vreader->get_frame(0);
 
     vlogger = std::make_unique<VideoLogger> (vpath);
+    setup_window(initial_frame);
+}
+
+VideoWindow::VideoWindow(const std::string& project_fpath, QWidget *parent)
+    : QMainWindow(parent), playback_speed(1.0), playback_start_index(0), playback_start_time(0), playback_stride(1), num_played_frames(0), num_dropped_frames(0), propose_bg_bboxes(false), saved_prefetch_depth(0), lease_first_frame(0), lease_last_frame(-1),
+      video_label(nullptr), prev_video_btn(nullptr), next_video_btn(nullptr), add_video_btn(nullptr)
+{
+    project = std::make_unique<ProjectSession>(project_fpath);
+    if (project->get_num_videos() == 0) {
+        add_project_video();
+        if (project->get_num_videos() == 0) {
+            std::string err_msg {"ERROR: project " + project_fpath + " has no videos"};
+            throw std::runtime_error(err_msg);
+        }
+    }
+
+    const int video_index = project->get_current_video_index();
+    vreader = project->open_video(video_index);
+    //pick up from wherever the user was last time
+    const int resume_index = project->get_resume_point(video_index).last_visited;
+    const int start_index = std::min(std::max(resume_index, 0), vreader->get_num_frames()-1);
+    auto initial_frame = vreader->get_frame(start_index);
+
+    vlogger = std::make_unique<VideoLogger> (vreader->get_video_path());
+    setup_window(initial_frame);
+    retrieve_frame_metadata(start_index);
+    update_frame_labels(start_index);
+}
 
+void VideoWindow::setup_window(const FrameBuffer& initial_frame)
+{
     main_window = new QWidget(this);
     setCentralWidget(main_window);
-    fviewer = std::make_shared<FrameViewer>(initial_frame, main_window);
+    fviewer = new FrameViewer(initial_frame, main_window);
+    fviewer->set_worker_pool(&get_worker_pool());
+    mask_propagator = std::make_unique<MaskPropagator>(get_worker_pool(), this);
+    frame_enhancer = std::make_shared<FrameEnhancer>();
+    vreader->set_enhancer(frame_enhancer);
+    fviewer->set_fullres_loader([this]{
+        load_full_resolution();
+    });
     init_window();
+    reset_annotation_index();
+    reset_range_editor();
+    seed_edit_range();
+    reset_bg_proposer();
 
-    //TODO: for whatever reason, this causes a memory leak until the frame is cycled. No idea why though
     //resizes the screen s.t. the frame fits well
     QTimer::singleShot(100, this, SLOT(showFullScreen()));
 }
@@ -62,6 +115,10 @@ void VideoWindow::init_window()
     connect(instance_idledit, &QLineEdit::editingFinished, [this]{
         set_instanceid();
     });
+    class_idledit = new QLineEdit("0", main_window);
+    connect(class_idledit, &QLineEdit::editingFinished, [this]{
+        set_classid();
+    });
 
     prev_btn = new QPushButton("previous", main_window);
     connect(prev_btn, &QPushButton::clicked, [this]{
@@ -80,6 +137,51 @@ void VideoWindow::init_window()
         apply_video_offset();
     });
 
+    play_btn = new QPushButton("play", main_window);
+    connect(play_btn, &QPushButton::clicked, [this]{
+        toggle_playback();
+    });
+    playback_speed_box = new QComboBox(main_window);
+    for (const char* speed_str : {"0.5x", "1x", "2x", "3x", "4x", "8x"}) {
+        playback_speed_box->addItem(speed_str);
+    }
+    playback_speed_box->setCurrentIndex(1);
+    connect(playback_speed_box, static_cast<void (QComboBox::*)(int)>(&QComboBox::currentIndexChanged), [this](int){
+        //restart s.t. the new speed counts from the current frame
+        if (playback_timer->isActive()) {
+            stop_playback();
+            start_playback();
+        }
+    });
+    playback_label = new QLabel(main_window);
+    playback_timer = new QTimer(this);
+    playback_timer->setTimerType(Qt::PreciseTimer);
+    connect(playback_timer, &QTimer::timeout, [this]{
+        playback_tick();
+    });
+
+    enhance_btn = new QPushButton("enhance", main_window);
+    connect(enhance_btn, &QPushButton::clicked, [this]{
+        toggle_enhancement();
+    });
+
+    bg_btn = new QPushButton("propose boxes", main_window);
+    connect(bg_btn, &QPushButton::clicked, [this]{
+        toggle_bbox_proposals();
+    });
+
+    review_btn = new QPushButton("review", main_window);
+    connect(review_btn, &QPushButton::clicked, [this]{
+        toggle_review_mode();
+    });
+    review_label = new QLabel(main_window);
+
+    lease_label = new QLabel(main_window);
+    heartbeat_timer = new QTimer(this);
+    connect(heartbeat_timer, &QTimer::timeout, [this]{
+        lease_heartbeat();
+    });
+
     ql_paintsz = new QLineEdit(main_window); 
     connect(ql_paintsz, &QLineEdit::editingFinished, [this]{
         adjust_paintbrush_size();
@@ -92,18 +194,33 @@ void VideoWindow::init_window()
     metadata_textlabel->setText("Frame Metadata:");
     metadata_edit = new QPlainTextEdit(main_window);
 
+    stats_panel = new StatsPanel(main_window);
+    range_edit_panel = new RangeEditPanel(main_window);
+    range_edit_panel->set_apply_handler([this](const RangeEdit& edit, const int first_frame, const int last_frame) {
+        apply_range_edit(edit, first_frame, last_frame);
+    });
+    range_edit_panel->set_undo_handler([this]{
+        undo_range_edit();
+    });
+
     QVBoxLayout* rhs_layout = new QVBoxLayout;
     rhs_layout->addWidget(metadata_textlabel);
     rhs_layout->addWidget(metadata_edit);
+    rhs_layout->addWidget(stats_panel);
+    rhs_layout->addWidget(range_edit_panel);
 
     QHBoxLayout* lhs_layout = new QHBoxLayout;
-    auto fview_p = fviewer.get();
-    fview = new FrameView(fview_p);
+    fview = new FrameView(fviewer);
     lhs_layout->addWidget(fview);
 
     QVBoxLayout* main_layout = new QVBoxLayout;
     main_layout->addLayout(lhs_layout);
     main_layout->addLayout(cfg_layout);
+    if (project) {
+        auto project_layout = new QHBoxLayout;
+        set_projectUI_layout(project_layout);
+        main_layout->addLayout(project_layout);
+    }
     main_layout->addLayout(rhs_layout);
     main_window->setLayout(main_layout);
     main_window->setWindowTitle("Fish Labeler");
@@ -122,6 +239,8 @@ void VideoWindow::set_cfgUI_layout(QHBoxLayout* cfg_layout)
     ql_paintsz_txt->setText("brush size: ");
     auto ql_instanceid_txt = new QLabel(main_window);
     ql_instanceid_txt->setText("instance ID: ");
+    auto ql_classid_txt = new QLabel(main_window);
+    ql_classid_txt->setText("class ID: ");
 
     constexpr int min_btn_height = 40; 
     constexpr int min_btn_width = 100;
@@ -135,6 +254,7 @@ void VideoWindow::set_cfgUI_layout(QHBoxLayout* cfg_layout)
     ql_sec->setMaximumWidth(max_offset_width);
     ql_paintsz->setMaximumWidth(max_offset_width);
     instance_idledit->setMaximumWidth(max_offset_width);
+    class_idledit->setMaximumWidth(max_offset_width);
 
     constexpr int max_offset_text_width = 40;
     ql_hour_txt->setMaximumWidth(max_offset_text_width);
@@ -142,6 +262,7 @@ void VideoWindow::set_cfgUI_layout(QHBoxLayout* cfg_layout)
     ql_sec_txt->setMaximumWidth(max_offset_text_width);
     ql_paintsz_txt->setMaximumWidth(2*max_offset_text_width);
     ql_instanceid_txt->setMaximumWidth(2*max_offset_text_width);
+    ql_classid_txt->setMaximumWidth(2*max_offset_text_width);
 
     cfg_layout->addWidget(framenum_label);
     cfg_layout->addWidget(hour_timestamp);
@@ -150,6 +271,8 @@ void VideoWindow::set_cfgUI_layout(QHBoxLayout* cfg_layout)
 
     cfg_layout->addWidget(ql_instanceid_txt);
     cfg_layout->addWidget(instance_idledit);
+    cfg_layout->addWidget(ql_classid_txt);
+    cfg_layout->addWidget(class_idledit);
    
     cfg_layout->addWidget(ql_paintsz_txt);
     cfg_layout->addWidget(ql_paintsz);
@@ -164,6 +287,63 @@ void VideoWindow::set_cfgUI_layout(QHBoxLayout* cfg_layout)
 
     cfg_layout->addWidget(prev_btn);
     cfg_layout->addWidget(next_btn);
+
+    play_btn->setMinimumSize(min_btn_width, min_btn_height);
+    playback_speed_box->setMaximumWidth(2*max_offset_width);
+    cfg_layout->addWidget(play_btn);
+    cfg_layout->addWidget(playback_speed_box);
+    cfg_layout->addWidget(playback_label);
+
+    enhance_btn->setMinimumSize(min_btn_width, min_btn_height);
+    cfg_layout->addWidget(enhance_btn);
+
+    bg_btn->setMinimumSize(min_btn_width, min_btn_height);
+    cfg_layout->addWidget(bg_btn);
+
+    review_btn->setMinimumSize(min_btn_width, min_btn_height);
+    cfg_layout->addWidget(review_btn);
+    cfg_layout->addWidget(review_label);
+    cfg_layout->addWidget(lease_label);
+}
+
+void VideoWindow::set_projectUI_layout(QHBoxLayout* project_layout)
+{
+    video_label = new QLabel(main_window);
+    update_video_label();
+
+    prev_video_btn = new QPushButton("previous video", main_window);
+    connect(prev_video_btn, &QPushButton::clicked, [this]{
+        switch_video(project->get_current_video_index() - 1);
+    });
+    next_video_btn = new QPushButton("next video", main_window);
+    connect(next_video_btn, &QPushButton::clicked, [this]{
+        switch_video(project->get_current_video_index() + 1);
+    });
+    add_video_btn = new QPushButton("add video", main_window);
+    connect(add_video_btn, &QPushButton::clicked, [this]{
+        add_project_video();
+        update_video_label();
+    });
+
+    constexpr int min_btn_height = 40; 
+    constexpr int min_btn_width = 100;
+    prev_video_btn->setMinimumSize(min_btn_width, min_btn_height);
+    next_video_btn->setMinimumSize(min_btn_width, min_btn_height);
+    add_video_btn->setMinimumSize(min_btn_width, min_btn_height);
+
+    project_layout->addWidget(video_label);
+    project_layout->addWidget(add_video_btn);
+    project_layout->addWidget(prev_video_btn);
+    project_layout->addWidget(next_video_btn);
+}
+
+void VideoWindow::update_video_label()
+{
+    const int video_index = project->get_current_video_index();
+    const auto& resume_point = project->get_resume_point(video_index);
+    std::string video_str {"Video #: " + std::to_string(video_index) + " / " + std::to_string(project->get_num_videos()-1) + 
+        " (" + resume_point.frame_dir + ")"};
+    video_label->setText(video_str.c_str());
 }
 
 void VideoWindow::keyPressEvent(QKeyEvent *evt)
@@ -177,6 +357,30 @@ void VideoWindow::keyPressEvent(QKeyEvent *evt)
             std::cout << "PREV key" << std::endl;
             prev_frame();
             break;
+        case Qt::Key_Space:
+            toggle_playback();
+            break;
+        case Qt::Key_L:
+            toggle_review_mode();
+            break;
+        case Qt::Key_H:
+            toggle_enhancement();
+            break;
+        case Qt::Key_X:
+            toggle_bbox_proposals();
+            break;
+        case Qt::Key_BracketLeft:
+            if (project) {
+                std::cout << "PREV VIDEO key" << std::endl;
+                switch_video(project->get_current_video_index() - 1);
+            }
+            break;
+        case Qt::Key_BracketRight:
+            if (project) {
+                std::cout << "NEXT VIDEO key" << std::endl;
+                switch_video(project->get_current_video_index() + 1);
+            }
+            break;
         default:
             std::cout << "key: " << evt->key() << std::endl;
     }
@@ -184,40 +388,111 @@ void VideoWindow::keyPressEvent(QKeyEvent *evt)
     QWidget::keyPressEvent(evt);
 }
 
-void VideoWindow::write_frame_metadat(const int old_frame_index)
+bool VideoWindow::write_frame_metadat(const int old_frame_index)
 {
+    bool has_labels = false;
+    uint8_t label_kinds = 0;
     //we want to get the frame information that is being phased out (so use old frame index)
     auto frame_name = vreader->get_frame_name(old_frame_index);
 
+    //with leases on, labels that would clobber another annotator's go into our own conflict directory instead
+    VideoLogger* out_logger = vlogger.get();
+    std::unique_ptr<VideoLogger> conflict_logger;
+    const bool text_modified = metadata_edit->document()->isModified() && !metadata_edit->toPlainText().isEmpty();
+    std::string conflict_reason;
+    if (lease_manager && (text_modified || fviewer->is_modified()) && lease_manager->is_conflicted(old_frame_index, frame_name, conflict_reason)) {
+        const auto conflict_dir = lease_manager->get_conflict_dir();
+        std::cout << "CONFLICT: " << conflict_reason << ", writing the labels to " << conflict_dir.string() << " instead" << std::endl;
+        conflict_logger = std::make_unique<VideoLogger>(conflict_dir.string(), vlogger->get_bbox_format());
+        out_logger = conflict_logger.get();
+    }
+
     //check the edit box for text
     auto fmeta_text = metadata_edit->toPlainText().toStdString();
     if (fmeta_text.size() > 0) {
-        vlogger->write_textmetadata(frame_name, std::move(fmeta_text));
+        //NOTE: only re-write it if the user actually changed it, what was loaded is already on disk
+        if (metadata_edit->document()->isModified()) {
+            out_logger->write_textmetadata(frame_name, std::move(fmeta_text));
+            has_labels = true;
+            label_kinds |= LABEL_TEXT;
+        }
         //reset the metadata text, if needed
         metadata_edit->clear();
     }
 
     //check the frame viewer for user-supplied annotations and write them out to disk
-    auto fannotations = fview->get_frame_annotations();
-    const int bsz = fviewer->get_brushsz();
-    const int fheight = fviewer->get_frame_height();
-    const int fwidth = fviewer->get_frame_width();
-    if (fannotations.bboxes.size() > 0) {
-        vlogger->write_bboxes(frame_name, std::move(fannotations.bboxes), bsz, fheight, fwidth);
+    //NOTE: same as the text, there's nothing to write if the user hasn't touched them (e.g. during playback)
+    if (fviewer->is_modified()) {
+        auto fannotations = fview->get_frame_annotations();
+        const int bsz = fviewer->get_brushsz();
+        const int fheight = fviewer->get_frame_height();
+        const int fwidth = fviewer->get_frame_width();
+        if (fannotations.bboxes.size() > 0) {
+            out_logger->write_bboxes(frame_name, fannotations.bboxes.get(), bsz, fheight, fwidth);
+            has_labels = true;
+            label_kinds |= LABEL_BBOX;
+        }
+
+        if (fannotations.segm_points.size() > 0) {
+            out_logger->write_annotations(frame_name, fannotations.segm_points.get(), bsz, fheight, fwidth);
+            has_labels = true;
+            label_kinds |= LABEL_MASK;
+        }
     }
 
-    if (fannotations.segm_points.size() > 0) {
-        vlogger->write_annotations(frame_name, std::move(fannotations.segm_points), bsz, fheight, fwidth);
+    if (has_labels && !conflict_logger) {
+        annotation_index->mark_stale(frame_name);
+        if (review_queue) {
+            review_queue->mark_labelled(old_frame_index, label_kinds);
+        }
+        if (lease_manager) {
+            lease_manager->update_snapshot(frame_name);
+        }
+    }
+    if (has_labels) {
+        if (project) {
+            project->set_last_labelled(old_frame_index);
+        }
     }
+    return has_labels;
 }
 
 void VideoWindow::retrieve_frame_metadata(const int new_frame_index)
 {
+    //what's on disk now is what the user's edits get checked against when they're written
+    if (lease_manager) {
+        lease_manager->snapshot_frame(vreader->get_frame_name(new_frame_index));
+    }
+
+    //in review mode we already know what the frame has (and it's likely been read ahead of time)
+    if (review_queue) {
+        auto frame_labels = review_queue->get_labels(new_frame_index);
+        if (frame_labels.label_kinds & (LABEL_BBOX | LABEL_MASK)) {
+            FrameAnnotations nframe_annotations {std::move(frame_labels.bboxes), std::move(frame_labels.segm_points)};
+            fview->set_frame_annotations(std::move(nframe_annotations));
+        }
+        if (!frame_labels.text.empty()) {
+            metadata_edit->appendPlainText(QString::fromStdString(frame_labels.text));
+        }
+        metadata_edit->document()->setModified(false);
+        return;
+    }
+
     auto nextframe_name = vreader->get_frame_name(new_frame_index);
     //check for pre-existing metadata as well
     if (vlogger->has_annotations(nextframe_name) || vlogger->has_boundingbox(nextframe_name)) {
-        auto nfbboxes = vlogger->get_boundingboxes(nextframe_name);
-        auto nfannotations = vlogger->get_annotations(nextframe_name);
+        std::vector<BoundingBoxMD> nfbboxes;
+        try {
+            nfbboxes = vlogger->get_boundingboxes(nextframe_name);
+        } catch (const std::runtime_error& err) {
+            std::cout << err.what() << std::endl;
+        }
+        std::vector<PixelLabelMB> nfannotations;
+        try {
+            nfannotations = vlogger->get_annotations(nextframe_name);
+        } catch (const std::runtime_error& err) {
+            std::cout << err.what() << std::endl;
+        }
         FrameAnnotations nframe_annotations {std::move(nfbboxes), std::move(nfannotations)};
         fview->set_frame_annotations(std::move(nframe_annotations));
     }
@@ -227,35 +502,189 @@ void VideoWindow::retrieve_frame_metadata(const int new_frame_index)
         auto nfmetadata = vlogger->get_textmetadata(nextframe_name);
         metadata_edit->appendPlainText(QString::fromStdString(nfmetadata));
     }
+    //loading the saved text doesn't count as an edit
+    metadata_edit->document()->setModified(false);
 }
 
-void VideoWindow::frame_change_metadata(const QImage& vframe, const int old_frame_index, const int new_frame_index)
+void VideoWindow::frame_change_metadata(const FrameBuffer& vframe, const int old_frame_index, const int new_frame_index)
 {
+    //NOTE: shared with the viewer, so holding on to the old frame's masks doesn't copy them
+    auto old_masks = fviewer->get_frame_annotations();
     //collect and save existing frame's metadata
     write_frame_metadat(old_frame_index);
     //move to the new frame to be displayed
-    fview->update_frame(vframe);
+    fview->update_frame(vframe, vreader->get_frame_size());
+    load_enhanced_frame();
     //retreive and display existing metadata for the new frame (if applicable)
     retrieve_frame_metadata(new_frame_index);
+    propagate_masks(std::move(old_masks), old_frame_index, new_frame_index);
+    propose_bboxes(new_frame_index);
+    update_frame_labels(new_frame_index);
+    fview->update();
+}
+
+void VideoWindow::propagate_masks(SharedList<PixelLabelMB> old_masks, const int old_frame_index, const int new_frame_index)
+{
+    //whatever's still in flight is for a frame the user's left
+    mask_propagator->cancel();
+    //the user isn't labelling while it's playing back
+    if (playback_timer->isActive()) {
+        return;
+    }
+
+    const QSize frame_size = vreader->get_frame_size();
+    const std::string new_frame_fpath = vreader->get_frame_path(new_frame_index);
+    if (!old_masks.empty() && std::abs(new_frame_index - old_frame_index) == 1 && fviewer->get_frame_annotations().empty()) {
+        mask_propagator->request(vreader->get_frame_source(), old_frame_index, new_frame_index, frame_size, std::move(old_masks),
+                [this, new_frame_index, new_frame_fpath](std::vector<PixelLabelMB>&& proposals) {
+            //NOTE: the path as well, the user could have switched videos in the meantime
+            if (vreader->get_current_frame_index() == new_frame_index && vreader->get_frame_path(new_frame_index) == new_frame_fpath) {
+                fviewer->set_proposals(std::move(proposals));
+            }
+        });
+    }
+
+    //the user's likely to carry the new frame's masks on in either direction, so the flow can be worked out meanwhile
+    if (!fviewer->get_frame_annotations().empty()) {
+        for (const int next_index : {new_frame_index + 1, new_frame_index - 1}) {
+            if (next_index >= 0 && next_index < vreader->get_num_frames()) {
+                mask_propagator->prepare(vreader->get_frame_source(), new_frame_index, next_index, frame_size);
+            }
+        }
+    }
+}
+
+void VideoWindow::propose_bboxes(const int new_frame_index)
+{
+    bg_proposer->cancel();
+    //NOTE: the model catches up on the frames skipped during playback once it stops
+    if (!propose_bg_bboxes || playback_timer->isActive()) {
+        return;
+    }
+
+    //the model gets fed every frame the user visits, labelled or not, s.t. it doesn't fall behind
+    const std::string new_frame_fpath = vreader->get_frame_path(new_frame_index);
+    bg_proposer->request(new_frame_index, [this, new_frame_index, new_frame_fpath](std::vector<BoundingBoxMD>&& proposals) {
+        //NOTE: the path as well, the user could have switched videos in the meantime
+        if (vreader->get_current_frame_index() == new_frame_index && vreader->get_frame_path(new_frame_index) == new_frame_fpath
+                && fviewer->get_bounding_boxes().empty()) {
+            fviewer->set_bbox_proposals(std::move(proposals));
+        }
+    });
+}
+
+void VideoWindow::toggle_bbox_proposals()
+{
+    propose_bg_bboxes = !propose_bg_bboxes;
+    bg_btn->setText(propose_bg_bboxes ? "stop proposing" : "propose boxes");
+    propose_bboxes(vreader->get_current_frame_index());
+}
+
+void VideoWindow::update_frame_labels(const int new_frame_index)
+{
+    if (project) {
+        project->set_last_visited(new_frame_index);
+    }
 
     auto fnum_str = make_framecount_string(new_frame_index);
     framenum_label->setText(fnum_str.c_str());
  
-    int h_ts, m_ts, s_ts;
+    int h_ts, m_ts;
+    double s_ts;
     std::tie(h_ts, m_ts, s_ts) = vreader->get_current_timestamp();
     std::string hour_ts {"hour: " + std::to_string(h_ts)};
     hour_timestamp->setText(hour_ts.c_str());
     std::string min_ts {"min: " + std::to_string(m_ts)};
     min_timestamp->setText(min_ts.c_str());
-    std::string sec_ts {"sec: " + std::to_string(s_ts)};
-    sec_timestamp->setText(sec_ts.c_str());       
-    fview->update();
+    //NOTE: to the millisecond, frames are only a few tens of ms apart
+    sec_timestamp->setText(QString("sec: %1").arg(s_ts, 0, 'f', 3));
+}
+
+void VideoWindow::update_decode_scale()
+{
+    vreader->set_decode_scale(fview->pick_decode_scale(vreader->get_frame_size()));
+}
+
+void VideoWindow::load_full_resolution()
+{
+    const int frame_index = vreader->get_current_frame_index();
+    //NOTE: the path and the frame source are copied, the reader can get swapped out (switching videos) while the
+    //frame is decoding
+    const std::string frame_fpath = vreader->get_frame_path(frame_index);
+    const FrameSource frames = vreader->get_frame_source();
+    QPointer<VideoWindow> window (this);
+    std::shared_ptr<FrameEnhancer> enhancer;
+    if (frame_enhancer->is_enabled()) {
+        enhancer = frame_enhancer;
+    }
+    const EnhanceSettings settings = frame_enhancer->get_settings();
+    get_worker_pool().submit([window, frames, frame_fpath, frame_index, enhancer, settings]{
+        FrameBuffer full_frame;
+        try {
+            full_frame = frames.read(frame_index);
+        } catch (const std::runtime_error& err) {
+            std::cout << err.what() << std::endl;
+        }
+        if (full_frame.empty()) {
+            return;
+        }
+        if (enhancer) {
+            full_frame = enhancer->get(frame_fpath, full_frame, settings);
+        }
+        if (!window) {
+            return;
+        }
+        const bool enhanced = static_cast<bool>(enhancer);
+        QMetaObject::invokeMethod(window.data(), [window, full_frame, frame_fpath, frame_index, enhanced]{
+            //only swap it in if the user is still on the same frame (and hasn't toggled the enhancement since)
+            if (window && window->vreader->get_current_frame_index() == frame_index 
+                    && window->vreader->get_frame_path(frame_index) == frame_fpath
+                    && window->frame_enhancer->is_enabled() == enhanced) {
+                window->fviewer->upgrade_frame(full_frame);
+            }
+        }, Qt::QueuedConnection);
+    }, 1);
+}
+
+void VideoWindow::load_enhanced_frame()
+{
+    //the frames being played back were prefetched (and enhanced along with that), a miss is only on screen for a moment
+    if (playback_timer->isActive()) {
+        return;
+    }
+    const int frame_index = vreader->get_current_frame_index();
+    const std::string frame_fpath = vreader->get_frame_path(frame_index);
+    QPointer<VideoWindow> window (this);
+    vreader->enhance_current_frame([window, frame_index, frame_fpath]{
+        if (!window) {
+            return;
+        }
+        QMetaObject::invokeMethod(window.data(), [window, frame_index, frame_fpath]{
+            //only swap it in if the user is still on the same frame (and hasn't toggled the enhancement since)
+            if (!window || window->vreader->get_current_frame_index() != frame_index
+                    || window->vreader->get_frame_path(frame_index) != frame_fpath
+                    || !window->frame_enhancer->is_enabled()) {
+                return;
+            }
+            //NOTE: the full resolution frame could have been swapped in meanwhile, it got enhanced along with loading it
+            const FrameBuffer enhanced_frame = window->vreader->get_current_frame();
+            if (window->fviewer->is_preview() || enhanced_frame.size() == window->vreader->get_frame_size()) {
+                window->fviewer->replace_frame(enhanced_frame);
+            }
+        }, Qt::QueuedConnection);
+    });
 }
 
 void VideoWindow::next_frame()
 {
+    stop_playback();
     const int frame_index = vreader->get_current_frame_index();
+    if (review_queue) {
+        jump_to_frame(review_queue->next_frame(frame_index), 1);
+        return;
+    }
     if (frame_index+1 < vreader->get_num_frames()) {
+        update_decode_scale();
         auto vframe = vreader->get_next_frame();
         //save frame's existing metadata, change frame, and (if applicable) load saved metadata for the new frame
         frame_change_metadata(vframe, frame_index, frame_index+1);
@@ -264,31 +693,213 @@ void VideoWindow::next_frame()
 
 void VideoWindow::prev_frame()
 {
+    stop_playback();
     const int frame_index = vreader->get_current_frame_index();
+    if (review_queue) {
+        jump_to_frame(review_queue->prev_frame(frame_index), -1);
+        return;
+    }
     if (frame_index > 0) {
+        update_decode_scale();
         auto vframe = vreader->get_prev_frame();
         //save frame's existing metadata, change frame, and (if applicable) load saved metadata for the new frame
         frame_change_metadata(vframe, frame_index, frame_index-1);
     }
 }
 
+void VideoWindow::jump_to_frame(const int new_frame_index, const int direction)
+{
+    stop_playback();
+    const int frame_index = vreader->get_current_frame_index();
+    if (new_frame_index < 0 || new_frame_index >= vreader->get_num_frames() || new_frame_index == frame_index) {
+        return;
+    }
+    update_decode_scale();
+    auto vframe = vreader->get_frame(new_frame_index);
+    frame_change_metadata(vframe, frame_index, new_frame_index);
+    if (review_queue) {
+        review_queue->prefetch(new_frame_index, direction);
+        update_review_label();
+    }
+}
+
+void VideoWindow::toggle_review_mode()
+{
+    if (review_queue) {
+        stop_review();
+    } else {
+        start_review();
+    }
+}
+
+void VideoWindow::start_review()
+{
+    stop_playback();
+    review_queue = std::make_unique<ReviewQueue>(*vlogger, *vreader, get_worker_pool());
+    if (review_queue->get_num_frames() == 0) {
+        std::cout << "no labelled frames to review" << std::endl;
+        review_queue.reset();
+        return;
+    }
+    //the frames in between are skipped over, so reading ahead sequentially would just waste the workers' time
+    saved_prefetch_depth = vreader->get_prefetch_depth();
+    vreader->set_prefetch_depth(0);
+    review_btn->setText("stop review");
+
+    //start from the current frame if it's labelled, otherwise from the closest labelled frame after it (or before it)
+    const int frame_index = vreader->get_current_frame_index();
+    if (review_queue->position(frame_index) >= 0) {
+        review_queue->prefetch(frame_index, 1);
+        update_review_label();
+    } else if (review_queue->next_frame(frame_index) >= 0) {
+        jump_to_frame(review_queue->next_frame(frame_index), 1);
+    } else {
+        jump_to_frame(review_queue->prev_frame(frame_index), -1);
+    }
+}
+
+void VideoWindow::stop_review()
+{
+    if (!review_queue) {
+        return;
+    }
+    review_queue.reset();
+    vreader->prefetch_frames({});
+    vreader->set_prefetch_depth(saved_prefetch_depth);
+    review_btn->setText("review");
+    review_label->clear();
+}
+
+void VideoWindow::update_review_label()
+{
+    const int position = review_queue->position(vreader->get_current_frame_index());
+    //NOTE: counted from 1, i.e. the last labelled frame shows as N / N
+    std::string review_str {"labelled: " + (position >= 0 ? std::to_string(position + 1) : std::string("-")) + 
+        " / " + std::to_string(review_queue->get_num_frames())};
+    review_label->setText(review_str.c_str());
+}
+
+void VideoWindow::toggle_playback()
+{
+    if (playback_timer->isActive()) {
+        stop_playback();
+    } else {
+        start_playback();
+    }
+}
+
+void VideoWindow::start_playback()
+{
+    const double video_fps = vreader->get_fps();
+    if (video_fps <= 0) {
+        std::cout << "ERROR: can't play back a video without a frame rate" << std::endl;
+        return;
+    }
+    if (vreader->get_current_frame_index()+1 >= vreader->get_num_frames()) {
+        return;
+    }
+
+    //NOTE: playback goes through every frame, so it needs the sequential prefetching back
+    stop_review();
+
+    //e.g. "2x" --> 2
+    playback_speed = playback_speed_box->currentText().remove('x').toDouble();
+    const double playback_fps = video_fps * playback_speed;
+    playback_stride = std::max(1, static_cast<int>(playback_fps / MAX_PLAYBACK_FPS));
+    const double display_fps = playback_fps / playback_stride;
+    std::cout << "playing back at " << playback_speed << "x (" << display_fps << " fps, every " << playback_stride << " frame(s))" << std::endl;
+
+    update_decode_scale();
+    vreader->set_prefetch_stride(playback_stride);
+    playback_start_index = vreader->get_current_frame_index();
+    playback_start_time = vreader->get_frame_timestamp(playback_start_index);
+    num_played_frames = 0;
+    num_dropped_frames = 0;
+    playback_clock.start();
+    playback_timer->start(static_cast<int>(1000 / display_fps));
+    play_btn->setText("pause");
+}
+
+void VideoWindow::stop_playback()
+{
+    if (!playback_timer->isActive()) {
+        return;
+    }
+    playback_timer->stop();
+    vreader->set_prefetch_stride(1);
+    play_btn->setText("play");
+    update_playback_label();
+    std::cout << "played " << num_played_frames << " frames, dropped " << num_dropped_frames << std::endl;
+    //the frame playback stopped on is up for labelling
+    load_enhanced_frame();
+    propose_bboxes(vreader->get_current_frame_index());
+}
+
+void VideoWindow::playback_tick()
+{
+    const int frame_index = vreader->get_current_frame_index();
+    const int last_index = vreader->get_num_frames() - 1;
+    //where we should be by now, going by the clock (and the frames' timestamps, the frame rate could vary)
+    const double video_time = playback_start_time + playback_clock.elapsed() / 1000.0 * playback_speed;
+    const int target_index = std::min(vreader->find_frame_index(video_time), last_index);
+    if (target_index <= frame_index) {
+        return;
+    }
+
+    //NOTE: don't block the GUI on a decode -- show the latest frame that's ready, or wait for the next tick
+    int show_index = target_index;
+    while (show_index > frame_index && !vreader->is_frame_ready(show_index)) {
+        show_index--;
+    }
+    if (show_index == frame_index) {
+        //nothing's decoded yet (e.g. the target fell outside of the prefetch window), so ask for it
+        vreader->prefetch(target_index, 1);
+        return;
+    }
+
+    //anything skipped beyond the stride is a frame we should have shown but couldn't
+    num_dropped_frames += std::max(0, show_index - frame_index - playback_stride);
+    num_played_frames++;
+    auto vframe = vreader->get_frame(show_index);
+    frame_change_metadata(vframe, frame_index, show_index);
+    update_playback_label();
+
+    if (show_index == last_index) {
+        stop_playback();
+    }
+}
+
+void VideoWindow::update_playback_label()
+{
+    std::string playback_str {"shown: " + std::to_string(num_played_frames) + ", dropped: " + std::to_string(num_dropped_frames)};
+    playback_label->setText(playback_str.c_str());
+}
+
 void VideoWindow::closeEvent(QCloseEvent *evt)
 {
+    stop_playback();
+
     //TODO: do we need to do anything? Flush out un-written annotations, etc?
 
     //collect and save existing frame's metadata
     const int frame_index = vreader->get_current_frame_index();
     write_frame_metadat(frame_index);
+    if (project) {
+        project->set_last_visited(frame_index);
+        project->save();
+    }
 }
 
 void VideoWindow::apply_video_offset()
 {
+    stop_playback();
     auto frame_index = vreader->get_current_frame_index();
     auto hour_offset = ql_hour->text().toInt();
     auto min_offset = ql_min->text().toInt();
-    auto sec_offset = ql_sec->text().toInt();
+    auto sec_offset = ql_sec->text().toDouble();
     std::cout << "H: " << hour_offset << ", M: " << min_offset << ", S: " << sec_offset << std::endl;
-    QImage vframe;
+    FrameBuffer vframe;
+    update_decode_scale();
     try {
         vframe = vreader->get_frame(hour_offset, min_offset, sec_offset);
     } catch (const std::runtime_error& err) {
@@ -313,5 +924,252 @@ void VideoWindow::set_instanceid()
 {
     auto instance_id = instance_idledit->text().toInt();
     fviewer->set_instance_id(instance_id);
+    //the instance's class, if it already has one on this frame
+    class_idledit->setText(QString::number(fviewer->get_class_id()));
+}
+
+void VideoWindow::set_classid()
+{
+    auto class_id = class_idledit->text().toInt();
+    fviewer->set_class_id(class_id);
+}
+
+void VideoWindow::toggle_enhancement()
+{
+    frame_enhancer->set_enabled(!frame_enhancer->is_enabled());
+    enhance_btn->setText(frame_enhancer->is_enabled() ? "original" : "enhance");
+    //NOTE: the frames already prefetched were decoded without it, so they (and the current one) get shown as-is
+    //until they've been enhanced in the background
+    fviewer->replace_frame(vreader->get_current_frame());
+    load_enhanced_frame();
+}
+
+void VideoWindow::switch_video(const int video_index)
+{
+    if (video_index < 0 || video_index >= project->get_num_videos() || video_index == project->get_current_video_index()) {
+        return;
+    }
+    stop_playback();
+    stop_review();
+    mask_propagator->cancel();
+    bg_proposer->cancel();
+
+    //flush out the current frame before the reader and logger get swapped out from under it
+    const int frame_index = vreader->get_current_frame_index();
+    write_frame_metadat(frame_index);
+    project->set_last_visited(frame_index);
+
+    std::unique_ptr<VideoReader> next_vreader;
+    try {
+        next_vreader = project->open_video(video_index);
+    } catch (const std::runtime_error& err) {
+        std::cout << "couldn't open video #" << video_index << ": " << err.what() << std::endl;
+        return;
+    }
+    //NOTE: the lease manager and range editor reference the logger, so they have to go first
+    const bool had_leases = static_cast<bool>(lease_manager);
+    lease_manager.reset();
+    range_editor.reset();
+    vreader = std::move(next_vreader);
+    vreader->set_enhancer(frame_enhancer);
+    vlogger = std::make_unique<VideoLogger> (vreader->get_video_path());
+    reset_annotation_index();
+    reset_range_editor();
+    reset_bg_proposer();
+    if (had_leases) {
+        reset_leases();
+    }
+
+    const int resume_index = project->get_resume_point(video_index).last_visited;
+    const int start_index = std::min(std::max(resume_index, 0), vreader->get_num_frames()-1);
+    update_decode_scale();
+    auto vframe = vreader->get_frame(start_index);
+    fview->update_frame(vframe, vreader->get_frame_size());
+    load_enhanced_frame();
+    seed_edit_range();
+    retrieve_frame_metadata(start_index);
+    propose_bboxes(start_index);
+    update_frame_labels(start_index);
+    update_video_label();
+    fview->update();
+
+    project->save();
+}
+
+void VideoWindow::add_project_video()
+{
+    auto filename = QFileDialog::getExistingDirectory(this, 
+    tr("Add Fish Video Frame Directory"), QDir::currentPath(), QFileDialog::ShowDirsOnly);
+    if (filename.isEmpty()) {
+        return;
+    }
+    project->add_video(filename.toStdString());
+    project->save();
+}
+
+bool VideoWindow::enable_leases(const std::string& annotator, const int first_frame, const int last_frame)
+{
+    lease_annotator = annotator;
+    lease_first_frame = first_frame;
+    lease_last_frame = last_frame;
+    const bool claimed = reset_leases();
+    //the frame that's up was loaded before there was anything to snapshot it
+    lease_manager->snapshot_frame(vreader->get_frame_name(vreader->get_current_frame_index()));
+    heartbeat_timer->start(LeaseManager::HEARTBEAT_INTERVAL_S * 1000);
+    return claimed;
+}
+
+bool VideoWindow::reset_leases()
+{
+    lease_manager.reset();
+    lease_manager = std::make_unique<LeaseManager>(*vlogger, lease_annotator);
+    //a negative last frame means to the end of the video
+    const int last_index = vreader->get_num_frames() - 1;
+    const int last_frame = lease_last_frame < 0 ? last_index : std::min(lease_last_frame, last_index);
+    const bool claimed = lease_manager->claim(std::min(lease_first_frame, last_frame), last_frame);
+    update_lease_label();
+    seed_edit_range();
+    return claimed;
+}
+
+void VideoWindow::lease_heartbeat()
+{
+    if (!lease_manager) {
+        return;
+    }
+    try {
+        lease_manager->heartbeat();
+    } catch (const std::runtime_error& err) {
+        //e.g. the share went away for a bit, the next heartbeat might have better luck
+        std::cout << err.what() << std::endl;
+    }
+    update_lease_label();
+}
+
+void VideoWindow::update_lease_label()
+{
+    if (!lease_manager->holds_lease()) {
+        lease_label->setText("no lease");
+        return;
+    }
+    const auto& lease = lease_manager->get_lease();
+    std::string lease_str {lease.annotator + ": frames " + std::to_string(lease.first_frame) + " - " + std::to_string(lease.last_frame)};
+    lease_label->setText(lease_str.c_str());
 }
 
+void VideoWindow::reset_annotation_index()
+{
+    //NOTE: the index doesn't get built until the first query
+    annotation_index = std::make_unique<AnnotationIndex>(*vlogger, *vreader, get_worker_pool());
+    stats_panel->set_index(annotation_index.get());
+}
+
+void VideoWindow::reset_range_editor()
+{
+    range_editor.reset();
+    try {
+        //finishes off an edit that got interrupted last time
+        range_editor = std::make_unique<RangeEditor>(*vlogger, get_worker_pool());
+        range_edit_panel->set_status("", range_editor->can_undo());
+    } catch (const std::exception& err) {
+        std::cout << "couldn't set up range edits: " << err.what() << std::endl;
+        range_edit_panel->set_status("range edits unavailable", false);
+    }
+}
+
+void VideoWindow::reset_bg_proposer()
+{
+    if (bg_proposer) {
+        bg_proposer->cancel();
+    }
+    //NOTE: the checkpoints go alongside the frames, same as the labels
+    bg_proposer = std::make_unique<BackgroundProposer>(vreader->get_video_path(), vreader->get_frame_source(), vreader->get_frame_size(),
+            get_worker_pool(), this);
+}
+
+void VideoWindow::seed_edit_range()
+{
+    if (lease_manager && lease_manager->holds_lease()) {
+        const auto& lease = lease_manager->get_lease();
+        range_edit_panel->set_range(lease.first_frame, lease.last_frame);
+    } else {
+        const int frame_index = vreader->get_current_frame_index();
+        range_edit_panel->set_range(frame_index, frame_index);
+    }
+}
+
+void VideoWindow::apply_range_edit(const RangeEdit& edit, const int first_frame, const int last_frame)
+{
+    if (!range_editor) {
+        return;
+    }
+    stop_playback();
+    stop_review();
+    mask_propagator->cancel();
+    //the edit works on what's on disk, so the current frame's labels have to be there too
+    const int frame_index = vreader->get_current_frame_index();
+    write_frame_metadat(frame_index);
+
+    int first_index = std::max(0, std::min(first_frame, last_frame));
+    int last_index = std::min(vreader->get_num_frames() - 1, std::max(first_frame, last_frame));
+    //don't touch anyone else's frames
+    if (lease_manager) {
+        if (!lease_manager->holds_lease()) {
+            range_edit_panel->set_status("no lease on any frames", range_editor->can_undo());
+            reload_frame_labels();
+            return;
+        }
+        const auto& lease = lease_manager->get_lease();
+        first_index = std::max(first_index, lease.first_frame);
+        last_index = std::min(last_index, lease.last_frame);
+    }
+
+    std::vector<std::string> frame_names;
+    for (int fidx = first_index; fidx <= last_index; fidx++) {
+        frame_names.push_back(vreader->get_frame_name(fidx));
+    }
+    std::string status_str;
+    try {
+        const auto stats = range_editor->apply(edit, frame_names, vreader->get_frame_size());
+        status_str = "edited " + std::to_string(stats.num_frames_changed) + " of " + std::to_string(stats.num_frames) + " frames";
+    } catch (const std::exception& err) {
+        //NOTE: nothing got changed
+        std::cout << err.what() << std::endl;
+        status_str = err.what();
+    }
+    range_edit_panel->set_status(status_str, range_editor->can_undo());
+    reset_annotation_index();
+    reload_frame_labels();
+}
+
+void VideoWindow::undo_range_edit()
+{
+    if (!range_editor) {
+        return;
+    }
+    stop_playback();
+    stop_review();
+    mask_propagator->cancel();
+    //NOTE: anything written to the edited frames since gets undone along with it
+    write_frame_metadat(vreader->get_current_frame_index());
+    std::string status_str;
+    try {
+        status_str = range_editor->undo() ? "undid the last edit" : "nothing to undo";
+    } catch (const std::exception& err) {
+        std::cout << err.what() << std::endl;
+        status_str = err.what();
+    }
+    range_edit_panel->set_status(status_str, range_editor->can_undo());
+    reset_annotation_index();
+    reload_frame_labels();
+}
+
+void VideoWindow::reload_frame_labels()
+{
+    const int frame_index = vreader->get_current_frame_index();
+    //the same frame, but it clears out the old labels
+    fview->update_frame(vreader->get_current_frame(), vreader->get_frame_size());
+    metadata_edit->clear();
+    retrieve_frame_metadata(frame_index);
+    fview->update();
+}
@@ -12,16 +12,35 @@
 #include <QWidget>
 #include <QHBoxLayout>
 #include <QVBoxLayout>
+#include <QComboBox>
+#include <QTimer>
+#include <QElapsedTimer>
 
 #include "VideoReader.hpp"
 #include "FrameViewer.hpp"
 #include "VideoLogger.hpp"
+#include "ProjectSession.hpp"
+#include "AnnotationIndex.hpp"
+#include "StatsPanel.hpp"
+#include "RangeEditPanel.hpp"
+#include "RangeEditor.hpp"
+#include "ReviewQueue.hpp"
+#include "LeaseManager.hpp"
+#include "MaskPropagator.hpp"
+#include "BackgroundProposer.hpp"
 
 class VideoWindow : public QMainWindow
 {
     Q_OBJECT
 public:
     explicit VideoWindow(QWidget *parent = 0);
+    //project mode -- works through the list of videos in the project file, picking up where the user left off
+    explicit VideoWindow(const std::string& project_fpath, QWidget *parent = 0);
+
+    //label alongside other annotators: claims [first_frame, last_frame] (last_frame < 0 for the rest of the video)
+    //of each video that gets opened, see LeaseManager. Returns false if someone else holds some of those frames,
+    //in which case their frames' labels only ever get written into the annotator's conflict directory
+    bool enable_leases(const std::string& annotator, const int first_frame, const int last_frame);
     
 protected:
     void closeEvent(QCloseEvent *evt) override;
@@ -33,21 +52,81 @@ private:
         return std::string {"Frame #: " + std::to_string(findex) + " / " + std::to_string(vreader->get_num_frames()-1)};
     }
 
+    void setup_window(const FrameBuffer& initial_frame);
     void init_window();
     void set_cfgUI_layout(QHBoxLayout* layout);
+    void set_projectUI_layout(QHBoxLayout* layout);
     void next_frame();
     void prev_frame();
+    //go straight to a frame (saving the current one's labels), with direction saying which way the user is headed
+    void jump_to_frame(const int new_frame_index, const int direction);
 
     void set_instanceid();
+    void set_classid();
+    //show the frames enhanced or as they are, see FrameEnhancer
+    void toggle_enhancement();
     void apply_video_offset();
     void adjust_paintbrush_size();
-    void frame_change_metadata(const QImage& vframe, const int old_frame_index, const int new_frame_index);
+    //edit [first_frame, last_frame]'s labels on disk in one go, see RangeEditor
+    void apply_range_edit(const RangeEdit& edit, const int first_frame, const int last_frame);
+    void undo_range_edit();
+    //re-read the current frame's labels after they've been changed on disk
+    void reload_frame_labels();
+    void frame_change_metadata(const FrameBuffer& vframe, const int old_frame_index, const int new_frame_index);
 
-    void write_frame_metadat(const int old_frame_index);
+    //returns true if there were any labels to write out
+    bool write_frame_metadat(const int old_frame_index);
     void retrieve_frame_metadata(const int new_frame_index);
+    void update_frame_labels(const int new_frame_index);
+    //offer the old frame's masks, warped along the optical flow, as proposals for the new frame (if it's a neighbour
+    //without any masks of its own), and get the flow to the new frame's neighbours ready if it has masks
+    void propagate_masks(SharedList<PixelLabelMB> old_masks, const int old_frame_index, const int new_frame_index);
+    //offer the fish the background model picks out as box proposals for the new frame (if it doesn't have any boxes
+    //of its own), see BackgroundProposer
+    void propose_bboxes(const int new_frame_index);
+    void toggle_bbox_proposals();
+
+    //playback at (a multiple of) the video's fps -- frames are decoded ahead on the worker pool, and the
+    //display skips over frames that aren't decoded in time rather than falling behind
+    void toggle_playback();
+    void start_playback();
+    void stop_playback();
+    void playback_tick();
+    void update_playback_label();
+
+    //review mode -- next / previous only visit the frames that have labels, and the upcoming ones get prefetched
+    void toggle_review_mode();
+    void start_review();
+    void stop_review();
+    void update_review_label();
+
+    //decode frames at the coarsest resolution that still fills the view
+    void update_decode_scale();
+    //decodes the current frame at full resolution in the background, and swaps it in for the preview
+    void load_full_resolution();
+    //enhances the current frame in the background if it's showing unenhanced, and swaps it in
+    void load_enhanced_frame();
+
+    //(re-)claims the lease on the current video
+    bool reset_leases();
+    void lease_heartbeat();
+    void update_lease_label();
+
+    WorkerPool& get_worker_pool() {
+        return project ? project->get_worker_pool() : *workers;
+    }
+    void reset_annotation_index();
+    void reset_range_editor();
+    //start the range edit controls off on the frames that are up for editing: the lease's, or else the current frame
+    void seed_edit_range();
+    void reset_bg_proposer();
 
-    //TODO: figure out if Qt manages the lifetime, or if I do...
-    std::shared_ptr<FrameViewer> fviewer;
+    void switch_video(const int video_index);
+    void add_project_video();
+    void update_video_label();
+
+    //NOTE: parented to the main window, so Qt owns it (as with the rest of the widgets)
+    FrameViewer* fviewer;
     FrameView* fview;
 
     QWidget* main_window;
@@ -60,15 +139,71 @@ private:
     QLabel* sec_timestamp;
 
     QLineEdit* instance_idledit;
+    QLineEdit* class_idledit;
         
     QLineEdit* ql_hour;
     QLineEdit* ql_min;
     QLineEdit* ql_sec;
     QPushButton* offset_btn;
     QLineEdit* ql_paintsz;
+    StatsPanel* stats_panel;
+    RangeEditPanel* range_edit_panel;
+
+    QPushButton* play_btn;
+    QComboBox* playback_speed_box;
+    QLabel* playback_label;
+    QTimer* playback_timer;
+    QElapsedTimer playback_clock;
+    double playback_speed;
+    int playback_start_index;
+    double playback_start_time;
+    //show every playback_stride-th frame when the playback rate is faster than we'd display frames anyway
+    int playback_stride;
+    int num_played_frames;
+    int num_dropped_frames;
+
+    //the fastest we'll try to show frames during playback
+    static constexpr int MAX_PLAYBACK_FPS = 60;
+
+    QPushButton* enhance_btn;
+    QPushButton* bg_btn;
+    bool propose_bg_bboxes;
+
+    QPushButton* review_btn;
+    QLabel* review_label;
+    //the reader's sequential prefetch depth from before review mode turned it off
+    int saved_prefetch_depth;
+
+    QLabel* lease_label;
+    QTimer* heartbeat_timer;
+    std::string lease_annotator;
+    int lease_first_frame;
+    int lease_last_frame;
+
+    //only set up in project mode
+    QLabel* video_label;
+    QPushButton* prev_video_btn;
+    QPushButton* next_video_btn;
+    QPushButton* add_video_btn;
 
+    //NOTE: declared before the reader s.t. they get destroyed after it, the reader decodes on the project's pool
+    //(or the window's own pool when there's no project)
+    std::unique_ptr<ProjectSession> project;
+    std::unique_ptr<WorkerPool> workers;
     std::unique_ptr<VideoReader> vreader;
     std::unique_ptr<VideoLogger> vlogger;
+    std::unique_ptr<AnnotationIndex> annotation_index;
+    //only set up in review mode. NOTE: declared after the reader and logger, it references both
+    std::unique_ptr<ReviewQueue> review_queue;
+    //only set up when labelling alongside other annotators. NOTE: references the logger as well
+    std::unique_ptr<LeaseManager> lease_manager;
+    std::unique_ptr<MaskPropagator> mask_propagator;
+    //one per video, the background model is the video's
+    std::unique_ptr<BackgroundProposer> bg_proposer;
+    //NOTE: references the logger as well, so it gets re-made along with it
+    std::unique_ptr<RangeEditor> range_editor;
+    //shared with the reader(s), and their prefetch jobs
+    std::shared_ptr<FrameEnhancer> frame_enhancer;
 };
 
 #endif
@@ -0,0 +1,95 @@
+#ifndef FISHLABELER_WORKERPOOL_HPP
+#define FISHLABELER_WORKERPOOL_HPP
+
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <memory>
+#include <vector>
+
+#include <QThread>
+#include <QThreadPool>
+#include <QRunnable>
+
+//a thin wrapper around QThreadPool s.t. decode/IO jobs can be handed off and their results collected
+//through std::futures. One of these gets shared between all the readers of a project
+class WorkerPool
+{
+public:
+    explicit WorkerPool(const int num_threads = QThread::idealThreadCount())
+    {
+        pool.setMaxThreadCount(std::max(1, num_threads));
+    }
+
+    ~WorkerPool() {
+        pool.waitForDone();
+    }
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    //NOTE: higher priority jobs get run first -- prefetching should stay at the default of 0 s.t. anything
+    //the user is actively waiting on can jump the queue
+    template <typename FnT>
+    auto submit(FnT&& fn, const int priority = 0) -> std::future<decltype(fn())>
+    {
+        using ResultT = decltype(fn());
+        //packaged_task isn't copyable, so it has to live on the heap for std::function's sake
+        auto task = std::make_shared<std::packaged_task<ResultT()>>(std::forward<FnT>(fn));
+        auto result = task->get_future();
+        pool.start(new TaskRunner([task]{ (*task)(); }), priority);
+        return result;
+    }
+
+    //split [begin, end) into chunks over the pool and block until they've all run. Any exception thrown by fn
+    //gets re-thrown here. NOTE: don't call this from inside one of the pool's own jobs, it can starve itself
+    template <typename FnT>
+    void parallel_for(const int begin, const int end, FnT fn)
+    {
+        if (end <= begin) {
+            return;
+        }
+        const int num_chunks = std::min(end - begin, 4 * num_threads());
+        const int chunk_sz = (end - begin + num_chunks - 1) / num_chunks;
+        std::vector<std::future<void>> chunks;
+        for (int chunk_begin = begin; chunk_begin < end; chunk_begin += chunk_sz) {
+            const int chunk_end = std::min(end, chunk_begin + chunk_sz);
+            chunks.emplace_back(submit([&fn, chunk_begin, chunk_end]{
+                for (int idx = chunk_begin; idx < chunk_end; idx++) {
+                    fn(idx);
+                }
+            }, 1));
+        }
+        //every chunk holds a reference to fn, so they all need to finish before we can throw out of here
+        for (auto& chunk : chunks) {
+            chunk.wait();
+        }
+        for (auto& chunk : chunks) {
+            chunk.get();
+        }
+    }
+
+    int num_threads() const {
+        return pool.maxThreadCount();
+    }
+
+private:
+    class TaskRunner : public QRunnable
+    {
+    public:
+        explicit TaskRunner(std::function<void()>&& task)
+            : job(std::move(task))
+        {}
+
+        void run() override {
+            job();
+        }
+
+    private:
+        std::function<void()> job;
+    };
+
+    QThreadPool pool;
+};
+
+#endif
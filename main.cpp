@@ -1,5 +1,8 @@
+#include <memory>
+#include <iostream>
 
 #include <QApplication>
+#include <QCommandLineParser>
 #include "VideoWindow.hpp"
 
 int main(int argc, char *argv[])
@@ -11,7 +14,37 @@ int main(int argc, char *argv[])
     QCoreApplication::setApplicationName("Fish Labeler");
     QCoreApplication::setApplicationVersion(QT_VERSION_STR);
 
-    VideoWindow video_window;
-    video_window.show();
+    QCommandLineParser cmd_parser;
+    cmd_parser.setApplicationDescription("Fish video frame labeler");
+    cmd_parser.addHelpOption();
+    QCommandLineOption project_option("project", "Work through the videos listed in the project <file>, resuming where it was left off.", "file");
+    cmd_parser.addOption(project_option);
+    QCommandLineOption annotator_option("annotator", "Label alongside other annotators as <name>, claiming a lease on the frames given by --frames.", "name");
+    cmd_parser.addOption(annotator_option);
+    QCommandLineOption frames_option("frames", "The frames to lease, as <first>:<last> (leave out the last frame for the rest of the video).", "range", "0:");
+    cmd_parser.addOption(frames_option);
+    cmd_parser.process(app);
+
+    //without a project, just ask for a single frame directory
+    std::unique_ptr<VideoWindow> video_window;
+    if (cmd_parser.isSet(project_option)) {
+        video_window = std::make_unique<VideoWindow>(cmd_parser.value(project_option).toStdString());
+    } else {
+        video_window = std::make_unique<VideoWindow>();
+    }
+    if (cmd_parser.isSet(annotator_option)) {
+        const auto frame_range = cmd_parser.value(frames_option).split(':');
+        bool valid_first = false, valid_last = true;
+        const int first_frame = frame_range[0].toInt(&valid_first);
+        const int last_frame = (frame_range.size() > 1 && !frame_range[1].isEmpty()) ? frame_range[1].toInt(&valid_last) : -1;
+        if (frame_range.size() != 2 || !valid_first || !valid_last) {
+            std::cout << "ERROR: invalid frame range " << cmd_parser.value(frames_option).toStdString() << " (should be <first>:<last>)" << std::endl;
+            return 1;
+        }
+        if (!video_window->enable_leases(cmd_parser.value(annotator_option).toStdString(), first_frame, last_frame)) {
+            std::cout << "couldn't lease the frames, labels for frames leased by others will go to the conflict directory" << std::endl;
+        }
+    }
+    video_window->show();
     return app.exec();
 }